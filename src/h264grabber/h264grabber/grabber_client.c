@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reference client of the h264grabber Unix socket: subscribe, check the
+ * messages and optionally dump the payloads of a stream to a file.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "grabber_socket.h"
+
+#define STREAMS 3
+
+int stop;
+
+long long current_timestamp() {
+    struct timeval te;
+    gettimeofday(&te, NULL); // get current time
+    long long milliseconds = te.tv_sec*1000LL + te.tv_usec/1000; // calculate milliseconds
+
+    return milliseconds;
+}
+
+void sigint_handler(int unused)
+{
+    stop = 1;
+}
+
+int stream_index(int stream)
+{
+    if (stream == GRABBER_STREAM_LOW) return 0;
+    if (stream == GRABBER_STREAM_HIGH) return 1;
+    return 2;
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [-u PATH] [-r RES] [-a] [-i] [-n FRAMES] [-o FILE] [-d]\n\n", progname);
+    fprintf(stderr, "\t-u PATH, --socket PATH\n");
+    fprintf(stderr, "\t\tsocket of h264grabber (default %s)\n", GRABBER_SOCKET_NAME);
+    fprintf(stderr, "\t-r RES, --resolution RES\n");
+    fprintf(stderr, "\t\tvideo: LOW, HIGH, BOTH or NONE (default HIGH)\n");
+    fprintf(stderr, "\t-a, --audio\n");
+    fprintf(stderr, "\t\tsubscribe to AAC\n");
+    fprintf(stderr, "\t-i, --idr\n");
+    fprintf(stderr, "\t\tstart at the last IDR in the ring\n");
+    fprintf(stderr, "\t-n FRAMES, --frames FRAMES\n");
+    fprintf(stderr, "\t\texit after FRAMES messages (default 0, no limit)\n");
+    fprintf(stderr, "\t-o FILE, --output FILE\n");
+    fprintf(stderr, "\t\twrite the payloads of the video stream to FILE (one stream only)\n");
+    fprintf(stderr, "\t-d, --debug\n");
+    fprintf(stderr, "\t\tprint every message\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const char *names[STREAMS] = {"low", "high", "aac"};
+    struct sockaddr_un addr;
+    struct grabber_sub_s sub;
+    struct grabber_msg_s msg;
+    char *socket_name = GRABBER_SOCKET_NAME;
+    char *output_name = NULL;
+    FILE *fOut = NULL;
+    unsigned char *payload = NULL;
+    unsigned int payload_size = 0;
+    unsigned int frames = 0, max_frames = 0;
+    unsigned int count[STREAMS], errors[STREAMS];
+    uint32_t last_counter[STREAMS], first_time[STREAMS], last_time[STREAMS];
+    long long start, first_msg[STREAMS], first_key[STREAMS];
+    int fd, c, s, debug = 0;
+    char *endptr;
+    long val;
+    ssize_t n;
+
+    memset(&sub, 0, sizeof(sub));
+    sub.magic = GRABBER_SUB_MAGIC;
+    sub.version = GRABBER_PROTOCOL_VERSION;
+    sub.streams = GRABBER_STREAM_HIGH;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"socket",  required_argument, 0, 'u'},
+            {"resolution",  required_argument, 0, 'r'},
+            {"audio",  no_argument, 0, 'a'},
+            {"idr",  no_argument, 0, 'i'},
+            {"frames",  required_argument, 0, 'n'},
+            {"output",  required_argument, 0, 'o'},
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "u:r:ain:o:dh", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'u':
+            socket_name = optarg;
+            break;
+
+        case 'r':
+            sub.streams &= ~(GRABBER_STREAM_LOW | GRABBER_STREAM_HIGH);
+            if (strcasecmp("low", optarg) == 0) {
+                sub.streams |= GRABBER_STREAM_LOW;
+            } else if (strcasecmp("high", optarg) == 0) {
+                sub.streams |= GRABBER_STREAM_HIGH;
+            } else if (strcasecmp("both", optarg) == 0) {
+                sub.streams |= GRABBER_STREAM_LOW | GRABBER_STREAM_HIGH;
+            }
+            break;
+
+        case 'a':
+            sub.streams |= GRABBER_STREAM_AAC;
+            break;
+
+        case 'i':
+            sub.flags |= GRABBER_SUB_LAST_IDR;
+            break;
+
+        case 'n':
+            errno = 0;    /* To distinguish success/failure after call */
+            val = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno == ERANGE && (val == LONG_MAX || val == LONG_MIN)) || (errno != 0 && val == 0)) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            if ((endptr == optarg) || (val < 0)) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            max_frames = val;
+            break;
+
+        case 'o':
+            output_name = optarg;
+            break;
+
+        case 'd':
+            debug = 1;
+            break;
+
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (sub.streams == 0) {
+        fprintf(stderr, "No stream selected\n");
+        return -1;
+    }
+    if (output_name != NULL) {
+        fOut = fopen(output_name, "w");
+        if (fOut == NULL) {
+            fprintf(stderr, "Error opening file %s\n", output_name);
+            return -1;
+        }
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Error creating socket\n");
+        return -2;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_name, sizeof(addr.sun_path) - 1);
+
+    start = current_timestamp();
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Error connecting to %s\n", socket_name);
+        close(fd);
+        return -2;
+    }
+    if (send(fd, &sub, sizeof(sub), 0) != sizeof(sub)) {
+        fprintf(stderr, "Error sending subscription\n");
+        close(fd);
+        return -2;
+    }
+
+    sigaction(SIGINT, &(struct sigaction){{sigint_handler}}, NULL);
+    sigaction(SIGTERM, &(struct sigaction){{sigint_handler}}, NULL);
+
+    memset(count, 0, sizeof(count));
+    memset(errors, 0, sizeof(errors));
+    memset(first_time, 0, sizeof(first_time));
+    memset(last_time, 0, sizeof(last_time));
+    memset(last_counter, 0, sizeof(last_counter));
+    for (s = 0; s < STREAMS; s++) {
+        first_msg[s] = -1;
+        first_key[s] = -1;
+    }
+
+    while (!stop) {
+        n = recv(fd, &msg, sizeof(msg), MSG_WAITALL);
+        if (n != sizeof(msg)) break;
+        if (msg.len > payload_size) {
+            payload = realloc(payload, msg.len);
+            if (payload == NULL) {
+                fprintf(stderr, "Unable to allocate %u bytes\n", msg.len);
+                break;
+            }
+            payload_size = msg.len;
+        }
+        if ((msg.len > 0) && (recv(fd, payload, msg.len, MSG_WAITALL) != msg.len)) break;
+
+        s = stream_index(msg.stream);
+        if (debug) fprintf(stderr, "%s - codec %d - type 0x%04x - counter %u - time %u - len %u\n",
+                names[s], msg.codec, msg.type, msg.counter, msg.time, msg.len);
+
+        if (first_msg[s] < 0) {
+            first_msg[s] = current_timestamp() - start;
+            first_time[s] = msg.time;
+            // Video must start with a parameter set
+            if ((s != 2) && (!(msg.type & (GRABBER_TYPE_SPS | GRABBER_TYPE_VPS)))) errors[s]++;
+        } else if (msg.counter <= last_counter[s]) {
+            errors[s]++;
+        }
+        if ((first_key[s] < 0) && ((msg.type & GRABBER_TYPE_IDR) || (s == 2))) first_key[s] = current_timestamp() - start;
+        if ((msg.len < 4) || ((s != 2) && (memcmp(payload, "\x00\x00\x00\x01", 4) != 0)) ||
+                ((s == 2) && ((payload[0] != 0xFF) || ((payload[1] & 0xF0) != 0xF0)))) {
+            errors[s]++;
+        }
+        last_counter[s] = msg.counter;
+        last_time[s] = msg.time;
+        count[s]++;
+
+        if ((fOut != NULL) && (s != 2)) fwrite(payload, 1, msg.len, fOut);
+
+        frames++;
+        if ((max_frames > 0) && (frames >= max_frames)) break;
+    }
+
+    for (s = 0; s < STREAMS; s++) {
+        if (count[s] == 0) continue;
+        fprintf(stderr, "%s: %u messages, %u errors, first after %lld ms, first IDR after %lld ms, %u ms of frames\n",
+                names[s], count[s], errors[s], first_msg[s], first_key[s], last_time[s] - first_time[s]);
+    }
+
+    close(fd);
+    if (fOut != NULL) fclose(fOut);
+    free(payload);
+
+    return 0;
+}
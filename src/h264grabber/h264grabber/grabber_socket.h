@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Frame protocol of the h264grabber Unix socket.
+ *
+ * A client connects and sends a grabber_sub_s with the streams it wants.
+ * Then it receives messages: a grabber_msg_s header followed by len bytes
+ * of payload, a NAL with its start code or an ADTS frame.
+ * Video starts at the next SPS/VPS, or at the last one still in the ring
+ * with GRABBER_SUB_LAST_IDR. After a drop (slow client) video restarts
+ * at the next SPS/VPS of the same stream.
+ * Integers are little endian.
+ */
+
+#ifndef _GRABBER_SOCKET_H
+#define _GRABBER_SOCKET_H
+
+#include <stdint.h>
+
+#define GRABBER_SOCKET_NAME "/tmp/h264grabber.sock"
+#define GRABBER_SUB_MAGIC 0x53425247        // "GRBS"
+#define GRABBER_PROTOCOL_VERSION 1
+
+// Streams
+#define GRABBER_STREAM_LOW  0x01
+#define GRABBER_STREAM_HIGH 0x02
+#define GRABBER_STREAM_AAC  0x04
+
+// Subscription flags
+#define GRABBER_SUB_LAST_IDR 0x01           // start with the GOP in progress
+
+// Codecs
+#define GRABBER_CODEC_NONE 0
+#define GRABBER_CODEC_H264 1
+#define GRABBER_CODEC_H265 2
+#define GRABBER_CODEC_AAC  3
+
+// Frame types, the same bits of the ring
+#define GRABBER_TYPE_IDR 0x0001
+#define GRABBER_TYPE_SPS 0x0002
+#define GRABBER_TYPE_PPS 0x0004
+#define GRABBER_TYPE_VPS 0x0008
+#define GRABBER_TYPE_AAC 0x0100
+
+struct __attribute__((__packed__)) grabber_sub_s {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t streams;                        // GRABBER_STREAM_* mask
+    uint8_t flags;                          // GRABBER_SUB_*
+    uint8_t reserved;
+};
+
+struct __attribute__((__packed__)) grabber_msg_s {
+    uint32_t len;                           // payload length
+    uint8_t stream;                         // GRABBER_STREAM_*
+    uint8_t codec;                          // GRABBER_CODEC_*
+    uint16_t type;                          // GRABBER_TYPE_* mask, 0 for other slices
+    uint32_t counter;                       // frame counter of the ring
+    uint32_t time;                          // frame time of the ring, ms
+};
+
+#endif
@@ -34,91 +34,17 @@
 #include <getopt.h>
 #include <signal.h>
 #include <pthread.h>
-
-//#define USE_SEMAPHORE 1
-#ifdef USE_SEMAPHORE
-#include <semaphore.h>
-#endif
-
-#define FRAME_OFFSET_AUTODETECT 0
-#define FRAME_OFFSET_TRY_1 300
-#define FRAME_OFFSET_TRY_2 368
-#define FRAME_HEADER_SIZE_AUTODETECT 0
-
-#define BUF_OFFSET_Y20GA 300
-#define FRAME_HEADER_SIZE_Y20GA 22
-
-#define BUF_OFFSET_Y25GA 300
-#define FRAME_HEADER_SIZE_Y25GA 22
-
-#define BUF_OFFSET_Y30QA 300
-#define FRAME_HEADER_SIZE_Y30QA 22
-
-#define BUF_OFFSET_Y501GC 368
-#define FRAME_HEADER_SIZE_Y501GC 24
-
-#define BUF_OFFSET_Y21GA 368
-#define FRAME_HEADER_SIZE_Y21GA 28
-
-#define BUF_OFFSET_Y211GA 368
-#define FRAME_HEADER_SIZE_Y211GA 28
-
-#define BUF_OFFSET_Y211BA 368
-#define FRAME_HEADER_SIZE_Y211BA 28
-
-#define BUF_OFFSET_Y213GA 368
-#define FRAME_HEADER_SIZE_Y213GA 28
-
-#define BUF_OFFSET_Y291GA 368
-#define FRAME_HEADER_SIZE_Y291GA 28
-
-#define BUF_OFFSET_H30GA 368
-#define FRAME_HEADER_SIZE_H30GA 28
-
-//#define BUF_OFFSET_R30GB 300
-#define BUF_OFFSET_R30GB 0
-//#define FRAME_HEADER_SIZE_R30GB 22
-#define FRAME_HEADER_SIZE_R30GB 0
-
-//#define BUF_OFFSET_R35GB 300
-#define BUF_OFFSET_R35GB 0
-//#define FRAME_HEADER_SIZE_R35GB 26
-#define FRAME_HEADER_SIZE_R35GB 0
-
-//#define BUF_OFFSET_R37GB 368
-#define BUF_OFFSET_R37GB 0
-//#define FRAME_HEADER_SIZE_R37GB 28
-#define FRAME_HEADER_SIZE_R37GB 0
-
-#define BUF_OFFSET_R40GA 300
-#define FRAME_HEADER_SIZE_R40GA 26
-
-#define BUF_OFFSET_H51GA 368
-#define FRAME_HEADER_SIZE_H51GA 28
-
-#define BUF_OFFSET_H52GA 368
-#define FRAME_HEADER_SIZE_H52GA 28
-
-#define BUF_OFFSET_H60GA 368
-#define FRAME_HEADER_SIZE_H60GA 28
-
-#define BUF_OFFSET_Y28GA 368
-#define FRAME_HEADER_SIZE_Y28GA 28
-
-#define BUF_OFFSET_Y29GA 368
-#define FRAME_HEADER_SIZE_Y29GA 28
-
-#define BUF_OFFSET_Y623 368
-#define FRAME_HEADER_SIZE_Y623 28
-
-#define BUF_OFFSET_Q321BR_LSX 300
-#define FRAME_HEADER_SIZE_Q321BR_LSX 26
-
-#define BUF_OFFSET_QG311R 300
-#define FRAME_HEADER_SIZE_QG311R 26
-
-#define BUF_OFFSET_B091QP 300
-#define FRAME_HEADER_SIZE_B091QP 26
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "fshare.h"
+#include "tsmux.h"
+#include "grabber_socket.h"
 
 #define RESOLUTION_NONE 0
 #define RESOLUTION_LOW  360
@@ -129,266 +55,110 @@
 #define TYPE_LOW  360
 #define TYPE_HIGH 1080
 #define TYPE_AAC 65521
-
-#define BUFFER_FILE "/dev/shm/fshare_frame_buf"
-#define BUFFER_SHM "fshare_frame_buf"
-#define READ_LOCK_FILE "fshare_read_lock"
-#define WRITE_LOCK_FILE "fshare_write_lock"
+#define TYPE_TS_LOW  3600               // MPEG-TS, low res and AAC
+#define TYPE_TS_HIGH 10800              // MPEG-TS, high res and AAC
+#define TYPE_SOCKET  1                  // client of the Unix socket
 
 #define FIFO_NAME_LOW "/tmp/h264_low_fifo"
 #define FIFO_NAME_HIGH "/tmp/h264_high_fifo"
 #define FIFO_NAME_AAC  "/tmp/aac_audio_fifo"
 
-#define CODEC_NONE 0
-#define CODEC_H264 264
-#define CODEC_H265 265
+#define OUTPUT_MAX 16
+#define OUTPUT_BACKLOG_LOW  131072      // default backlog limits in bytes
+#define OUTPUT_BACKLOG_HIGH 524288
+#define OUTPUT_BACKLOG_AAC  32768
+#define OUTPUT_BACKLOG_MIN  4096
+#define OUTPUT_POLL_TIMEOUT 1000        // ms
+#define OUTPUT_INFLIGHT 64              // spliced frames tracked per output
+#define OUTPUT_PIPE_SIZE 262144         // pipe size asked for zero-copy fifos
+
+#define SOCKET_PENDING 4                // clients subscribed, not started yet
+#define SOCKET_TIMEOUT 2                // s, to receive the subscription
+#define HISTORY_FRAMES 512              // frames remembered for GRABBER_SUB_LAST_IDR
+
+// A frame handed to the pipe with vmsplice, its pages belong to the ring
+typedef struct
+{
+    unsigned long long mark;        // ring_mark when it was spliced
+    unsigned long long end;         // bytes put in the pipe up to its end
+} output_inflight;
 
-/*
-Type:
-bit 0	IDR
-bit 1	SPS
-bit 2	PPS
-bit 3	VPS
-bit 4	?
-bit 5	FPS, Width and Height prefix
-bit 6 	HEVC 265
-bit 7	?
-
-bit 8	AAC 
-bit 9 	?
-bit 10 	main (high) 
-bit 11 	sub  (low) 
-bit 12	fast 
-bit 13	?
-bit 14	?
-bit 15	?
-*/
-
-struct __attribute__((__packed__)) frame_header {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-};
-
-struct __attribute__((__packed__)) frame_header_22 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint16_t u4;
-};
-
-struct __attribute__((__packed__)) frame_header_24 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint16_t u4;
-    uint16_t u5;
-};
-
-struct __attribute__((__packed__)) frame_header_26 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t u2;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint16_t u4;
-};
-
-struct __attribute__((__packed__)) frame_header_28 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t u2;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint32_t u4;
-};
-
-struct stream_type_s {
-    int codec_low;
-    int codec_high;
-    int sps_type_low;
-    int sps_type_high;
-    int vps_type_low;
-    int vps_type_high;
-};
-
-int buf_offset;
-int buf_size;
-int frame_header_size;
+// A destination fed by its own writer thread through a bounded buffer,
+// a slow reader only loses its own frames
+typedef struct
+{
+    int type;                       // TYPE_LOW, TYPE_HIGH, TYPE_AAC, TYPE_TS_* or TYPE_SOCKET
+    char *name;                     // fifo or file, NULL for a descriptor
+    int fd;
+    int is_fifo;
+    int created;                    // fifo made by the grabber, removed at exit
+    unsigned char *buf;
+    unsigned int size;              // backlog limit
+    unsigned int head;              // bytes queued, free running
+    unsigned int tail;              // bytes written, free running
+    int wait_key;                   // frame dropped, skip until the next SPS/VPS
+    int closed;
+    int zerocopy;                   // vmsplice from the ring while the queue is empty
+    int flush;                      // the writer thread throws the queue away
+    int streams;                    // socket: GRABBER_STREAM_* subscribed
+    int wait_streams;               // socket: video streams waiting for their SPS/VPS
+    output_inflight inflight[OUTPUT_INFLIGHT];
+    unsigned int inflight_head;
+    unsigned int inflight_tail;
+    unsigned long long spliced_bytes;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    // Statistics
+    unsigned int frames;
+    unsigned int dropped;
+    unsigned int syscalls;          // writev and poll calls, atomic: counted outside the mutex
+    unsigned int spliced;           // frames sent without copies
+    unsigned int drained;           // times the pipe was taken back from a late reader
+    unsigned long long bytes;
+} grabber_output;
+
+fshare_ring ring;
 struct stream_type_s stream_type;
+fshare_timing timing_low;
+fshare_timing timing_high;
+grabber_output outputs[OUTPUT_MAX];
+int noutputs;
+tsmux mux_low;
+tsmux mux_high;
+int ts_low;
+int ts_high;
+
+unsigned long long ring_mark;       // bytes written by the producer, as seen by the scan
+
+// Frames of the last GOPs, sent to the clients that ask for GRABBER_SUB_LAST_IDR
+typedef struct
+{
+    fshare_frame frame;
+    int stream;                     // GRABBER_STREAM_*
+    int key;
+} history_frame;
+
+char *socket_name;
+int socket_fd;
+pthread_mutex_t socket_mutex = PTHREAD_MUTEX_INITIALIZER;
+int socket_pending_fd[SOCKET_PENDING];
+struct grabber_sub_s socket_pending_sub[SOCKET_PENDING];
+int socket_npending;
+history_frame history[HISTORY_FRAMES];
+unsigned int history_count;         // frames added, free running
+unsigned int history_key[2];        // last SPS/VPS of low and high
+int history_key_valid[2];
+unsigned char *replay_buf;
+unsigned int replay_size;
 
-unsigned char IDR4[]                = {0x65, 0xB8};
-unsigned char NALx_START[]          = {0x00, 0x00, 0x00, 0x01};
-unsigned char IDR4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x65, 0x88};
-unsigned char IDR5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x26};
-unsigned char PFR4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x41};
-unsigned char PFR5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x02};
-unsigned char SPS4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x67};
-unsigned char SPS5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x42};
-unsigned char PPS4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x68};
-unsigned char PPS5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x44};
-unsigned char VPS5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x40};
-
-unsigned char PPS4_HEADER[]         = {0x08, 0x00, 0x00, 0x00};
-
-unsigned char SPS4_640X360[]        = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x14,
-                                       0x96, 0x54, 0x05, 0x01, 0x7B, 0xCB, 0x37, 0x01,
-                                       0x01, 0x01, 0x02};
-unsigned char SPS4_640X360_TI[]     = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x14,
-                                       0x96, 0x54, 0x05, 0x01, 0x7B, 0xCB, 0x37, 0x01,
-                                       0x01, 0x01, 0x40, 0x00, 0x00, 0x7D, 0x00, 0x00,
-                                       0x13, 0x88, 0x21};
-unsigned char SPS4_1920X1080[]      = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
-                                       0x96, 0x54, 0x03, 0xC0, 0x11, 0x2F, 0x2C, 0xDC,
-                                       0x04, 0x04, 0x04, 0x08};
-unsigned char SPS4_1920X1080_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
-                                       0x96, 0x54, 0x03, 0xC0, 0x11, 0x2F, 0x2C, 0xDC,
-                                       0x04, 0x04, 0x05, 0x00, 0x00, 0x03, 0x01, 0xF4,
-                                       0x00, 0x00, 0x4E, 0x20, 0x84};
-unsigned char SPS4_2304X1296[]      = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
-                                       0x96, 0x54, 0x01, 0x20, 0x05, 0x19, 0x37, 0x01,
-                                       0x01, 0x01, 0x02};
-unsigned char SPS4_2304X1296_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
-                                       0x96, 0x54, 0x01, 0x20, 0x05, 0x19, 0x37, 0x01,
-                                       0x00, 0x00, 0x40, 0x00, 0x00, 0x7D, 0x00, 0x00,
-                                       0x13, 0x88, 0x21};
-unsigned char SPS4_2_640X360[]      = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x14,
-                                       0xAC, 0x2C, 0xA8, 0x0A, 0x02, 0xF7, 0x96, 0x6E,
-                                       0x02, 0x02, 0x02, 0x04};
-unsigned char SPS4_2_640X360_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x14,
-                                       0xAC, 0x2C, 0xA8, 0x0A, 0x02, 0xF7, 0x96, 0x6E,
-                                       0x02, 0x02, 0x02, 0x80, 0x00, 0x00, 0xFA, 0x00,
-                                       0x00, 0x27, 0x10, 0x42};
-unsigned char SPS4_2_1920X1080[]    = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x07, 0x80, 0x22, 0x5E, 0x59,
-                                       0xB8, 0x08, 0x08, 0x08, 0x10};
-unsigned char SPS4_2_1920X1080_TI[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x07, 0x80, 0x22, 0x5E, 0x59,
-                                       0xB8, 0x08, 0x08, 0x0A, 0x00, 0x00, 0x03, 0x03,
-                                       0xE8, 0x00, 0x00, 0x9C, 0x41, 0x08};
-unsigned char SPS4_2_2304X1296[]    = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x02, 0x40, 0x0A, 0x32, 0x6E,
-                                       0x02, 0x02, 0x02, 0x04};
-unsigned char SPS4_2_2304X1296_TI[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x02, 0x40, 0x0A, 0x32, 0x6E,
-                                       0x02, 0x02, 0x02, 0x80, 0x00, 0x00, 0xFA, 0x00,
-                                       0x00, 0x27, 0x10, 0x42};
-unsigned char SPS4_3_640X360[]      = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x14,
-                                       0xAC, 0x2C, 0xA8, 0x0A, 0x02, 0xF7, 0x96, 0x6A,
-                                       0x02, 0x02, 0x02, 0x04};
-unsigned char SPS4_3_640X360_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x14,
-                                       0xAC, 0x2C, 0xA8, 0x0A, 0x02, 0xF7, 0x96, 0x6A,
-                                       0x02, 0x02, 0x02, 0x80, 0x00, 0x00, 0xFA, 0x00,
-                                       0x00, 0x27, 0x10, 0x42};
-unsigned char SPS4_3_1920X1080[]    = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x07, 0x80, 0x22, 0x5E, 0x59,
-                                       0xA8, 0x08, 0x08, 0x08, 0x10};
-unsigned char SPS4_3_1920X1080_TI[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x07, 0x80, 0x22, 0x5E, 0x59,
-                                       0xA8, 0x08, 0x08, 0x0A, 0x00, 0x00, 0x03, 0x03,
-                                       0xE8, 0x00, 0x00, 0x9C, 0x41, 0x08};
-unsigned char SPS4_3_2304X1296[]    = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x02, 0x40, 0x0A, 0x32, 0x6A,
-                                       0x02, 0x02, 0x02, 0x04};
-unsigned char SPS4_3_2304X1296_TI[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x02, 0x40, 0x0A, 0x32, 0x6A,
-                                       0x02, 0x02, 0x02, 0x80, 0x00, 0x00, 0xFA, 0x00,
-                                       0x00, 0x27, 0x10, 0x42};
-unsigned char SPS5_1920X1080[]      = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x7B, 0xA0,
-                                       0x03, 0xC0, 0x80, 0x10, 0xE7, 0xF9, 0x6B, 0xB9,
-                                       0x12, 0x20, 0xB2, 0xFC, 0xF3, 0xCF, 0x3C, 0xF3,
-                                       0xCF, 0x3C, 0xF3, 0xCF, 0x3C, 0xF3, 0xCF, 0x3C,
-                                       0xF3, 0xCB, 0x73, 0x70, 0x10, 0x10, 0x10, 0x08};
-//unsigned char SPS5_1920X1080_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-//                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-//                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x7B, 0xA0,
-//                                       0x03, 0xC0, 0x80, 0x10, 0xE7, 0xF9, 0x6B, 0xB9,
-//                                       0x12, 0x20, 0xB2, 0xFC, 0xF3, 0xCF, 0x3C, 0xF3,
-//                                       0xCF, 0x3C, 0xF3, 0xCF, 0x3C, 0xF3, 0xCF, 0x3C,
-//                                       0xF3, 0xCB, 0x73, 0x70, 0x10, 0x10, 0x10, 0x40,
-//                                       0x00, 0x00, 0x7D, 0x00, 0x00, 0x13, 0x88, 0x02};
-unsigned char SPS5_2_1920X1080[]    = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xBA, 0xA0,
-                                       0x03, 0xC0, 0x80, 0x10, 0xE7, 0xF9, 0x6B, 0xB9,
-                                       0x12, 0x20, 0xB2, 0xFC, 0xF3, 0xCF, 0x3C, 0xF3,
-                                       0xCF, 0x3C, 0xF3, 0xCF, 0x3C, 0xF3, 0xCF, 0x3C,
-                                       0xF3, 0xCB, 0x73, 0x70, 0x10, 0x10, 0x10, 0x08};
-//unsigned char SPS5_2_1920X1080_TI[] = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-//                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-//                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xBA, 0xA0,
-//                                       0x03, 0xC0, 0x80, 0x10, 0xE7, 0xF9, 0x6B, 0xB9,
-//                                       0x12, 0x20, 0xB2, 0xFC, 0xF3, 0xCF, 0x3C, 0xF3,
-//                                       0xCF, 0x3C, 0xF3, 0xCF, 0x3C, 0xF3, 0xCF, 0x3C,
-//                                       0xF3, 0xCB, 0x73, 0x70, 0x10, 0x10, 0x10, 0x40,
-//                                       0x00, 0x00, 0x7D, 0x00, 0x00, 0x13, 0x88, 0x02};
-unsigned char SPS5_3_2304X1296[]    = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xBA, 0xA0,
-                                       0x01, 0x20, 0x20, 0x05, 0x11, 0xFE, 0x5A, 0xEE,
-                                       0x44, 0x88, 0x8B, 0xF2, 0xDC, 0xD4, 0x04, 0x04,
-                                       0x04, 0x02};
-//unsigned char SPS5_3_2304X1296_TI[] = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-//                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-//                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xBA, 0xA0,
-//                                       0x01, 0x20, 0x20, 0x05, 0x11, 0xFE, 0x5A, 0xEE,
-//                                       0x44, 0x88, 0x8B, 0xF2, 0xDC, 0xD4, 0x04, 0x04,
-//                                       0x04, 0x10, 0x00, 0x00, 0x1F, 0x40, 0x00, 0x04,
-//                                       0xE2, 0x00, 0x80};
-unsigned char VPS5_1920X1080[]      = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0x7B, 0xAC, 0x09};
-unsigned char VPS5_1920X1080_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0x7B, 0xAC, 0x0C, 0x00, 0x00, 0x07, 0xD0,
-                                       0x00, 0x01, 0x38, 0x81, 0x40};
-unsigned char VPS5_2_1920X1080[]    = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0xBA, 0xAC, 0x09};
-unsigned char VPS5_2_1920X1080_TI[] = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0xBA, 0xAC, 0x0C, 0x00, 0x00, 0x07, 0xD0,
-                                       0x00, 0x01, 0x38, 0x81, 0x40};
-unsigned char VPS5_3_2304X1296[]    = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0xBA, 0xAC, 0x09};
-unsigned char VPS5_3_2304X1296_TI[] = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0xBA, 0xAC, 0x0C, 0x00, 0x00, 0x07, 0xD0,
-                                       0x00, 0x01, 0x38, 0x81, 0x40};
-
-unsigned char *addr;                      /* Pointer to shared memory region (header) */
 int resolution;
 int audio;
 int sps_timing_info;
 int fifo;
+int zerocopy;
 int debug;
 
-#ifdef USE_SEMAPHORE
-sem_t *sem_fshare_read_lock = SEM_FAILED;
-sem_t *sem_fshare_write_lock = SEM_FAILED;
-#endif
-
 long long current_timestamp() {
     struct timeval te; 
     gettimeofday(&te, NULL); // get current time
@@ -397,192 +167,778 @@ long long current_timestamp() {
     return milliseconds;
 }
 
-/* Locate a string in the circular buffer */
-unsigned char *cb_memmem(unsigned char *src, int src_len, unsigned char *what, int what_len)
+void sigpipe_handler(int unused)
+{
+    // Do nothing
+}
+
+// Open the write end of a fifo without waiting for a reader
+// The descriptor stays non-blocking, the writer thread polls when the pipe is full
+int output_open_fifo(grabber_output *o)
 {
-    unsigned char *p;
+    int fd_r;
+
+    // Hold a read end meanwhile, writes fail with EPIPE until a reader comes
+    fd_r = open(o->name, O_RDONLY | O_NONBLOCK);
+    o->fd = open(o->name, O_WRONLY | O_NONBLOCK);
+    if (fd_r >= 0) close(fd_r);
+    if (o->fd < 0) return -1;
+
+#ifdef SPLICE_F_NONBLOCK
+    if (zerocopy) {
+        o->zerocopy = 1;
+#ifdef F_SETPIPE_SZ
+        // Room for a whole IDR, so that it doesn't fall back to the queue
+        fcntl(o->fd, F_SETPIPE_SZ, OUTPUT_PIPE_SIZE);
+#endif
+    }
+#endif
 
-    if (src_len >= 0) {
-        p = (unsigned char*) memmem(src, src_len, what, what_len);
-    } else {
-        // From src to the end of the buffer
-        p = (unsigned char*) memmem(src, addr + buf_size - src, what, what_len);
-        if (p == NULL) {
-            // And from the start of the buffer size src_len
-            p = (unsigned char*) memmem(addr + buf_offset, src + src_len - (addr + buf_offset), what, what_len);
+    return 0;
+}
+
+// Writer thread: drain the output buffer to its destination, everything
+// queued goes out with a single writev
+void* output_thread(void *data)
+{
+    grabber_output *o = data;
+    struct iovec iov[2];
+    struct pollfd pfd;
+    unsigned int off, len;
+    ssize_t w;
+    int niov, err;
+
+    while (1) {
+        pthread_mutex_lock(&o->mutex);
+        while ((o->head == o->tail) && (!o->flush)) {
+            pthread_cond_wait(&o->cond, &o->mutex);
+        }
+        if (o->flush) {
+            o->tail = o->head;
+            o->flush = 0;
+            pthread_mutex_unlock(&o->mutex);
+            continue;
+        }
+        off = o->tail % o->size;
+        len = o->head - o->tail;
+        pthread_mutex_unlock(&o->mutex);
+
+        // The main thread never overwrites the bytes between tail and head
+        iov[0].iov_base = o->buf + off;
+        if (len > o->size - off) {
+            iov[0].iov_len = o->size - off;
+            iov[1].iov_base = o->buf;
+            iov[1].iov_len = len - iov[0].iov_len;
+            niov = 2;
+        } else {
+            iov[0].iov_len = len;
+            niov = 1;
+        }
+        w = writev(o->fd, iov, niov);
+        err = errno;
+        __atomic_add_fetch(&o->syscalls, 1, __ATOMIC_RELAXED);
+
+        if ((w < 0) && ((err == EAGAIN) || (err == EWOULDBLOCK))) {
+            // The reader is behind, the main thread drops frames when the backlog is full
+            pfd.fd = o->fd;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, OUTPUT_POLL_TIMEOUT);
+            __atomic_add_fetch(&o->syscalls, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        pthread_mutex_lock(&o->mutex);
+        if (w >= 0) {
+            o->tail += w;
+            o->bytes += w;
+        } else if ((err == EPIPE) && (o->is_fifo)) {
+            // Nobody is reading, throw the queue away and restart from a key frame
+            o->tail = o->head;
+            o->wait_key = 1;
+        } else if (err != EINTR) {
+            o->closed = 1;
+            pthread_mutex_unlock(&o->mutex);
+            if (debug) fprintf(stderr, "%lld: output %s closed - %s\n", current_timestamp(),
+                    (o->name != NULL) ? o->name : ((o->type == TYPE_SOCKET) ? "socket client" : "fd"), strerror(err));
+            return NULL;
         }
+        pthread_mutex_unlock(&o->mutex);
     }
-    return p;
+
+    return NULL;
+}
+
+// Copy at off in the output buffer, the caller checked the room
+void output_copy(grabber_output *o, unsigned int *off, unsigned char *src, unsigned int len)
+{
+    unsigned int n;
+
+    if (len == 0) return;
+    n = len;
+    if (n > o->size - *off) n = o->size - *off;
+    memcpy(o->buf + *off, src, n);
+    if (n < len) memcpy(o->buf, src + n, len - n);
+    *off = (*off + len) % o->size;
 }
 
-unsigned char *cb_move(unsigned char *buf, int offset)
+// Send a frame while the queue is empty, from the capture thread
+// Frames in the ring are handed to the pipe with vmsplice, the others
+// (a rewritten SPS) are written
+// Returns the bytes sent, 0 if the pipe is full, or -errno
+int output_send(grabber_output *o, fshare_span *span, int from_ring)
 {
-    buf += offset;
-    if ((offset > 0) && (buf > addr + buf_size))
-        buf -= (buf_size - buf_offset);
-    if ((offset < 0) && (buf < addr + buf_offset))
-        buf += (buf_size - buf_offset);
+    struct iovec iov[2];
+    output_inflight *f;
+    ssize_t n;
+    int niov = 0, i;
+
+    for (i = 0; i < 2; i++) {
+        if (span->len[i] == 0) continue;
+        iov[niov].iov_base = span->ptr[i];
+        iov[niov].iov_len = span->len[i];
+        niov++;
+    }
 
-    return buf;
+#ifdef SPLICE_F_NONBLOCK
+    if (from_ring) {
+        if (o->inflight_head - o->inflight_tail >= OUTPUT_INFLIGHT) return 0;
+        n = vmsplice(o->fd, iov, niov, SPLICE_F_NONBLOCK);
+        if ((n < 0) && ((errno == ENOSYS) || (errno == EINVAL))) {
+            fprintf(stderr, "vmsplice not available for %s, using copies\n", o->name);
+            o->zerocopy = 0;
+            return 0;
+        }
+        if (n > 0) {
+            // The writer thread is idle, bytes doesn't change
+            pthread_mutex_lock(&o->mutex);
+            o->spliced_bytes += n;
+            f = &o->inflight[o->inflight_head % OUTPUT_INFLIGHT];
+            f->mark = ring_mark;
+            f->end = o->spliced_bytes + o->bytes;
+            pthread_mutex_unlock(&o->mutex);
+            o->inflight_head++;
+        }
+    } else
+#endif
+    {
+        n = writev(o->fd, iov, niov);
+        if (n > 0) {
+            pthread_mutex_lock(&o->mutex);
+            o->bytes += n;
+            pthread_mutex_unlock(&o->mutex);
+        }
+    }
+    __atomic_add_fetch(&o->syscalls, 1, __ATOMIC_RELAXED);
+
+    if (n < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+        return -errno;
+    }
+
+    return n;
 }
 
-// The second argument is the circular buffer
-int cb_memcmp(unsigned char *str1, unsigned char *str2, size_t n)
+// The pages handed to the pipe are read by the consumer later: if it falls
+// behind by limit bytes of the ring, take them back before the producer
+// overwrites them, the output restarts from the next IDR
+void output_guard(grabber_output *o, unsigned long long limit)
 {
-    int ret;
+    unsigned long long total, consumed;
+    unsigned char scratch[4096];
+    int pending, fd_r;
+    ssize_t r;
+
+    if (o->inflight_head == o->inflight_tail) return;
+    if (ioctl(o->fd, FIONREAD, &pending) < 0) return;
+
+    pthread_mutex_lock(&o->mutex);
+    total = o->spliced_bytes + o->bytes;
+    pthread_mutex_unlock(&o->mutex);
+    consumed = (total > pending) ? total - pending : 0;
+
+    while ((o->inflight_head != o->inflight_tail) &&
+            (o->inflight[o->inflight_tail % OUTPUT_INFLIGHT].end <= consumed)) {
+        o->inflight_tail++;
+    }
+    if (o->inflight_head == o->inflight_tail) return;
+    if (ring_mark - o->inflight[o->inflight_tail % OUTPUT_INFLIGHT].mark < limit) return;
+
+    // The queue can hold the rest of a frame whose start is drained
+    pthread_mutex_lock(&o->mutex);
+    if (o->type != TYPE_AAC) o->wait_key = 1;
+    o->flush = 1;
+    o->drained++;
+    pthread_cond_signal(&o->cond);
+    pthread_mutex_unlock(&o->mutex);
+
+    fd_r = open(o->name, O_RDONLY | O_NONBLOCK);
+    if (fd_r >= 0) {
+        while (pending > 0) {
+            r = read(fd_r, scratch, (pending < sizeof(scratch)) ? pending : sizeof(scratch));
+            if (r <= 0) break;
+            pending -= r;
+        }
+        close(fd_r);
+    }
+    o->inflight_tail = o->inflight_head;
 
-    if (str2 + n > addr + buf_size) {
-        ret = memcmp(str1, str2, addr + buf_size - str2);
-        if (ret != 0) return ret;
-        ret = memcmp(str1 + (addr + buf_size - str2), addr + buf_offset, n - (addr + buf_size - str2));
-    } else {
-        ret = memcmp(str1, str2, n);
+    if (debug) fprintf(stderr, "%lld: output %s too late, pipe drained\n", current_timestamp(), o->name);
+}
+
+// Queue a frame for an output, drop it if the buffer is full
+// After a drop video frames are skipped until the next SPS/VPS
+// from_ring tells that span points into the ring, not to a private buffer
+void output_put(grabber_output *o, fshare_span *span, int key, int from_ring)
+{
+    fshare_span rest;
+    unsigned int len, off, i, n;
+    int direct, sent;
+
+    len = span->len[0] + span->len[1];
+
+    pthread_mutex_lock(&o->mutex);
+    if (o->closed) {
+        pthread_mutex_unlock(&o->mutex);
+        return;
+    }
+    if (((o->wait_key) && (!key)) || (o->flush)) {
+        o->dropped++;
+        pthread_mutex_unlock(&o->mutex);
+        return;
+    }
+    // The writer thread only touches the descriptor when the queue isn't empty
+    direct = (o->zerocopy) && (o->head == o->tail);
+    pthread_mutex_unlock(&o->mutex);
+
+    if (direct) {
+        sent = output_send(o, span, from_ring);
+        if (sent < 0) {
+            pthread_mutex_lock(&o->mutex);
+            o->dropped++;
+            if (sent == -EPIPE) {
+                // Nobody is reading
+                if (o->type != TYPE_AAC) o->wait_key = 1;
+            } else {
+                o->closed = 1;
+            }
+            pthread_mutex_unlock(&o->mutex);
+            return;
+        }
+        if (sent == len) {
+            pthread_mutex_lock(&o->mutex);
+            o->wait_key = 0;
+            o->frames++;
+            if (from_ring) o->spliced++;
+            pthread_mutex_unlock(&o->mutex);
+            return;
+        }
+
+        // The pipe is full, queue what is left
+        rest = *span;
+        n = sent;
+        if (n >= rest.len[0]) {
+            n -= rest.len[0];
+            rest.ptr[0] = rest.ptr[1] + n;
+            rest.len[0] = rest.len[1] - n;
+            rest.ptr[1] = NULL;
+            rest.len[1] = 0;
+        } else {
+            rest.ptr[0] += n;
+            rest.len[0] -= n;
+        }
+        span = &rest;
+        len -= sent;
     }
 
-    return ret;
+    pthread_mutex_lock(&o->mutex);
+    if (len > o->size - (o->head - o->tail)) {
+        o->dropped++;
+        if (o->type != TYPE_AAC) o->wait_key = 1;
+        pthread_mutex_unlock(&o->mutex);
+        return;
+    }
+    o->wait_key = 0;
+    pthread_mutex_unlock(&o->mutex);
+
+    // Only this thread moves head, copy outside the lock
+    off = o->head % o->size;
+    for (i = 0; i < 2; i++) {
+        output_copy(o, &off, span->ptr[i], span->len[i]);
+    }
+
+    pthread_mutex_lock(&o->mutex);
+    o->head += len;
+    o->frames++;
+    pthread_cond_signal(&o->cond);
+    pthread_mutex_unlock(&o->mutex);
 }
 
-// The second argument is the circular buffer
-void cb2s_memcpy(unsigned char *dest, unsigned char *src, size_t n)
+// Queue a message for a socket client, header and frame go in together
+// After a drop every video stream of the client waits for its own SPS/VPS
+void output_put_msg(grabber_output *o, struct grabber_msg_s *msg, fshare_span *span, int key)
 {
-    if (src + n > addr + buf_size) {
-        memcpy(dest, src, addr + buf_size - src);
-        memcpy(dest + (addr + buf_size - src), addr + buf_offset, n - (addr + buf_size - src));
-    } else {
-        memcpy(dest, src, n);
+    unsigned int len, off, i;
+
+    len = sizeof(struct grabber_msg_s) + msg->len;
+
+    pthread_mutex_lock(&o->mutex);
+    if ((o->closed) || (!(o->streams & msg->stream))) {
+        pthread_mutex_unlock(&o->mutex);
+        return;
+    }
+    if ((o->wait_streams & msg->stream) && (!key)) {
+        o->dropped++;
+        pthread_mutex_unlock(&o->mutex);
+        return;
+    }
+    if (len > o->size - (o->head - o->tail)) {
+        o->dropped++;
+        o->wait_streams = o->streams & (GRABBER_STREAM_LOW | GRABBER_STREAM_HIGH);
+        pthread_mutex_unlock(&o->mutex);
+        return;
+    }
+    o->wait_streams &= ~msg->stream;
+    pthread_mutex_unlock(&o->mutex);
+
+    off = o->head % o->size;
+    output_copy(o, &off, (unsigned char *) msg, sizeof(struct grabber_msg_s));
+    for (i = 0; i < 2; i++) {
+        output_copy(o, &off, span->ptr[i], span->len[i]);
     }
+
+    pthread_mutex_lock(&o->mutex);
+    o->head += len;
+    o->frames++;
+    pthread_cond_signal(&o->cond);
+    pthread_mutex_unlock(&o->mutex);
 }
 
-// The second argument is the circular buffer
-void cb2s_headercpy(unsigned char *dest, unsigned char *src, size_t n)
+// Parse DEST and prepare an output of the given type
+// DEST is "-" for stdout, "fd:N" for an inherited descriptor, otherwise
+// a fifo (created if missing) or a regular file
+// backlog is the limit of queued bytes, 0 for the default of the stream
+int output_add(int type, char *dest, unsigned int backlog)
 {
-    struct frame_header *fh = (struct frame_header *) dest;
-    struct frame_header_22 fh22;
-    struct frame_header_24 fh24;
-    struct frame_header_26 fh26;
-    struct frame_header_28 fh28;
-    unsigned char *fp = NULL;
-
-    if (n == sizeof(fh22)) {
-        fp = (unsigned char *) &fh22;
-    } else if (n == sizeof(fh24)) {
-        fp = (unsigned char *) &fh24;
-    } else if (n == sizeof(fh26)) {
-        fp = (unsigned char *) &fh26;
-    } else if (n == sizeof(fh28)) {
-        fp = (unsigned char *) &fh28;
+    grabber_output *o;
+    struct stat st;
+    char *endptr;
+    int i;
+
+    if (noutputs >= OUTPUT_MAX) {
+        fprintf(stderr, "Too many outputs, max %d\n", OUTPUT_MAX);
+        return -1;
+    }
+    o = &outputs[noutputs];
+    memset(o, 0, sizeof(grabber_output));
+    o->type = type;
+    o->fd = -1;
+
+    if (strcmp("-", dest) == 0) {
+        o->fd = STDOUT_FILENO;
+    } else if (strncmp("fd:", dest, 3) == 0) {
+        errno = 0;
+        o->fd = strtol(dest + 3, &endptr, 10);
+        if ((errno != 0) || (endptr == dest + 3) || (*endptr != '\0') || (o->fd < 0) || (fcntl(o->fd, F_GETFL) < 0)) {
+            fprintf(stderr, "Invalid file descriptor %s\n", dest + 3);
+            return -1;
+        }
+    } else {
+        o->name = dest;
+        if (stat(dest, &st) < 0) {
+            if (mkfifo(dest, 0755) < 0) {
+                fprintf(stderr, "mkfifo failed for file %s\n", dest);
+                return -1;
+            }
+            o->is_fifo = 1;
+            o->created = 1;
+        } else if (S_ISFIFO(st.st_mode)) {
+            o->is_fifo = 1;
+        } else {
+            o->fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (o->fd < 0) {
+                fprintf(stderr, "Error opening file %s\n", dest);
+                return -1;
+            }
+        }
+    }
+    for (i = 0; i < noutputs; i++) {
+        if ((o->fd >= 0) && (outputs[i].fd == o->fd)) {
+            fprintf(stderr, "File descriptor %d used by more than one output\n", o->fd);
+            return -1;
+        }
     }
-    if (fp == NULL) return;
 
-    if (src + n > addr + buf_size) {
-        memcpy(fp, src, addr + buf_size - src);
-        memcpy(fp + (addr + buf_size - src), addr + buf_offset, n - (addr + buf_size - src));
+    if (backlog > 0) {
+        o->size = backlog;
+    } else if ((type == TYPE_LOW) || (type == TYPE_TS_LOW)) {
+        o->size = OUTPUT_BACKLOG_LOW;
+    } else if ((type == TYPE_HIGH) || (type == TYPE_TS_HIGH)) {
+        o->size = OUTPUT_BACKLOG_HIGH;
     } else {
-        memcpy(fp, src, n);
+        o->size = OUTPUT_BACKLOG_AAC;
     }
-    if (n == sizeof(fh22)) {
-        fh->len = fh22.len;
-        fh->counter = fh22.counter;
-        fh->time = fh22.time;
-        fh->type = fh22.type;
-        fh->stream_counter = fh22.stream_counter;
-    } else if (n == sizeof(fh24)) {
-        fh->len = fh24.len;
-        fh->counter = fh24.counter;
-        fh->time = fh24.time;
-        fh->type = fh24.type;
-        fh->stream_counter = fh24.stream_counter;
-    } else if (n == sizeof(fh26)) {
-        fh->len = fh26.len;
-        fh->counter = fh26.counter;
-        fh->time = fh26.time;
-        fh->type = fh26.type;
-        fh->stream_counter = fh26.stream_counter;
-    } else if (n == sizeof(fh28)) {
-        fh->len = fh28.len;
-        fh->counter = fh28.counter;
-        fh->time = fh28.time;
-        fh->type = fh28.type;
-        fh->stream_counter = fh28.stream_counter;
+    o->buf = (unsigned char *) malloc(o->size);
+    if (o->buf == NULL) {
+        fprintf(stderr, "Unable to allocate output buffer\n");
+        return -1;
     }
+    pthread_mutex_init(&o->mutex, NULL);
+    pthread_cond_init(&o->cond, NULL);
+    noutputs++;
+
+    return 0;
 }
 
-#ifdef USE_SEMAPHORE
-int sem_fshare_open()
+// Parse STREAM[@BACKLOG]:DEST
+int output_parse(char *arg)
 {
-    sem_fshare_read_lock = sem_open(READ_LOCK_FILE, O_RDWR);
-    if (sem_fshare_read_lock == SEM_FAILED) {
-        fprintf(stderr, "error opening %s\n", READ_LOCK_FILE);
+    char *dest, *limit, *endptr;
+    unsigned int backlog = 0;
+    long val;
+    int type;
+
+    dest = strchr(arg, ':');
+    if (dest == NULL) {
+        fprintf(stderr, "Invalid output %s, use STREAM:DEST\n", arg);
         return -1;
     }
-    sem_fshare_write_lock = sem_open(WRITE_LOCK_FILE, O_RDWR);
-    if (sem_fshare_write_lock == SEM_FAILED) {
-        fprintf(stderr, "error opening %s\n", WRITE_LOCK_FILE);
-        return -2;
+    *dest = '\0';
+    dest++;
+    limit = strchr(arg, '@');
+    if (limit != NULL) {
+        *limit = '\0';
+        limit++;
+        errno = 0;
+        val = strtol(limit, &endptr, 10);
+        if ((errno == ERANGE && (val == LONG_MAX || val == LONG_MIN)) || (errno != 0 && val == 0)) {
+            fprintf(stderr, "Invalid backlog value \"%s\"\n", limit);
+            return -1;
+        }
+        if ((endptr == limit) || (*endptr != '\0') || (val < OUTPUT_BACKLOG_MIN)) {
+            fprintf(stderr, "Invalid backlog value \"%s\", min %d\n", limit, OUTPUT_BACKLOG_MIN);
+            return -1;
+        }
+        backlog = val;
+    }
+    if (strcasecmp("low", arg) == 0) {
+        type = TYPE_LOW;
+    } else if (strcasecmp("high", arg) == 0) {
+        type = TYPE_HIGH;
+    } else if (strcasecmp("aac", arg) == 0) {
+        type = TYPE_AAC;
+    } else if ((strcasecmp("ts", arg) == 0) || (strcasecmp("ts_high", arg) == 0)) {
+        type = TYPE_TS_HIGH;
+    } else if (strcasecmp("ts_low", arg) == 0) {
+        type = TYPE_TS_LOW;
+    } else {
+        fprintf(stderr, "Invalid output stream %s, use low, high, aac, ts or ts_low\n", arg);
+        return -1;
+    }
+
+    return output_add(type, dest, backlog);
+}
+
+// Send the packets of the last muxed frame to the MPEG-TS outputs
+void ts_send(tsmux *m, int type, int len)
+{
+    fshare_span ts_span;
+    int j;
+
+    if (len <= 0) return;
+
+    ts_span.ptr[0] = m->buf;
+    ts_span.len[0] = len;
+    ts_span.ptr[1] = NULL;
+    ts_span.len[1] = 0;
+    for (j = 0; j < noutputs; j++) {
+        if (outputs[j].type == type) output_put(&outputs[j], &ts_span, m->key, 0);
+    }
+}
+
+void output_stats(grabber_output *o)
+{
+    pthread_mutex_lock(&o->mutex);
+    fprintf(stderr, "h264grabber output %s: %u frames, %u dropped, %llu bytes written, %u/%u bytes queued, syscalls %.2f/frame%s\n",
+            (o->name != NULL) ? o->name : ((o->type == TYPE_SOCKET) ? "socket client" : "fd"), o->frames, o->dropped, o->bytes + o->spliced_bytes, o->head - o->tail, o->size,
+            (o->frames > 0) ? (double) __atomic_load_n(&o->syscalls, __ATOMIC_RELAXED) / o->frames : 0.0, (o->closed) ? ", closed" : "");
+    if (o->zerocopy) fprintf(stderr, "h264grabber output %s: %u frames spliced, %llu bytes, %u pipe drains\n",
+            o->name, o->spliced, o->spliced_bytes, o->drained);
+    pthread_mutex_unlock(&o->mutex);
+}
+
+// Accept the clients and wait for their subscription, the capture loop starts them
+void* socket_thread(void *data)
+{
+    struct grabber_sub_s sub;
+    struct timeval tv;
+    ssize_t n;
+    int fd;
+
+    while (1) {
+        fd = accept(socket_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                fprintf(stderr, "Error accepting connection on %s\n", socket_name);
+                sleep(1);
+            }
+            continue;
+        }
+
+        tv.tv_sec = SOCKET_TIMEOUT;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        n = recv(fd, &sub, sizeof(sub), MSG_WAITALL);
+        if ((n != sizeof(sub)) || (sub.magic != GRABBER_SUB_MAGIC) ||
+                (sub.version != GRABBER_PROTOCOL_VERSION) || (sub.streams == 0)) {
+            fprintf(stderr, "Invalid subscription, closing connection\n");
+            close(fd);
+            continue;
+        }
+
+        pthread_mutex_lock(&socket_mutex);
+        if (socket_npending < SOCKET_PENDING) {
+            socket_pending_fd[socket_npending] = fd;
+            socket_pending_sub[socket_npending] = sub;
+            socket_npending++;
+            fd = -1;
+        }
+        pthread_mutex_unlock(&socket_mutex);
+        if (fd >= 0) {
+            fprintf(stderr, "Too many pending clients, closing connection\n");
+            close(fd);
+        }
+    }
+
+    return NULL;
+}
+
+int socket_open(char *name)
+{
+    struct sockaddr_un addr;
+    pthread_t thread;
+
+    if (strlen(name) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket name too long: %s\n", name);
+        return -1;
+    }
+    socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_fd < 0) {
+        fprintf(stderr, "Error creating socket\n");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, name);
+    unlink(name);
+    if ((bind(socket_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (listen(socket_fd, SOCKET_PENDING) < 0)) {
+        fprintf(stderr, "Error listening on %s\n", name);
+        close(socket_fd);
+        return -1;
+    }
+    if (pthread_create(&thread, NULL, socket_thread, NULL)) {
+        fprintf(stderr, "Error creating thread\n");
+        close(socket_fd);
+        return -1;
     }
+    pthread_detach(thread);
+
     return 0;
 }
 
-void sem_fshare_close()
+int socket_codec(int stream)
+{
+    int codec;
 
+    if (stream == GRABBER_STREAM_AAC) return GRABBER_CODEC_AAC;
+    codec = (stream == GRABBER_STREAM_LOW) ? stream_type.codec_low : stream_type.codec_high;
+    if (codec == CODEC_H264) return GRABBER_CODEC_H264;
+    if (codec == CODEC_H265) return GRABBER_CODEC_H265;
+    return GRABBER_CODEC_NONE;
+}
+
+// Send a frame to the clients of the socket, or only to o
+void socket_send(grabber_output *o, fshare_frame *frame, int stream, fshare_span *span, int key)
 {
-    if (sem_fshare_write_lock != SEM_FAILED) {
-        sem_close(sem_fshare_write_lock);
-        sem_fshare_write_lock = SEM_FAILED;
+    struct grabber_msg_s msg;
+    int j;
+
+    msg.len = span->len[0] + span->len[1];
+    msg.stream = stream;
+    msg.codec = socket_codec(stream);
+    msg.type = frame->type & (GRABBER_TYPE_IDR | GRABBER_TYPE_SPS | GRABBER_TYPE_PPS | GRABBER_TYPE_VPS | GRABBER_TYPE_AAC);
+    msg.counter = frame->counter;
+    msg.time = frame->time;
+
+    if (o != NULL) {
+        output_put_msg(o, &msg, span, key);
+        return;
     }
-    if (sem_fshare_read_lock != SEM_FAILED) {
-        sem_close(sem_fshare_read_lock);
-        sem_fshare_read_lock = SEM_FAILED;
+    for (j = 0; j < noutputs; j++) {
+        if (outputs[j].type == TYPE_SOCKET) output_put_msg(&outputs[j], &msg, span, key);
     }
-    return;
 }
 
-void sem_write_lock()
+void history_add(fshare_frame *frame, int stream, int key)
 {
-    int wl, ret = 0;
-    int *fshare_frame_buf_start = (int *) addr;
-
-    while (ret == 0) {
-        sem_wait(sem_fshare_read_lock);
-        wl = *fshare_frame_buf_start;
-        if (wl == 0) {
-            ret = 1;
-        } else {
-            sem_post(sem_fshare_read_lock);
-            usleep(1000);
-        }
+    history_frame *h = &history[history_count % HISTORY_FRAMES];
+
+    h->frame = *frame;
+    h->stream = stream;
+    h->key = key;
+    if ((key) && (stream != GRABBER_STREAM_AAC)) {
+        history_key[stream == GRABBER_STREAM_HIGH] = history_count;
+        history_key_valid[stream == GRABBER_STREAM_HIGH] = 1;
     }
-    return;
+    history_count++;
 }
 
-void sem_write_unlock()
+// The frame is still in the ring if its header is there
+int history_valid(history_frame *h)
 {
-    sem_post(sem_fshare_read_lock);
-    return;
+    struct frame_header fh;
+
+    fshare_header_read(&ring, &fh, h->frame.hdr);
+    return ((fh.counter == h->frame.counter) && (fh.type == h->frame.type));
 }
-#endif
 
-void sigpipe_handler(int unused)
+// Send the GOP in progress to a new client, from the oldest SPS/VPS of its streams
+void history_replay(grabber_output *o)
 {
-    // Do nothing
+    history_frame *h;
+    fshare_span span, copy;
+    unsigned char *buf, *sps;
+    unsigned int start = 0, k, len, sps_len;
+    int found = 0, i;
+
+    for (i = 0; i < 2; i++) {
+        if (!(o->streams & ((i == 0) ? GRABBER_STREAM_LOW : GRABBER_STREAM_HIGH))) continue;
+        if (!history_key_valid[i]) continue;
+        if ((history_count - history_key[i] >= HISTORY_FRAMES) || (!history_valid(&history[history_key[i] % HISTORY_FRAMES]))) continue;
+        if ((!found) || (history_count - history_key[i] > history_count - start)) start = history_key[i];
+        found = 1;
+    }
+    if (!found) return;
+
+    for (k = start; k != history_count; k++) {
+        h = &history[k % HISTORY_FRAMES];
+        if (!(o->streams & h->stream)) continue;
+
+        // Copy the frame out of the ring before checking that it wasn't overwritten
+        fshare_frame_span(&ring, &h->frame, (h->frame.type & FSHARE_TYPE_SPS) ? FSHARE_SPS_PREFIX_SIZE : 0, &span);
+        len = span.len[0] + span.len[1];
+        if (len > replay_size) {
+            buf = realloc(replay_buf, len);
+            if (buf == NULL) return;
+            replay_buf = buf;
+            replay_size = len;
+        }
+        fshare_span_copy(replay_buf, &span);
+        if (!history_valid(h)) continue;
+
+        copy.ptr[0] = replay_buf;
+        copy.len[0] = len;
+        copy.ptr[1] = NULL;
+        copy.len[1] = 0;
+        sps = NULL;
+        if ((sps_timing_info) && (h->stream == GRABBER_STREAM_LOW)) {
+            sps = fshare_timing_nal(&timing_low, stream_type.codec_low, &h->frame, &copy, &sps_len);
+        } else if ((sps_timing_info) && (h->stream == GRABBER_STREAM_HIGH)) {
+            sps = fshare_timing_nal(&timing_high, stream_type.codec_high, &h->frame, &copy, &sps_len);
+        }
+        if (sps != NULL) {
+            copy.ptr[0] = sps;
+            copy.len[0] = sps_len;
+        }
+        socket_send(o, &h->frame, h->stream, &copy, h->key);
+    }
 }
 
-void* unlock_fifo_thread(void *data)
+// Free the slots of the clients that went away
+void socket_reap()
 {
-    int fd;
-    char *fifo_name = data;
-    unsigned char buffer_fifo[1024];
+    grabber_output *o;
+    int j, closed;
+
+    for (j = 0; j < noutputs; j++) {
+        o = &outputs[j];
+        if (o->type != TYPE_SOCKET) continue;
+        pthread_mutex_lock(&o->mutex);
+        closed = o->closed;
+        pthread_mutex_unlock(&o->mutex);
+        if (!closed) continue;
+
+        pthread_join(o->thread, NULL);
+        if (debug) output_stats(o);
+        close(o->fd);
+        free(o->buf);
+        pthread_mutex_destroy(&o->mutex);
+        pthread_cond_destroy(&o->cond);
+        o->type = TYPE_NONE;
+    }
+}
 
-    fd = open(fifo_name, O_RDONLY);
-    read(fd, buffer_fifo, 1024);
-    close(fd);
+// Start the clients that sent their subscription
+void socket_accept()
+{
+    int fds[SOCKET_PENDING];
+    struct grabber_sub_s subs[SOCKET_PENDING];
+    grabber_output *o;
+    int i, j, n;
+
+    pthread_mutex_lock(&socket_mutex);
+    n = socket_npending;
+    memcpy(fds, socket_pending_fd, n * sizeof(int));
+    memcpy(subs, socket_pending_sub, n * sizeof(struct grabber_sub_s));
+    socket_npending = 0;
+    pthread_mutex_unlock(&socket_mutex);
+    if (n == 0) return;
+
+    socket_reap();
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < noutputs; j++) {
+            if (outputs[j].type == TYPE_NONE) break;
+        }
+        if (j == OUTPUT_MAX) {
+            fprintf(stderr, "Too many outputs, closing connection\n");
+            close(fds[i]);
+            continue;
+        }
 
-    return NULL;
+        o = &outputs[j];
+        memset(o, 0, sizeof(grabber_output));
+        o->type = TYPE_SOCKET;
+        o->fd = fds[i];
+        o->streams = subs[i].streams & (GRABBER_STREAM_LOW | GRABBER_STREAM_HIGH | GRABBER_STREAM_AAC);
+        o->wait_streams = o->streams & (GRABBER_STREAM_LOW | GRABBER_STREAM_HIGH);
+        o->size = OUTPUT_BACKLOG_HIGH;
+        o->buf = (unsigned char *) malloc(o->size);
+        if (o->buf == NULL) {
+            fprintf(stderr, "Unable to allocate output buffer\n");
+            close(fds[i]);
+            o->type = TYPE_NONE;
+            continue;
+        }
+        pthread_mutex_init(&o->mutex, NULL);
+        pthread_cond_init(&o->cond, NULL);
+
+        if (subs[i].flags & GRABBER_SUB_LAST_IDR) history_replay(o);
+
+        if (pthread_create(&o->thread, NULL, output_thread, o)) {
+            fprintf(stderr, "Error creating thread\n");
+            close(fds[i]);
+            free(o->buf);
+            o->type = TYPE_NONE;
+            continue;
+        }
+        if (j == noutputs) noutputs++;
+        if (debug) fprintf(stderr, "%lld: client started, streams 0x%x, flags 0x%x, %u bytes queued\n",
+                current_timestamp(), o->streams, subs[i].flags, o->head);
+    }
 }
 
 void print_usage(char *progname)
 {
-    fprintf(stderr, "\nUsage: %s [-m MODEL] [-r RES] [-s] [-f] [-d]\n\n", progname);
+    fprintf(stderr, "\nUsage: %s [-m MODEL] [-r RES] [-a] [-o STREAM:DEST]... [-u PATH] [-s] [-f] [-z] [-d]\n\n", progname);
     fprintf(stderr, "\t-m MODEL, --model MODEL\n");
     fprintf(stderr, "\t\tset model: y20ga, y25ga, y30qa or y501gc (Allwinner: default y20ga\n");
     fprintf(stderr, "\t\tset model: y21ga, y211ga, y211ba, y213ga, y291ga, h30ga, r30gb, r35gb, r37gb, r40ga, h51ga, h52ga, h60ga, y28ga, y29ga, y623, q321br_lsx, qg311r or b091qp (Allwinner-v2)\n");
@@ -594,39 +950,54 @@ void print_usage(char *progname)
     fprintf(stderr, "\t\tdon't overwrite SPS timing info (default overwrite)\n");
     fprintf(stderr, "\t-f, --fifo\n");
     fprintf(stderr, "\t\tenable fifo output\n");
+    fprintf(stderr, "\t-o STREAM[@BACKLOG]:DEST, --output STREAM[@BACKLOG]:DEST\n");
+    fprintf(stderr, "\t\tsend STREAM (low, high or aac) to DEST: a fifo, a file, fd:N or - for stdout\n");
+    fprintf(stderr, "\t\tSTREAM ts and ts_low are MPEG-TS with high or low res and AAC\n");
+    fprintf(stderr, "\t\tBACKLOG is the max bytes queued for DEST, over it frames are dropped until the next IDR\n");
+    fprintf(stderr, "\t\t(default %d, %d and %d)\n", OUTPUT_BACKLOG_LOW, OUTPUT_BACKLOG_HIGH, OUTPUT_BACKLOG_AAC);
+    fprintf(stderr, "\t\tcan be repeated, every output has its own writer thread\n");
+    fprintf(stderr, "\t\twhen present -r, -a and -f are ignored\n");
+    fprintf(stderr, "\t-u PATH, --socket PATH\n");
+    fprintf(stderr, "\t\tserve timestamped frames to the clients of the Unix socket PATH (%s)\n", GRABBER_SOCKET_NAME);
+    fprintf(stderr, "\t-z, --zerocopy\n");
+    fprintf(stderr, "\t\thand frames to fifos with vmsplice, without copies\n");
     fprintf(stderr, "\t-d, --debug\n");
     fprintf(stderr, "\t\tenable debug\n");
 }
 
 int main(int argc, char **argv) {
-    unsigned char *buf_idx, *buf_idx_cur, *buf_idx_end, *buf_idx_end_prev;
-    unsigned char *buf_idx_start = NULL;
-    unsigned char *header_a1, *header_a2;
-    char *stdoutbuf;
-    FILE *fFS, *fOut, *fOutLow = NULL, *fOutHigh = NULL, *fOutAac = NULL;
-    int fshm;
+    unsigned char *buf_idx_start, *buf_idx_end, *buf_idx_end_prev;
+    unsigned char *sps;
+    unsigned int sps_len;
+    unsigned int buf_offset, frame_header_size;
     mode_t mode = 0755;
 
     int frame_type = TYPE_NONE;
     int frame_len = 0;
     int frame_counter = -1;
-    int frame_counter_last_valid_low = -1;
-    int frame_counter_last_valid_high = -1;
-    int frame_counter_last_valid_audio = -1;
 
-    int i, n, c;
+    int i, j, n, c, ret, key, open_outputs, msg_stream;
     int write_enable = 0;
-    int frame_sync = 0;
 
-    struct frame_header fhs[10];
-    unsigned char* fhs_addr[10];
+    fshare_scan scan;
+    fshare_resync resync_low, resync_high, resync_audio;
+    fshare_wait wait;
+    fshare_frame *fhs;
+    fshare_span span, sps_span;
     uint32_t last_counter;
 
     resolution = RESOLUTION_HIGH;
     audio = 0;
     sps_timing_info = 1;
     fifo = 0;
+    zerocopy = 0;
     debug = 0;
+    noutputs = 0;
+    ts_low = 0;
+    ts_high = 0;
+    socket_name = NULL;
+    fshare_timing_init(&timing_low);
+    fshare_timing_init(&timing_high);
 
     buf_offset = BUF_OFFSET_Y20GA;
     frame_header_size = FRAME_HEADER_SIZE_Y20GA;
@@ -639,6 +1010,9 @@ int main(int argc, char **argv) {
             {"audio",  no_argument, 0, 'a'},
             {"sti",  no_argument, 0, 's'},
             {"fifo",  no_argument, 0, 'f'},
+            {"output",  required_argument, 0, 'o'},
+            {"zerocopy",  no_argument, 0, 'z'},
+            {"socket",  required_argument, 0, 'u'},
             {"debug",  no_argument, 0, 'd'},
             {"help",  no_argument, 0, 'h'},
             {0, 0, 0, 0}
@@ -646,7 +1020,7 @@ int main(int argc, char **argv) {
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "m:r:afsdh",
+        c = getopt_long (argc, argv, "m:r:afo:zu:sdh",
                          long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -655,76 +1029,8 @@ int main(int argc, char **argv) {
 
         switch (c) {
         case 'm':
-            if (strcasecmp("y20ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y20GA;
-                frame_header_size = FRAME_HEADER_SIZE_Y20GA;
-            } else if (strcasecmp("y25ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y25GA;
-                frame_header_size = FRAME_HEADER_SIZE_Y25GA;
-            } else if (strcasecmp("y30qa", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y30QA;
-                frame_header_size = FRAME_HEADER_SIZE_Y30QA;
-            } else if (strcasecmp("y501gc", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y501GC;
-                frame_header_size = FRAME_HEADER_SIZE_Y501GC;
-            } else if (strcasecmp("y21ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y21GA;
-                frame_header_size = FRAME_HEADER_SIZE_Y21GA;
-            } else if (strcasecmp("y211ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y211GA;
-                frame_header_size = FRAME_HEADER_SIZE_Y211GA;
-            } else if (strcasecmp("y211ba", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y211BA;
-                frame_header_size = FRAME_HEADER_SIZE_Y211BA;
-            } else if (strcasecmp("y213ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y213GA;
-                frame_header_size = FRAME_HEADER_SIZE_Y213GA;
-            } else if (strcasecmp("y291ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y291GA;
-                frame_header_size = FRAME_HEADER_SIZE_Y291GA;
-            } else if (strcasecmp("h30ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_H30GA;
-                frame_header_size = FRAME_HEADER_SIZE_H30GA;
-            } else if (strcasecmp("r30gb", optarg) == 0) {
-                buf_offset = BUF_OFFSET_R30GB;
-                frame_header_size = FRAME_HEADER_SIZE_R30GB;
-            } else if (strcasecmp("r35gb", optarg) == 0) {
-                buf_offset = BUF_OFFSET_R35GB;
-                frame_header_size = FRAME_HEADER_SIZE_R35GB;
-            } else if (strcasecmp("r37gb", optarg) == 0) {
-                buf_offset = BUF_OFFSET_R37GB;
-                frame_header_size = FRAME_HEADER_SIZE_R37GB;
-            } else if (strcasecmp("r40ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_R40GA;
-                frame_header_size = FRAME_HEADER_SIZE_R40GA;
-            } else if (strcasecmp("h51ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_H51GA;
-                frame_header_size = FRAME_HEADER_SIZE_H51GA;
-            } else if (strcasecmp("h52ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_H52GA;
-                frame_header_size = FRAME_HEADER_SIZE_H52GA;
-            } else if (strcasecmp("h60ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_H60GA;
-                frame_header_size = FRAME_HEADER_SIZE_H60GA;
-            } else if (strcasecmp("y28ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y28GA;
-                frame_header_size = FRAME_HEADER_SIZE_Y28GA;
-            } else if (strcasecmp("y29ga", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y29GA;
-                frame_header_size = FRAME_HEADER_SIZE_Y29GA;
-            } else if (strcasecmp("y623", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Y623;
-                frame_header_size = FRAME_HEADER_SIZE_Y623;
-            } else if (strcasecmp("q321br_lsx", optarg) == 0) {
-                buf_offset = BUF_OFFSET_Q321BR_LSX;
-                frame_header_size = FRAME_HEADER_SIZE_Q321BR_LSX;
-            } else if (strcasecmp("qg311r", optarg) == 0) {
-                buf_offset = BUF_OFFSET_QG311R;
-                frame_header_size = FRAME_HEADER_SIZE_QG311R;
-            } else if (strcasecmp("b091qp", optarg) == 0) {
-                buf_offset = BUF_OFFSET_B091QP;
-                frame_header_size = FRAME_HEADER_SIZE_B091QP;
-            }
+            // An unknown model keeps the default layout
+            fshare_model_layout(optarg, &buf_offset, &frame_header_size);
             break;
 
         case 'r':
@@ -752,6 +1058,25 @@ int main(int argc, char **argv) {
             fifo = 1;
             break;
 
+        case 'o':
+            if (output_parse(optarg) != 0) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+
+        case 'u':
+            socket_name = optarg;
+            break;
+
+        case 'z':
+#ifdef SPLICE_F_NONBLOCK
+            zerocopy = 1;
+#else
+            fprintf(stderr, "vmsplice not available, using copies\n");
+#endif
+            break;
+
         case 'd':
             fprintf (stderr, "debug on\n");
             debug = 1;
@@ -772,546 +1097,405 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (fifo == 0) {
-        if (resolution == RESOLUTION_BOTH) {
-            fprintf(stderr, "Both resolution are not supported with output to stdout\n");
-            fprintf(stderr, "Use fifo or run two processes\n");
-            return -2;
-        } else if ((resolution != RESOLUTION_NONE) && (audio == 1)) {
-            fprintf(stderr, "Both video and audio are not supported with output to stdout\n");
-            fprintf(stderr, "Use fifo or run two processes\n");
-            return -2;
+    if ((noutputs == 0) && (socket_name == NULL)) {
+        // Legacy options: one stream to stdout or the fixed fifos
+        if (fifo == 0) {
+            if (resolution == RESOLUTION_BOTH) {
+                fprintf(stderr, "Both resolution are not supported with output to stdout\n");
+                fprintf(stderr, "Use fifo, -o or run two processes\n");
+                return -2;
+            } else if ((resolution != RESOLUTION_NONE) && (audio == 1)) {
+                fprintf(stderr, "Both video and audio are not supported with output to stdout\n");
+                fprintf(stderr, "Use fifo, -o or run two processes\n");
+                return -2;
+            }
+            if (resolution == RESOLUTION_LOW) {
+                ret = output_add(TYPE_LOW, "-", 0);
+            } else if (resolution == RESOLUTION_HIGH) {
+                ret = output_add(TYPE_HIGH, "-", 0);
+            } else if (audio == 1) {
+                ret = output_add(TYPE_AAC, "-", 0);
+            } else {
+                ret = 0;
+            }
+            if (ret != 0) return -6;
+        } else {
+            if ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH)) {
+                unlink(FIFO_NAME_LOW);
+                if (mkfifo(FIFO_NAME_LOW, mode) < 0) {
+                    fprintf(stderr, "mkfifo failed for file %s\n", FIFO_NAME_LOW);
+                    return -6;
+                }
+                if (output_add(TYPE_LOW, FIFO_NAME_LOW, 0) != 0) return -6;
+                outputs[noutputs - 1].created = 1;
+            }
+            if ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH)) {
+                unlink(FIFO_NAME_HIGH);
+                if (mkfifo(FIFO_NAME_HIGH, mode) < 0) {
+                    fprintf(stderr, "mkfifo failed for file %s\n", FIFO_NAME_HIGH);
+                    return -6;
+                }
+                if (output_add(TYPE_HIGH, FIFO_NAME_HIGH, 0) != 0) return -6;
+                outputs[noutputs - 1].created = 1;
+            }
+            if (audio == 1) {
+                unlink(FIFO_NAME_AAC);
+                if (mkfifo(FIFO_NAME_AAC, mode) < 0) {
+                    fprintf(stderr, "mkfifo failed for file %s\n", FIFO_NAME_AAC);
+                    return -6;
+                }
+                if (output_add(TYPE_AAC, FIFO_NAME_AAC, 0) != 0) return -6;
+                outputs[noutputs - 1].created = 1;
+            }
+        }
+    } else {
+        // The streams to capture are the ones with an output
+        int low = 0, high = 0;
+
+        audio = 0;
+        for (i = 0; i < noutputs; i++) {
+            if (outputs[i].type == TYPE_LOW) low = 1;
+            else if (outputs[i].type == TYPE_HIGH) high = 1;
+            else if (outputs[i].type == TYPE_AAC) audio = 1;
+            else if (outputs[i].type == TYPE_TS_LOW) low = audio = ts_low = 1;
+            else if (outputs[i].type == TYPE_TS_HIGH) high = audio = ts_high = 1;
         }
+        if ((ts_low) && (tsmux_init(&mux_low) != 0)) return -6;
+        if ((ts_high) && (tsmux_init(&mux_high) != 0)) return -6;
+        // The clients of the socket can ask for any stream
+        if (socket_name != NULL) low = high = audio = 1;
+        if (low && high) resolution = RESOLUTION_BOTH;
+        else if (low) resolution = RESOLUTION_LOW;
+        else if (high) resolution = RESOLUTION_HIGH;
+        else resolution = RESOLUTION_NONE;
     }
-
-    fFS = fopen(BUFFER_FILE, "r");
-    if ( fFS == NULL ) {
-        fprintf(stderr, "Could not get size of %s\n", BUFFER_FILE);
-        return -3;
+    if ((noutputs == 0) && (socket_name == NULL)) {
+        fprintf(stderr, "Nothing to capture\n");
+        return -2;
     }
-    fseek(fFS, 0, SEEK_END);
-    buf_size = ftell(fFS);
-    fclose(fFS);
-    if (debug) fprintf(stderr, "The size of the buffer is %d\n", buf_size);
 
 #ifdef USE_SEMAPHORE
-    if (sem_fshare_open() != 0) {
+    if (fshare_sem_open() != 0) {
         fprintf(stderr, "Error - could not open semaphores\n") ;
         return -4;
     }
 #endif
 
-    // Opening an existing file
-    fshm = shm_open(BUFFER_SHM, O_RDWR, 0);
-    if ( fshm == -1 ) {
-        fprintf(stderr, "Error - could not open file %s\n", BUFFER_FILE) ;
+    // Map the buffer, its size is read from the shm object
+    if (fshare_open(&ring, buf_offset, frame_header_size) != 0) {
         return -5;
     }
-
-    // Map file to memory
-    addr = (unsigned char*) mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_SHARED, fshm, 0);
-    if (addr == MAP_FAILED) {
-        fprintf(stderr, "Error - mapping file %s\n", BUFFER_FILE);
-        close(fshm);
-        return -5;
-    }
-    if (debug) fprintf(stderr, "Mapping file %s, size %d, to %08x\n", BUFFER_FILE, buf_size, (unsigned int) addr);
-
-    // Closing the file
-    if (debug) fprintf(stderr, "Closing the file %s\n", BUFFER_FILE) ;
-    close(fshm);
-
-    // Opening/setting output file
-    if (fifo == 0) {
-        if (resolution == RESOLUTION_LOW) {
-            stdoutbuf = (char *) malloc(sizeof(char) * 131072);
-            if (setvbuf(stdout, stdoutbuf, _IOFBF, sizeof(stdoutbuf)) != 0) {
-                fprintf(stderr, "Error setting stdout buffer\n");
-            }
-            fOutLow = stdout;
-        } else if (resolution == RESOLUTION_HIGH) {
-            stdoutbuf = (char *) malloc(sizeof(char) * 524288);
-            if (setvbuf(stdout, stdoutbuf, _IOFBF, sizeof(stdoutbuf)) != 0) {
-                fprintf(stderr, "Error setting stdout buffer\n");
-            }
-            fOutHigh = stdout;
-        } else if (audio == 1) {
-            stdoutbuf = (char *) malloc(sizeof(char) * 32768);
-            if (setvbuf(stdout, stdoutbuf, _IOFBF, sizeof(stdoutbuf)) != 0) {
-                fprintf(stderr, "Error setting stdout buffer\n");
-            }
-            fOutAac = stdout;
+    if (debug) fprintf(stderr, "Mapping file %s, size %d, to %08x\n", BUFFER_FILE, ring.size, (unsigned int) ring.addr);
+
+    // Start the writer threads, a reader that doesn't consume stalls only its own output
+    sigaction(SIGPIPE, &(struct sigaction){{sigpipe_handler}}, NULL);
+    for (i = 0; i < noutputs; i++) {
+        if ((outputs[i].fd < 0) && (output_open_fifo(&outputs[i]) != 0)) {
+            fprintf(stderr, "Error opening fifo %s\n", outputs[i].name);
+            return -6;
         }
-    } else {
-        pthread_t unlock_low_thread, unlock_high_thread, unlock_aac_thread;
-
-        sigaction(SIGPIPE, &(struct sigaction){{sigpipe_handler}}, NULL);
-
-        if ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH)) {
-            unlink(FIFO_NAME_LOW);
-            if (mkfifo(FIFO_NAME_LOW, mode) < 0) {
-                fprintf(stderr, "mkfifo failed for file %s\n", FIFO_NAME_LOW);
-                return -6;
-            }
-            if(pthread_create(&unlock_low_thread, NULL, unlock_fifo_thread, (void *) FIFO_NAME_LOW)) {
-                fprintf(stderr, "Error creating thread\n");
-                return -6;
-            }
-            pthread_detach(unlock_low_thread);
-            fOutLow = fopen(FIFO_NAME_LOW, "w");
-            if (fOutLow == NULL) {
-                fprintf(stderr, "Error opening fifo %s\n", FIFO_NAME_LOW);
-                return -6;
-            }
-        }
-        if ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH)) {
-            unlink(FIFO_NAME_HIGH);
-            if (mkfifo(FIFO_NAME_HIGH, mode) < 0) {
-                fprintf(stderr, "mkfifo failed for file %s\n", FIFO_NAME_HIGH);
-                return -6;
-            }
-            if(pthread_create(&unlock_high_thread, NULL, unlock_fifo_thread, (void *) FIFO_NAME_HIGH)) {
-                fprintf(stderr, "Error creating thread\n");
-                return -6;
-            }
-            pthread_detach(unlock_high_thread);
-            fOutHigh = fopen(FIFO_NAME_HIGH, "w");
-            if (fOutHigh == NULL) {
-                fprintf(stderr, "Error opening fifo %s\n", FIFO_NAME_HIGH);
-                return -6;
-            }
-        }
-
-        if (audio == 1) {
-            unlink(FIFO_NAME_AAC);
-            if (mkfifo(FIFO_NAME_AAC, mode) < 0) {
-                fprintf(stderr, "mkfifo failed for file %s\n", FIFO_NAME_AAC);
-                return -6;
-            }
-            if(pthread_create(&unlock_aac_thread, NULL, unlock_fifo_thread, (void *) FIFO_NAME_AAC)) {
-                fprintf(stderr, "Error creating thread\n");
-                return -6;
-            }
-            pthread_detach(unlock_aac_thread);
-            fOutAac = fopen(FIFO_NAME_AAC, "w");
-            if (fOutAac == NULL) {
-                fprintf(stderr, "Error opening fifo %s\n", FIFO_NAME_AAC);
-                return -6;
-            }
+        if (pthread_create(&outputs[i].thread, NULL, output_thread, &outputs[i])) {
+            fprintf(stderr, "Error creating thread\n");
+            return -6;
         }
-
-        fprintf(stderr, "fifo started\n");
+        pthread_detach(outputs[i].thread);
     }
+    if (fifo) fprintf(stderr, "fifo started\n");
+    if ((socket_name != NULL) && (socket_open(socket_name) != 0)) return -6;
 
 #ifdef USE_SEMAPHORE
-    sem_write_lock();
+    fshare_sem_write_lock(&ring);
 #endif
 
+    // Use the layout detected by a previous process if it matches the ring
+    if ((fshare_layout_load(&ring, NULL) == 0) && (debug)) fprintf(stderr, "layout loaded from %s\n", FSHARE_LAYOUT_FILE);
+
     // Autodetect offset if not defined
-    if (buf_offset == FRAME_OFFSET_AUTODETECT) {
-        memcpy(&i, addr + FRAME_OFFSET_TRY_1, sizeof(i));
-        if (i != 0)
-            buf_offset = FRAME_OFFSET_TRY_1;
-        else
-            buf_offset = FRAME_OFFSET_TRY_2;
-    }
+    fshare_detect_offset(&ring);
 
-    memcpy(&i, addr + 16, sizeof(i));
-    buf_idx = addr + buf_offset + i;
-    buf_idx_cur = buf_idx;
-    memcpy(&i, addr + 4, sizeof(i));
-    buf_idx_end = buf_idx + i;
-    if (buf_idx_end >= addr + buf_size) buf_idx_end -= (buf_size - buf_offset);
+    while (fshare_read_index(&ring, NULL, &buf_idx_end) != 0) {
+        usleep(1000);
+    }
     buf_idx_end_prev = buf_idx_end;
 #ifdef USE_SEMAPHORE
-    sem_write_unlock();
+    fshare_sem_write_unlock();
 #endif
     last_counter = 0;
 
     // Autodetect header size if not defined
-    if ((frame_header_size == FRAME_HEADER_SIZE_AUTODETECT) && (debug)) fprintf(stderr, "detecting frame header size\n");
-    while (frame_header_size == FRAME_HEADER_SIZE_AUTODETECT) {
-        header_a2 = (unsigned char *) memmem(addr + buf_offset, buf_size - buf_offset, PPS4_START, sizeof(PPS4_START));
-        if ((header_a2 != NULL) && (header_a2 - 40 > addr + buf_offset)) {
-            header_a1 = cb_move(header_a2, -40);
-            header_a1 = (unsigned char *) memmem(header_a1, 40, PPS4_HEADER, sizeof(PPS4_HEADER));
-            if (header_a1 != NULL) {
-                frame_header_size = header_a2 - header_a1;
-                if (frame_header_size < 0)
-                        frame_header_size += (buf_size - buf_offset);
-                if ((frame_header_size < 0) && (frame_header_size > 40))
-                    frame_header_size = FRAME_HEADER_SIZE_AUTODETECT;
-            }
-        }
+    if ((ring.header_size == FRAME_HEADER_SIZE_AUTODETECT) && (debug)) fprintf(stderr, "detecting frame header size\n");
+    while (fshare_detect_header_size(&ring) == FRAME_HEADER_SIZE_AUTODETECT) {
         usleep(1000);
     }
-    if (debug) fprintf(stderr, "frame header size = %d\n", frame_header_size);
+    if (debug) fprintf(stderr, "frame header size = %d\n", ring.header_size);
+    fshare_layout_save(&ring, NULL);
 
     if (debug) fprintf(stderr, "starting capture main loop\n");
 
+    fshare_resync_init(&resync_low, 1);
+    fshare_resync_init(&resync_high, 1);
+    fshare_resync_init(&resync_audio, 0);
+    if (fshare_scan_init(&scan, &ring) != 0) {
+        fshare_close(&ring);
+        return -7;
+    }
+
+    // Wait for new frames predicting their arrival
+    fshare_wait_init(&wait, &ring);
+
     // Infinite loop
     while (1) {
 #ifdef USE_SEMAPHORE
-        sem_write_lock();
+        fshare_sem_write_lock(&ring);
+#endif
+        if (fshare_read_index(&ring, &buf_idx_start, &buf_idx_end) != 0) {
+#ifdef USE_SEMAPHORE
+            fshare_sem_write_unlock();
 #endif
-        memcpy(&i, addr + 16, sizeof(i));
-        buf_idx = addr + buf_offset + i;
-        memcpy(&i, addr + 4, sizeof(i));
-        buf_idx_end = buf_idx + i;
-        if (buf_idx_end >= addr + buf_size) buf_idx_end -= (buf_size - buf_offset);
-        // Check if the header is ok
-        memcpy(&i, addr + 12, sizeof(i));
-        if (buf_idx_end != addr + buf_offset + i) {
             usleep(1000);
             continue;
         }
 
         if (buf_idx_end == buf_idx_end_prev) {
 #ifdef USE_SEMAPHORE
-            sem_write_unlock();
+            fshare_sem_write_unlock();
 #endif
-            usleep(10000);
+            fshare_wait_next(&wait, 0);
             continue;
         }
 
-        buf_idx_cur = buf_idx_end_prev;
-        frame_sync = 1;
-        i = 0;
-
-        while (buf_idx_cur != buf_idx_end) {
-            cb2s_headercpy((unsigned char *) &fhs[i], buf_idx_cur, frame_header_size);
-            // Check the len
-            if (fhs[i].len > buf_size - buf_offset - frame_header_size) {
-                frame_sync = 0;
-                break;
-            }
-            fhs_addr[i] = buf_idx_cur;
-            buf_idx_cur = cb_move(buf_idx_cur, fhs[i].len + frame_header_size);
-            i++;
-            // Check if the sync is lost
-            if (i == 10) {
-                frame_sync = 0;
-                break;
-            }
-        }
+        // All the frames written since the last time, however many
+        n = fshare_scan_frames(&scan, buf_idx_end_prev, buf_idx_start, buf_idx_end);
+        buf_idx_end_prev = scan.next;
 
 #ifdef USE_SEMAPHORE
-        sem_write_unlock();
+        fshare_sem_write_unlock();
 #endif
 
-        if (frame_sync == 0) {
-            buf_idx_end_prev = buf_idx_end;
-            usleep(10000);
+        if (n < 0) {
+            fprintf(stderr, "%lld: warning - sync lost\n", current_timestamp());
+            fshare_resync_lost(&resync_low);
+            fshare_resync_lost(&resync_high);
+            fshare_resync_lost(&resync_audio);
+            // Unknown amount written, assume the spliced pages are gone
+            ring_mark += ring.size - ring.offset;
+            fshare_wait_next(&wait, 0);
             continue;
         }
-
-        n = i;
-        // Ignore last frame, it could be corrupted
-        if (n > 1) {
-            buf_idx_end_prev = fhs_addr[n - 1];
-            n--;
-        } else {
-            usleep(10000);
+        if (n == 0) {
+            fshare_wait_next(&wait, 0);
             continue;
         }
+        fhs = scan.frames;
 
-        if (n > 0) {
-            if (fhs[0].counter != last_counter + 1) {
-                fprintf(stderr, "%lld: warning - %d frame(s) lost\n",
-                            current_timestamp(), fhs[0].counter - (last_counter + 1));
-            }
-            last_counter = fhs[n - 1].counter;
+        if (fhs[0].counter != last_counter + 1) {
+            fprintf(stderr, "%lld: warning - %d frame(s) lost\n",
+                        current_timestamp(), fhs[0].counter - (last_counter + 1));
         }
+        last_counter = fhs[n - 1].counter;
 
         for (i = 0; i < n; i++) {
-            buf_idx_cur = fhs_addr[i];
-            frame_len = fhs[i].len;
-            // If SPS
-            if (fhs[i].type & 0x0002) {
-                buf_idx_cur = cb_move(buf_idx_cur, frame_header_size + 6);
-                frame_len -= 6;
+            ring_mark += ring.header_size + fhs[i].len;
+
+            // If SPS skip the FPS, width and height prefix
+            if (fhs[i].type & FSHARE_TYPE_SPS) {
+                fshare_frame_span(&ring, &fhs[i], FSHARE_SPS_PREFIX_SIZE, &span);
 
                 // Autodetect stream type (only the 1st time)
-                if ((stream_type.codec_low  == CODEC_NONE) && (fhs[i].type & 0x0800)) {
-                    if (cb_memcmp(SPS4_640X360, buf_idx_cur, sizeof(SPS4_640X360)) == 0) {
-                        stream_type.codec_low = CODEC_H264;
-                        stream_type.sps_type_low = 0x0101;
-                    } else if (cb_memcmp(SPS4_2_640X360, buf_idx_cur, sizeof(SPS4_2_640X360)) == 0) {
-                        stream_type.codec_low = CODEC_H264;
-                        stream_type.sps_type_low = 0x0201;
-                    } else if (cb_memcmp(SPS4_3_640X360, buf_idx_cur, sizeof(SPS4_3_640X360)) == 0) {
-                        stream_type.codec_low = CODEC_H264;
-                        stream_type.sps_type_low = 0x0401;
-                    } else if (cb_memcmp(SPS4_START, buf_idx_cur, sizeof(SPS4_START)) == 0) {
-                        stream_type.codec_low = CODEC_H264;
-                        stream_type.sps_type_low = 0x0000;
-                    } else if (cb_memcmp(SPS5_START, buf_idx_cur, sizeof(SPS5_START)) == 0) {
-                        stream_type.codec_low = CODEC_H265;
-                        stream_type.sps_type_low = 0x0000;
-                    }
-                    if ((debug) && (stream_type.codec_low != CODEC_NONE)) fprintf(stderr, "%lld: low - codec type is %d - sps type is %d\n",
-                            current_timestamp(), stream_type.codec_low, stream_type.sps_type_low);
-                } else if ((stream_type.codec_high  == CODEC_NONE) && (fhs[i].type & 0x0400)) {
-                    if (cb_memcmp(SPS4_1920X1080, buf_idx_cur, sizeof(SPS4_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0102;
-                    } else if (cb_memcmp(SPS4_2304X1296, buf_idx_cur, sizeof(SPS4_2304X1296)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0103;
-                    } else if (cb_memcmp(SPS4_2_1920X1080, buf_idx_cur, sizeof(SPS4_2_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0202;
-                    } else if (cb_memcmp(SPS4_2_2304X1296, buf_idx_cur, sizeof(SPS4_2_2304X1296)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0203;
-                    } else if (cb_memcmp(SPS4_3_1920X1080, buf_idx_cur, sizeof(SPS4_3_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0402;
-                    } else if (cb_memcmp(SPS4_3_2304X1296, buf_idx_cur, sizeof(SPS4_3_2304X1296)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0403;
-                    } else if (cb_memcmp(SPS5_1920X1080, buf_idx_cur, sizeof(SPS5_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H265;
-                        stream_type.sps_type_high = 0x0802;
-                    } else if (cb_memcmp(SPS5_2_1920X1080, buf_idx_cur, sizeof(SPS5_2_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H265;
-                        stream_type.sps_type_high = 0x1002;
-                    } else if (cb_memcmp(SPS5_3_2304X1296, buf_idx_cur, sizeof(SPS5_3_2304X1296)) == 0) {
-                        stream_type.codec_high = CODEC_H265;
-                        stream_type.sps_type_high = 0x2003;
-                    } else if (cb_memcmp(SPS4_START, buf_idx_cur, sizeof(SPS4_START)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0000;
-                    } else if (cb_memcmp(SPS5_START, buf_idx_cur, sizeof(SPS5_START)) == 0) {
-                        stream_type.codec_high = CODEC_H265;
-                        stream_type.sps_type_high = 0x0000;
-                    }
-                    if ((debug) && (stream_type.codec_high != CODEC_NONE)) fprintf(stderr, "%lld: high - codec type is %d - sps type is %d\n",
-                            current_timestamp(), stream_type.codec_high, stream_type.sps_type_high);
-                }
+                ret = fshare_stream_detect(&ring, &fhs[i], &stream_type);
+                if ((debug) && (ret == FSHARE_TYPE_LOW)) fprintf(stderr, "%lld: low - codec type is %d\n",
+                        current_timestamp(), stream_type.codec_low);
+                if ((debug) && (ret == FSHARE_TYPE_HIGH)) fprintf(stderr, "%lld: high - codec type is %d\n",
+                        current_timestamp(), stream_type.codec_high);
             } else {
-                buf_idx_cur = cb_move(buf_idx_cur, frame_header_size);
+                fshare_frame_span(&ring, &fhs[i], 0, &span);
             }
+            frame_len = span.len[0] + span.len[1];
 
             write_enable = 1;
             frame_counter = fhs[i].stream_counter;
-            if (fhs[i].type & 0x0800) {
+            if (fhs[i].type & FSHARE_TYPE_LOW) {
                 frame_type = TYPE_LOW;
-            } else if (fhs[i].type & 0x0400) {
+            } else if (fhs[i].type & FSHARE_TYPE_HIGH) {
                 frame_type = TYPE_HIGH;
-            } else if (fhs[i].type & 0x0100) {
+            } else if (fhs[i].type & FSHARE_TYPE_AAC) {
                 frame_type = TYPE_AAC;
             } else {
                 frame_type = TYPE_NONE;
             }
+            // Measure the frame rate of the video streams
+            if (sps_timing_info) {
+                if (frame_type == TYPE_LOW) fshare_timing_update(&timing_low, &fhs[i]);
+                else if (frame_type == TYPE_HIGH) fshare_timing_update(&timing_high, &fhs[i]);
+            }
             if ((frame_type == TYPE_LOW) && ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH))) {
-                if ((65536 + frame_counter - frame_counter_last_valid_low) % 65536 > 1) {
-
-                    if (debug) fprintf(stderr, "%lld: warning - %d low res frame(s) lost - frame_counter: %d - frame_counter_last_valid: %d\n",
-                                current_timestamp(), (65536 + frame_counter - frame_counter_last_valid_low - 1) % 65536, frame_counter, frame_counter_last_valid_low);
-                    frame_counter_last_valid_low = frame_counter;
-                } else {
-                    if (debug) {
-                        if (fhs[i].type & 0x0002) {
-                            fprintf(stderr, "%lld: SPS   detected - frame_len: %d - frame_counter: %d - frame_counter_last_valid: %d - resolution: %d\n",
-                                    current_timestamp(), frame_len, frame_counter,
-                                    frame_counter_last_valid_low, frame_type);
-                        } else {
-                            fprintf(stderr, "%lld: frame detected - frame_len: %d - frame_counter: %d - frame_counter_last_valid: %d - resolution: %d\n",
-                                    current_timestamp(), frame_len, frame_counter,
-                                    frame_counter_last_valid_low, frame_type);
-                        }
+                write_enable = fshare_resync_check(&resync_low, &fhs[i]);
+                if ((debug) && (resync_low.gap > 0)) {
+                    fprintf(stderr, "%lld: warning - %d low res frame(s) lost - frame_counter: %d\n",
+                            current_timestamp(), resync_low.gap, frame_counter);
+                }
+                if (!write_enable) {
+                    if (debug) fprintf(stderr, "%lld: low res frame dropped, waiting for IDR - frame_len: %d - frame_counter: %d\n",
+                            current_timestamp(), frame_len, frame_counter);
+                } else if (debug) {
+                    if (fhs[i].type & FSHARE_TYPE_SPS) {
+                        fprintf(stderr, "%lld: SPS detected - frame_len: %d - frame_counter: %d - resolution: %d\n",
+                                current_timestamp(), frame_len, frame_counter, frame_type);
+                    } else {
+                        fprintf(stderr, "%lld: frame detected - frame_len: %d - frame_counter: %d - resolution: %d\n",
+                                current_timestamp(), frame_len, frame_counter, frame_type);
                     }
-                    frame_counter_last_valid_low = frame_counter;
                 }
-
-                buf_idx_start = buf_idx_cur;
             } else if ((frame_type == TYPE_HIGH) && ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH))) {
-                if ((65536 + frame_counter - frame_counter_last_valid_high) % 65536 > 1) {
-
-                    if (debug) fprintf(stderr, "%lld: warning - %d high res frame(s) lost - frame_counter: %d - frame_counter_last_valid: %d\n",
-                                current_timestamp(), (65536 + frame_counter - frame_counter_last_valid_high - 1) % 65536, frame_counter, frame_counter_last_valid_high);
-                    frame_counter_last_valid_high = frame_counter;
-                } else {
-                    if (debug) {
-                        if (fhs[i].type & 0x0002) {
-                            fprintf(stderr, "%lld: SPS   detected - frame_len: %d - frame_counter: %d - frame_counter_last_valid: %d - resolution: %d\n",
-                                    current_timestamp(), frame_len, frame_counter,
-                                    frame_counter_last_valid_high, frame_type);
-                        } else {
-                            fprintf(stderr, "%lld: frame detected - frame_len: %d - frame_counter: %d - frame_counter_last_valid: %d - resolution: %d\n",
-                                    current_timestamp(), frame_len, frame_counter,
-                                    frame_counter_last_valid_high, frame_type);
-                        }
+                write_enable = fshare_resync_check(&resync_high, &fhs[i]);
+                if ((debug) && (resync_high.gap > 0)) {
+                    fprintf(stderr, "%lld: warning - %d high res frame(s) lost - frame_counter: %d\n",
+                            current_timestamp(), resync_high.gap, frame_counter);
+                }
+                if (!write_enable) {
+                    if (debug) fprintf(stderr, "%lld: high res frame dropped, waiting for IDR - frame_len: %d - frame_counter: %d\n",
+                            current_timestamp(), frame_len, frame_counter);
+                } else if (debug) {
+                    if (fhs[i].type & FSHARE_TYPE_SPS) {
+                        fprintf(stderr, "%lld: SPS detected - frame_len: %d - frame_counter: %d - resolution: %d\n",
+                                current_timestamp(), frame_len, frame_counter, frame_type);
+                    } else {
+                        fprintf(stderr, "%lld: frame detected - frame_len: %d - frame_counter: %d - resolution: %d\n",
+                                current_timestamp(), frame_len, frame_counter, frame_type);
                     }
-                    frame_counter_last_valid_high = frame_counter;
                 }
-
-                buf_idx_start = buf_idx_cur;
             } else if ((frame_type == TYPE_AAC) && (audio == 1)) {
-                if ((65536 + frame_counter - frame_counter_last_valid_audio) % 65536 > 1) {
-                    if (debug) fprintf(stderr, "%lld: warning - %d AAC frame(s) lost - frame_counter: %d - frame_counter_last_valid: %d\n",
-                                current_timestamp(), (65536 + frame_counter - frame_counter_last_valid_audio - 1) % 65536, frame_counter, frame_counter_last_valid_audio);
-                    frame_counter_last_valid_audio = frame_counter;
-                } else {
-                    if (debug) fprintf(stderr, "%lld: frame detected - frame_len: %d - frame_counter: %d - audio AAC\n",
-                                current_timestamp(), frame_len, fhs[i].stream_counter);
-
-                    frame_counter_last_valid_audio = frame_counter;
+                write_enable = fshare_resync_check(&resync_audio, &fhs[i]);
+                if ((debug) && (resync_audio.gap > 0)) {
+                    fprintf(stderr, "%lld: warning - %d AAC frame(s) lost - frame_counter: %d\n",
+                            current_timestamp(), resync_audio.gap, frame_counter);
                 }
-                buf_idx_start = buf_idx_cur;
+                if (debug) fprintf(stderr, "%lld: frame detected - frame_len: %d - frame_counter: %d - audio AAC\n",
+                            current_timestamp(), frame_len, frame_counter);
             } else {
                 write_enable = 0;
             }
 
-            // Send the frame to the ouput buffer
+            // Send the frame to the ouput buffers
             if (write_enable) {
-                if ((frame_type == TYPE_LOW) && ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH)) && (stream_type.codec_low != CODEC_NONE)) {
-                    fOut = fOutLow;
-                } else if ((frame_type == TYPE_HIGH) && ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH)) && (stream_type.codec_high != CODEC_NONE)) {
-                    fOut = fOutHigh;
-                } else if ((frame_type == TYPE_AAC) && (audio == 1)) {
-                    fOut = fOutAac;
+                if ((frame_type == TYPE_LOW) && (stream_type.codec_low == CODEC_NONE)) {
+                    write_enable = 0;
+                } else if ((frame_type == TYPE_HIGH) && (stream_type.codec_high == CODEC_NONE)) {
+                    write_enable = 0;
+                }
+            }
+            if (write_enable) {
+                // Overwrite SPS/VPS with one that contains the timing info of the measured frame rate
+                sps = NULL;
+                if ((sps_timing_info) && (frame_type == TYPE_LOW)) {
+                    sps = fshare_timing_nal(&timing_low, stream_type.codec_low, &fhs[i], &span, &sps_len);
+                } else if ((sps_timing_info) && (frame_type == TYPE_HIGH)) {
+                    sps = fshare_timing_nal(&timing_high, stream_type.codec_high, &fhs[i], &span, &sps_len);
+                }
+                if (sps != NULL) {
+                    sps_span.ptr[0] = sps;
+                    sps_span.len[0] = sps_len;
+                    sps_span.ptr[1] = NULL;
+                    sps_span.len[1] = 0;
+                }
+
+                // A dropping output restarts from the first parameter set of a GOP
+                if (frame_type == TYPE_AAC) {
+                    key = 1;
+                } else if (fhs[i].type & FSHARE_TYPE_VPS) {
+                    key = 1;
+                } else if (fhs[i].type & FSHARE_TYPE_SPS) {
+                    key = (((frame_type == TYPE_LOW) ? stream_type.codec_low : stream_type.codec_high) == CODEC_H264);
                 } else {
-                    fOut = NULL;
+                    key = 0;
                 }
-                if (fOut != NULL) {
-                    if (sps_timing_info) {
-                        // Overwrite SPS or VPS with one that contains timing info at 20 fps
-                        if (fhs[i].type & 0x0002) {
-                            if (frame_type == TYPE_LOW) {
-                                if (stream_type.sps_type_low & 0x0101) {
-                                    fwrite(SPS4_640X360_TI, 1, sizeof(SPS4_640X360_TI), fOut);
-                                } else if (stream_type.sps_type_low & 0x0201) {
-                                    fwrite(SPS4_2_640X360_TI, 1, sizeof(SPS4_2_640X360_TI), fOut);
-                                } else if (stream_type.sps_type_low & 0x0401) {
-                                    fwrite(SPS4_3_640X360_TI, 1, sizeof(SPS4_3_640X360_TI), fOut);
-                                } else {
-                                    if (buf_idx_start + frame_len > addr + buf_size) {
-                                        fwrite(buf_idx_start, 1, addr + buf_size - buf_idx_start, fOut);
-                                        fwrite(addr + buf_offset, 1, frame_len - (addr + buf_size - buf_idx_start), fOut);
-                                    } else {
-                                        fwrite(buf_idx_start, 1, frame_len, fOut);
-                                    }
-                                }
-                            } else if (frame_type == TYPE_HIGH) {
-                                if (stream_type.sps_type_high == 0x0102) {
-                                    fwrite(SPS4_1920X1080_TI, 1, sizeof(SPS4_1920X1080_TI), fOut);
-                                } else if (stream_type.sps_type_high == 0x0202) {
-                                    fwrite(SPS4_2_1920X1080_TI, 1, sizeof(SPS4_2_1920X1080_TI), fOut);
-                                } else if (stream_type.sps_type_high == 0x0402) {
-                                    fwrite(SPS4_3_1920X1080_TI, 1, sizeof(SPS4_3_1920X1080_TI), fOut);
-                                } else if (stream_type.sps_type_high == 0x0103) {
-                                    fwrite(SPS4_2304X1296_TI, 1, sizeof(SPS4_2304X1296_TI), fOut);
-                                } else if (stream_type.sps_type_high == 0x0203) {
-                                    fwrite(SPS4_2_2304X1296_TI, 1, sizeof(SPS4_2_2304X1296_TI), fOut);
-                                } else if (stream_type.sps_type_high == 0x0403) {
-                                    fwrite(SPS4_3_2304X1296_TI, 1, sizeof(SPS4_3_2304X1296_TI), fOut);
-/*                                } else if (stream_type.sps_type_high == 0x0802) {
-                                    fwrite(SPS5_1920X1080_TI, 1, sizeof(SPS5_1920X1080_TI), fOut);
-                                } else if (stream_type.sps_type_high == 0x1002) {
-                                    fwrite(SPS5_2_1920X1080_TI, 1, sizeof(SPS5_2_1920X1080_TI), fOut);
-                                } else if (stream_type.sps_type_high == 0x2003) {
-                                    fwrite(SPS5_3_2304X1296_TI, 1, sizeof(SPS5_3_2304X1296_TI), fOut); */
-                                } else {
-                                    if (buf_idx_start + frame_len > addr + buf_size) {
-                                        fwrite(buf_idx_start, 1, addr + buf_size - buf_idx_start, fOut);
-                                        fwrite(addr + buf_offset, 1, frame_len - (addr + buf_size - buf_idx_start), fOut);
-                                    } else {
-                                        fwrite(buf_idx_start, 1, frame_len, fOut);
-                                    }
-                                }
-                            } else {
-                                if (buf_idx_start + frame_len > addr + buf_size) {
-                                    fwrite(buf_idx_start, 1, addr + buf_size - buf_idx_start, fOut);
-                                    fwrite(addr + buf_offset, 1, frame_len - (addr + buf_size - buf_idx_start), fOut);
-                                } else {
-                                    fwrite(buf_idx_start, 1, frame_len, fOut);
-                                }
-                            }
-                        } else if (fhs[i].type & 0x0008) {
-                            if (frame_type == TYPE_LOW) {
-                                if (buf_idx_start + frame_len > addr + buf_size) {
-                                    fwrite(buf_idx_start, 1, addr + buf_size - buf_idx_start, fOut);
-                                    fwrite(addr + buf_offset, 1, frame_len - (addr + buf_size - buf_idx_start), fOut);
-                                } else {
-                                    fwrite(buf_idx_start, 1, frame_len, fOut);
-                                }
-                            } else if (frame_type == TYPE_HIGH) {
-/*                                if (stream_type.vps_type_high == 0x0102) {
-                                    fwrite(VPS5_1920X1080_TI, 1, sizeof(VPS5_1920X1080_TI), fOut);
-                                } else if (stream_type.vps_type_high == 0x0202) {
-                                    fwrite(VPS5_2_1920X1080_TI, 1, sizeof(VPS5_2_1920X1080_TI), fOut);
-                                } else { */
-                                    if (buf_idx_start + frame_len > addr + buf_size) {
-                                        fwrite(buf_idx_start, 1, addr + buf_size - buf_idx_start, fOut);
-                                        fwrite(addr + buf_offset, 1, frame_len - (addr + buf_size - buf_idx_start), fOut);
-                                    } else {
-                                        fwrite(buf_idx_start, 1, frame_len, fOut);
-                                    }
-/*                                } */
-                            } else {
-                                if (buf_idx_start + frame_len > addr + buf_size) {
-                                    fwrite(buf_idx_start, 1, addr + buf_size - buf_idx_start, fOut);
-                                    fwrite(addr + buf_offset, 1, frame_len - (addr + buf_size - buf_idx_start), fOut);
-                                } else {
-                                    fwrite(buf_idx_start, 1, frame_len, fOut);
-                                }
-                            }
-                        } else {
-                            if (buf_idx_start + frame_len > addr + buf_size) {
-                                fwrite(buf_idx_start, 1, addr + buf_size - buf_idx_start, fOut);
-                                fwrite(addr + buf_offset, 1, frame_len - (addr + buf_size - buf_idx_start), fOut);
-                            } else {
-                                fwrite(buf_idx_start, 1, frame_len, fOut);
-                            }
-                        }
+
+                for (j = 0; j < noutputs; j++) {
+                    if (outputs[j].type != frame_type) continue;
+                    if (sps != NULL) {
+                        output_put(&outputs[j], &sps_span, key, 0);
                     } else {
-                        if (buf_idx_start + frame_len > addr + buf_size) {
-                            fwrite(buf_idx_start, 1, addr + buf_size - buf_idx_start, fOut);
-                            fwrite(addr + buf_offset, 1, frame_len - (addr + buf_size - buf_idx_start), fOut);
-                        } else {
-                            fwrite(buf_idx_start, 1, frame_len, fOut);
-                        }
+                        output_put(&outputs[j], &span, key, 1);
                     }
-                    if (debug) fprintf(stderr, "%lld: writing frame, length %d\n", current_timestamp(), frame_len);
                 }
+
+                // Clients of the socket, and the history for the next ones
+                if (socket_name != NULL) {
+                    msg_stream = (frame_type == TYPE_LOW) ? GRABBER_STREAM_LOW :
+                            ((frame_type == TYPE_HIGH) ? GRABBER_STREAM_HIGH : GRABBER_STREAM_AAC);
+                    socket_send(NULL, &fhs[i], msg_stream, (sps != NULL) ? &sps_span : &span, key);
+                    history_add(&fhs[i], msg_stream, key);
+                }
+
+                // MPEG-TS outputs get the frame through their muxer
+                if ((frame_type == TYPE_LOW) && (ts_low)) {
+                    ts_send(&mux_low, TYPE_TS_LOW, tsmux_video(&mux_low, stream_type.codec_low,
+                            (sps != NULL) ? &sps_span : &span, fhs[i].type, fhs[i].time));
+                } else if ((frame_type == TYPE_HIGH) && (ts_high)) {
+                    ts_send(&mux_high, TYPE_TS_HIGH, tsmux_video(&mux_high, stream_type.codec_high,
+                            (sps != NULL) ? &sps_span : &span, fhs[i].type, fhs[i].time));
+                } else if (frame_type == TYPE_AAC) {
+                    if (ts_low) ts_send(&mux_low, TYPE_TS_LOW, tsmux_audio(&mux_low, &span, fhs[i].time));
+                    if (ts_high) ts_send(&mux_high, TYPE_TS_HIGH, tsmux_audio(&mux_high, &span, fhs[i].time));
+                }
+                if (debug) fprintf(stderr, "%lld: writing frame, length %d\n", current_timestamp(), frame_len);
             }
         }
 
-        usleep(25000);
+        if (socket_name != NULL) {
+            socket_reap();
+            socket_accept();
+        }
+
+        // Stop when every output has been closed by its reader
+        open_outputs = (socket_name != NULL);
+        for (j = 0; j < noutputs; j++) {
+            if (outputs[j].type == TYPE_NONE) continue;
+            if (outputs[j].zerocopy) output_guard(&outputs[j], (ring.size - ring.offset) / 2);
+            pthread_mutex_lock(&outputs[j].mutex);
+            if (!outputs[j].closed) open_outputs++;
+            pthread_mutex_unlock(&outputs[j].mutex);
+        }
+        if (open_outputs == 0) {
+            fprintf(stderr, "all outputs closed, exiting\n");
+            break;
+        }
+
+        if (debug) {
+            fshare_wait_stats(&wait, "h264grabber", 0);
+            if (fshare_scan_stats(&scan, "h264grabber", 0)) {
+                fshare_resync_stats(&resync_low, "h264grabber low");
+                fshare_resync_stats(&resync_high, "h264grabber high");
+                fshare_resync_stats(&resync_audio, "h264grabber audio");
+                for (j = 0; j < noutputs; j++) {
+                    if (outputs[j].type != TYPE_NONE) output_stats(&outputs[j]);
+                }
+            }
+        }
+        fshare_wait_next(&wait, 0);
     }
 
-    // Unreacheable path
+    fshare_wait_close(&wait);
+    fshare_scan_free(&scan);
 
     // Unmap file from memory
-    if (munmap(addr, buf_size) == -1) {
-        if (debug) fprintf(stderr, "error - unmapping file");
-    } else {
-        if (debug) fprintf(stderr, "unmapping file %s, size %d, from %08x\n", BUFFER_FILE, buf_size, (unsigned int) addr);
-    }
+    if (debug) fprintf(stderr, "unmapping file %s, size %d, from %08x\n", BUFFER_FILE, ring.size, (unsigned int) ring.addr);
+    fshare_close(&ring);
 
 #ifdef USE_SEMAPHORE
-    sem_fshare_close();
+    fshare_sem_close();
 #endif
 
-    if (fifo == 0) {
-        free(stdoutbuf);
-    } else {
-        if ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH)) {
-            fclose(fOutLow);
-            unlink(FIFO_NAME_LOW);
-        }
-        if ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH)) {
-            fclose(fOutHigh);
-            unlink(FIFO_NAME_HIGH);
-        }
-
-        if (audio == 1) {
-            fclose(fOutAac);
-            unlink(FIFO_NAME_AAC);
-        }
+    // Regular files and fifos made by the user stay
+    for (i = 0; i < noutputs; i++) {
+        if (outputs[i].created) unlink(outputs[i].name);
+    }
+    if (socket_name != NULL) {
+        close(socket_fd);
+        unlink(socket_name);
     }
+    if (ts_low) tsmux_free(&mux_low);
+    if (ts_high) tsmux_free(&mux_high);
 
     return 0;
 }
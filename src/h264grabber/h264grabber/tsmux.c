@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal MPEG-TS muxer.
+ * Every frame of the ring becomes a PES: parameter sets are held back and
+ * sent in front of the picture they belong to, with an access unit
+ * delimiter, so that a PES is always a whole access unit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsmux.h"
+
+#define TS_STREAM_TYPE_H264 0x1B
+#define TS_STREAM_TYPE_H265 0x24
+#define TS_STREAM_TYPE_AAC  0x0F            // ADTS
+
+#define TS_PES_HEADER_SIZE 14               // with PTS
+#define TS_PES_MAX_IOV 4
+
+static unsigned char AUD_H264[] = {0x00, 0x00, 0x00, 0x01, 0x09, 0xF0};
+static unsigned char AUD_H265[] = {0x00, 0x00, 0x00, 0x01, 0x46, 0x01, 0x50};
+
+typedef struct
+{
+    unsigned char *ptr;
+    unsigned int len;
+} ts_chunk;
+
+static uint32_t ts_crc32(unsigned char *data, int len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    int i;
+
+    while (len-- > 0) {
+        crc ^= (uint32_t) *data++ << 24;
+        for (i = 0; i < 8; i++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+// 90 kHz ticks from the frame time, 33 bits
+static uint64_t ts_time(tsmux *m, uint32_t time)
+{
+    return ((uint64_t) (uint32_t) (time - m->base_time) * 90) & 0x1FFFFFFFFULL;
+}
+
+static int ts_reserve(tsmux *m, unsigned int len)
+{
+    unsigned char *buf;
+    unsigned int size;
+
+    if (m->len + len <= m->size) return 0;
+
+    size = m->size * 2;
+    if (size < m->len + len) size = m->len + len;
+    buf = realloc(m->buf, size);
+    if (buf == NULL) {
+        fprintf(stderr, "Unable to allocate TS buffer\n");
+        return -1;
+    }
+    m->buf = buf;
+    m->size = size;
+
+    return 0;
+}
+
+static unsigned char *ts_header(tsmux *m, int pid, int pusi, int af, unsigned int *cc)
+{
+    unsigned char *p = m->buf + m->len;
+
+    p[0] = 0x47;
+    p[1] = (pusi ? 0x40 : 0x00) | ((pid >> 8) & 0x1F);
+    p[2] = pid & 0xFF;
+    p[3] = (af ? 0x30 : 0x10) | (*cc & 0x0F);
+    *cc = (*cc + 1) & 0x0F;
+    m->len += TS_PACKET_SIZE;
+
+    return p;
+}
+
+// A PSI section in a single packet
+static void ts_section(tsmux *m, int pid, unsigned int *cc, unsigned char *section, int len)
+{
+    unsigned char *p;
+    uint32_t crc;
+
+    p = ts_header(m, pid, 1, 0, cc);
+    p[4] = 0x00;                            // pointer field
+    memcpy(p + 5, section, len);
+    crc = ts_crc32(section, len);
+    p[5 + len] = crc >> 24;
+    p[6 + len] = crc >> 16;
+    p[7 + len] = crc >> 8;
+    p[8 + len] = crc;
+    memset(p + 9 + len, 0xFF, TS_PACKET_SIZE - 9 - len);
+}
+
+static void ts_psi(tsmux *m, uint32_t time)
+{
+    unsigned char s[32];
+    int n;
+
+    // PAT: program 1 -> PMT
+    s[0] = 0x00;
+    s[1] = 0xB0;
+    s[2] = 13;
+    s[3] = 0x00;
+    s[4] = 0x01;                            // transport stream id
+    s[5] = 0xC1;                            // version 0, current
+    s[6] = 0x00;
+    s[7] = 0x00;
+    s[8] = 0x00;
+    s[9] = 0x01;
+    s[10] = 0xE0 | (TS_PID_PMT >> 8);
+    s[11] = TS_PID_PMT & 0xFF;
+    ts_section(m, 0x0000, &m->cc_pat, s, 12);
+
+    // PMT: video (PCR) and audio
+    s[0] = 0x02;
+    s[1] = 0xB0;
+    s[2] = 23;
+    s[3] = 0x00;
+    s[4] = 0x01;                            // program number
+    s[5] = 0xC1;
+    s[6] = 0x00;
+    s[7] = 0x00;
+    s[8] = 0xE0 | (TS_PID_VIDEO >> 8);
+    s[9] = TS_PID_VIDEO & 0xFF;
+    s[10] = 0xF0;
+    s[11] = 0x00;
+    n = 12;
+    s[n++] = (m->codec == CODEC_H265) ? TS_STREAM_TYPE_H265 : TS_STREAM_TYPE_H264;
+    s[n++] = 0xE0 | (TS_PID_VIDEO >> 8);
+    s[n++] = TS_PID_VIDEO & 0xFF;
+    s[n++] = 0xF0;
+    s[n++] = 0x00;
+    s[n++] = TS_STREAM_TYPE_AAC;
+    s[n++] = 0xE0 | (TS_PID_AUDIO >> 8);
+    s[n++] = TS_PID_AUDIO & 0xFF;
+    s[n++] = 0xF0;
+    s[n++] = 0x00;
+    ts_section(m, TS_PID_PMT, &m->cc_pmt, s, n);
+
+    m->psi_time = time;
+}
+
+static void ts_pes_header(unsigned char *h, int stream_id, unsigned int payload, uint64_t pts)
+{
+    unsigned int len;
+
+    h[0] = 0x00;
+    h[1] = 0x00;
+    h[2] = 0x01;
+    h[3] = stream_id;
+    // Unbounded for video, it can be longer than 64k
+    len = (stream_id == 0xE0) ? 0 : payload + TS_PES_HEADER_SIZE - 6;
+    if (len > 0xFFFF) len = 0;
+    h[4] = len >> 8;
+    h[5] = len;
+    h[6] = 0x80;
+    h[7] = 0x80;                            // PTS only
+    h[8] = 5;
+    h[9] = 0x21 | ((pts >> 29) & 0x0E);
+    h[10] = pts >> 22;
+    h[11] = ((pts >> 14) & 0xFE) | 0x01;
+    h[12] = pts >> 7;
+    h[13] = ((pts << 1) & 0xFE) | 0x01;
+}
+
+// Split a PES in packets, the first one carries PCR and the random access flag if asked
+static int ts_pes(tsmux *m, int pid, unsigned int *cc, int stream_id, ts_chunk *c, int nc,
+        uint64_t pts, int pcr, uint64_t pcr_base, int rai)
+{
+    unsigned char hdr[TS_PES_HEADER_SIZE];
+    unsigned char *p, *q;
+    unsigned int total, payload, af, n;
+    int i, first;
+
+    payload = 0;
+    for (i = 0; i < nc; i++) payload += c[i].len;
+    ts_pes_header(hdr, stream_id, payload, pts);
+
+    total = TS_PES_HEADER_SIZE + payload;
+    if (ts_reserve(m, (total / (TS_PACKET_SIZE - 12) + 2) * TS_PACKET_SIZE) != 0) return -1;
+
+    // The header is consumed as the first chunk
+    i = -1;
+    q = hdr;
+    n = TS_PES_HEADER_SIZE;
+    first = 1;
+    while (total > 0) {
+        af = 0;
+        if ((first) && ((pcr) || (rai))) af = (pcr) ? 8 : 2;
+        if (total < TS_PACKET_SIZE - 4 - af) {
+            // Stuffing in the adaptation field
+            af = TS_PACKET_SIZE - 4 - total;
+        }
+
+        p = ts_header(m, pid, first, (af > 0), cc);
+        if (af > 0) {
+            p[4] = af - 1;
+            if (af > 1) {
+                p[5] = 0x00;
+                if (first) {
+                    if (rai) p[5] |= 0x40;
+                    if (pcr) {
+                        p[5] |= 0x10;
+                        p[6] = pcr_base >> 25;
+                        p[7] = pcr_base >> 17;
+                        p[8] = pcr_base >> 9;
+                        p[9] = pcr_base >> 1;
+                        p[10] = ((pcr_base & 0x01) << 7) | 0x7E;
+                        p[11] = 0x00;
+                    }
+                }
+                memset(p + 6 + ((first && pcr) ? 6 : 0), 0xFF,
+                        af - 2 - ((first && pcr) ? 6 : 0));
+            }
+        }
+
+        // Payload
+        p += 4 + af;
+        payload = TS_PACKET_SIZE - 4 - af;
+        total -= payload;
+        while (payload > 0) {
+            while (n == 0) {
+                i++;
+                q = c[i].ptr;
+                n = c[i].len;
+            }
+            if (n > payload) {
+                memcpy(p, q, payload);
+                q += payload;
+                n -= payload;
+                break;
+            }
+            memcpy(p, q, n);
+            p += n;
+            payload -= n;
+            n = 0;
+        }
+        first = 0;
+    }
+    m->pes++;
+
+    return 0;
+}
+
+int tsmux_init(tsmux *m)
+{
+    memset(m, 0, sizeof(tsmux));
+    m->size = 64 * TS_PACKET_SIZE;
+    m->buf = malloc(m->size);
+    m->pending_size = 1024;
+    m->pending = malloc(m->pending_size);
+    if ((m->buf == NULL) || (m->pending == NULL)) {
+        fprintf(stderr, "Unable to allocate TS buffer\n");
+        tsmux_free(m);
+        return -1;
+    }
+
+    return 0;
+}
+
+void tsmux_free(tsmux *m)
+{
+    free(m->buf);
+    free(m->pending);
+    m->buf = NULL;
+    m->pending = NULL;
+}
+
+/*
+ * Add a video frame, in span, with its ring type and time.
+ * Return the length of the packets in m->buf, 0 if nothing is ready or -1.
+ */
+int tsmux_video(tsmux *m, int codec, fshare_span *span, uint16_t type, uint32_t time)
+{
+    ts_chunk c[TS_PES_MAX_IOV];
+    unsigned char *pending;
+    unsigned int len;
+    uint64_t pcr;
+    int nc = 0;
+
+    m->len = 0;
+    m->key = 0;
+    len = span->len[0] + span->len[1];
+
+    if (type & (FSHARE_TYPE_VPS | FSHARE_TYPE_SPS | FSHARE_TYPE_PPS)) {
+        // A GOP starts with the VPS (H.265) or the SPS (H.264)
+        if ((!m->started) && ((type & FSHARE_TYPE_VPS) || ((type & FSHARE_TYPE_SPS) && (codec == CODEC_H264)))) {
+            m->started = 1;
+            m->codec = codec;
+            m->base_time = time - TS_TIME_MARGIN;
+        }
+        if (!m->started) return 0;
+
+        if (m->pending_len + len > m->pending_size) {
+            pending = realloc(m->pending, m->pending_len + len);
+            if (pending == NULL) return -1;
+            m->pending = pending;
+            m->pending_size = m->pending_len + len;
+        }
+        fshare_span_copy(m->pending + m->pending_len, span);
+        m->pending_len += len;
+        return 0;
+    }
+    if (!m->started) return 0;
+
+    if (m->codec == CODEC_H265) {
+        c[nc].ptr = AUD_H265;
+        c[nc++].len = sizeof(AUD_H265);
+    } else {
+        c[nc].ptr = AUD_H264;
+        c[nc++].len = sizeof(AUD_H264);
+    }
+    if (m->pending_len > 0) {
+        c[nc].ptr = m->pending;
+        c[nc++].len = m->pending_len;
+        m->key = 1;
+    }
+    c[nc].ptr = span->ptr[0];
+    c[nc++].len = span->len[0];
+    if (span->len[1] > 0) {
+        c[nc].ptr = span->ptr[1];
+        c[nc++].len = span->len[1];
+    }
+    m->pending_len = 0;
+
+    if ((m->key) || ((uint32_t) (time - m->psi_time) >= TS_PSI_INTERVAL)) {
+        if (ts_reserve(m, 2 * TS_PACKET_SIZE) != 0) return -1;
+        ts_psi(m, time);
+    }
+
+    pcr = ts_time(m, time);
+    if (ts_pes(m, TS_PID_VIDEO, &m->cc_video, 0xE0, c, nc,
+            (pcr + TS_PTS_DELAY) & 0x1FFFFFFFFULL, 1, pcr, m->key) != 0) return -1;
+    m->bytes += m->len;
+
+    return m->len;
+}
+
+/*
+ * Add an ADTS frame: nothing is sent before the first video GOP.
+ * Return the length of the packets in m->buf, 0 if nothing is ready or -1.
+ */
+int tsmux_audio(tsmux *m, fshare_span *span, uint32_t time)
+{
+    ts_chunk c[2];
+    int nc = 0;
+
+    m->len = 0;
+    m->key = 0;
+    if (!m->started) return 0;
+
+    c[nc].ptr = span->ptr[0];
+    c[nc++].len = span->len[0];
+    if (span->len[1] > 0) {
+        c[nc].ptr = span->ptr[1];
+        c[nc++].len = span->len[1];
+    }
+
+    if ((uint32_t) (time - m->psi_time) >= TS_PSI_INTERVAL) {
+        if (ts_reserve(m, 2 * TS_PACKET_SIZE) != 0) return -1;
+        ts_psi(m, time);
+    }
+
+    if (ts_pes(m, TS_PID_AUDIO, &m->cc_audio, 0xC0, c, nc,
+            (ts_time(m, time) + TS_PTS_DELAY) & 0x1FFFFFFFFULL, 0, 0, 0) != 0) return -1;
+    m->bytes += m->len;
+
+    return m->len;
+}
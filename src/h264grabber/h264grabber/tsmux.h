@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal MPEG-TS muxer: one program with a H.264/H.265 stream and an
+ * ADTS AAC stream.
+ * PTS come from the frame time of the ring, PCR is carried by the video
+ * PID and PAT/PMT are repeated before every IDR and at least every
+ * TS_PSI_INTERVAL ms.
+ */
+
+#ifndef _TSMUX_H
+#define _TSMUX_H
+
+#include <stdint.h>
+
+#include "fshare.h"
+
+#define TS_PACKET_SIZE 188
+#define TS_PID_PMT 0x1000
+#define TS_PID_VIDEO 0x100
+#define TS_PID_AUDIO 0x101
+#define TS_PSI_INTERVAL 100                 // ms
+#define TS_PTS_DELAY 63000                  // 90 kHz, PTS ahead of PCR (700 ms)
+#define TS_TIME_MARGIN 1000                 // ms, audio older than the first IDR
+
+typedef struct
+{
+    unsigned char *buf;                     // TS packets of the last frame
+    unsigned int size;
+    unsigned int len;
+    int key;                                // buf starts with PAT/PMT and an IDR
+    unsigned char *pending;                 // parameter sets waiting for their picture
+    unsigned int pending_size;
+    unsigned int pending_len;
+    int codec;                              // CODEC_H264 or CODEC_H265
+    int started;                            // first parameter set received
+    uint32_t base_time;                     // ms, frame time of PTS 0
+    uint32_t psi_time;                      // ms, frame time of the last PAT/PMT
+    unsigned int cc_pat;
+    unsigned int cc_pmt;
+    unsigned int cc_video;
+    unsigned int cc_audio;
+    // Statistics
+    unsigned int pes;
+    unsigned long long bytes;
+} tsmux;
+
+int tsmux_init(tsmux *m);
+void tsmux_free(tsmux *m);
+int tsmux_video(tsmux *m, int codec, fshare_span *span, uint16_t type, uint32_t time);
+int tsmux_audio(tsmux *m, fshare_span *span, uint32_t time);
+
+#endif
@@ -0,0 +1,1025 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shared reader for the /dev/shm/fshare_frame_buf circular buffer.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifdef USE_SEMAPHORE
+#include <semaphore.h>
+#endif
+
+#include "fshare.h"
+
+unsigned char IDR4[]                = {0x65, 0xB8};
+unsigned char NALx_START[]          = {0x00, 0x00, 0x00, 0x01};
+unsigned char IDR4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x65, 0x88};
+unsigned char IDR5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x26};
+unsigned char PFR4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x41};
+unsigned char PFR5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x02};
+unsigned char SPS4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x67};
+unsigned char SPS5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x42};
+unsigned char PPS4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x68};
+unsigned char PPS5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x44};
+unsigned char VPS5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x40};
+
+unsigned char PPS4_HEADER[]         = {0x08, 0x00, 0x00, 0x00};
+
+#ifdef USE_SEMAPHORE
+sem_t *sem_fshare_read_lock = SEM_FAILED;
+sem_t *sem_fshare_write_lock = SEM_FAILED;
+#endif
+
+// Ring layout and platform (1 Allwinner, 2 Allwinner-v2) of each model
+static struct {
+    const char *model;
+    unsigned int offset;
+    unsigned int header_size;
+    int version;
+} fshare_models[] = {
+    { "y20ga", BUF_OFFSET_Y20GA, FRAME_HEADER_SIZE_Y20GA, 1 },
+    { "y25ga", BUF_OFFSET_Y25GA, FRAME_HEADER_SIZE_Y25GA, 1 },
+    { "y30qa", BUF_OFFSET_Y30QA, FRAME_HEADER_SIZE_Y30QA, 1 },
+    { "y501gc", BUF_OFFSET_Y501GC, FRAME_HEADER_SIZE_Y501GC, 1 },
+    { "y21ga", BUF_OFFSET_Y21GA, FRAME_HEADER_SIZE_Y21GA, 2 },
+    { "y211ga", BUF_OFFSET_Y211GA, FRAME_HEADER_SIZE_Y211GA, 2 },
+    { "y211ba", BUF_OFFSET_Y211BA, FRAME_HEADER_SIZE_Y211BA, 2 },
+    { "y213ga", BUF_OFFSET_Y213GA, FRAME_HEADER_SIZE_Y213GA, 2 },
+    { "y291ga", BUF_OFFSET_Y291GA, FRAME_HEADER_SIZE_Y291GA, 2 },
+    { "h30ga", BUF_OFFSET_H30GA, FRAME_HEADER_SIZE_H30GA, 2 },
+    { "r30gb", BUF_OFFSET_R30GB, FRAME_HEADER_SIZE_R30GB, 2 },
+    { "r35gb", BUF_OFFSET_R35GB, FRAME_HEADER_SIZE_R35GB, 2 },
+    { "r37gb", BUF_OFFSET_R37GB, FRAME_HEADER_SIZE_R37GB, 2 },
+    { "r40ga", BUF_OFFSET_R40GA, FRAME_HEADER_SIZE_R40GA, 2 },
+    { "h51ga", BUF_OFFSET_H51GA, FRAME_HEADER_SIZE_H51GA, 2 },
+    { "h52ga", BUF_OFFSET_H52GA, FRAME_HEADER_SIZE_H52GA, 2 },
+    { "h60ga", BUF_OFFSET_H60GA, FRAME_HEADER_SIZE_H60GA, 2 },
+    { "y28ga", BUF_OFFSET_Y28GA, FRAME_HEADER_SIZE_Y28GA, 2 },
+    { "y29ga", BUF_OFFSET_Y29GA, FRAME_HEADER_SIZE_Y29GA, 2 },
+    { "y623", BUF_OFFSET_Y623, FRAME_HEADER_SIZE_Y623, 2 },
+    { "q321br_lsx", BUF_OFFSET_Q321BR_LSX, FRAME_HEADER_SIZE_Q321BR_LSX, 2 },
+    { "qg311r", BUF_OFFSET_QG311R, FRAME_HEADER_SIZE_QG311R, 2 },
+    { "b091qp", BUF_OFFSET_B091QP, FRAME_HEADER_SIZE_B091QP, 2 },
+};
+
+static int fshare_model_find(const char *model)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(fshare_models) / sizeof(fshare_models[0]); i++) {
+        if (strcasecmp(fshare_models[i].model, model) == 0) return i;
+    }
+
+    return -1;
+}
+
+/*
+ * Get the offset and the header size of a model.
+ * Return -1 if the model is unknown.
+ */
+int fshare_model_layout(const char *model, unsigned int *offset, unsigned int *header_size)
+{
+    int i = fshare_model_find(model);
+
+    if (i < 0) return -1;
+    *offset = fshare_models[i].offset;
+    *header_size = fshare_models[i].header_size;
+
+    return 0;
+}
+
+/* Return the platform of a model: 1 Allwinner, 2 Allwinner-v2 or -1 if unknown */
+int fshare_model_version(const char *model)
+{
+    int i = fshare_model_find(model);
+
+    if (i < 0) return -1;
+
+    return fshare_models[i].version;
+}
+
+/* Map the shared memory object, its size is read from the object itself */
+int fshare_open(fshare_ring *ring, unsigned int offset, unsigned int header_size)
+{
+    int fshm;
+    struct stat st;
+
+    ring->addr = NULL;
+    ring->offset = offset;
+    ring->header_size = header_size;
+
+    fshm = shm_open(BUFFER_SHM, O_RDWR, 0);
+    if (fshm == -1) {
+        fprintf(stderr, "error - could not open file %s\n", BUFFER_FILE);
+        return -1;
+    }
+    if (fstat(fshm, &st) != 0) {
+        fprintf(stderr, "error - could not get size of %s\n", BUFFER_FILE);
+        close(fshm);
+        return -2;
+    }
+    ring->size = st.st_size;
+
+    ring->addr = (unsigned char *) mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fshm, 0);
+    close(fshm);
+    if (ring->addr == MAP_FAILED) {
+        fprintf(stderr, "error - mapping file %s\n", BUFFER_FILE);
+        ring->addr = NULL;
+        return -3;
+    }
+
+    return 0;
+}
+
+void fshare_close(fshare_ring *ring)
+{
+    if (ring->addr != NULL) {
+        munmap(ring->addr, ring->size);
+        ring->addr = NULL;
+    }
+}
+
+void fshare_detect_offset(fshare_ring *ring)
+{
+    int i;
+
+    if (ring->offset != FRAME_OFFSET_AUTODETECT) return;
+
+    memcpy(&i, ring->addr + FRAME_OFFSET_TRY_1, sizeof(i));
+    if (i != 0)
+        ring->offset = FRAME_OFFSET_TRY_1;
+    else
+        ring->offset = FRAME_OFFSET_TRY_2;
+}
+
+/*
+ * Look for a PPS and for its length word in the previous 40 bytes.
+ * Return the header size or FRAME_HEADER_SIZE_AUTODETECT if not found yet.
+ */
+int fshare_detect_header_size(fshare_ring *ring)
+{
+    unsigned char *header_a1, *header_a2;
+    int size;
+
+    if (ring->header_size != FRAME_HEADER_SIZE_AUTODETECT) return ring->header_size;
+
+    header_a2 = (unsigned char *) memmem(ring->addr + ring->offset, ring->size - ring->offset, PPS4_START, sizeof(PPS4_START));
+    if ((header_a2 == NULL) || (header_a2 - 40 <= ring->addr + ring->offset))
+        return FRAME_HEADER_SIZE_AUTODETECT;
+
+    header_a1 = (unsigned char *) memmem(header_a2 - 40, 40, PPS4_HEADER, sizeof(PPS4_HEADER));
+    if (header_a1 == NULL)
+        return FRAME_HEADER_SIZE_AUTODETECT;
+
+    size = header_a2 - header_a1;
+    if ((size == sizeof(struct frame_header_22)) || (size == sizeof(struct frame_header_24)) ||
+            (size == sizeof(struct frame_header_26)) || (size == sizeof(struct frame_header_28))) {
+        ring->header_size = size;
+    }
+
+    return ring->header_size;
+}
+
+// Check a layout against the frames of the last write of the live ring
+static int fshare_layout_check(fshare_ring *ring, unsigned int offset, unsigned int header_size)
+{
+    fshare_ring r = *ring;
+    fshare_iter it;
+    fshare_frame fr;
+    unsigned char *start, *end;
+    int i, ret;
+
+    if ((offset != FRAME_OFFSET_TRY_1) && (offset != FRAME_OFFSET_TRY_2)) return -1;
+    if ((header_size != sizeof(struct frame_header_22)) && (header_size != sizeof(struct frame_header_24)) &&
+            (header_size != sizeof(struct frame_header_26)) && (header_size != sizeof(struct frame_header_28))) {
+        return -1;
+    }
+    r.offset = offset;
+    r.header_size = header_size;
+
+    if (fshare_read_index(&r, &start, &end) != 0) return -1;
+    // Nothing to check yet
+    if (start == end) return -1;
+
+    fshare_iter_init(&it, &r, start, end);
+    for (i = 0; i < FSHARE_LAYOUT_PROBE_FRAMES; i++) {
+        ret = fshare_iter_next(&it, &fr);
+        // The chain of headers lands exactly on the write end
+        if (ret == 0) return 0;
+        if (ret < 0) return -1;
+        if ((fr.len == 0) || ((fr.type & (FSHARE_TYPE_LOW | FSHARE_TYPE_HIGH | FSHARE_TYPE_AAC)) == 0)) return -1;
+        if (fshare_distance(&r, start, it.cur) > fshare_distance(&r, start, end)) return -1;
+    }
+
+    // A long write, all the headers checked are valid
+    return 0;
+}
+
+/*
+ * Fill the autodetected fields of the ring and the codecs not known yet
+ * from the layout file, if it matches the live ring.
+ * Return 0 if the layout is used, -1 otherwise.
+ */
+int fshare_layout_load(fshare_ring *ring, struct stream_type_s *stream_type)
+{
+    struct fshare_layout_s l;
+    int fd;
+    ssize_t n;
+
+    fd = open(FSHARE_LAYOUT_FILE, O_RDONLY);
+    if (fd == -1) return -1;
+    n = read(fd, &l, sizeof(l));
+    close(fd);
+
+    if ((n != sizeof(l)) || (memcmp(l.magic, FSHARE_LAYOUT_MAGIC, sizeof(l.magic)) != 0) ||
+            (l.version != FSHARE_LAYOUT_VERSION) || (l.size != ring->size)) {
+        return -1;
+    }
+    // The layout of the model, if defined, must agree
+    if ((ring->offset != FRAME_OFFSET_AUTODETECT) && (ring->offset != l.offset)) return -1;
+    if ((ring->header_size != FRAME_HEADER_SIZE_AUTODETECT) && (ring->header_size != l.header_size)) return -1;
+    if (fshare_layout_check(ring, l.offset, l.header_size) != 0) return -1;
+
+    ring->offset = l.offset;
+    ring->header_size = l.header_size;
+    if (stream_type != NULL) {
+        if (stream_type->codec_low == CODEC_NONE) stream_type->codec_low = l.codec_low;
+        if (stream_type->codec_high == CODEC_NONE) stream_type->codec_high = l.codec_high;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the layout of the ring and the codecs detected so far, replacing
+ * the file atomically. The codecs of a file with the same layout are kept
+ * if this process didn't detect them.
+ * Return 0 on success.
+ */
+int fshare_layout_save(fshare_ring *ring, struct stream_type_s *stream_type)
+{
+    struct fshare_layout_s l, old;
+    char tmp[64];
+    int fd;
+    ssize_t n;
+
+    if ((ring->offset == FRAME_OFFSET_AUTODETECT) || (ring->header_size == FRAME_HEADER_SIZE_AUTODETECT)) return -1;
+
+    memset(&l, 0, sizeof(l));
+    memcpy(l.magic, FSHARE_LAYOUT_MAGIC, sizeof(l.magic));
+    l.version = FSHARE_LAYOUT_VERSION;
+    l.size = ring->size;
+    l.offset = ring->offset;
+    l.header_size = ring->header_size;
+    l.codec_low = (stream_type != NULL) ? stream_type->codec_low : CODEC_NONE;
+    l.codec_high = (stream_type != NULL) ? stream_type->codec_high : CODEC_NONE;
+
+    fd = open(FSHARE_LAYOUT_FILE, O_RDONLY);
+    if (fd != -1) {
+        n = read(fd, &old, sizeof(old));
+        close(fd);
+        if ((n == sizeof(old)) && (memcmp(&old, &l, offsetof(struct fshare_layout_s, codec_low)) == 0)) {
+            if (l.codec_low == CODEC_NONE) l.codec_low = old.codec_low;
+            if (l.codec_high == CODEC_NONE) l.codec_high = old.codec_high;
+            // Up to date
+            if (memcmp(&old, &l, sizeof(l)) == 0) return 0;
+        }
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", FSHARE_LAYOUT_FILE, (int) getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        fprintf(stderr, "error - could not create %s\n", tmp);
+        return -1;
+    }
+    n = write(fd, &l, sizeof(l));
+    close(fd);
+    if ((n != sizeof(l)) || (rename(tmp, FSHARE_LAYOUT_FILE) != 0)) {
+        fprintf(stderr, "error - could not write %s\n", FSHARE_LAYOUT_FILE);
+        unlink(tmp);
+        return -2;
+    }
+
+    return 0;
+}
+
+// Forget the layout, the next process detects it again
+void fshare_layout_remove()
+{
+    unlink(FSHARE_LAYOUT_FILE);
+}
+
+unsigned char *fshare_move(fshare_ring *ring, unsigned char *buf, int offset)
+{
+    buf += offset;
+    if ((offset > 0) && (buf >= ring->addr + ring->size))
+        buf -= (ring->size - ring->offset);
+    if ((offset < 0) && (buf < ring->addr + ring->offset))
+        buf += (ring->size - ring->offset);
+
+    return buf;
+}
+
+/* Locate a string in the circular buffer */
+unsigned char *fshare_memmem(fshare_ring *ring, unsigned char *src, int src_len, unsigned char *what, int what_len)
+{
+    unsigned char *p;
+
+    if (src_len >= 0) {
+        p = (unsigned char *) memmem(src, src_len, what, what_len);
+    } else {
+        // From src to the end of the buffer
+        p = (unsigned char *) memmem(src, ring->addr + ring->size - src, what, what_len);
+        if (p == NULL) {
+            // And from the start of the buffer size src_len
+            p = (unsigned char *) memmem(ring->addr + ring->offset, src + src_len - (ring->addr + ring->offset), what, what_len);
+        }
+    }
+    return p;
+}
+
+// The third argument is the circular buffer
+int fshare_memcmp(fshare_ring *ring, unsigned char *str, unsigned char *src, size_t n)
+{
+    int ret;
+    unsigned char *end = ring->addr + ring->size;
+
+    if (src + n > end) {
+        ret = memcmp(str, src, end - src);
+        if (ret != 0) return ret;
+        ret = memcmp(str + (end - src), ring->addr + ring->offset, n - (end - src));
+    } else {
+        ret = memcmp(str, src, n);
+    }
+
+    return ret;
+}
+
+// The third argument is the circular buffer
+void fshare_memcpy(fshare_ring *ring, unsigned char *dest, unsigned char *src, size_t n)
+{
+    unsigned char *end = ring->addr + ring->size;
+
+    if (src + n > end) {
+        memcpy(dest, src, end - src);
+        memcpy(dest + (end - src), ring->addr + ring->offset, n - (end - src));
+    } else {
+        memcpy(dest, src, n);
+    }
+}
+
+/* Decode a 22, 24, 26 or 28 bytes header in place, copying it only if it wraps */
+void fshare_header_read(fshare_ring *ring, struct frame_header *fh, unsigned char *src)
+{
+    unsigned char tmp[FRAME_HEADER_SIZE_MAX];
+    unsigned char *h = src;
+
+    if (src + ring->header_size > ring->addr + ring->size) {
+        fshare_memcpy(ring, tmp, src, ring->header_size);
+        h = tmp;
+    }
+
+    memcpy(&fh->len, h + offsetof(struct frame_header_22, len), sizeof(fh->len));
+    memcpy(&fh->counter, h + offsetof(struct frame_header_22, counter), sizeof(fh->counter));
+    if ((ring->header_size == sizeof(struct frame_header_22)) || (ring->header_size == sizeof(struct frame_header_24))) {
+        memcpy(&fh->time, h + offsetof(struct frame_header_22, time), sizeof(fh->time));
+        memcpy(&fh->type, h + offsetof(struct frame_header_22, type), sizeof(fh->type));
+        memcpy(&fh->stream_counter, h + offsetof(struct frame_header_22, stream_counter), sizeof(fh->stream_counter));
+    } else {
+        memcpy(&fh->time, h + offsetof(struct frame_header_26, time), sizeof(fh->time));
+        memcpy(&fh->type, h + offsetof(struct frame_header_26, type), sizeof(fh->type));
+        memcpy(&fh->stream_counter, h + offsetof(struct frame_header_26, stream_counter), sizeof(fh->stream_counter));
+    }
+}
+
+/* Encode a header in the layout of the ring, wrapping at the end (writer side) */
+void fshare_header_write(fshare_ring *ring, unsigned char *dest, struct frame_header *fh)
+{
+    unsigned char h[FRAME_HEADER_SIZE_MAX];
+    unsigned char *end = ring->addr + ring->size;
+
+    memset(h, 0, sizeof(h));
+    memcpy(h + offsetof(struct frame_header_22, len), &fh->len, sizeof(fh->len));
+    memcpy(h + offsetof(struct frame_header_22, counter), &fh->counter, sizeof(fh->counter));
+    if ((ring->header_size == sizeof(struct frame_header_22)) || (ring->header_size == sizeof(struct frame_header_24))) {
+        memcpy(h + offsetof(struct frame_header_22, time), &fh->time, sizeof(fh->time));
+        memcpy(h + offsetof(struct frame_header_22, type), &fh->type, sizeof(fh->type));
+        memcpy(h + offsetof(struct frame_header_22, stream_counter), &fh->stream_counter, sizeof(fh->stream_counter));
+    } else {
+        memcpy(h + offsetof(struct frame_header_26, time), &fh->time, sizeof(fh->time));
+        memcpy(h + offsetof(struct frame_header_26, type), &fh->type, sizeof(fh->type));
+        memcpy(h + offsetof(struct frame_header_26, stream_counter), &fh->stream_counter, sizeof(fh->stream_counter));
+    }
+
+    if (dest + ring->header_size > end) {
+        memcpy(dest, h, end - dest);
+        memcpy(ring->addr + ring->offset, h + (end - dest), ring->header_size - (end - dest));
+    } else {
+        memcpy(dest, h, ring->header_size);
+    }
+}
+
+/*
+ * Read the start and the end of the valid data.
+ * Return -1 if the end check word at addr+12 doesn't match: the writer is
+ * updating the ring.
+ */
+int fshare_read_index(fshare_ring *ring, unsigned char **start, unsigned char **end)
+{
+    int i;
+    unsigned char *s, *e;
+
+    memcpy(&i, ring->addr + 16, sizeof(i));
+    s = ring->addr + ring->offset + i;
+    memcpy(&i, ring->addr + 4, sizeof(i));
+    e = s + i;
+    if (e >= ring->addr + ring->size) e -= (ring->size - ring->offset);
+    // Check if the header is ok
+    memcpy(&i, ring->addr + 12, sizeof(i));
+    if (e != ring->addr + ring->offset + i) return -1;
+
+    if (start != NULL) *start = s;
+    if (end != NULL) *end = e;
+
+    return 0;
+}
+
+void fshare_iter_init(fshare_iter *it, fshare_ring *ring, unsigned char *from, unsigned char *to)
+{
+    it->ring = ring;
+    it->cur = from;
+    it->end = to;
+}
+
+/*
+ * Fill the next frame descriptor.
+ * Return 1 if a frame is available, 0 at the end, -1 if the sync is lost.
+ */
+int fshare_iter_next(fshare_iter *it, fshare_frame *frame)
+{
+    fshare_ring *ring = it->ring;
+    struct frame_header fh;
+
+    if (it->cur == it->end) return 0;
+
+    fshare_header_read(ring, &fh, it->cur);
+    // Check the len
+    if (fh.len > ring->size - ring->offset - ring->header_size) return -1;
+
+    frame->hdr = it->cur;
+    frame->offset = fshare_move(ring, it->cur, ring->header_size) - (ring->addr + ring->offset);
+    frame->len = fh.len;
+    frame->counter = fh.counter;
+    frame->time = fh.time;
+    frame->type = fh.type;
+    frame->stream_counter = fh.stream_counter;
+
+    it->cur = fshare_move(ring, it->cur, fh.len + ring->header_size);
+
+    return 1;
+}
+
+/* Bytes from "from" to "to" going forward in the circular area */
+unsigned int fshare_distance(fshare_ring *ring, unsigned char *from, unsigned char *to)
+{
+    if (to >= from) return to - from;
+
+    return (ring->size - ring->offset) - (from - to);
+}
+
+int fshare_scan_init(fshare_scan *s, fshare_ring *ring)
+{
+    memset(s, 0, sizeof(fshare_scan));
+    s->ring = ring;
+    s->size = FSHARE_SCAN_FRAMES;
+    s->frames = (fshare_frame *) malloc(s->size * sizeof(fshare_frame));
+    if (s->frames == NULL) {
+        fprintf(stderr, "error - could not allocate frame descriptors\n");
+        return -1;
+    }
+    s->stats_start = fshare_time_us();
+
+    return 0;
+}
+
+void fshare_scan_free(fshare_scan *s)
+{
+    free(s->frames);
+    s->frames = NULL;
+    s->size = 0;
+}
+
+/*
+ * Collect the descriptors of the frames from "from" up to the write end.
+ * The window grows with the burst, up to the frames that fit in the ring.
+ * The end was validated by fshare_read_index() with the end check word:
+ * a chain of headers landing exactly on it is complete, the newest frame
+ * included. Only a frame crossing the end is held for the next scan.
+ * Return the number of frames, -1 if the sync is lost: the writer lapped
+ * the reader or a header is broken.
+ */
+int fshare_scan_frames(fshare_scan *s, unsigned char *from, unsigned char *start, unsigned char *end)
+{
+    fshare_ring *ring = s->ring;
+    fshare_iter it;
+    fshare_frame *f;
+    unsigned int max = (ring->size - ring->offset) / ring->header_size;
+    int ret;
+
+    s->count = 0;
+    s->next = from;
+
+    // Overwritten since the last scan
+    if ((start != NULL) && (fshare_distance(ring, start, from) > fshare_distance(ring, start, end))) {
+        s->sync_lost++;
+        s->next = end;
+        return -1;
+    }
+
+    fshare_iter_init(&it, ring, from, end);
+    while (1) {
+        if (s->count == s->size) {
+            if (s->size >= max) break;
+            f = (fshare_frame *) realloc(s->frames, 2 * s->size * sizeof(fshare_frame));
+            if (f == NULL) break;
+            s->frames = f;
+            s->size *= 2;
+        }
+        f = &s->frames[s->count];
+        ret = fshare_iter_next(&it, f);
+        if (ret == 0) break;
+        if (ret < 0) {
+            s->sync_lost++;
+            s->count = 0;
+            s->next = end;
+            return -1;
+        }
+        if (ring->header_size + f->len > fshare_distance(ring, f->hdr, end)) {
+            // Still being written
+            s->held++;
+            break;
+        }
+        s->count++;
+        s->next = it.cur;
+    }
+
+    if (s->count > 0) {
+        if (s->last_counter != 0) {
+            if (s->frames[0].counter > s->last_counter + 1) {
+                s->lost += s->frames[0].counter - (s->last_counter + 1);
+            } else if (s->frames[0].counter <= s->last_counter) {
+                // The counter went back: the producer restarted
+                s->resyncs++;
+            }
+        }
+        s->last_counter = s->frames[s->count - 1].counter;
+    }
+    s->scans++;
+    s->total += s->count;
+    if (s->count > s->max_count) s->max_count = s->count;
+
+    return s->count;
+}
+
+/*
+ * Print the scan statistics every FSHARE_WAIT_STATS_PERIOD and reset the
+ * counters.
+ * Return 1 if the statistics were printed.
+ */
+int fshare_scan_stats(fshare_scan *s, const char *name, int force)
+{
+    long long now = fshare_time_us();
+    long long elapsed = now - s->stats_start;
+
+    if ((!force) && (elapsed < FSHARE_WAIT_STATS_PERIOD)) return 0;
+    if (elapsed <= 0) return 0;
+
+    fprintf(stderr, "%s - scan: frames %.1f/s - frames per scan avg %.1f, max %u - held %u - lost %u - sync lost %u - resyncs %u\n",
+            name, s->total * 1000000.0 / elapsed, (s->scans > 0)?((double) s->total / s->scans):0,
+            s->max_count, s->held, s->lost, s->sync_lost, s->resyncs);
+
+    s->stats_start = now;
+    s->scans = 0;
+    s->total = 0;
+    s->max_count = 0;
+    s->held = 0;
+    s->lost = 0;
+    s->sync_lost = 0;
+    s->resyncs = 0;
+
+    return 1;
+}
+
+void fshare_resync_init(fshare_resync *r, int video)
+{
+    memset(r, 0, sizeof(fshare_resync));
+    r->video = video;
+    r->last = -1;
+    // The stream is joined in the middle of a GOP
+    r->wait_idr = video;
+}
+
+/*
+ * Check the continuity of a frame of the stream.
+ * Return 1 if the frame can be forwarded, 0 if it must be dropped.
+ */
+int fshare_resync_check(fshare_resync *r, fshare_frame *frame)
+{
+    unsigned int d;
+
+    r->gap = 0;
+    if (r->last >= 0) {
+        // The counter wraps at 65536: a step of half of it or more, or
+        // none, is the counter going back after a producer restart
+        d = (65536 + frame->stream_counter - r->last) % 65536;
+        if ((d == 0) || (d >= 32768)) {
+            r->resyncs++;
+            if (r->video) r->wait_idr = 1;
+        } else {
+            r->gap = d - 1;
+        }
+    }
+    r->last = frame->stream_counter;
+    if (r->gap > 0) {
+        r->gaps++;
+        r->lost += r->gap;
+        if (r->video) r->wait_idr = 1;
+    }
+
+    if (r->wait_idr) {
+        if (frame->type & (FSHARE_TYPE_VPS | FSHARE_TYPE_SPS | FSHARE_TYPE_IDR)) {
+            r->wait_idr = 0;
+        } else {
+            r->suppressed++;
+            r->suppressed_bytes += frame->len;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* The frames since the last check can't be counted: wait for an IDR */
+void fshare_resync_lost(fshare_resync *r)
+{
+    if (r->last >= 0) r->gaps++;
+    r->last = -1;
+    if (r->video) r->wait_idr = 1;
+}
+
+void fshare_resync_stats(fshare_resync *r, const char *name)
+{
+    fprintf(stderr, "%s - resync: gaps %u - frames lost %u - resyncs %u - suppressed %u frames, %llu bytes%s\n",
+            name, r->gaps, r->lost, r->resyncs, r->suppressed, r->suppressed_bytes, (r->wait_idr)?" - waiting for IDR":"");
+
+    r->gaps = 0;
+    r->lost = 0;
+    r->resyncs = 0;
+    r->suppressed = 0;
+    r->suppressed_bytes = 0;
+}
+
+unsigned char *fshare_frame_data(fshare_ring *ring, fshare_frame *frame)
+{
+    return ring->addr + ring->offset + frame->offset;
+}
+
+/* Build the view of the payload skipping the first "skip" bytes */
+void fshare_frame_span(fshare_ring *ring, fshare_frame *frame, unsigned int skip, fshare_span *span)
+{
+    unsigned char *p;
+    unsigned int n, tail;
+
+    if (skip > frame->len) skip = frame->len;
+    p = fshare_move(ring, fshare_frame_data(ring, frame), skip);
+    n = frame->len - skip;
+    tail = ring->addr + ring->size - p;
+
+    span->ptr[0] = p;
+    if (n > tail) {
+        span->len[0] = tail;
+        span->ptr[1] = ring->addr + ring->offset;
+        span->len[1] = n - tail;
+    } else {
+        span->len[0] = n;
+        span->ptr[1] = NULL;
+        span->len[1] = 0;
+    }
+}
+
+unsigned int fshare_span_copy(unsigned char *dest, fshare_span *span)
+{
+    memcpy(dest, span->ptr[0], span->len[0]);
+    if (span->len[1] > 0)
+        memcpy(dest + span->len[0], span->ptr[1], span->len[1]);
+
+    return span->len[0] + span->len[1];
+}
+
+/*
+ * Autodetect the codec from the 1st SPS of each resolution.
+ * Return FSHARE_TYPE_LOW or FSHARE_TYPE_HIGH when a stream is detected,
+ * 0 otherwise.
+ */
+int fshare_stream_detect(fshare_ring *ring, fshare_frame *frame, struct stream_type_s *stream_type)
+{
+    unsigned char *p;
+    int *codec;
+
+    if ((frame->type & FSHARE_TYPE_SPS) == 0) return 0;
+
+    if (frame->type & FSHARE_TYPE_LOW) {
+        codec = &stream_type->codec_low;
+    } else if (frame->type & FSHARE_TYPE_HIGH) {
+        codec = &stream_type->codec_high;
+    } else {
+        return 0;
+    }
+    if (*codec != CODEC_NONE) return 0;
+
+    p = fshare_move(ring, fshare_frame_data(ring, frame), FSHARE_SPS_PREFIX_SIZE);
+    if (fshare_memcmp(ring, SPS4_START, p, sizeof(SPS4_START)) == 0) {
+        *codec = CODEC_H264;
+    } else if (fshare_memcmp(ring, SPS5_START, p, sizeof(SPS5_START)) == 0) {
+        *codec = CODEC_H265;
+    } else {
+        return 0;
+    }
+
+    return (frame->type & FSHARE_TYPE_LOW) ? FSHARE_TYPE_LOW : FSHARE_TYPE_HIGH;
+}
+
+long long fshare_time_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void fshare_wait_init(fshare_wait *w, fshare_ring *ring)
+{
+    int fd;
+    void *p;
+
+    memset(w, 0, sizeof(fshare_wait));
+    w->ring = ring;
+    memcpy(&w->index_start, ring->addr + 16, sizeof(w->index_start));
+    memcpy(&w->index_len, ring->addr + 4, sizeof(w->index_len));
+    w->interval = FSHARE_WAIT_INTERVAL_DEFAULT;
+    w->last_change = fshare_time_us();
+    w->last_poll = w->last_change;
+    w->stats_start = w->last_change;
+
+    // Use the notifier if it's running
+    fd = shm_open(FSHARE_NOTIFY_SHM, O_RDWR, 0);
+    if (fd != -1) {
+        p = mmap(NULL, sizeof(fshare_notify_s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p != MAP_FAILED) w->notify = (fshare_notify_s *) p;
+    }
+}
+
+void fshare_wait_close(fshare_wait *w)
+{
+    if (w->notify != NULL) {
+        munmap(w->notify, sizeof(fshare_notify_s));
+        w->notify = NULL;
+    }
+}
+
+/*
+ * Return 1 if the notifier is alive: it checks the ring every
+ * FSHARE_NOTIFY_HEARTBEAT at least, and at every frame.
+ */
+static int fshare_wait_notify_alive(fshare_wait *w, long long now)
+{
+    long long stale;
+
+    if (w->notify == NULL) return 0;
+
+    stale = (long long) w->interval * FSHARE_NOTIFY_STALE_FRAMES;
+    if (stale < 2 * FSHARE_NOTIFY_HEARTBEAT) stale = 2 * FSHARE_NOTIFY_HEARTBEAT;
+    if (now - __atomic_load_n(&w->notify->heartbeat, __ATOMIC_RELAXED) > stale) {
+        if (!w->notify_stale) {
+            fprintf(stderr, "warning - %s (pid %u) is not running, adaptive wait\n",
+                    FSHARE_NOTIFY_SHM, w->notify->pid);
+            w->notify_stale = 1;
+        }
+        return 0;
+    }
+    if (w->notify_stale) {
+        fprintf(stderr, "%s (pid %u) is running again\n", FSHARE_NOTIFY_SHM, w->notify->pid);
+        w->notify_stale = 0;
+    }
+
+    return 1;
+}
+
+static void fshare_wait_sleep(fshare_wait *w, uint32_t seq, long long us)
+{
+    struct timespec ts;
+
+    if ((w->notify != NULL) && (!w->notify_stale)) {
+        ts.tv_sec = us / 1000000;
+        ts.tv_nsec = (us % 1000000) * 1000;
+        syscall(SYS_futex, &w->notify->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+    } else {
+        usleep(us);
+    }
+}
+
+/*
+ * Wait until the write index changes.
+ * Return 1 if new data is available, 0 if the timeout (us) expired.
+ * A timeout of 0 means wait forever.
+ */
+int fshare_wait_next(fshare_wait *w, unsigned int timeout)
+{
+    fshare_ring *ring = w->ring;
+    uint32_t start, len, seq = 0;
+    long long now, begin, next, sleep_us, delta, latency, changed;
+    int slept = 0, notified;
+
+    begin = now = fshare_time_us();
+    while (1) {
+        // Read the futex word before the index to not miss a wake
+        notified = fshare_wait_notify_alive(w, now);
+        if (notified) seq = __atomic_load_n(&w->notify->seq, __ATOMIC_ACQUIRE);
+        memcpy(&start, ring->addr + 16, sizeof(start));
+        memcpy(&len, ring->addr + 4, sizeof(len));
+        if (slept) w->wakeups++;
+
+        if ((start != w->index_start) || (len != w->index_len)) {
+            w->index_start = start;
+            w->index_len = len;
+
+            // Estimate when the change happened: between the last check and now
+            if (!slept)
+                changed = now;
+            else if (notified)
+                changed = w->notify->time;
+            else
+                changed = (w->last_poll + now) / 2;
+            if (changed > now) changed = now;
+            // It wasn't there at the last check
+            if ((slept) && (changed < w->last_poll)) changed = w->last_poll;
+
+            // Update the estimated interval
+            delta = changed - w->last_change;
+            if ((delta > 0) && (delta < FSHARE_WAIT_INTERVAL_MAX)) {
+                w->interval = (w->interval * 7 + delta) / 8;
+                if (w->interval < FSHARE_WAIT_INTERVAL_MIN) w->interval = FSHARE_WAIT_INTERVAL_MIN;
+            }
+            // Latency from the change to the read, only if we were waiting for it
+            if (slept) {
+                latency = now - changed;
+                w->latency_sum += latency;
+                if (latency > w->latency_max) w->latency_max = latency;
+                w->changes++;
+            }
+            w->last_change = changed;
+            return 1;
+        }
+
+        if (slept) w->idle_wakeups++;
+        w->last_poll = now;
+        if ((timeout != 0) && (now - begin >= timeout)) return 0;
+
+        next = w->last_change + w->interval;
+        if (notified) {
+            // The notifier wakes us up, the timeout is just a fallback
+            sleep_us = FSHARE_WAIT_INTERVAL_MAX;
+        } else if (now < next - FSHARE_WAIT_SPIN) {
+            // Sleep until just before the predicted frame
+            sleep_us = next - FSHARE_WAIT_SPIN - now;
+        } else if (now < next + FSHARE_WAIT_SPIN) {
+            // Spin-check around the predicted frame
+            sleep_us = FSHARE_WAIT_SPIN_STEP;
+        } else {
+            // Prediction missed, back off
+            sleep_us = w->interval / 4;
+            if (sleep_us < FSHARE_WAIT_SPIN_STEP) sleep_us = FSHARE_WAIT_SPIN_STEP;
+        }
+        if ((timeout != 0) && (sleep_us > begin + timeout - now)) sleep_us = begin + timeout - now;
+
+        fshare_wait_sleep(w, seq, sleep_us);
+        slept = 1;
+        now = fshare_time_us();
+    }
+}
+
+/*
+ * Print wakeups and latency statistics every FSHARE_WAIT_STATS_PERIOD
+ * and reset the counters.
+ * Return 1 if the statistics were printed.
+ */
+int fshare_wait_stats(fshare_wait *w, const char *name, int force)
+{
+    long long now = fshare_time_us();
+    long long elapsed = now - w->stats_start;
+
+    if ((!force) && (elapsed < FSHARE_WAIT_STATS_PERIOD)) return 0;
+    if (elapsed <= 0) return 0;
+
+    fprintf(stderr, "%s - wait: %s - interval %u us - waited changes %.1f/s - wakeups %.1f/s - idle wakeups %.1f/s - latency avg %lld us, max %u us\n",
+            name, ((w->notify != NULL) && (!w->notify_stale))?"futex":"adaptive", w->interval,
+            w->changes * 1000000.0 / elapsed, w->wakeups * 1000000.0 / elapsed,
+            w->idle_wakeups * 1000000.0 / elapsed,
+            (w->changes > 0)?(w->latency_sum / w->changes):0, w->latency_max);
+
+    w->stats_start = now;
+    w->wakeups = 0;
+    w->idle_wakeups = 0;
+    w->changes = 0;
+    w->latency_sum = 0;
+    w->latency_max = 0;
+
+    return 1;
+}
+
+#ifdef USE_SEMAPHORE
+int fshare_sem_open()
+{
+    sem_fshare_read_lock = sem_open(READ_LOCK_FILE, O_RDWR);
+    if (sem_fshare_read_lock == SEM_FAILED) {
+        fprintf(stderr, "error opening %s\n", READ_LOCK_FILE);
+        return -1;
+    }
+    sem_fshare_write_lock = sem_open(WRITE_LOCK_FILE, O_RDWR);
+    if (sem_fshare_write_lock == SEM_FAILED) {
+        fprintf(stderr, "error opening %s\n", WRITE_LOCK_FILE);
+        return -2;
+    }
+    return 0;
+}
+
+void fshare_sem_close()
+{
+    if (sem_fshare_write_lock != SEM_FAILED) {
+        sem_close(sem_fshare_write_lock);
+        sem_fshare_write_lock = SEM_FAILED;
+    }
+    if (sem_fshare_read_lock != SEM_FAILED) {
+        sem_close(sem_fshare_read_lock);
+        sem_fshare_read_lock = SEM_FAILED;
+    }
+    return;
+}
+
+void fshare_sem_write_lock(fshare_ring *ring)
+{
+    int wl, ret = 0;
+    int *fshare_frame_buf_start = (int *) ring->addr;
+
+    while (ret == 0) {
+        sem_wait(sem_fshare_read_lock);
+        wl = *fshare_frame_buf_start;
+        if (wl == 0) {
+            ret = 1;
+        } else {
+            sem_post(sem_fshare_read_lock);
+            usleep(1000);
+        }
+    }
+    return;
+}
+
+void fshare_sem_write_unlock()
+{
+    sem_post(sem_fshare_read_lock);
+    return;
+}
+#endif
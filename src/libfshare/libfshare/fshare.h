@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shared reader for the /dev/shm/fshare_frame_buf circular buffer.
+ * The ring is mapped once and walked through an iterator that returns
+ * frame descriptors pointing into the mapping: consumers copy only the
+ * bytes they actually emit.
+ */
+
+#ifndef _FSHARE_H
+#define _FSHARE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//#define USE_SEMAPHORE 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUFFER_FILE "/dev/shm/fshare_frame_buf"
+#define BUFFER_SHM "fshare_frame_buf"
+#define READ_LOCK_FILE "fshare_read_lock"
+#define WRITE_LOCK_FILE "fshare_write_lock"
+
+#define FRAME_OFFSET_AUTODETECT 0
+#define FRAME_OFFSET_TRY_1 300
+#define FRAME_OFFSET_TRY_2 368
+#define FRAME_HEADER_SIZE_AUTODETECT 0
+#define FRAME_HEADER_SIZE_MAX 28
+
+#define BUF_OFFSET_Y20GA 300
+#define FRAME_HEADER_SIZE_Y20GA 22
+
+#define BUF_OFFSET_Y25GA 300
+#define FRAME_HEADER_SIZE_Y25GA 22
+
+#define BUF_OFFSET_Y30QA 300
+#define FRAME_HEADER_SIZE_Y30QA 22
+
+#define BUF_OFFSET_Y501GC 368
+#define FRAME_HEADER_SIZE_Y501GC 24
+
+#define BUF_OFFSET_Y21GA 368
+#define FRAME_HEADER_SIZE_Y21GA 28
+
+#define BUF_OFFSET_Y211GA 368
+#define FRAME_HEADER_SIZE_Y211GA 28
+
+#define BUF_OFFSET_Y211BA 368
+#define FRAME_HEADER_SIZE_Y211BA 28
+
+#define BUF_OFFSET_Y213GA 368
+#define FRAME_HEADER_SIZE_Y213GA 28
+
+#define BUF_OFFSET_Y291GA 368
+#define FRAME_HEADER_SIZE_Y291GA 28
+
+#define BUF_OFFSET_H30GA 368
+#define FRAME_HEADER_SIZE_H30GA 28
+
+//#define BUF_OFFSET_R30GB 300
+#define BUF_OFFSET_R30GB 0
+//#define FRAME_HEADER_SIZE_R30GB 22
+#define FRAME_HEADER_SIZE_R30GB 0
+
+//#define BUF_OFFSET_R35GB 300
+#define BUF_OFFSET_R35GB 0
+//#define FRAME_HEADER_SIZE_R35GB 26
+#define FRAME_HEADER_SIZE_R35GB 0
+
+//#define BUF_OFFSET_R37GB 368
+#define BUF_OFFSET_R37GB 0
+//#define FRAME_HEADER_SIZE_R37GB 28
+#define FRAME_HEADER_SIZE_R37GB 0
+
+#define BUF_OFFSET_R40GA 300
+#define FRAME_HEADER_SIZE_R40GA 26
+
+#define BUF_OFFSET_H51GA 368
+#define FRAME_HEADER_SIZE_H51GA 28
+
+#define BUF_OFFSET_H52GA 368
+#define FRAME_HEADER_SIZE_H52GA 28
+
+#define BUF_OFFSET_H60GA 368
+#define FRAME_HEADER_SIZE_H60GA 28
+
+#define BUF_OFFSET_Y28GA 368
+#define FRAME_HEADER_SIZE_Y28GA 28
+
+#define BUF_OFFSET_Y29GA 368
+#define FRAME_HEADER_SIZE_Y29GA 28
+
+#define BUF_OFFSET_Y623 368
+#define FRAME_HEADER_SIZE_Y623 28
+
+#define BUF_OFFSET_Q321BR_LSX 300
+#define FRAME_HEADER_SIZE_Q321BR_LSX 26
+
+#define BUF_OFFSET_QG311R 300
+#define FRAME_HEADER_SIZE_QG311R 26
+
+#define BUF_OFFSET_B091QP 300
+#define FRAME_HEADER_SIZE_B091QP 26
+
+#define CODEC_NONE 0
+#define CODEC_H264 264
+#define CODEC_H265 265
+
+/*
+Type:
+bit 0	IDR
+bit 1	SPS
+bit 2	PPS
+bit 3	VPS
+bit 4	?
+bit 5	FPS, Width and Height prefix
+bit 6 	HEVC 265
+bit 7	?
+
+bit 8	AAC
+bit 9 	?
+bit 10 	main (high)
+bit 11 	sub  (low)
+bit 12	fast
+bit 13	?
+bit 14	?
+bit 15	?
+*/
+#define FSHARE_TYPE_IDR  0x0001
+#define FSHARE_TYPE_SPS  0x0002
+#define FSHARE_TYPE_PPS  0x0004
+#define FSHARE_TYPE_VPS  0x0008
+#define FSHARE_TYPE_AAC  0x0100
+#define FSHARE_TYPE_HIGH 0x0400
+#define FSHARE_TYPE_LOW  0x0800
+
+// Size of the "FPS, Width and Height" prefix before the SPS NAL
+#define FSHARE_SPS_PREFIX_SIZE 6
+
+struct __attribute__((__packed__)) frame_header {
+    uint32_t len;
+    uint32_t counter;
+    uint32_t time;
+    uint16_t type;
+    uint16_t stream_counter;
+};
+
+struct __attribute__((__packed__)) frame_header_22 {
+    uint32_t len;
+    uint32_t counter;
+    uint32_t u1;
+    uint32_t time;
+    uint16_t type;
+    uint16_t stream_counter;
+    uint16_t u4;
+};
+
+struct __attribute__((__packed__)) frame_header_24 {
+    uint32_t len;
+    uint32_t counter;
+    uint32_t u1;
+    uint32_t time;
+    uint16_t type;
+    uint16_t stream_counter;
+    uint16_t u4;
+    uint16_t u5;
+};
+
+struct __attribute__((__packed__)) frame_header_26 {
+    uint32_t len;
+    uint32_t counter;
+    uint32_t u1;
+    uint32_t u2;
+    uint32_t time;
+    uint16_t type;
+    uint16_t stream_counter;
+    uint16_t u4;
+};
+
+struct __attribute__((__packed__)) frame_header_28 {
+    uint32_t len;
+    uint32_t counter;
+    uint32_t u1;
+    uint32_t u2;
+    uint32_t time;
+    uint16_t type;
+    uint16_t stream_counter;
+    uint32_t u4;
+};
+
+struct stream_type_s {
+    int codec_low;
+    int codec_high;
+};
+
+typedef struct
+{
+    unsigned char *addr;                    // base of the mapping (ring header)
+    unsigned int size;                      // size of the shm object
+    unsigned int offset;                    // offset where the circular area starts
+    unsigned int header_size;               // frame header size: 22, 24, 26 or 28
+} fshare_ring;
+
+// A frame descriptor: it points into the mapping, nothing is copied
+typedef struct
+{
+    unsigned char *hdr;                     // address of the frame header
+    uint32_t offset;                        // payload offset from the start of the circular area
+    uint32_t len;                           // payload length
+    uint32_t counter;
+    uint32_t time;
+    uint16_t type;
+    uint16_t stream_counter;
+} fshare_frame;
+
+// Two-span view of a (possibly wrapped) region of the ring
+typedef struct
+{
+    unsigned char *ptr[2];
+    unsigned int len[2];
+} fshare_span;
+
+typedef struct
+{
+    fshare_ring *ring;
+    unsigned char *cur;
+    unsigned char *end;
+} fshare_iter;
+
+/*
+ * Frames found since the last scan. The descriptors array grows to hold
+ * a whole burst of the writer.
+ */
+#define FSHARE_SCAN_FRAMES 64               // initial size of the window
+
+typedef struct
+{
+    fshare_ring *ring;
+    fshare_frame *frames;
+    unsigned int size;                      // allocated descriptors
+    unsigned int count;                     // frames of the last scan
+    unsigned char *next;                    // where the next scan starts
+    uint32_t last_counter;
+    // Statistics
+    long long stats_start;
+    unsigned int scans;
+    unsigned int total;
+    unsigned int max_count;
+    unsigned int held;                      // scans ended by a frame still being written
+    unsigned int lost;                      // frames overwritten before being read
+    unsigned int sync_lost;
+    unsigned int resyncs;                   // the frame counter went back
+} fshare_scan;
+
+/*
+ * Continuity of a stream, from its stream_counter.
+ * After a gap the video frames are dropped until the next VPS/SPS or IDR:
+ * the frames that follow reference pictures that the decoder never got.
+ * A counter that goes back, after a producer restart, is a resync: it
+ * waits for an IDR too but counts no lost frames.
+ */
+typedef struct
+{
+    int video;                              // wait for an IDR after a gap
+    int last;                               // last stream_counter, -1 if none
+    int wait_idr;
+    unsigned int gap;                       // frames missing before the last frame checked
+    // Statistics
+    unsigned int gaps;
+    unsigned int lost;
+    unsigned int resyncs;                   // the counter went back
+    unsigned int suppressed;
+    unsigned long long suppressed_bytes;
+} fshare_resync;
+
+/*
+ * Adaptive wait for new data in the ring.
+ * The write index words at addr+4 and addr+16 are watched: the interval
+ * between changes is measured and the reader sleeps until just before the
+ * next predicted change, then spin-checks for a short time.
+ * If the fshare_notify process is running, a futex wake is used instead.
+ * A notifier that stops updating its heartbeat (killed or crashed) is
+ * ignored until it comes back.
+ */
+#define FSHARE_NOTIFY_SHM "fshare_notify"
+
+// Content of FSHARE_NOTIFY_SHM
+typedef struct
+{
+    uint32_t seq;                           // futex word, incremented at every change
+    uint32_t pid;                           // pid of fshare_notify
+    int64_t time;                           // time of the last change detected, us
+    int64_t heartbeat;                      // time of the last check of the ring, us
+} fshare_notify_s;
+
+#define FSHARE_NOTIFY_HEARTBEAT 50000       // us, the notifier checks the ring at least this often
+#define FSHARE_NOTIFY_STALE_FRAMES 4        // a notifier silent this many frame intervals is gone
+
+#define FSHARE_WAIT_INTERVAL_DEFAULT 25000  // us
+#define FSHARE_WAIT_INTERVAL_MIN 2000       // us
+#define FSHARE_WAIT_INTERVAL_MAX 100000     // us
+#define FSHARE_WAIT_SPIN 1000               // us, wake up this time before the predicted frame
+#define FSHARE_WAIT_SPIN_STEP 1000          // us
+#define FSHARE_WAIT_STATS_PERIOD 10000000   // us
+
+typedef struct
+{
+    fshare_ring *ring;
+    uint32_t index_start;                   // last seen write index words
+    uint32_t index_len;
+    long long last_change;                  // time of the last change, us
+    long long last_poll;                    // time of the last check without changes, us
+    unsigned int interval;                  // estimated interval between changes, us
+    fshare_notify_s *notify;                // fshare_notify shared data, NULL if not present
+    int notify_stale;                       // the notifier stopped, adaptive wait meanwhile
+    // Statistics
+    long long stats_start;
+    unsigned int wakeups;                   // wakeups from sleep
+    unsigned int idle_wakeups;              // wakeups that found nothing new
+    unsigned int changes;
+    long long latency_sum;                  // wake-to-read latency, upper bound
+    unsigned int latency_max;
+} fshare_wait;
+
+/*
+ * SPS/VPS timing info.
+ * The frame rate of each stream is measured from the time of its frames
+ * and written in the timing info of the SPS (and of the VPS for H.265).
+ */
+#define FSHARE_NAL_MAX_SIZE 256
+#define FSHARE_TIMING_UNITS 500             // num_units_in_tick
+#define FSHARE_TIMING_FPS_DEFAULT 20        // until the frame rate is measured
+#define FSHARE_TIMING_FPS_MAX 60
+#define FSHARE_TIMING_FRAMES 40             // frames to measure the frame rate
+
+// Last source NAL and its rewritten copy
+typedef struct
+{
+    unsigned char src[FSHARE_NAL_MAX_SIZE];
+    unsigned int src_len;
+    unsigned int fps;
+    unsigned char nal[FSHARE_NAL_MAX_SIZE + 32];
+    unsigned int nal_len;                   // 0 if the source can't be rewritten
+} fshare_nal_cache;
+
+typedef struct
+{
+    uint32_t start_time;                    // ms, frame time
+    uint32_t last_time;
+    unsigned int frames;
+    unsigned int fps;                       // 0 until measured
+    fshare_nal_cache sps;
+    fshare_nal_cache vps;
+    // Statistics
+    unsigned int rewrites;
+    unsigned int errors;
+} fshare_timing;
+
+/*
+ * Capture file written by fshare_capture and replayed by fshare_producer:
+ * a fshare_capture_header, then each frame as a struct frame_header
+ * followed by its payload.
+ */
+#define FSHARE_CAPTURE_MAGIC "FSCP"
+#define FSHARE_CAPTURE_VERSION 1
+
+struct __attribute__((__packed__)) fshare_capture_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t offset;                        // layout of the captured ring
+    uint32_t header_size;
+    uint32_t size;
+};
+
+/*
+ * Layout detected by a previous process, in a small tmpfs file.
+ * A new process checks it against the live ring with a few headers
+ * instead of scanning the whole buffer, and falls back to the scan if
+ * it doesn't match.
+ */
+#define FSHARE_LAYOUT_FILE "/dev/shm/fshare_layout"
+#define FSHARE_LAYOUT_MAGIC "FSLY"
+#define FSHARE_LAYOUT_VERSION 1
+#define FSHARE_LAYOUT_PROBE_FRAMES 8        // headers checked against the ring
+
+struct __attribute__((__packed__)) fshare_layout_s {
+    char magic[4];
+    uint32_t version;
+    uint32_t size;                          // size of the ring it was detected on
+    uint32_t offset;
+    uint32_t header_size;
+    int32_t codec_low;                      // CODEC_NONE if not detected yet
+    int32_t codec_high;
+};
+
+extern unsigned char IDR4[];
+extern unsigned char NALx_START[4];
+extern unsigned char IDR4_START[6];
+extern unsigned char IDR5_START[5];
+extern unsigned char PFR4_START[5];
+extern unsigned char PFR5_START[5];
+extern unsigned char SPS4_START[5];
+extern unsigned char SPS5_START[5];
+extern unsigned char PPS4_START[5];
+extern unsigned char PPS5_START[5];
+extern unsigned char VPS5_START[5];
+extern unsigned char PPS4_HEADER[4];
+
+/* Mapping */
+int fshare_model_layout(const char *model, unsigned int *offset, unsigned int *header_size);
+int fshare_model_version(const char *model);
+int fshare_open(fshare_ring *ring, unsigned int offset, unsigned int header_size);
+void fshare_close(fshare_ring *ring);
+void fshare_detect_offset(fshare_ring *ring);
+int fshare_detect_header_size(fshare_ring *ring);
+int fshare_layout_load(fshare_ring *ring, struct stream_type_s *stream_type);
+int fshare_layout_save(fshare_ring *ring, struct stream_type_s *stream_type);
+void fshare_layout_remove();
+
+/* Circular buffer helpers, the ring pointer is always inside the mapping */
+unsigned char *fshare_move(fshare_ring *ring, unsigned char *buf, int offset);
+unsigned char *fshare_memmem(fshare_ring *ring, unsigned char *src, int src_len, unsigned char *what, int what_len);
+int fshare_memcmp(fshare_ring *ring, unsigned char *str, unsigned char *src, size_t n);
+void fshare_memcpy(fshare_ring *ring, unsigned char *dest, unsigned char *src, size_t n);
+void fshare_header_read(fshare_ring *ring, struct frame_header *fh, unsigned char *src);
+void fshare_header_write(fshare_ring *ring, unsigned char *dest, struct frame_header *fh);
+
+/* Write index, frame iterator and scanner */
+int fshare_read_index(fshare_ring *ring, unsigned char **start, unsigned char **end);
+void fshare_iter_init(fshare_iter *it, fshare_ring *ring, unsigned char *from, unsigned char *to);
+int fshare_iter_next(fshare_iter *it, fshare_frame *frame);
+unsigned int fshare_distance(fshare_ring *ring, unsigned char *from, unsigned char *to);
+int fshare_scan_init(fshare_scan *s, fshare_ring *ring);
+void fshare_scan_free(fshare_scan *s);
+int fshare_scan_frames(fshare_scan *s, unsigned char *from, unsigned char *start, unsigned char *end);
+int fshare_scan_stats(fshare_scan *s, const char *name, int force);
+
+/* Stream continuity */
+void fshare_resync_init(fshare_resync *r, int video);
+int fshare_resync_check(fshare_resync *r, fshare_frame *frame);
+void fshare_resync_lost(fshare_resync *r);
+void fshare_resync_stats(fshare_resync *r, const char *name);
+
+/* Frame payload access */
+unsigned char *fshare_frame_data(fshare_ring *ring, fshare_frame *frame);
+void fshare_frame_span(fshare_ring *ring, fshare_frame *frame, unsigned int skip, fshare_span *span);
+unsigned int fshare_span_copy(unsigned char *dest, fshare_span *span);
+
+/* Stream type autodetection */
+int fshare_stream_detect(fshare_ring *ring, fshare_frame *frame, struct stream_type_s *stream_type);
+
+/* SPS/VPS with timing info (fshare_sps.c) */
+int fshare_nal_set_timing(int codec, unsigned char *src, unsigned int len, unsigned char *dest, unsigned int size, unsigned int fps);
+void fshare_timing_init(fshare_timing *t);
+void fshare_timing_update(fshare_timing *t, fshare_frame *frame);
+unsigned char *fshare_timing_nal(fshare_timing *t, int codec, fshare_frame *frame, fshare_span *span, unsigned int *len);
+
+/* Adaptive wait */
+long long fshare_time_us();
+void fshare_wait_init(fshare_wait *w, fshare_ring *ring);
+void fshare_wait_close(fshare_wait *w);
+int fshare_wait_next(fshare_wait *w, unsigned int timeout);
+int fshare_wait_stats(fshare_wait *w, const char *name, int force);
+
+#ifdef USE_SEMAPHORE
+int fshare_sem_open();
+void fshare_sem_close();
+void fshare_sem_write_lock(fshare_ring *ring);
+void fshare_sem_write_unlock();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
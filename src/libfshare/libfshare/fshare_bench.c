@@ -0,0 +1,673 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of the ring helpers and of the capture path.
+ * The ring is built in private memory, no camera and no shm are needed.
+ * A line is printed for each case, as CSV (default) or JSON:
+ *     bench,header_size,layout,mix,ops,bytes,ns_per_op,mb_per_s
+ * so the results of two releases can be compared with a script.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "fshare.h"
+
+#define RING_SIZE 2097152
+#define RING_OFFSET 368
+#define FRAME_SIZE_MAX 131072
+#define QUEUE_SLOTS 64                      // slabs of the simulated output queue
+
+#define LAYOUT_LINEAR 0
+#define LAYOUT_WRAP 1                       // the data crosses the end of the ring
+
+#define MIX_HIGH 0
+#define MIX_LOW 1
+#define MIX_AUDIO 2
+#define MIX_ALL 3
+#define MIXES 4
+
+#define OUTPUT_CSV 0
+#define OUTPUT_JSON 1
+
+typedef struct
+{
+    const char *bench;
+    unsigned int header_size;               // 0 if not relevant
+    int layout;
+    const char *mix;
+    unsigned long long ops;
+    unsigned long long bytes;
+    long long ns;
+} bench_result;
+
+unsigned char SPS4_LOW[] =  {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x14,
+                             0x96, 0x54, 0x05, 0x01, 0x7B, 0xCB, 0x37, 0x01,
+                             0x01, 0x01, 0x02};
+unsigned char SPS4_HIGH[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
+                             0x96, 0x54, 0x03, 0xC0, 0x11, 0x2F, 0x2C, 0xDC,
+                             0x04, 0x04, 0x04, 0x08};
+unsigned char PPS4[] =      {0x00, 0x00, 0x00, 0x01, 0x68, 0xEE, 0x3C, 0x80};
+
+const char *mix_names[MIXES] = {"high", "low", "audio", "all"};
+const unsigned int header_sizes[] = {22, 24, 26, 28};
+
+int output;
+long long duration;                         // ns for each case
+unsigned int only_header_size;
+char *only_bench;
+volatile unsigned int sink;
+
+fshare_ring ring;
+unsigned char *ring_mem;
+unsigned char filler[FRAME_SIZE_MAX];
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [-t MS] [-s HEADER_SIZE] [-b BENCH] [-j]\n\n", progname);
+    fprintf(stderr, "\t-t MS, --time MS\n");
+    fprintf(stderr, "\t\ttime of each case in ms (default 200)\n");
+    fprintf(stderr, "\t-s HEADER_SIZE, --header HEADER_SIZE\n");
+    fprintf(stderr, "\t\trun only the cases with this header size: 22, 24, 26 or 28\n");
+    fprintf(stderr, "\t-b BENCH, --bench BENCH\n");
+    fprintf(stderr, "\t\trun only BENCH: memcpy, memmem, header_read, iter, stream_detect,\n");
+    fprintf(stderr, "\t\tnal_set_timing, timing_nal, capture\n");
+    fprintf(stderr, "\t-j, --json\n");
+    fprintf(stderr, "\t\tprint JSON lines instead of CSV\n");
+}
+
+long long time_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void result_print(bench_result *r)
+{
+    double ns_per_op = (r->ops > 0) ? (double) r->ns / r->ops : 0;
+    double mb_per_s = (r->ns > 0) ? r->bytes * 1000.0 / r->ns : 0;
+
+    if (output == OUTPUT_JSON) {
+        printf("{\"bench\":\"%s\",\"header_size\":%u,\"layout\":\"%s\",\"mix\":\"%s\",\"ops\":%llu,\"bytes\":%llu,\"ns_per_op\":%.1f,\"mb_per_s\":%.1f}\n",
+                r->bench, r->header_size, (r->layout == LAYOUT_WRAP) ? "wrap" : "linear", r->mix,
+                r->ops, r->bytes, ns_per_op, mb_per_s);
+    } else {
+        printf("%s,%u,%s,%s,%llu,%llu,%.1f,%.1f\n",
+                r->bench, r->header_size, (r->layout == LAYOUT_WRAP) ? "wrap" : "linear", r->mix,
+                r->ops, r->bytes, ns_per_op, mb_per_s);
+    }
+    fflush(stdout);
+}
+
+int bench_enabled(const char *bench, unsigned int header_size)
+{
+    if ((only_bench != NULL) && (strcmp(only_bench, bench) != 0)) return 0;
+    if ((only_header_size != 0) && (header_size != 0) && (only_header_size != header_size)) return 0;
+
+    return 1;
+}
+
+void ring_setup(unsigned int header_size)
+{
+    ring.addr = ring_mem;
+    ring.size = RING_SIZE;
+    ring.offset = RING_OFFSET;
+    ring.header_size = header_size;
+}
+
+/* Address of the circular area where n bytes start, crossing the end if wrap */
+unsigned char *ring_position(unsigned int n, int layout)
+{
+    if (layout == LAYOUT_WRAP) return ring.addr + ring.size - n / 2;
+
+    return ring.addr + ring.offset + 4096;
+}
+
+/* Store a payload at dest, wrapping at the end */
+unsigned char *ring_put(unsigned char *dest, unsigned char *data, unsigned int n)
+{
+    unsigned char *end = ring.addr + ring.size;
+
+    if (dest + n > end) {
+        memcpy(dest, data, end - dest);
+        memcpy(ring.addr + ring.offset, data + (end - dest), n - (end - dest));
+    } else {
+        memcpy(dest, data, n);
+    }
+
+    return fshare_move(&ring, dest, n);
+}
+
+/* Append a frame at p, return the address after it or NULL if the ring is full */
+unsigned char *ring_fill_frame(unsigned char *p, struct frame_header *fh, unsigned char *data, unsigned int *used)
+{
+    if (*used + ring.header_size + fh->len > ring.size - ring.offset - 1024) return NULL;
+
+    fshare_header_write(&ring, p, fh);
+    p = fshare_move(&ring, p, ring.header_size);
+    p = ring_put(p, data, fh->len);
+    *used += ring.header_size + fh->len;
+
+    return p;
+}
+
+/*
+ * Fill the ring with a sequence of frames like the firmware: parameter sets
+ * and IDR every 40 pictures at 20 fps, AAC every 64 ms.
+ * With LAYOUT_WRAP the data starts in the last third of the ring.
+ * Return the number of frames.
+ */
+unsigned int ring_fill(int mix, int layout)
+{
+    struct frame_header fh;
+    unsigned char sps[FSHARE_SPS_PREFIX_SIZE + sizeof(SPS4_HIGH)];
+    unsigned char *start, *p;
+    unsigned int used = 0, frames = 0, picture = 0, ms = 0, audio_ms = 0;
+    unsigned int types[2], nstreams = 0, s, high;
+    uint16_t stream_counter[3] = {0, 0, 0};
+    uint16_t prefix[3];
+    uint32_t idx;
+
+    if ((mix == MIX_HIGH) || (mix == MIX_ALL)) types[nstreams++] = FSHARE_TYPE_HIGH;
+    if ((mix == MIX_LOW) || (mix == MIX_ALL)) types[nstreams++] = FSHARE_TYPE_LOW;
+
+    start = ring.addr + ring.offset;
+    if (layout == LAYOUT_WRAP) start += (ring.size - ring.offset) / 3 * 2;
+    p = start;
+    memset(&fh, 0, sizeof(fh));
+
+    while (p != NULL) {
+        for (s = 0; (s < nstreams) && (p != NULL); s++) {
+            high = (types[s] == FSHARE_TYPE_HIGH);
+            fh.time = ms;
+            if (picture % 40 == 0) {
+                // FPS, width and height prefix
+                prefix[0] = 20;
+                prefix[1] = high ? 1920 : 640;
+                prefix[2] = high ? 1080 : 360;
+                memcpy(sps, prefix, sizeof(prefix));
+                memcpy(sps + FSHARE_SPS_PREFIX_SIZE, high ? SPS4_HIGH : SPS4_LOW, high ? sizeof(SPS4_HIGH) : sizeof(SPS4_LOW));
+                fh.len = FSHARE_SPS_PREFIX_SIZE + (high ? sizeof(SPS4_HIGH) : sizeof(SPS4_LOW));
+                fh.type = types[s] | FSHARE_TYPE_SPS | 0x0020;
+                fh.counter = frames + 1;
+                fh.stream_counter = stream_counter[s];
+                if ((p = ring_fill_frame(p, &fh, sps, &used)) == NULL) break;
+                frames++;
+                stream_counter[s]++;
+
+                fh.len = sizeof(PPS4);
+                fh.type = types[s] | FSHARE_TYPE_PPS;
+                fh.counter = frames + 1;
+                fh.stream_counter = stream_counter[s];
+                if ((p = ring_fill_frame(p, &fh, PPS4, &used)) == NULL) break;
+                frames++;
+                stream_counter[s]++;
+
+                fh.len = high ? 80000 : 20000;
+                fh.type = types[s] | FSHARE_TYPE_IDR;
+            } else {
+                fh.len = high ? 12000 : 3000;
+                fh.type = types[s];
+            }
+            fh.counter = frames + 1;
+            fh.stream_counter = stream_counter[s];
+            if ((p = ring_fill_frame(p, &fh, filler, &used)) == NULL) break;
+            frames++;
+            stream_counter[s]++;
+        }
+        if ((mix == MIX_AUDIO) || (mix == MIX_ALL)) {
+            while ((p != NULL) && (audio_ms <= ms)) {
+                fh.time = audio_ms;
+                fh.len = 300;
+                fh.type = FSHARE_TYPE_AAC;
+                fh.counter = frames + 1;
+                fh.stream_counter = stream_counter[2];
+                if ((p = ring_fill_frame(p, &fh, filler, &used)) == NULL) break;
+                frames++;
+                stream_counter[2]++;
+                audio_ms += 64;
+            }
+        }
+        picture++;
+        ms += 50;
+    }
+
+    // Index words: start at +16, length at +4, end check at +12
+    p = fshare_move(&ring, start, used);
+    idx = start - (ring.addr + ring.offset);
+    memcpy(ring.addr + 16, &idx, sizeof(idx));
+    memcpy(ring.addr + 4, &used, sizeof(used));
+    idx = p - (ring.addr + ring.offset);
+    memcpy(ring.addr + 12, &idx, sizeof(idx));
+
+    return frames;
+}
+
+/* Helpers */
+
+void bench_memcpy()
+{
+    static const unsigned int sizes[] = {300, 3000, 12000, 80000};
+    static const char *names[] = {"aac", "p_low", "p_high", "idr_high"};
+    unsigned char *dest, *src;
+    bench_result r;
+    long long start;
+    unsigned int i;
+    int layout;
+
+    if (!bench_enabled("memcpy", 0)) return;
+    ring_setup(FRAME_HEADER_SIZE_Y20GA);
+    dest = (unsigned char *) malloc(FRAME_SIZE_MAX);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (layout = LAYOUT_LINEAR; layout <= LAYOUT_WRAP; layout++) {
+            src = ring_position(sizes[i], layout);
+            memset(&r, 0, sizeof(r));
+            start = time_ns();
+            do {
+                fshare_memcpy(&ring, dest, src, sizes[i]);
+                sink += dest[sizes[i] - 1];
+                r.ops++;
+            } while ((r.ops & 63) || (time_ns() - start < duration));
+            r.ns = time_ns() - start;
+            r.bench = "memcpy";
+            r.layout = layout;
+            r.mix = names[i];
+            r.bytes = r.ops * sizes[i];
+            result_print(&r);
+        }
+    }
+    free(dest);
+}
+
+/* Header size detection: PPS start code in a window, and a miss in a whole frame */
+void bench_memmem()
+{
+    static const unsigned int sizes[] = {40, 12000};
+    static const char *names[] = {"pps_window", "frame_miss"};
+    unsigned char *src;
+    bench_result r;
+    long long start;
+    unsigned int i;
+    int layout;
+
+    if (!bench_enabled("memmem", 0)) return;
+    ring_setup(FRAME_HEADER_SIZE_Y20GA);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (layout = LAYOUT_LINEAR; layout <= LAYOUT_WRAP; layout++) {
+            src = ring_position(sizes[i], layout);
+            ring_put(src, filler, sizes[i]);
+            if (i == 0) ring_put(fshare_move(&ring, src, sizes[i] - sizeof(PPS4)), PPS4, sizeof(PPS4));
+            memset(&r, 0, sizeof(r));
+            start = time_ns();
+            do {
+                if (layout == LAYOUT_WRAP) {
+                    // Negative length: up to the end, then from the start up to src + len
+                    sink += (fshare_memmem(&ring, src, (sizes[i] - (ring.addr + ring.size - src)) - (src - (ring.addr + ring.offset)),
+                            PPS4_START, sizeof(PPS4_START)) != NULL);
+                } else {
+                    sink += (fshare_memmem(&ring, src, sizes[i], PPS4_START, sizeof(PPS4_START)) != NULL);
+                }
+                r.ops++;
+            } while ((r.ops & 63) || (time_ns() - start < duration));
+            r.ns = time_ns() - start;
+            r.bench = "memmem";
+            r.layout = layout;
+            r.mix = names[i];
+            r.bytes = r.ops * sizes[i];
+            result_print(&r);
+        }
+    }
+}
+
+void bench_header_read()
+{
+    struct frame_header fh;
+    unsigned char *src;
+    bench_result r;
+    long long start;
+    unsigned int h;
+    int layout;
+
+    for (h = 0; h < sizeof(header_sizes) / sizeof(header_sizes[0]); h++) {
+        if (!bench_enabled("header_read", header_sizes[h])) continue;
+        ring_setup(header_sizes[h]);
+        for (layout = LAYOUT_LINEAR; layout <= LAYOUT_WRAP; layout++) {
+            src = ring_position(ring.header_size, layout);
+            memset(&r, 0, sizeof(r));
+            start = time_ns();
+            do {
+                fshare_header_read(&ring, &fh, src);
+                sink += fh.len;
+                r.ops++;
+            } while ((r.ops & 1023) || (time_ns() - start < duration));
+            r.ns = time_ns() - start;
+            r.bench = "header_read";
+            r.header_size = ring.header_size;
+            r.layout = layout;
+            r.mix = "-";
+            r.bytes = r.ops * ring.header_size;
+            result_print(&r);
+        }
+    }
+}
+
+/* Walk of the whole ring, ns per frame */
+void bench_iter()
+{
+    fshare_iter it;
+    fshare_frame frame;
+    unsigned char *s, *e;
+    bench_result r;
+    long long start;
+    unsigned int h, frames;
+    int layout, mix;
+
+    for (h = 0; h < sizeof(header_sizes) / sizeof(header_sizes[0]); h++) {
+        if (!bench_enabled("iter", header_sizes[h])) continue;
+        ring_setup(header_sizes[h]);
+        for (layout = LAYOUT_LINEAR; layout <= LAYOUT_WRAP; layout++) {
+            for (mix = 0; mix < MIXES; mix++) {
+                frames = ring_fill(mix, layout);
+                fshare_read_index(&ring, &s, &e);
+                memset(&r, 0, sizeof(r));
+                start = time_ns();
+                do {
+                    fshare_iter_init(&it, &ring, s, e);
+                    while (fshare_iter_next(&it, &frame) == 1) {
+                        sink += frame.len;
+                        r.bytes += frame.len;
+                    }
+                    r.ops += frames;
+                } while (time_ns() - start < duration);
+                r.ns = time_ns() - start;
+                r.bench = "iter";
+                r.header_size = ring.header_size;
+                r.layout = layout;
+                r.mix = mix_names[mix];
+                result_print(&r);
+            }
+        }
+    }
+}
+
+/* Find the 1st frame of the ring with type */
+int ring_find(unsigned int type, fshare_frame *frame)
+{
+    fshare_iter it;
+    unsigned char *s, *e;
+
+    fshare_read_index(&ring, &s, &e);
+    fshare_iter_init(&it, &ring, s, e);
+    while (fshare_iter_next(&it, frame) == 1) {
+        if ((frame->type & type) == type) return 0;
+    }
+
+    return -1;
+}
+
+/* SPS detection and rewrite */
+void bench_sps()
+{
+    struct stream_type_s stream_type;
+    fshare_frame frame;
+    fshare_span span;
+    fshare_timing timing;
+    unsigned char sps[FSHARE_NAL_MAX_SIZE];
+    unsigned char nal[FSHARE_NAL_MAX_SIZE + 32];
+    unsigned char *p;
+    unsigned int sps_len, fps;
+    bench_result r;
+    long long start;
+    unsigned int h;
+
+    for (h = 0; h < sizeof(header_sizes) / sizeof(header_sizes[0]); h++) {
+        ring_setup(header_sizes[h]);
+        ring_fill(MIX_HIGH, LAYOUT_LINEAR);
+        ring_find(FSHARE_TYPE_HIGH | FSHARE_TYPE_SPS, &frame);
+
+        if (bench_enabled("stream_detect", header_sizes[h])) {
+            memset(&r, 0, sizeof(r));
+            start = time_ns();
+            do {
+                stream_type.codec_low = CODEC_NONE;
+                stream_type.codec_high = CODEC_NONE;
+                sink += fshare_stream_detect(&ring, &frame, &stream_type);
+                r.ops++;
+            } while ((r.ops & 1023) || (time_ns() - start < duration));
+            r.ns = time_ns() - start;
+            r.bench = "stream_detect";
+            r.header_size = ring.header_size;
+            r.mix = "high";
+            result_print(&r);
+        }
+
+        fshare_frame_span(&ring, &frame, FSHARE_SPS_PREFIX_SIZE, &span);
+        sps_len = fshare_span_copy(sps, &span);
+
+        if (bench_enabled("nal_set_timing", header_sizes[h])) {
+            // Rewrite at every call, as when the source or the frame rate change
+            memset(&r, 0, sizeof(r));
+            fps = 0;
+            start = time_ns();
+            do {
+                sink += fshare_nal_set_timing(CODEC_H264, sps, sps_len, nal, sizeof(nal), 10 + (fps++ & 15));
+                r.ops++;
+            } while ((r.ops & 255) || (time_ns() - start < duration));
+            r.ns = time_ns() - start;
+            r.bench = "nal_set_timing";
+            r.header_size = ring.header_size;
+            r.mix = "high";
+            r.bytes = r.ops * sps_len;
+            result_print(&r);
+        }
+
+        if (bench_enabled("timing_nal", header_sizes[h])) {
+            // Steady state: the cached copy is returned
+            fshare_timing_init(&timing);
+            memset(&r, 0, sizeof(r));
+            start = time_ns();
+            do {
+                p = fshare_timing_nal(&timing, CODEC_H264, &frame, &span, &sps_len);
+                sink += (p != NULL);
+                r.ops++;
+            } while ((r.ops & 1023) || (time_ns() - start < duration));
+            r.ns = time_ns() - start;
+            r.bench = "timing_nal";
+            r.header_size = ring.header_size;
+            r.mix = "high";
+            r.bytes = r.ops * sps_len;
+            result_print(&r);
+        }
+    }
+}
+
+/*
+ * Capture path of h264grabber and rRTSPServer: read the index, walk the new
+ * frames leaving the last one for the next time, detect the streams, measure
+ * the frame rate, rewrite the SPS and copy the payload to a queue slab.
+ */
+void bench_capture()
+{
+    fshare_scan scan;
+    fshare_frame *fhs;
+    fshare_span span;
+    fshare_timing timing_low, timing_high;
+    fshare_timing *timing;
+    struct stream_type_s stream_type;
+    unsigned char *slabs, *s, *e, *sps;
+    unsigned int h, i, slab, sps_len;
+    int layout, mix, codec, n;
+    bench_result r;
+    long long start;
+
+    slabs = (unsigned char *) malloc(QUEUE_SLOTS * FRAME_SIZE_MAX);
+    if (slabs == NULL) {
+        fprintf(stderr, "error - could not allocate the queue\n");
+        return;
+    }
+
+    for (h = 0; h < sizeof(header_sizes) / sizeof(header_sizes[0]); h++) {
+        if (!bench_enabled("capture", header_sizes[h])) continue;
+        ring_setup(header_sizes[h]);
+        if (fshare_scan_init(&scan, &ring) != 0) break;
+        for (layout = LAYOUT_LINEAR; layout <= LAYOUT_WRAP; layout++) {
+            for (mix = 0; mix < MIXES; mix++) {
+                ring_fill(mix, layout);
+                memset(&r, 0, sizeof(r));
+                slab = 0;
+                start = time_ns();
+                do {
+                    stream_type.codec_low = CODEC_NONE;
+                    stream_type.codec_high = CODEC_NONE;
+                    fshare_timing_init(&timing_low);
+                    fshare_timing_init(&timing_high);
+                    if (fshare_read_index(&ring, &s, &e) != 0) break;
+                    // The whole ring as a single burst
+                    scan.last_counter = 0;
+                    n = fshare_scan_frames(&scan, s, s, e);
+                    fhs = scan.frames;
+                    for (i = 0; i < n; i++) {
+                        if (fhs[i].type & FSHARE_TYPE_SPS) {
+                            fshare_frame_span(&ring, &fhs[i], FSHARE_SPS_PREFIX_SIZE, &span);
+                            fshare_stream_detect(&ring, &fhs[i], &stream_type);
+                        } else {
+                            fshare_frame_span(&ring, &fhs[i], 0, &span);
+                        }
+                        timing = NULL;
+                        codec = CODEC_NONE;
+                        if (fhs[i].type & FSHARE_TYPE_LOW) {
+                            timing = &timing_low;
+                            codec = stream_type.codec_low;
+                        } else if (fhs[i].type & FSHARE_TYPE_HIGH) {
+                            timing = &timing_high;
+                            codec = stream_type.codec_high;
+                        }
+                        sps = NULL;
+                        if (timing != NULL) {
+                            fshare_timing_update(timing, &fhs[i]);
+                            sps = fshare_timing_nal(timing, codec, &fhs[i], &span, &sps_len);
+                        }
+                        if (sps != NULL) {
+                            memcpy(slabs + slab * FRAME_SIZE_MAX, sps, sps_len);
+                            r.bytes += sps_len;
+                        } else {
+                            r.bytes += fshare_span_copy(slabs + slab * FRAME_SIZE_MAX, &span);
+                        }
+                        slab = (slab + 1) % QUEUE_SLOTS;
+                        r.ops++;
+                    }
+                } while (time_ns() - start < duration);
+                r.ns = time_ns() - start;
+                r.bench = "capture";
+                r.header_size = ring.header_size;
+                r.layout = layout;
+                r.mix = mix_names[mix];
+                result_print(&r);
+            }
+        }
+        fshare_scan_free(&scan);
+    }
+
+    free(slabs);
+}
+
+int main(int argc, char **argv) {
+    int c, i;
+
+    output = OUTPUT_CSV;
+    duration = 200000000LL;
+    only_header_size = 0;
+    only_bench = NULL;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"time",  required_argument, 0, 't'},
+            {"header",  required_argument, 0, 's'},
+            {"bench",  required_argument, 0, 'b'},
+            {"json",  no_argument, 0, 'j'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "t:s:b:jh",
+                         long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 't':
+            duration = atoi(optarg) * 1000000LL;
+            break;
+
+        case 's':
+            only_header_size = atoi(optarg);
+            break;
+
+        case 'b':
+            only_bench = optarg;
+            break;
+
+        case 'j':
+            output = OUTPUT_JSON;
+            break;
+
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (duration <= 0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    ring_mem = (unsigned char *) malloc(RING_SIZE);
+    if (ring_mem == NULL) {
+        fprintf(stderr, "error - could not allocate the ring\n");
+        return -2;
+    }
+    memset(ring_mem, 0, RING_SIZE);
+    // Payload without start codes
+    srand(1);
+    for (i = 0; i < FRAME_SIZE_MAX; i++) filler[i] = 1 + rand() % 255;
+
+    if (output == OUTPUT_CSV) printf("bench,header_size,layout,mix,ops,bytes,ns_per_op,mb_per_s\n");
+
+    bench_memcpy();
+    bench_memmem();
+    bench_header_read();
+    bench_iter();
+    bench_sps();
+    bench_capture();
+
+    free(ring_mem);
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Capture the frames of /dev/shm/fshare_frame_buf to a file.
+ * The file can be replayed by fshare_producer on a host without camera.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+
+#include "fshare.h"
+
+int debug;
+volatile int stop;
+
+void sig_handler(int signum)
+{
+    stop = 1;
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s -o FILE [-m MODEL] [-n FRAMES] [-t SECONDS] [-d]\n\n", progname);
+    fprintf(stderr, "\t-o FILE, --output FILE\n");
+    fprintf(stderr, "\t\toutput file, - for stdout\n");
+    fprintf(stderr, "\t-m MODEL, --model MODEL\n");
+    fprintf(stderr, "\t\tset the model to get offset and header size (default autodetect)\n");
+    fprintf(stderr, "\t-n FRAMES, --frames FRAMES\n");
+    fprintf(stderr, "\t\tstop after FRAMES frames (default 0, no limit)\n");
+    fprintf(stderr, "\t-t SECONDS, --time SECONDS\n");
+    fprintf(stderr, "\t\tstop after SECONDS seconds (default 0, no limit)\n");
+    fprintf(stderr, "\t-d, --debug\n");
+    fprintf(stderr, "\t\tenable debug\n");
+}
+
+int write_frame(FILE *fOut, fshare_ring *ring, fshare_frame *frame)
+{
+    struct frame_header fh;
+    fshare_span span;
+
+    fh.len = frame->len;
+    fh.counter = frame->counter;
+    fh.time = frame->time;
+    fh.type = frame->type;
+    fh.stream_counter = frame->stream_counter;
+    if (fwrite(&fh, sizeof(fh), 1, fOut) != 1) return -1;
+
+    fshare_frame_span(ring, frame, 0, &span);
+    if (fwrite(span.ptr[0], 1, span.len[0], fOut) != span.len[0]) return -1;
+    if ((span.len[1] > 0) && (fwrite(span.ptr[1], 1, span.len[1], fOut) != span.len[1])) return -1;
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    fshare_ring ring;
+    fshare_scan scan;
+    fshare_wait wait;
+    struct fshare_capture_header ch;
+    unsigned char *buf_idx_start, *buf_idx_end, *buf_idx_end_prev;
+    unsigned int buf_offset, frame_header_size;
+    unsigned int frames, max_frames, seconds, lost;
+    uint32_t last_counter;
+    long long start;
+    char *output;
+    FILE *fOut;
+    int i, n, c;
+
+    buf_offset = FRAME_OFFSET_AUTODETECT;
+    frame_header_size = FRAME_HEADER_SIZE_AUTODETECT;
+    output = NULL;
+    max_frames = 0;
+    seconds = 0;
+    debug = 0;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"output",  required_argument, 0, 'o'},
+            {"model",  required_argument, 0, 'm'},
+            {"frames",  required_argument, 0, 'n'},
+            {"time",  required_argument, 0, 't'},
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "o:m:n:t:dh",
+                         long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'o':
+            output = optarg;
+            break;
+
+        case 'm':
+            if (fshare_model_layout(optarg, &buf_offset, &frame_header_size) != 0) {
+                fprintf(stderr, "unknown model %s\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'n':
+            max_frames = atoi(optarg);
+            break;
+
+        case 't':
+            seconds = atoi(optarg);
+            break;
+
+        case 'd':
+            fprintf (stderr, "debug on\n");
+            debug = 1;
+            break;
+
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (output == NULL) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+#ifdef USE_SEMAPHORE
+    if (fshare_sem_open() != 0) {
+        fprintf(stderr, "error - could not open semaphores\n") ;
+        return -2;
+    }
+#endif
+
+    if (fshare_open(&ring, buf_offset, frame_header_size) != 0) {
+        return -3;
+    }
+
+#ifdef USE_SEMAPHORE
+    fshare_sem_write_lock(&ring);
+#endif
+    fshare_detect_offset(&ring);
+    while (fshare_read_index(&ring, NULL, &buf_idx_end) != 0) {
+        usleep(1000);
+    }
+    buf_idx_end_prev = buf_idx_end;
+#ifdef USE_SEMAPHORE
+    fshare_sem_write_unlock();
+#endif
+
+    if ((ring.header_size == FRAME_HEADER_SIZE_AUTODETECT) && (debug)) fprintf(stderr, "detecting frame header size\n");
+    while (fshare_detect_header_size(&ring) == FRAME_HEADER_SIZE_AUTODETECT) {
+        usleep(1000);
+    }
+    if (debug) fprintf(stderr, "offset = %d - frame header size = %d - size = %d\n", ring.offset, ring.header_size, ring.size);
+
+    if (strcmp(output, "-") == 0) {
+        fOut = stdout;
+    } else {
+        fOut = fopen(output, "w");
+        if (fOut == NULL) {
+            fprintf(stderr, "error - could not open %s\n", output);
+            fshare_close(&ring);
+            return -4;
+        }
+    }
+
+    memcpy(ch.magic, FSHARE_CAPTURE_MAGIC, sizeof(ch.magic));
+    ch.version = FSHARE_CAPTURE_VERSION;
+    ch.offset = ring.offset;
+    ch.header_size = ring.header_size;
+    ch.size = ring.size;
+    fwrite(&ch, sizeof(ch), 1, fOut);
+
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+
+    if (fshare_scan_init(&scan, &ring) != 0) {
+        fshare_close(&ring);
+        return -5;
+    }
+    fshare_wait_init(&wait, &ring);
+    start = fshare_time_us();
+    frames = 0;
+    lost = 0;
+    last_counter = 0;
+
+    while (!stop) {
+        if ((max_frames > 0) && (frames >= max_frames)) break;
+        if ((seconds > 0) && (fshare_time_us() - start >= seconds * 1000000LL)) break;
+
+#ifdef USE_SEMAPHORE
+        fshare_sem_write_lock(&ring);
+#endif
+        if (fshare_read_index(&ring, &buf_idx_start, &buf_idx_end) != 0) {
+#ifdef USE_SEMAPHORE
+            fshare_sem_write_unlock();
+#endif
+            usleep(1000);
+            continue;
+        }
+        if (buf_idx_end == buf_idx_end_prev) {
+#ifdef USE_SEMAPHORE
+            fshare_sem_write_unlock();
+#endif
+            fshare_wait_next(&wait, 100000);
+            continue;
+        }
+
+        n = fshare_scan_frames(&scan, buf_idx_end_prev, buf_idx_start, buf_idx_end);
+        buf_idx_end_prev = scan.next;
+#ifdef USE_SEMAPHORE
+        fshare_sem_write_unlock();
+#endif
+
+        if (n <= 0) {
+            if ((n < 0) && (debug)) fprintf(stderr, "sync lost\n");
+            fshare_wait_next(&wait, 100000);
+            continue;
+        }
+
+        for (i = 0; i < n; i++) {
+            if ((frames > 0) && (scan.frames[i].counter > last_counter + 1)) lost += scan.frames[i].counter - (last_counter + 1);
+            last_counter = scan.frames[i].counter;
+            if (write_frame(fOut, &ring, &scan.frames[i]) != 0) {
+                fprintf(stderr, "error - could not write to %s\n", output);
+                stop = 1;
+                break;
+            }
+            frames++;
+            if (debug) fprintf(stderr, "frame %u - type 0x%04x - len %u - time %u\n", scan.frames[i].counter, scan.frames[i].type, scan.frames[i].len, scan.frames[i].time);
+            if ((max_frames > 0) && (frames >= max_frames)) break;
+        }
+    }
+
+    fprintf(stderr, "%u frames captured, %u lost, in %.1f s\n", frames, lost, (fshare_time_us() - start) / 1000000.0);
+
+    fshare_wait_close(&wait);
+    fshare_scan_free(&scan);
+    if (fOut != stdout) fclose(fOut);
+    else fflush(fOut);
+    fshare_close(&ring);
+#ifdef USE_SEMAPHORE
+    fshare_sem_close();
+#endif
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Watch /dev/shm/fshare_frame_buf and wake up all the readers with a futex
+ * when new data is written.
+ * Only one process polls the ring, the others sleep until they are woken.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <getopt.h>
+#include <signal.h>
+
+#include "fshare.h"
+
+int debug;
+
+void sig_handler(int signum)
+{
+    shm_unlink(FSHARE_NOTIFY_SHM);
+    exit(EXIT_SUCCESS);
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [-d]\n\n", progname);
+    fprintf(stderr, "\t-d, --debug\n");
+    fprintf(stderr, "\t\tenable debug\n");
+}
+
+int main(int argc, char **argv) {
+    fshare_ring ring;
+    fshare_wait w;
+    fshare_notify_s *notify;
+    int fd, c;
+
+    debug = 0;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "dh",
+                         long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'd':
+            fprintf (stderr, "debug on\n");
+            debug = 1;
+            break;
+
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    // Only the write index is used, offset and header size are not needed
+    if (fshare_open(&ring, FRAME_OFFSET_AUTODETECT, FRAME_HEADER_SIZE_AUTODETECT) != 0) {
+        return -2;
+    }
+
+    // Init the wait before creating the futex word, the notifier polls the ring
+    fshare_wait_init(&w, &ring);
+    fshare_wait_close(&w);
+
+    fd = shm_open(FSHARE_NOTIFY_SHM, O_RDWR | O_CREAT, 0666);
+    if (fd == -1) {
+        fprintf(stderr, "error - could not create %s\n", FSHARE_NOTIFY_SHM);
+        fshare_close(&ring);
+        return -3;
+    }
+    if (ftruncate(fd, sizeof(fshare_notify_s)) != 0) {
+        fprintf(stderr, "error - could not set size of %s\n", FSHARE_NOTIFY_SHM);
+        close(fd);
+        fshare_close(&ring);
+        return -3;
+    }
+    notify = (fshare_notify_s *) mmap(NULL, sizeof(fshare_notify_s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (notify == MAP_FAILED) {
+        fprintf(stderr, "error - mapping %s\n", FSHARE_NOTIFY_SHM);
+        shm_unlink(FSHARE_NOTIFY_SHM);
+        fshare_close(&ring);
+        return -3;
+    }
+
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+
+    // The readers ignore the futex if the heartbeat stops
+    notify->pid = getpid();
+    notify->time = fshare_time_us();
+    __atomic_store_n(&notify->heartbeat, notify->time, __ATOMIC_RELAXED);
+
+    while (1) {
+        if (fshare_wait_next(&w, FSHARE_NOTIFY_HEARTBEAT) == 1) {
+            notify->time = fshare_time_us();
+            __atomic_store_n(&notify->heartbeat, notify->time, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&notify->seq, 1, __ATOMIC_RELEASE);
+            syscall(SYS_futex, &notify->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        } else {
+            __atomic_store_n(&notify->heartbeat, fshare_time_us(), __ATOMIC_RELAXED);
+        }
+        if (debug) fshare_wait_stats(&w, "fshare_notify", 0);
+    }
+
+    // Unreacheable path
+    munmap(notify, sizeof(fshare_notify_s));
+    shm_unlink(FSHARE_NOTIFY_SHM);
+    fshare_close(&ring);
+
+    return 0;
+}
@@ -0,0 +1,761 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Create /dev/shm/fshare_frame_buf and fill it like the camera firmware,
+ * replaying a file written by fshare_capture or with synthetic frames.
+ * It runs on a host without camera:
+ *     make CC=gcc AR=ar STRIP=strip OPTS= fshare_producer
+ * then start h264grabber, rRTSPServer or imggrabber with the same model.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fshare.h"
+
+#define RING_SIZE_DEFAULT 2097152
+#define FRAME_SIZE_MAX 524288
+
+#define STREAM_HIGH 0
+#define STREAM_LOW 1
+#define STREAM_AUDIO 2
+#define STREAMS 3
+
+#define RESOLUTION_LOW 360
+#define RESOLUTION_HIGH 1080
+#define RESOLUTION_BOTH 1440
+
+#define AUDIO_INTERVAL 64000                // us, 1024 samples at 16 kHz
+
+#define FSHARE_TYPE_PREFIX 0x0020
+#define FSHARE_TYPE_HEVC 0x0040
+
+typedef struct
+{
+    int enabled;
+    unsigned int type;                      // FSHARE_TYPE_HIGH, FSHARE_TYPE_LOW or FSHARE_TYPE_AAC
+    unsigned int width;
+    unsigned int height;
+    unsigned int idr_size;
+    unsigned int p_size;
+    long long interval;                     // us
+    long long next;                         // us, time of the next picture
+    unsigned int pictures;
+    unsigned int step;                      // position in the parameter sets + IDR sequence
+    uint16_t stream_counter;
+} synth_stream;
+
+unsigned char SPS4_LOW[] =  {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x14,
+                             0x96, 0x54, 0x05, 0x01, 0x7B, 0xCB, 0x37, 0x01,
+                             0x01, 0x01, 0x02};
+unsigned char SPS4_HIGH[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
+                             0x96, 0x54, 0x03, 0xC0, 0x11, 0x2F, 0x2C, 0xDC,
+                             0x04, 0x04, 0x04, 0x08};
+unsigned char PPS4[] =      {0x00, 0x00, 0x00, 0x01, 0x68, 0xEE, 0x3C, 0x80};
+unsigned char VPS5[] =      {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
+                             0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
+                             0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+                             0x00, 0x7B, 0xAC, 0x09};
+unsigned char SPS5[] =      {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
+                             0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
+                             0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x7B, 0xA0,
+                             0x03, 0xC0, 0x80, 0x10, 0xE7, 0xF9, 0x6B, 0xB9,
+                             0x12, 0x20, 0xB2, 0xFC, 0xF3, 0xCF, 0x3C, 0xF3,
+                             0xCF, 0x3C, 0xF3, 0xCF, 0x3C, 0xF3, 0xCF, 0x3C,
+                             0xF3, 0xCB, 0x73, 0x70, 0x10, 0x10, 0x10, 0x08};
+unsigned char PPS5[] =      {0x00, 0x00, 0x00, 0x01, 0x44, 0x01, 0xC1, 0x72,
+                             0xB4, 0x62, 0x40};
+
+int debug;
+volatile int stop;
+
+fshare_ring ring;
+uint32_t ring_start, ring_len, ring_end;    // indices of the circular area
+int use_sem;
+sem_t *sem_read_lock = SEM_FAILED;
+sem_t *sem_write_lock = SEM_FAILED;
+
+// Synthetic frames
+synth_stream streams[STREAMS];
+int codec_high;
+unsigned int gop;
+unsigned char filler[FRAME_SIZE_MAX];
+
+// Replay
+FILE *fIn;
+long capture_start;
+double speed;
+int loop;
+long long replay_base;                      // us, -1 before the 1st frame
+int replay_restart;                         // the next frame starts the file again
+uint32_t replay_first;                      // ms, time of the 1st frame of the file
+uint32_t replay_last;
+
+void sig_handler(int signum)
+{
+    stop = 1;
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [-m MODEL] [-o OFFSET] [-s HEADER_SIZE] [-S SIZE] [-f FILE [-x SPEED] [-l]]\n", progname);
+    fprintf(stderr, "\t[-r FPS] [-g GOP] [-R RES] [-c CODEC] [-a] [-b BURST] [-j JITTER] [-p LOSS] [-n FRAMES] [-L] [-k] [-d]\n\n");
+    fprintf(stderr, "\t-m MODEL, --model MODEL\n");
+    fprintf(stderr, "\t\tring layout of the model (default y20ga, or the layout of the file)\n");
+    fprintf(stderr, "\t-o OFFSET, --offset OFFSET\n");
+    fprintf(stderr, "\t\toffset of the circular area\n");
+    fprintf(stderr, "\t-s HEADER_SIZE, --header HEADER_SIZE\n");
+    fprintf(stderr, "\t\tframe header size: 22, 24, 26 or 28\n");
+    fprintf(stderr, "\t-S SIZE, --size SIZE\n");
+    fprintf(stderr, "\t\tsize of the shm object (default %d)\n", RING_SIZE_DEFAULT);
+    fprintf(stderr, "\t-f FILE, --file FILE\n");
+    fprintf(stderr, "\t\treplay a file written by fshare_capture (default synthetic frames)\n");
+    fprintf(stderr, "\t-x SPEED, --speed SPEED\n");
+    fprintf(stderr, "\t\treplay speed (default 1.0)\n");
+    fprintf(stderr, "\t-l, --loop\n");
+    fprintf(stderr, "\t\treplay the file in a loop\n");
+    fprintf(stderr, "\t-r FPS, --fps FPS\n");
+    fprintf(stderr, "\t\tsynthetic video frame rate (default 20)\n");
+    fprintf(stderr, "\t-g GOP, --gop GOP\n");
+    fprintf(stderr, "\t\tsynthetic frames between 2 IDR (default 40)\n");
+    fprintf(stderr, "\t-R RES, --resolution RES\n");
+    fprintf(stderr, "\t\tsynthetic streams: LOW, HIGH or BOTH (default BOTH)\n");
+    fprintf(stderr, "\t-c CODEC, --codec CODEC\n");
+    fprintf(stderr, "\t\tcodec of the synthetic high stream: h264 or h265 (default h264)\n");
+    fprintf(stderr, "\t-a, --audio\n");
+    fprintf(stderr, "\t\tadd synthetic AAC frames\n");
+    fprintf(stderr, "\t-b BURST, --burst BURST\n");
+    fprintf(stderr, "\t\tupdate the write index every BURST frames (default 1)\n");
+    fprintf(stderr, "\t-j JITTER, --jitter JITTER\n");
+    fprintf(stderr, "\t\trandom delay up to JITTER us before each index update (default 0)\n");
+    fprintf(stderr, "\t-p LOSS, --loss LOSS\n");
+    fprintf(stderr, "\t\tdon't write LOSS frames out of 1000, their counters are used (default 0)\n");
+    fprintf(stderr, "\t-n FRAMES, --frames FRAMES\n");
+    fprintf(stderr, "\t\tstop after FRAMES frames (default 0, no limit)\n");
+    fprintf(stderr, "\t-L, --lock\n");
+    fprintf(stderr, "\t\tcreate the %s and %s semaphores and use them\n", READ_LOCK_FILE, WRITE_LOCK_FILE);
+    fprintf(stderr, "\t-k, --keep\n");
+    fprintf(stderr, "\t\tdon't remove the shm object at exit\n");
+    fprintf(stderr, "\t-d, --debug\n");
+    fprintf(stderr, "\t\tenable debug\n");
+}
+
+long long time_us()
+{
+    return fshare_time_us();
+}
+
+void sleep_until(long long us)
+{
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while ((clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) && (!stop));
+}
+
+/* Ring writer */
+
+int ring_create(unsigned int size, unsigned int offset, unsigned int header_size)
+{
+    int fshm;
+
+    fshm = shm_open(BUFFER_SHM, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fshm == -1) {
+        fprintf(stderr, "error - could not create %s\n", BUFFER_FILE);
+        return -1;
+    }
+    if (ftruncate(fshm, size) != 0) {
+        fprintf(stderr, "error - could not set size of %s\n", BUFFER_FILE);
+        close(fshm);
+        return -2;
+    }
+    ring.addr = (unsigned char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fshm, 0);
+    close(fshm);
+    if (ring.addr == MAP_FAILED) {
+        fprintf(stderr, "error - mapping file %s\n", BUFFER_FILE);
+        ring.addr = NULL;
+        return -3;
+    }
+    ring.size = size;
+    ring.offset = offset;
+    ring.header_size = header_size;
+    memset(ring.addr, 0, size);
+
+    ring_start = 0;
+    ring_len = 0;
+    ring_end = 0;
+
+    return 0;
+}
+
+uint32_t ring_put(uint32_t idx, unsigned char *data, unsigned int n)
+{
+    unsigned int capacity = ring.size - ring.offset;
+    unsigned int tail = capacity - idx;
+
+    if (n > tail) {
+        memcpy(ring.addr + ring.offset + idx, data, tail);
+        memcpy(ring.addr + ring.offset, data + tail, n - tail);
+    } else {
+        memcpy(ring.addr + ring.offset + idx, data, n);
+    }
+    idx += n;
+    if (idx >= capacity) idx -= capacity;
+
+    return idx;
+}
+
+void ring_lock()
+{
+    int busy = 1;
+
+    if (!use_sem) return;
+    sem_wait(sem_write_lock);
+    // Readers back off while the word at addr is not 0
+    sem_wait(sem_read_lock);
+    memcpy(ring.addr, &busy, sizeof(busy));
+    sem_post(sem_read_lock);
+}
+
+void ring_unlock()
+{
+    int busy = 0;
+
+    if (!use_sem) return;
+    sem_wait(sem_read_lock);
+    memcpy(ring.addr, &busy, sizeof(busy));
+    sem_post(sem_read_lock);
+    sem_post(sem_write_lock);
+}
+
+/* Write a frame after the end, dropping the oldest frames to make room */
+int ring_write(struct frame_header *fh, unsigned char *data)
+{
+    struct frame_header old;
+    unsigned int capacity = ring.size - ring.offset;
+    unsigned int n = ring.header_size + fh->len;
+
+    if (n >= capacity) return -1;
+
+    while (ring_len + n > capacity) {
+        fshare_header_read(&ring, &old, ring.addr + ring.offset + ring_start);
+        ring_start += ring.header_size + old.len;
+        if (ring_start >= capacity) ring_start -= capacity;
+        ring_len -= ring.header_size + old.len;
+    }
+
+    fshare_header_write(&ring, ring.addr + ring.offset + ring_end, fh);
+    ring_end += ring.header_size;
+    if (ring_end >= capacity) ring_end -= capacity;
+    ring_end = ring_put(ring_end, data, fh->len);
+    ring_len += n;
+
+    return 0;
+}
+
+/* Update the index words: start at +16, length at +4, end check at +12 */
+void ring_publish()
+{
+    memcpy(ring.addr + 16, &ring_start, sizeof(ring_start));
+    memcpy(ring.addr + 4, &ring_len, sizeof(ring_len));
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(ring.addr + 12, &ring_end, sizeof(ring_end));
+}
+
+/* Synthetic frames */
+
+void synth_init(int resolution, int audio, unsigned int fps)
+{
+    int i;
+
+    memset(streams, 0, sizeof(streams));
+    streams[STREAM_HIGH].enabled = (resolution != RESOLUTION_LOW);
+    streams[STREAM_HIGH].type = FSHARE_TYPE_HIGH;
+    streams[STREAM_HIGH].width = 1920;
+    streams[STREAM_HIGH].height = 1080;
+    streams[STREAM_HIGH].idr_size = 80000;
+    streams[STREAM_HIGH].p_size = 12000;
+    streams[STREAM_LOW].enabled = (resolution != RESOLUTION_HIGH);
+    streams[STREAM_LOW].type = FSHARE_TYPE_LOW;
+    streams[STREAM_LOW].width = 640;
+    streams[STREAM_LOW].height = 360;
+    streams[STREAM_LOW].idr_size = 20000;
+    streams[STREAM_LOW].p_size = 3000;
+    streams[STREAM_AUDIO].enabled = audio;
+    streams[STREAM_AUDIO].type = FSHARE_TYPE_AAC;
+    streams[STREAM_AUDIO].interval = AUDIO_INTERVAL;
+
+    for (i = 0; i < STREAMS; i++) {
+        if (i != STREAM_AUDIO) streams[i].interval = 1000000 / fps;
+        streams[i].next = time_us() + i * 1000;
+    }
+
+    // Payload without start codes
+    for (i = 0; i < FRAME_SIZE_MAX; i++) filler[i] = 1 + rand() % 255;
+}
+
+unsigned int synth_size(unsigned int size)
+{
+    // +/- 20%
+    return size * 4 / 5 + rand() % (size * 2 / 5 + 1);
+}
+
+unsigned int synth_nal(unsigned char *buf, unsigned char *nal, unsigned int nal_size, unsigned int size)
+{
+    memcpy(buf, nal, nal_size);
+    memcpy(buf + nal_size, filler, size - nal_size);
+
+    return size;
+}
+
+/*
+ * Next synthetic frame: parameter sets and IDR at the start of each GOP,
+ * then P frames. Return its time (us), -1 if no stream is enabled.
+ */
+long long synth_next(struct frame_header *fh, unsigned char *buf)
+{
+    static unsigned char IDR4_NAL[] = {0x00, 0x00, 0x00, 0x01, 0x65, 0x88};
+    static unsigned char P4_NAL[] = {0x00, 0x00, 0x00, 0x01, 0x41, 0x9A};
+    static unsigned char IDR5_NAL[] = {0x00, 0x00, 0x00, 0x01, 0x26, 0x01};
+    static unsigned char P5_NAL[] = {0x00, 0x00, 0x00, 0x01, 0x02, 0x01};
+    synth_stream *s = NULL;
+    unsigned int len, type, fps, i;
+    int h265;
+    uint16_t u;
+
+    for (i = 0; i < STREAMS; i++) {
+        if ((streams[i].enabled) && ((s == NULL) || (streams[i].next < s->next))) s = &streams[i];
+    }
+    if (s == NULL) return -1;
+
+    type = s->type;
+    if (s->type == FSHARE_TYPE_AAC) {
+        // ADTS, AAC LC, 16 kHz, mono
+        len = synth_size(300);
+        buf[0] = 0xFF;
+        buf[1] = 0xF1;
+        buf[2] = 0x60;
+        buf[3] = 0x40 | ((len >> 11) & 0x03);
+        buf[4] = (len >> 3) & 0xFF;
+        buf[5] = ((len & 0x07) << 5) | 0x1F;
+        buf[6] = 0xFC;
+        memcpy(buf + 7, filler, len - 7);
+        s->step = 0;
+    } else {
+        h265 = ((s == &streams[STREAM_HIGH]) && (codec_high == CODEC_H265));
+        if (h265) type |= FSHARE_TYPE_HEVC;
+        // Sequence at the start of a GOP: (VPS) SPS PPS IDR
+        if ((s->pictures % gop == 0) && (s->step == 0) && (!h265)) s->step = 1;
+        if ((s->pictures % gop) != 0) {
+            len = synth_nal(buf, h265 ? P5_NAL : P4_NAL, sizeof(P4_NAL), synth_size(s->p_size));
+            s->step = 0;
+        } else if (s->step == 0) {
+            type |= FSHARE_TYPE_VPS;
+            len = synth_nal(buf, VPS5, sizeof(VPS5), sizeof(VPS5));
+            s->step = 1;
+        } else if (s->step == 1) {
+            // FPS, width and height prefix
+            type |= FSHARE_TYPE_SPS | FSHARE_TYPE_PREFIX;
+            fps = 1000000 / s->interval;
+            u = fps;
+            memcpy(buf, &u, sizeof(u));
+            u = s->width;
+            memcpy(buf + 2, &u, sizeof(u));
+            u = s->height;
+            memcpy(buf + 4, &u, sizeof(u));
+            if (h265) {
+                len = FSHARE_SPS_PREFIX_SIZE + synth_nal(buf + FSHARE_SPS_PREFIX_SIZE, SPS5, sizeof(SPS5), sizeof(SPS5));
+            } else if (s == &streams[STREAM_HIGH]) {
+                len = FSHARE_SPS_PREFIX_SIZE + synth_nal(buf + FSHARE_SPS_PREFIX_SIZE, SPS4_HIGH, sizeof(SPS4_HIGH), sizeof(SPS4_HIGH));
+            } else {
+                len = FSHARE_SPS_PREFIX_SIZE + synth_nal(buf + FSHARE_SPS_PREFIX_SIZE, SPS4_LOW, sizeof(SPS4_LOW), sizeof(SPS4_LOW));
+            }
+            s->step = 2;
+        } else if (s->step == 2) {
+            type |= FSHARE_TYPE_PPS;
+            if (h265) len = synth_nal(buf, PPS5, sizeof(PPS5), sizeof(PPS5));
+            else len = synth_nal(buf, PPS4, sizeof(PPS4), sizeof(PPS4));
+            s->step = 3;
+        } else {
+            type |= FSHARE_TYPE_IDR;
+            len = synth_nal(buf, h265 ? IDR5_NAL : IDR4_NAL, sizeof(IDR4_NAL), synth_size(s->idr_size));
+            s->step = 0;
+        }
+    }
+
+    fh->len = len;
+    fh->type = type;
+    fh->time = s->next / 1000;
+    fh->stream_counter = s->stream_counter++;
+
+    // The parameter sets have the time of their IDR
+    if (s->step == 0) {
+        s->pictures++;
+        s->next += s->interval;
+        return s->next - s->interval;
+    }
+
+    return s->next;
+}
+
+/* Replay */
+
+int replay_open(char *file, struct fshare_capture_header *ch)
+{
+    fIn = fopen(file, "r");
+    if (fIn == NULL) {
+        fprintf(stderr, "error - could not open %s\n", file);
+        return -1;
+    }
+    if ((fread(ch, sizeof(struct fshare_capture_header), 1, fIn) != 1) ||
+            (memcmp(ch->magic, FSHARE_CAPTURE_MAGIC, sizeof(ch->magic)) != 0) ||
+            (ch->version != FSHARE_CAPTURE_VERSION)) {
+        fprintf(stderr, "error - %s is not a capture file\n", file);
+        fclose(fIn);
+        return -2;
+    }
+    capture_start = ftell(fIn);
+    replay_base = -1;
+    replay_restart = 0;
+
+    return 0;
+}
+
+/*
+ * Next frame of the file. Return its time (us) scaled by the speed,
+ * -1 at the end of the file.
+ */
+long long replay_next(struct frame_header *fh, unsigned char *buf)
+{
+    long long t;
+
+    while (1) {
+        if (fread(fh, sizeof(struct frame_header), 1, fIn) == 1) break;
+        if ((!loop) || (replay_base < 0)) return -1;
+        // Start again after the last frame
+        fseek(fIn, capture_start, SEEK_SET);
+        replay_base += (long long) ((replay_last - replay_first) * 1000.0 / speed) + 50000;
+        replay_restart = 1;
+    }
+    if ((fh->len > FRAME_SIZE_MAX) || (fread(buf, 1, fh->len, fIn) != fh->len)) {
+        fprintf(stderr, "error - truncated capture file\n");
+        return -1;
+    }
+
+    if (replay_base < 0) {
+        replay_base = time_us();
+        replay_first = fh->time;
+    } else if (replay_restart) {
+        // 1st frame after a restart, replay_base already follows the last frame
+        replay_restart = 0;
+        replay_first = fh->time;
+    }
+    replay_last = fh->time;
+    t = replay_base + (long long) ((int32_t) (fh->time - replay_first) * 1000.0 / speed);
+    fh->time = t / 1000;
+
+    return t;
+}
+
+int main(int argc, char **argv) {
+    struct fshare_capture_header ch;
+    struct frame_header fh;
+    unsigned char *buf;
+    unsigned int buf_offset, frame_header_size, size, fps, burst, jitter, max_frames;
+    unsigned int frames, pending, counter, loss;
+    unsigned long long bytes;
+    int layout_set, size_set, resolution, audio, keep, c, ret;
+    char *file;
+    long long t, start;
+
+    buf_offset = BUF_OFFSET_Y20GA;
+    frame_header_size = FRAME_HEADER_SIZE_Y20GA;
+    layout_set = 0;
+    size = RING_SIZE_DEFAULT;
+    size_set = 0;
+    file = NULL;
+    speed = 1.0;
+    loop = 0;
+    fps = 20;
+    gop = 40;
+    resolution = RESOLUTION_BOTH;
+    codec_high = CODEC_H264;
+    audio = 0;
+    burst = 1;
+    jitter = 0;
+    max_frames = 0;
+    loss = 0;
+    use_sem = 0;
+    keep = 0;
+    debug = 0;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"model",  required_argument, 0, 'm'},
+            {"offset",  required_argument, 0, 'o'},
+            {"header",  required_argument, 0, 's'},
+            {"size",  required_argument, 0, 'S'},
+            {"file",  required_argument, 0, 'f'},
+            {"speed",  required_argument, 0, 'x'},
+            {"loop",  no_argument, 0, 'l'},
+            {"fps",  required_argument, 0, 'r'},
+            {"gop",  required_argument, 0, 'g'},
+            {"resolution",  required_argument, 0, 'R'},
+            {"codec",  required_argument, 0, 'c'},
+            {"audio",  no_argument, 0, 'a'},
+            {"burst",  required_argument, 0, 'b'},
+            {"jitter",  required_argument, 0, 'j'},
+            {"loss",  required_argument, 0, 'p'},
+            {"frames",  required_argument, 0, 'n'},
+            {"lock",  no_argument, 0, 'L'},
+            {"keep",  no_argument, 0, 'k'},
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "m:o:s:S:f:x:lr:g:R:c:ab:j:p:n:Lkdh",
+                         long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'm':
+            if (fshare_model_layout(optarg, &buf_offset, &frame_header_size) != 0) {
+                fprintf(stderr, "unknown model %s\n", optarg);
+                return -1;
+            }
+            layout_set = 1;
+            break;
+
+        case 'o':
+            buf_offset = atoi(optarg);
+            layout_set = 1;
+            break;
+
+        case 's':
+            frame_header_size = atoi(optarg);
+            layout_set = 1;
+            break;
+
+        case 'S':
+            size = atoi(optarg);
+            size_set = 1;
+            break;
+
+        case 'f':
+            file = optarg;
+            break;
+
+        case 'x':
+            speed = atof(optarg);
+            break;
+
+        case 'l':
+            loop = 1;
+            break;
+
+        case 'r':
+            fps = atoi(optarg);
+            break;
+
+        case 'g':
+            gop = atoi(optarg);
+            break;
+
+        case 'R':
+            if (strcasecmp("low", optarg) == 0) {
+                resolution = RESOLUTION_LOW;
+            } else if (strcasecmp("high", optarg) == 0) {
+                resolution = RESOLUTION_HIGH;
+            } else if (strcasecmp("both", optarg) == 0) {
+                resolution = RESOLUTION_BOTH;
+            }
+            break;
+
+        case 'c':
+            if (strcasecmp("h265", optarg) == 0) codec_high = CODEC_H265;
+            else codec_high = CODEC_H264;
+            break;
+
+        case 'a':
+            audio = 1;
+            break;
+
+        case 'b':
+            burst = atoi(optarg);
+            break;
+
+        case 'j':
+            jitter = atoi(optarg);
+            break;
+
+        case 'p':
+            loss = atoi(optarg);
+            break;
+
+        case 'n':
+            max_frames = atoi(optarg);
+            break;
+
+        case 'L':
+            use_sem = 1;
+            break;
+
+        case 'k':
+            keep = 1;
+            break;
+
+        case 'd':
+            fprintf (stderr, "debug on\n");
+            debug = 1;
+            break;
+
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (file != NULL) {
+        if (replay_open(file, &ch) != 0) return -2;
+        if (!layout_set) {
+            buf_offset = ch.offset;
+            frame_header_size = ch.header_size;
+        }
+        if (!size_set) size = ch.size;
+    }
+
+    if ((frame_header_size != sizeof(struct frame_header_22)) && (frame_header_size != sizeof(struct frame_header_24)) &&
+            (frame_header_size != sizeof(struct frame_header_26)) && (frame_header_size != sizeof(struct frame_header_28))) {
+        fprintf(stderr, "error - wrong header size %d\n", frame_header_size);
+        return -1;
+    }
+    if ((buf_offset < 20) || (size <= buf_offset + 2 * FRAME_SIZE_MAX) || (fps == 0) || (fps > 1000) ||
+            (gop == 0) || (burst == 0) || (speed <= 0)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    if (ring_create(size, buf_offset, frame_header_size) != 0) return -3;
+    if (debug) fprintf(stderr, "%s created - size %d - offset %d - header size %d\n", BUFFER_FILE, size, buf_offset, frame_header_size);
+
+    if (use_sem) {
+        sem_read_lock = sem_open(READ_LOCK_FILE, O_RDWR | O_CREAT, 0666, 1);
+        sem_write_lock = sem_open(WRITE_LOCK_FILE, O_RDWR | O_CREAT, 0666, 1);
+        if ((sem_read_lock == SEM_FAILED) || (sem_write_lock == SEM_FAILED)) {
+            fprintf(stderr, "error - could not create semaphores\n");
+            return -4;
+        }
+    }
+
+    buf = (unsigned char *) malloc(FRAME_SIZE_MAX);
+    if (buf == NULL) {
+        fprintf(stderr, "error - could not allocate frame buffer\n");
+        return -5;
+    }
+
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+
+    srand(1);
+    if (file == NULL) synth_init(resolution, audio, fps);
+
+    start = time_us();
+    frames = 0;
+    pending = 0;
+    counter = 0;
+    bytes = 0;
+    memset(&fh, 0, sizeof(fh));
+
+    while ((!stop) && ((max_frames == 0) || (frames < max_frames))) {
+        if (file != NULL) t = replay_next(&fh, buf);
+        else t = synth_next(&fh, buf);
+        if (t < 0) break;
+
+        sleep_until(t);
+        counter++;
+        if ((loss > 0) && (rand() % 1000 < loss)) continue;
+
+        // The frames are written at their time, the readers see them every BURST frames
+        ring_lock();
+        fh.counter = counter;
+        ret = ring_write(&fh, buf);
+        ring_unlock();
+        if (ret != 0) {
+            fprintf(stderr, "error - frame too big for the ring: %d\n", fh.len);
+            continue;
+        }
+        frames++;
+        bytes += fh.len;
+        pending++;
+        if (debug) fprintf(stderr, "frame %u - type 0x%04x - len %u - time %u\n", fh.counter, fh.type, fh.len, fh.time);
+
+        if (pending >= burst) {
+            if (jitter > 0) sleep_until(time_us() + rand() % (jitter + 1));
+            ring_lock();
+            ring_publish();
+            ring_unlock();
+            pending = 0;
+        }
+    }
+    if (pending > 0) {
+        ring_lock();
+        ring_publish();
+        ring_unlock();
+    }
+
+    t = time_us() - start;
+    fprintf(stderr, "%u frames written, %llu bytes, in %.1f s - %.1f frames/s\n",
+            frames, bytes, t / 1000000.0, (t > 0) ? frames * 1000000.0 / t : 0);
+
+    // Let the readers get the last frames
+    while ((keep == 0) && (!stop)) pause();
+
+    free(buf);
+    if (fIn != NULL) fclose(fIn);
+    munmap(ring.addr, ring.size);
+    if (!keep) shm_unlink(BUFFER_SHM);
+    if (use_sem) {
+        sem_close(sem_read_lock);
+        sem_close(sem_write_lock);
+        if (!keep) {
+            sem_unlink(READ_LOCK_FILE);
+            sem_unlink(WRITE_LOCK_FILE);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,621 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SPS/VPS timing info rewriter.
+ * The NAL is unescaped, parsed up to the VUI timing info and written back
+ * with the timing info of the frame rate measured on the ring: the bits
+ * before and after the timing info are copied as they are.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fshare.h"
+
+typedef struct
+{
+    unsigned char *buf;
+    unsigned int size;                      // bits
+    unsigned int pos;                       // bits
+    int error;
+} bitstream;
+
+static void bs_init(bitstream *bs, unsigned char *buf, unsigned int size)
+{
+    bs->buf = buf;
+    bs->size = size;
+    bs->pos = 0;
+    bs->error = 0;
+}
+
+static uint32_t bs_read(bitstream *bs, int n)
+{
+    uint32_t v = 0;
+
+    while (n-- > 0) {
+        if (bs->pos >= bs->size) {
+            bs->error = 1;
+            return 0;
+        }
+        v = (v << 1) | ((bs->buf[bs->pos >> 3] >> (7 - (bs->pos & 7))) & 1);
+        bs->pos++;
+    }
+
+    return v;
+}
+
+static void bs_skip(bitstream *bs, unsigned int n)
+{
+    if (bs->pos + n > bs->size) {
+        bs->error = 1;
+        bs->pos = bs->size;
+    } else {
+        bs->pos += n;
+    }
+}
+
+// Exp-Golomb unsigned
+static uint32_t bs_read_ue(bitstream *bs)
+{
+    int zeros = 0;
+
+    while (bs_read(bs, 1) == 0) {
+        if ((bs->error) || (++zeros > 31)) {
+            bs->error = 1;
+            return 0;
+        }
+    }
+
+    return ((1U << zeros) - 1) + bs_read(bs, zeros);
+}
+
+// Exp-Golomb signed
+static int32_t bs_read_se(bitstream *bs)
+{
+    uint32_t k = bs_read_ue(bs);
+
+    return (k & 1) ? (int32_t) ((k + 1) / 2) : -(int32_t) (k / 2);
+}
+
+static void bs_write(bitstream *bs, uint32_t v, int n)
+{
+    while (n-- > 0) {
+        if (bs->pos >= bs->size) {
+            bs->error = 1;
+            return;
+        }
+        if ((v >> n) & 1) bs->buf[bs->pos >> 3] |= 0x80 >> (bs->pos & 7);
+        else bs->buf[bs->pos >> 3] &= ~(0x80 >> (bs->pos & 7));
+        bs->pos++;
+    }
+}
+
+static void bs_write_ue(bitstream *bs, uint32_t v)
+{
+    int len = 0;
+
+    while ((v + 1) >> (len + 1)) len++;
+    bs_write(bs, 0, len);
+    bs_write(bs, v + 1, len + 1);
+}
+
+// Copy the bits [from, to) of src
+static void bs_copy(bitstream *dst, bitstream *src, unsigned int from, unsigned int to)
+{
+    unsigned int pos = src->pos;
+
+    src->pos = from;
+    while ((src->pos + 32 <= to) && (!dst->error)) bs_write(dst, bs_read(src, 32), 32);
+    if (src->pos < to) bs_write(dst, bs_read(src, to - src->pos), to - src->pos);
+    src->pos = pos;
+}
+
+/*
+ * Remove the emulation prevention bytes.
+ * Return the length of the RBSP.
+ */
+static unsigned int nal_to_rbsp(unsigned char *src, unsigned int len, unsigned char *dest)
+{
+    unsigned int i, n = 0, zeros = 0;
+
+    for (i = 0; i < len; i++) {
+        if ((zeros >= 2) && (src[i] == 0x03)) {
+            zeros = 0;
+            continue;
+        }
+        dest[n++] = src[i];
+        zeros = (src[i] == 0x00) ? zeros + 1 : 0;
+    }
+
+    return n;
+}
+
+/*
+ * Insert the emulation prevention bytes.
+ * Return the length of the NAL payload, 0 if it doesn't fit.
+ */
+static unsigned int rbsp_to_nal(unsigned char *src, unsigned int len, unsigned char *dest, unsigned int size)
+{
+    unsigned int i, n = 0, zeros = 0;
+
+    for (i = 0; i < len; i++) {
+        if ((zeros >= 2) && (src[i] <= 0x03)) {
+            if (n >= size) return 0;
+            dest[n++] = 0x03;
+            zeros = 0;
+        }
+        if (n >= size) return 0;
+        dest[n++] = src[i];
+        zeros = (src[i] == 0x00) ? zeros + 1 : 0;
+    }
+
+    return n;
+}
+
+/*
+ * Timing info written in the NAL.
+ * H.264 counts fields: frame rate = time_scale / (2 * num_units_in_tick).
+ */
+static void h264_write_timing(bitstream *w, unsigned int fps)
+{
+    bs_write(w, FSHARE_TIMING_UNITS, 32);               // num_units_in_tick
+    bs_write(w, 2 * fps * FSHARE_TIMING_UNITS, 32);     // time_scale
+    bs_write(w, 1, 1);                                  // fixed_frame_rate_flag
+}
+
+static void h265_write_timing(bitstream *w, unsigned int fps)
+{
+    bs_write(w, FSHARE_TIMING_UNITS, 32);               // num_units_in_tick
+    bs_write(w, fps * FSHARE_TIMING_UNITS, 32);         // time_scale
+}
+
+static void h264_skip_scaling_list(bitstream *r, int size)
+{
+    int j, last = 8, next = 8;
+
+    for (j = 0; j < size; j++) {
+        if (next != 0) next = (last + bs_read_se(r) + 256) % 256;
+        if (next != 0) last = next;
+    }
+}
+
+static int h264_sps_set_timing(bitstream *r, bitstream *w, unsigned int fps)
+{
+    unsigned int profile_idc, chroma_format_idc, poc_type, n, i;
+    unsigned int mark;
+
+    profile_idc = bs_read(r, 8);
+    bs_skip(r, 16);                                     // constraint_set flags, level_idc
+    bs_read_ue(r);                                      // seq_parameter_set_id
+    if ((profile_idc == 100) || (profile_idc == 110) || (profile_idc == 122) ||
+            (profile_idc == 244) || (profile_idc == 44) || (profile_idc == 83) ||
+            (profile_idc == 86) || (profile_idc == 118) || (profile_idc == 128) ||
+            (profile_idc == 138) || (profile_idc == 139) || (profile_idc == 134) ||
+            (profile_idc == 135)) {
+        chroma_format_idc = bs_read_ue(r);
+        if (chroma_format_idc == 3) bs_skip(r, 1);      // separate_colour_plane_flag
+        bs_read_ue(r);                                  // bit_depth_luma_minus8
+        bs_read_ue(r);                                  // bit_depth_chroma_minus8
+        bs_skip(r, 1);                                  // qpprime_y_zero_transform_bypass_flag
+        if (bs_read(r, 1)) {                            // seq_scaling_matrix_present_flag
+            for (i = 0; i < ((chroma_format_idc != 3) ? 8 : 12); i++) {
+                if (bs_read(r, 1)) h264_skip_scaling_list(r, (i < 6) ? 16 : 64);
+            }
+        }
+    }
+    bs_read_ue(r);                                      // log2_max_frame_num_minus4
+    poc_type = bs_read_ue(r);
+    if (poc_type == 0) {
+        bs_read_ue(r);                                  // log2_max_pic_order_cnt_lsb_minus4
+    } else if (poc_type == 1) {
+        bs_skip(r, 1);                                  // delta_pic_order_always_zero_flag
+        bs_read_se(r);                                  // offset_for_non_ref_pic
+        bs_read_se(r);                                  // offset_for_top_to_bottom_field
+        n = bs_read_ue(r);
+        if (n > 255) return -1;
+        for (i = 0; (i < n) && (!r->error); i++) bs_read_se(r);
+    }
+    bs_read_ue(r);                                      // max_num_ref_frames
+    bs_skip(r, 1);                                      // gaps_in_frame_num_value_allowed_flag
+    bs_read_ue(r);                                      // pic_width_in_mbs_minus1
+    bs_read_ue(r);                                      // pic_height_in_map_units_minus1
+    if (bs_read(r, 1) == 0) bs_skip(r, 1);              // frame_mbs_only_flag, mb_adaptive_frame_field_flag
+    bs_skip(r, 1);                                      // direct_8x8_inference_flag
+    if (bs_read(r, 1)) {                                // frame_cropping_flag
+        for (i = 0; i < 4; i++) bs_read_ue(r);
+    }
+    if (r->error) return -1;
+
+    mark = r->pos;
+    if (bs_read(r, 1) == 0) {
+        // No VUI, add one with the timing info only
+        bs_copy(w, r, 0, mark);
+        bs_write(w, 1, 1);                              // vui_parameters_present_flag
+        bs_write(w, 0, 4);                              // aspect_ratio, overscan, video_signal_type, chroma_loc
+        bs_write(w, 1, 1);                              // timing_info_present_flag
+        h264_write_timing(w, fps);
+        bs_write(w, 0, 4);                              // nal_hrd, vcl_hrd, pic_struct, bitstream_restriction
+        bs_copy(w, r, r->pos, r->size);
+        return w->error ? -1 : 0;
+    }
+
+    if (bs_read(r, 1)) {                                // aspect_ratio_info_present_flag
+        if (bs_read(r, 8) == 255) bs_skip(r, 32);       // aspect_ratio_idc, sar_width, sar_height
+    }
+    if (bs_read(r, 1)) bs_skip(r, 1);                   // overscan_info_present_flag
+    if (bs_read(r, 1)) {                                // video_signal_type_present_flag
+        bs_skip(r, 4);
+        if (bs_read(r, 1)) bs_skip(r, 24);              // colour_description_present_flag
+    }
+    if (bs_read(r, 1)) {                                // chroma_loc_info_present_flag
+        bs_read_ue(r);
+        bs_read_ue(r);
+    }
+    if (r->error) return -1;
+
+    mark = r->pos;
+    bs_copy(w, r, 0, mark);
+    bs_write(w, 1, 1);                                  // timing_info_present_flag
+    h264_write_timing(w, fps);
+    // Replace the old timing info
+    if (bs_read(r, 1)) bs_skip(r, 65);
+    if (r->error) return -1;
+    bs_copy(w, r, r->pos, r->size);
+
+    return w->error ? -1 : 0;
+}
+
+static void h265_skip_profile_tier_level(bitstream *r, unsigned int max_sub_layers_minus1)
+{
+    unsigned int i, profile_present = 0, level_present = 0;
+
+    bs_skip(r, 96);                                     // general profile, tier and level
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        if (bs_read(r, 1)) profile_present |= 1 << i;
+        if (bs_read(r, 1)) level_present |= 1 << i;
+    }
+    if (max_sub_layers_minus1 > 0) bs_skip(r, 2 * (8 - max_sub_layers_minus1));
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        if (profile_present & (1 << i)) bs_skip(r, 88);
+        if (level_present & (1 << i)) bs_skip(r, 8);
+    }
+}
+
+static void h265_skip_sub_layer_ordering_info(bitstream *r, unsigned int max_sub_layers_minus1)
+{
+    unsigned int i;
+
+    for (i = (bs_read(r, 1) ? 0 : max_sub_layers_minus1); i <= max_sub_layers_minus1; i++) {
+        bs_read_ue(r);                                  // max_dec_pic_buffering_minus1
+        bs_read_ue(r);                                  // max_num_reorder_pics
+        bs_read_ue(r);                                  // max_latency_increase_plus1
+    }
+}
+
+static void h265_skip_scaling_list_data(bitstream *r)
+{
+    int size_id, matrix_id, i, n;
+
+    for (size_id = 0; size_id < 4; size_id++) {
+        for (matrix_id = 0; matrix_id < 6; matrix_id += (size_id == 3) ? 3 : 1) {
+            if (bs_read(r, 1) == 0) {                   // scaling_list_pred_mode_flag
+                bs_read_ue(r);                          // scaling_list_pred_matrix_id_delta
+            } else {
+                n = 1 << (4 + (size_id << 1));
+                if (n > 64) n = 64;
+                if (size_id > 1) bs_read_se(r);         // scaling_list_dc_coef_minus8
+                for (i = 0; (i < n) && (!r->error); i++) bs_read_se(r);
+            }
+        }
+    }
+}
+
+static int h265_skip_short_term_ref_pic_sets(bitstream *r, unsigned int num)
+{
+    unsigned int num_delta_pocs[64];
+    unsigned int i, j, n, neg, pos;
+
+    for (i = 0; i < num; i++) {
+        if ((i != 0) && (bs_read(r, 1))) {              // inter_ref_pic_set_prediction_flag
+            bs_skip(r, 1);                              // delta_rps_sign
+            bs_read_ue(r);                              // abs_delta_rps_minus1
+            // In the SPS the reference is always the previous set
+            n = 0;
+            for (j = 0; j <= num_delta_pocs[i - 1]; j++) {
+                if (bs_read(r, 1)) n++;                 // used_by_curr_pic_flag
+                else if (bs_read(r, 1)) n++;            // use_delta_flag
+            }
+            num_delta_pocs[i] = n;
+        } else {
+            neg = bs_read_ue(r);
+            pos = bs_read_ue(r);
+            if ((neg > 16) || (pos > 16)) return -1;
+            for (j = 0; j < neg + pos; j++) {
+                bs_read_ue(r);                          // delta_poc_minus1
+                bs_skip(r, 1);                          // used_by_curr_pic_flag
+            }
+            num_delta_pocs[i] = neg + pos;
+        }
+        if (r->error) return -1;
+    }
+
+    return 0;
+}
+
+static int h265_sps_set_timing(bitstream *r, bitstream *w, unsigned int fps)
+{
+    unsigned int max_sub_layers_minus1, log2_max_poc_lsb, n, i;
+    unsigned int mark;
+
+    bs_skip(r, 4);                                      // sps_video_parameter_set_id
+    max_sub_layers_minus1 = bs_read(r, 3);
+    bs_skip(r, 1);                                      // sps_temporal_id_nesting_flag
+    h265_skip_profile_tier_level(r, max_sub_layers_minus1);
+    bs_read_ue(r);                                      // sps_seq_parameter_set_id
+    if (bs_read_ue(r) == 3) bs_skip(r, 1);              // chroma_format_idc, separate_colour_plane_flag
+    bs_read_ue(r);                                      // pic_width_in_luma_samples
+    bs_read_ue(r);                                      // pic_height_in_luma_samples
+    if (bs_read(r, 1)) {                                // conformance_window_flag
+        for (i = 0; i < 4; i++) bs_read_ue(r);
+    }
+    bs_read_ue(r);                                      // bit_depth_luma_minus8
+    bs_read_ue(r);                                      // bit_depth_chroma_minus8
+    log2_max_poc_lsb = bs_read_ue(r) + 4;
+    if (log2_max_poc_lsb > 16) return -1;
+    h265_skip_sub_layer_ordering_info(r, max_sub_layers_minus1);
+    for (i = 0; i < 6; i++) bs_read_ue(r);              // coding and transform block sizes, hierarchy depths
+    if (bs_read(r, 1)) {                                // scaling_list_enabled_flag
+        if (bs_read(r, 1)) h265_skip_scaling_list_data(r);
+    }
+    bs_skip(r, 2);                                      // amp_enabled_flag, sample_adaptive_offset_enabled_flag
+    if (bs_read(r, 1)) {                                // pcm_enabled_flag
+        bs_skip(r, 8);
+        bs_read_ue(r);
+        bs_read_ue(r);
+        bs_skip(r, 1);
+    }
+    n = bs_read_ue(r);                                  // num_short_term_ref_pic_sets
+    if ((n > 64) || (h265_skip_short_term_ref_pic_sets(r, n) != 0)) return -1;
+    if (bs_read(r, 1)) {                                // long_term_ref_pics_present_flag
+        n = bs_read_ue(r);
+        if (n > 32) return -1;
+        for (i = 0; i < n; i++) bs_skip(r, log2_max_poc_lsb + 1);
+    }
+    bs_skip(r, 2);                                      // sps_temporal_mvp_enabled_flag, strong_intra_smoothing_enabled_flag
+    if (r->error) return -1;
+
+    mark = r->pos;
+    if (bs_read(r, 1) == 0) {
+        // No VUI, add one with the timing info only
+        bs_copy(w, r, 0, mark);
+        bs_write(w, 1, 1);                              // vui_parameters_present_flag
+        bs_write(w, 0, 8);                              // aspect_ratio ... default_display_window
+        bs_write(w, 1, 1);                              // vui_timing_info_present_flag
+        h265_write_timing(w, fps);
+        bs_write(w, 0, 3);                              // poc_proportional, hrd_parameters, bitstream_restriction
+        bs_copy(w, r, r->pos, r->size);
+        return w->error ? -1 : 0;
+    }
+
+    if (bs_read(r, 1)) {                                // aspect_ratio_info_present_flag
+        if (bs_read(r, 8) == 255) bs_skip(r, 32);
+    }
+    if (bs_read(r, 1)) bs_skip(r, 1);                   // overscan_info_present_flag
+    if (bs_read(r, 1)) {                                // video_signal_type_present_flag
+        bs_skip(r, 4);
+        if (bs_read(r, 1)) bs_skip(r, 24);
+    }
+    if (bs_read(r, 1)) {                                // chroma_loc_info_present_flag
+        bs_read_ue(r);
+        bs_read_ue(r);
+    }
+    bs_skip(r, 3);                                      // neutral_chroma, field_seq, frame_field_info_present
+    if (bs_read(r, 1)) {                                // default_display_window_flag
+        for (i = 0; i < 4; i++) bs_read_ue(r);
+    }
+    if (r->error) return -1;
+
+    mark = r->pos;
+    bs_copy(w, r, 0, mark);
+    bs_write(w, 1, 1);                                  // vui_timing_info_present_flag
+    h265_write_timing(w, fps);
+    if (bs_read(r, 1)) {
+        // Replace the values, keep the rest of the old timing info
+        bs_skip(r, 64);
+    } else {
+        bs_write(w, 0, 2);                              // poc_proportional, hrd_parameters
+    }
+    if (r->error) return -1;
+    bs_copy(w, r, r->pos, r->size);
+
+    return w->error ? -1 : 0;
+}
+
+static int h265_vps_set_timing(bitstream *r, bitstream *w, unsigned int fps)
+{
+    unsigned int max_sub_layers_minus1, max_layer_id, n;
+    unsigned int mark;
+
+    bs_skip(r, 12);                                     // vps_video_parameter_set_id ... vps_max_layers_minus1
+    max_sub_layers_minus1 = bs_read(r, 3);
+    bs_skip(r, 17);                                     // vps_temporal_id_nesting_flag, vps_reserved_0xffff_16bits
+    h265_skip_profile_tier_level(r, max_sub_layers_minus1);
+    h265_skip_sub_layer_ordering_info(r, max_sub_layers_minus1);
+    max_layer_id = bs_read(r, 6);
+    n = bs_read_ue(r);                                  // vps_num_layer_sets_minus1
+    if (n > 1023) return -1;
+    bs_skip(r, n * (max_layer_id + 1));                 // layer_id_included_flag
+    if (r->error) return -1;
+
+    mark = r->pos;
+    bs_copy(w, r, 0, mark);
+    bs_write(w, 1, 1);                                  // vps_timing_info_present_flag
+    h265_write_timing(w, fps);
+    if (bs_read(r, 1)) {
+        bs_skip(r, 64);
+    } else {
+        bs_write(w, 0, 1);                              // vps_poc_proportional_to_timing_flag
+        bs_write_ue(w, 0);                              // vps_num_hrd_parameters
+    }
+    if (r->error) return -1;
+    bs_copy(w, r, r->pos, r->size);
+
+    return w->error ? -1 : 0;
+}
+
+/*
+ * Write the timing info of fps into a SPS (H.264/H.265) or VPS (H.265) NAL
+ * with its start code. Anything after the NAL is copied as it is.
+ * Return the length of the new NAL, -1 if it can't be rewritten.
+ */
+int fshare_nal_set_timing(int codec, unsigned char *src, unsigned int len, unsigned char *dest, unsigned int size, unsigned int fps)
+{
+    unsigned char rbsp[FSHARE_NAL_MAX_SIZE + 16];
+    unsigned char out[FSHARE_NAL_MAX_SIZE + 16];
+    bitstream r, w;
+    unsigned int sc, hdr, end, n, rbsp_len, stop;
+    int nal_type, ret;
+
+    if ((fps == 0) || (len > FSHARE_NAL_MAX_SIZE)) return -1;
+
+    // Start code
+    if ((len > 4) && (memcmp(src, NALx_START, 4) == 0)) sc = 4;
+    else if ((len > 3) && (src[0] == 0x00) && (src[1] == 0x00) && (src[2] == 0x01)) sc = 3;
+    else return -1;
+
+    if (codec == CODEC_H264) {
+        hdr = 1;
+        nal_type = src[sc] & 0x1F;
+        if (nal_type != 7) return -1;
+    } else if (codec == CODEC_H265) {
+        hdr = 2;
+        nal_type = (src[sc] >> 1) & 0x3F;
+        if ((nal_type != 32) && (nal_type != 33)) return -1;
+    } else {
+        return -1;
+    }
+    if (len <= sc + hdr) return -1;
+
+    // The NAL ends at the next start code, if any
+    for (end = sc + hdr; end + 2 < len; end++) {
+        if ((src[end] == 0x00) && (src[end + 1] == 0x00) && (src[end + 2] == 0x01)) break;
+    }
+    if (end + 2 >= len) end = len;
+    while ((end > sc + hdr) && (src[end - 1] == 0x00)) end--;
+
+    // RBSP without the stop bit
+    rbsp_len = nal_to_rbsp(src + sc + hdr, end - sc - hdr, rbsp);
+    while ((rbsp_len > 0) && (rbsp[rbsp_len - 1] == 0x00)) rbsp_len--;
+    if (rbsp_len == 0) return -1;
+    for (stop = 0; (rbsp[rbsp_len - 1] & (1 << stop)) == 0; stop++);
+    bs_init(&r, rbsp, rbsp_len * 8 - stop - 1);
+
+    memset(out, 0, sizeof(out));
+    bs_init(&w, out, (sizeof(out) - 1) * 8);
+    if (codec == CODEC_H264) ret = h264_sps_set_timing(&r, &w, fps);
+    else if (nal_type == 33) ret = h265_sps_set_timing(&r, &w, fps);
+    else ret = h265_vps_set_timing(&r, &w, fps);
+    if (ret != 0) return -1;
+
+    // rbsp_trailing_bits
+    bs_write(&w, 1, 1);
+    if (w.pos & 7) bs_write(&w, 0, 8 - (w.pos & 7));
+    if (w.error) return -1;
+
+    if (sc + hdr >= size) return -1;
+    memcpy(dest, src, sc + hdr);
+    n = rbsp_to_nal(out, w.pos / 8, dest + sc + hdr, size - sc - hdr);
+    if (n == 0) return -1;
+    n += sc + hdr;
+    if (n + (len - end) > size) return -1;
+    memcpy(dest + n, src + end, len - end);
+
+    return n + len - end;
+}
+
+void fshare_timing_init(fshare_timing *t)
+{
+    memset(t, 0, sizeof(fshare_timing));
+}
+
+/*
+ * Measure the frame rate of a stream from the time of its frames.
+ * Call it for every frame of the stream.
+ */
+void fshare_timing_update(fshare_timing *t, fshare_frame *frame)
+{
+    unsigned int elapsed, fps;
+
+    if (frame->type & (FSHARE_TYPE_SPS | FSHARE_TYPE_PPS | FSHARE_TYPE_VPS)) return;
+    // Slices of the same picture
+    if ((t->frames > 0) && (frame->time == t->last_time)) return;
+
+    // Restart after a gap or if the time goes back
+    if ((t->frames == 0) || (frame->time - t->last_time > 1000)) {
+        t->start_time = frame->time;
+        t->last_time = frame->time;
+        t->frames = 1;
+        return;
+    }
+
+    t->last_time = frame->time;
+    t->frames++;
+    if (t->frames > FSHARE_TIMING_FRAMES) {
+        elapsed = t->last_time - t->start_time;
+        fps = ((t->frames - 1) * 1000 + elapsed / 2) / elapsed;
+        if ((fps > 0) && (fps <= FSHARE_TIMING_FPS_MAX)) t->fps = fps;
+        t->start_time = t->last_time;
+        t->frames = 1;
+    }
+}
+
+/*
+ * Return the SPS/VPS with the timing info to be sent instead of the NAL in
+ * span, or NULL if the frame must be sent as is.
+ * The rewritten NAL is cached: it's rebuilt only when the source NAL or
+ * the frame rate change.
+ */
+unsigned char *fshare_timing_nal(fshare_timing *t, int codec, fshare_frame *frame, fshare_span *span, unsigned int *len)
+{
+    fshare_nal_cache *c;
+    unsigned int n, fps;
+    int ret;
+
+    if (frame->type & FSHARE_TYPE_SPS) c = &t->sps;
+    else if ((frame->type & FSHARE_TYPE_VPS) && (codec == CODEC_H265)) c = &t->vps;
+    else return NULL;
+
+    n = span->len[0] + span->len[1];
+    if (n > FSHARE_NAL_MAX_SIZE) return NULL;
+    fps = (t->fps > 0) ? t->fps : FSHARE_TIMING_FPS_DEFAULT;
+
+    if ((n != c->src_len) || (fps != c->fps) ||
+            (memcmp(c->src, span->ptr[0], span->len[0]) != 0) ||
+            ((span->len[1] > 0) && (memcmp(c->src + span->len[0], span->ptr[1], span->len[1]) != 0))) {
+        c->src_len = fshare_span_copy(c->src, span);
+        c->fps = fps;
+        ret = fshare_nal_set_timing(codec, c->src, c->src_len, c->nal, sizeof(c->nal), fps);
+        c->nal_len = (ret > 0) ? ret : 0;
+        t->rewrites++;
+        if (ret < 0) t->errors++;
+    }
+
+    if (c->nal_len == 0) return NULL;
+    *len = c->nal_len;
+
+    return c->nal;
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bounded lock-free frame queue.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "FrameQueue.hh"
+
+int frame_queue_init(frame_queue *q, unsigned int max_size)
+{
+    memset(q, 0, sizeof(frame_queue));
+
+    if (max_size == 0) return -1;
+    q->capacity = 1;
+    while (q->capacity < max_size + FRAME_QUEUE_KEY_MARGIN) q->capacity <<= 1;
+    q->frames = (output_frame *) calloc(q->capacity, sizeof(output_frame));
+    if (q->frames == NULL) {
+        fprintf(stderr, "error - could not allocate frame queue\n");
+        return -1;
+    }
+    q->max_size = max_size;
+
+    return 0;
+}
+
+void frame_queue_free(frame_queue *q)
+{
+    output_frame of;
+
+    if (q->frames == NULL) return;
+    while (frame_queue_pop(q, &of) == 1) {
+        if (of.slab != NULL) frame_slab_unref(of.slab);
+    }
+    free(q->frames);
+    q->frames = NULL;
+}
+
+void frame_queue_set_notify(frame_queue *q, void (*notify)(void *), void *notify_data)
+{
+    q->notify_data = notify_data;
+    __atomic_store_n(&q->notify, notify, __ATOMIC_RELEASE);
+}
+
+/*
+ * Set the byte and time limits, 0 means no limit, and the drop policy.
+ * Must be called before the first push.
+ */
+void frame_queue_set_limits(frame_queue *q, int policy, unsigned int max_bytes, unsigned int max_ms)
+{
+    q->policy = policy;
+    q->max_bytes = max_bytes;
+    q->max_ms = max_ms;
+}
+
+static inline unsigned int frame_bytes(output_frame *of)
+{
+    return (of->slab != NULL) ? of->slab->len : 0;
+}
+
+// Return 1 if adding the new frame to the queue breaks a limit
+static int frame_queue_over(frame_queue *q, uint32_t head, uint32_t tail, output_frame *of)
+{
+    if (head == tail) return 0;
+    if (head - tail >= q->max_size) return 1;
+    if ((q->max_bytes > 0) && (__atomic_load_n(&q->bytes, __ATOMIC_ACQUIRE) + frame_bytes(of) > q->max_bytes)) return 1;
+    // The slot at tail is written only by the producer, it's still valid
+    // if the reader takes the frame meanwhile
+    if ((q->max_ms > 0) && ((int32_t) (of->time - q->frames[tail & (q->capacity - 1)].time) > (int32_t) q->max_ms)) return 1;
+
+    return 0;
+}
+
+/*
+ * Drop the frames before index end.
+ * Return the number of frames dropped, the reader could take some of them.
+ */
+static unsigned int frame_queue_drop(frame_queue *q, uint32_t end)
+{
+    output_frame old;
+    uint32_t tail;
+    unsigned int dropped = 0;
+
+    tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    while ((int32_t) (end - tail) > 0) {
+        old = q->frames[tail & (q->capacity - 1)];
+        if (__atomic_compare_exchange_n(&q->tail, &tail, tail + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_sub_fetch(&q->bytes, frame_bytes(&old), __ATOMIC_ACQ_REL);
+            if (old.slab != NULL) frame_slab_unref(old.slab);
+            dropped++;
+            tail++;
+        }
+        // On failure tail has been reloaded
+    }
+
+    return dropped;
+}
+
+/*
+ * Return the index of the first frame after tail that starts a GOP: a key
+ * frame after a frame that is not. head is the new frame. Return tail if
+ * there is none.
+ */
+static uint32_t frame_queue_gop_start(frame_queue *q, uint32_t head, uint32_t tail, output_frame *of)
+{
+    uint32_t i;
+    unsigned int flags, prev;
+
+    prev = q->frames[tail & (q->capacity - 1)].flags;
+    for (i = tail + 1; i != head; i++) {
+        flags = q->frames[i & (q->capacity - 1)].flags;
+        if ((flags & FRAME_FLAG_KEY) && !(prev & FRAME_FLAG_KEY)) return i;
+        prev = flags;
+    }
+    if ((of->flags & FRAME_FLAG_KEY) && !(prev & FRAME_FLAG_KEY)) return head;
+
+    return tail;
+}
+
+/*
+ * Make room for the new frame with the gop policy.
+ * Return 1 if the new frame must be dropped.
+ */
+static int frame_queue_make_room_gop(frame_queue *q, uint32_t head, output_frame *of)
+{
+    uint32_t tail, start;
+    unsigned int n;
+
+    if ((q->skipping) && (of->flags & FRAME_FLAG_KEY)) q->skipping = 0;
+    if (q->skipping) {
+        // The reference frames of this one have been skipped
+        q->skipped++;
+        return 1;
+    }
+
+    tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    while (frame_queue_over(q, head, tail, of)) {
+        if (of->flags & FRAME_FLAG_NONREF) {
+            // No other frame depends on it
+            q->dropped_nonref++;
+            return 1;
+        }
+        start = frame_queue_gop_start(q, head, tail, of);
+        if (start != tail) {
+            // Drop the rest of the oldest GOP, the reader gets a clean cut
+            n = frame_queue_drop(q, start);
+            q->dropped_gop += n;
+            q->dropped += n;
+        } else if (of->flags & FRAME_FLAG_KEY) {
+            // The queue holds only the parameter sets of this GOP, keep them
+            if (head - tail < q->capacity) break;
+            n = frame_queue_drop(q, head);
+            q->dropped += n;
+        } else {
+            // A single GOP, skip the new frames until the next one starts
+            q->skipping = 1;
+            q->skipped++;
+            return 1;
+        }
+        tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    }
+
+    return 0;
+}
+
+/*
+ * Add a frame, dropping frames if the queue is over its limits.
+ * Return the number of frames dropped, the new one included.
+ */
+int frame_queue_push(frame_queue *q, output_frame *of)
+{
+    uint32_t head, tail;
+    void (*notify)(void *);
+    unsigned int dropped;
+
+    head = q->head;
+    dropped = q->dropped;
+    if (q->policy == FRAME_QUEUE_POLICY_GOP) {
+        if (frame_queue_make_room_gop(q, head, of)) {
+            q->last_flags = of->flags;
+            q->dropped++;
+            if (of->slab != NULL) frame_slab_unref(of->slab);
+            return q->dropped - dropped;
+        }
+    } else {
+        tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        while (frame_queue_over(q, head, tail, of)) {
+            q->dropped += frame_queue_drop(q, tail + 1);
+            tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        }
+    }
+    q->last_flags = of->flags;
+
+    q->frames[head & (q->capacity - 1)] = *of;
+    __atomic_add_fetch(&q->bytes, frame_bytes(of), __ATOMIC_ACQ_REL);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    q->pushed++;
+
+    if (__atomic_load_n(&q->waiters, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &q->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+    notify = __atomic_load_n(&q->notify, __ATOMIC_ACQUIRE);
+    if (notify != NULL) notify(q->notify_data);
+
+    return q->dropped - dropped;
+}
+
+/*
+ * Take the oldest frame.
+ * Return 1 and the ownership of the slab, 0 if the queue is empty.
+ */
+int frame_queue_pop(frame_queue *q, output_frame *of)
+{
+    uint32_t head, tail;
+
+    tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    while (1) {
+        head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (head == tail) return 0;
+        *of = q->frames[tail & (q->capacity - 1)];
+        // If the producer dropped this frame meanwhile the cas fails and tail is reloaded
+        if (__atomic_compare_exchange_n(&q->tail, &tail, tail + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_sub_fetch(&q->bytes, frame_bytes(of), __ATOMIC_ACQ_REL);
+            return 1;
+        }
+    }
+}
+
+/*
+ * Wait until at least count frames are available or the timeout (us)
+ * expires, timeout 0 means forever.
+ * Return 1 if the frames are available.
+ */
+int frame_queue_wait(frame_queue *q, unsigned int count, unsigned int timeout)
+{
+    struct timespec ts;
+    uint32_t head;
+
+    head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= count) return 1;
+
+    ts.tv_sec = timeout / 1000000;
+    ts.tv_nsec = (timeout % 1000000) * 1000;
+    __atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+    // Recheck after registering, the producer could have missed us
+    if (__atomic_load_n(&q->head, __ATOMIC_SEQ_CST) == head) {
+        syscall(SYS_futex, &q->head, FUTEX_WAIT, head, (timeout > 0) ? &ts : NULL, NULL, 0);
+    }
+    __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+
+    return (frame_queue_size(q) >= count);
+}
+
+unsigned int frame_queue_size(frame_queue *q)
+{
+    uint32_t tail, head;
+
+    tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+    return head - tail;
+}
+
+void frame_queue_stats(frame_queue *q, const char *name)
+{
+    fprintf(stderr, "%s: frame queue - pushed: %u - dropped: %u (non-ref: %u - gop: %u - skipped: %u) - size: %u/%u - bytes: %u/%u\n",
+            name, q->pushed, q->dropped, q->dropped_nonref, q->dropped_gop, q->skipped,
+            frame_queue_size(q), q->max_size, __atomic_load_n(&q->bytes, __ATOMIC_ACQUIRE), q->max_bytes);
+    q->pushed = 0;
+    q->dropped = 0;
+    q->dropped_nonref = 0;
+    q->dropped_gop = 0;
+    q->skipped = 0;
+}
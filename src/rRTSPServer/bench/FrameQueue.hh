@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bounded lock-free frame queue.
+ * One producer (the capture thread) and one consumer (the live555 event
+ * loop). When the queue is over its limits (frames, bytes or ms) the
+ * producer drops frames: the read index is advanced with a compare and
+ * swap by both sides, so a frame is owned by whoever advances the index
+ * past it.
+ * With FRAME_QUEUE_POLICY_GOP the oldest frames are dropped only up to the
+ * start of a GOP, so the reader never gets a frame whose references have
+ * been removed: non-reference frames are dropped first, then the rest of
+ * the oldest GOP, and if the queue holds a single GOP the new frames are
+ * skipped until the next parameter sets or IDR.
+ * The server reads the frames through FrameRing now: this is the single
+ * reader queue of the StreamReplicator, kept to compare with it.
+ */
+
+#ifndef _FRAME_QUEUE_H
+#define _FRAME_QUEUE_H
+
+#include <stdint.h>
+
+#include "FramePool.hh"
+
+#define FRAME_QUEUE_POLICY_OLDEST 0         // audio, drop the oldest frames
+#define FRAME_QUEUE_POLICY_GOP    1         // video, drop whole GOP segments
+
+// Room for a group of parameter sets pushed above the limits
+#define FRAME_QUEUE_KEY_MARGIN 4
+
+typedef struct
+{
+    output_frame *frames;
+    unsigned int capacity;                  // power of 2
+    unsigned int max_size;                  // drop frames above this size
+    unsigned int max_bytes;                 // 0 no limit
+    unsigned int max_ms;                    // 0 no limit
+    int policy;
+    uint32_t head;                          // written by the producer only, futex word
+    uint32_t tail;                          // advanced by both, with cas
+    unsigned int bytes;                     // subtracted by whoever advances tail
+    unsigned int last_flags;                // producer only
+    int skipping;                           // producer only, waiting for a key frame
+    int waiters;
+    void (*notify)(void *);                 // called by the producer after each push
+    void *notify_data;
+    // Statistics
+    unsigned int pushed;
+    unsigned int dropped;                   // total, the following are included
+    unsigned int dropped_nonref;
+    unsigned int dropped_gop;
+    unsigned int skipped;
+} frame_queue;
+
+int frame_queue_init(frame_queue *q, unsigned int max_size);
+void frame_queue_set_limits(frame_queue *q, int policy, unsigned int max_bytes, unsigned int max_ms);
+void frame_queue_free(frame_queue *q);
+void frame_queue_set_notify(frame_queue *q, void (*notify)(void *), void *notify_data);
+
+/* Producer */
+int frame_queue_push(frame_queue *q, output_frame *of);
+
+/* Consumer */
+int frame_queue_pop(frame_queue *q, output_frame *of);
+int frame_queue_wait(frame_queue *q, unsigned int count, unsigned int timeout);
+
+unsigned int frame_queue_size(frame_queue *q);
+void frame_queue_stats(frame_queue *q, const char *name);
+
+#endif
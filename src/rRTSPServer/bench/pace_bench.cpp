@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host benchmark of the packet pacer over a real UDP link.
+ * The sender produces a 20 fps stream with an IDR every 40 frames, splits
+ * the frames in packets like the RTP sink and sends them back to back or
+ * through the pacer. It prints the largest burst and the gaps inside the
+ * IDRs. The receiver counts the lost packets and the broken frames.
+ * Limit the link with tc to see the effect, for example a veth in a
+ * network namespace with
+ *   tc qdisc add dev veth0 root tbf rate 20mbit burst 8kb limit 40kb
+ * With a multicast group several receivers get the single stream of the
+ * sender, for example on the loopback interface
+ *   ip link set lo multicast on
+ *   pace_bench -R 18888 -g 232.1.2.3 -I 127.0.0.1 (once for each receiver)
+ *   pace_bench -d 232.1.2.3:18888 -I 127.0.0.1
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <getopt.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "PacketPacer.hh"
+
+#define FRAME_US 50000
+#define GOP 40
+#define BURST_GAP_US 100                    // closer packets are in the same burst
+#define MAX_FRAMES 100000
+
+struct __attribute__((__packed__)) bench_packet {
+    uint32_t seq;
+    uint32_t frame;
+    uint16_t index;
+    uint16_t count;
+    uint8_t key;
+    uint8_t end;
+};
+
+long long now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void sleep_until(long long t)
+{
+    long long d = t - now_us();
+    struct timespec ts;
+
+    if (d <= 0) return;
+    ts.tv_sec = d / 1000000;
+    ts.tv_nsec = (d % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+int receiver(int port, struct in_addr *group, struct in_addr *iface)
+{
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    struct timeval tv;
+    unsigned char buf[2048];
+    struct bench_packet *bp = (struct bench_packet *) buf;
+    static unsigned char got[MAX_FRAMES];
+    static unsigned char count[MAX_FRAMES];
+    static unsigned char key[MAX_FRAMES];
+    unsigned int received = 0, last_seq = 0, lost = 0, lost_key = 0, frames = 0;
+    unsigned int broken = 0, broken_key = 0, keys = 0, i;
+    int fd, started = 0, on = 1;
+    ssize_t n;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    // The receivers of a group share the port
+    if (group != NULL) {
+        addr.sin_addr = *group;
+        if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+    if ((fd < 0) || (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)) {
+        fprintf(stderr, "Error binding port %d\n", port);
+        return -1;
+    }
+    if (group != NULL) {
+        mreq.imr_multiaddr = *group;
+        mreq.imr_interface = *iface;
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+            fprintf(stderr, "Error joining the group\n");
+            close(fd);
+            return -1;
+        }
+    }
+    tv.tv_sec = 5;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    memset(got, 0, sizeof(got));
+    while (1) {
+        n = recv(fd, buf, sizeof(buf), 0);
+        if (n < (ssize_t) sizeof(struct bench_packet)) break;
+        if (bp->end) break;
+        if (bp->frame >= MAX_FRAMES) continue;
+        // Lost packets, the link doesn't reorder
+        if ((started) && (bp->seq > last_seq + 1)) lost += bp->seq - last_seq - 1;
+        started = 1;
+        last_seq = bp->seq;
+        received++;
+        if (got[bp->frame] < 255) got[bp->frame]++;
+        count[bp->frame] = (bp->count > 255) ? 255 : bp->count;
+        key[bp->frame] = bp->key;
+        if (bp->frame + 1 > frames) frames = bp->frame + 1;
+    }
+
+    for (i = 0; i < frames; i++) {
+        if (key[i]) keys++;
+        if ((got[i] == 0) || (got[i] < count[i])) {
+            broken++;
+            if (key[i]) broken_key++;
+        }
+        if ((key[i]) && (got[i] < count[i])) lost_key += count[i] - got[i];
+    }
+    fprintf(stdout, "receiver - packets: %u - lost: %u (%.2f%%) - lost in IDRs: %u - broken frames: %u/%u - broken IDRs: %u/%u\n",
+            received, lost, (received + lost > 0) ? 100.0 * lost / (received + lost) : 0.0,
+            lost_key, broken, frames, broken_key, keys);
+    close(fd);
+
+    return 0;
+}
+
+// Sender statistics
+unsigned int burst, max_burst, idr_packets, idrs;
+long long last_send, idr_first, idr_span;
+
+// Send a packet now and measure the bursts and the IDRs
+void send_packet(int fd, struct sockaddr_in *dest, unsigned char *p, unsigned int l)
+{
+    struct bench_packet *h = (struct bench_packet *) p;
+    long long now = now_us();
+
+    sendto(fd, p, l, 0, (struct sockaddr *) dest, sizeof(*dest));
+    burst = ((last_send > 0) && (now - last_send < BURST_GAP_US)) ? burst + 1 : 1;
+    if (burst > max_burst) max_burst = burst;
+    last_send = now;
+    if (h->key) {
+        if (h->index == 0) idr_first = now;
+        if (h->index == h->count - 1) {
+            idr_span += now - idr_first;
+            idr_packets += h->count;
+            idrs++;
+        }
+    }
+}
+
+int sender(struct sockaddr_in *dest, struct in_addr *iface, unsigned int frames, unsigned int pace, unsigned int size,
+        unsigned int idr_len, unsigned int p_len)
+{
+    packet_pacer pacer;
+    unsigned char buf[PACER_SLOT_SIZE];
+    unsigned char *out;
+    struct bench_packet *bp = (struct bench_packet *) buf;
+    unsigned int frame, i, count, len, out_len, payload = size - 12;
+    unsigned int seq = 0;
+    long long start, t, next;
+    int fd, ret, key;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    if (IN_MULTICAST(ntohl(dest->sin_addr.s_addr))) {
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, iface, sizeof(*iface));
+    }
+    if (packet_pacer_init(&pacer, FRAME_US * pace / 100, 2) != 0) return -1;
+    memset(buf, 0, sizeof(buf));
+
+    start = now_us();
+    for (frame = 0; frame < frames; frame++) {
+        t = start + (long long) frame * FRAME_US;
+        // Send the packets due before the frame
+        while (((next = packet_pacer_next(&pacer)) >= 0) && (next < t)) {
+            sleep_until(next);
+            while (((next = packet_pacer_next(&pacer)) >= 0) && (next <= now_us())) {
+                packet_pacer_pop(&pacer, &out, &out_len, now_us());
+                send_packet(fd, dest, out, out_len);
+            }
+        }
+        sleep_until(t);
+
+        key = (frame % GOP == 0);
+        len = key ? idr_len : p_len;
+        count = (len + payload - 1) / payload;
+        for (i = 0; i < count; i++) {
+            bp->seq = seq++;
+            bp->frame = frame;
+            bp->index = i;
+            bp->count = count;
+            bp->key = key;
+            bp->end = 0;
+            out_len = (i == count - 1) ? len - i * payload + 12 : size;
+            if (out_len < sizeof(struct bench_packet)) out_len = sizeof(struct bench_packet);
+            ret = packet_pacer_push(&pacer, buf, out_len, now_us());
+            if (ret < 0) {
+                while (packet_pacer_pop(&pacer, &out, &out_len, now_us()) == 1) send_packet(fd, dest, out, out_len);
+                out_len = (i == count - 1) ? len - i * payload + 12 : size;
+                if (out_len < sizeof(struct bench_packet)) out_len = sizeof(struct bench_packet);
+            }
+            if (ret != 0) send_packet(fd, dest, buf, out_len);
+        }
+    }
+    while (packet_pacer_pop(&pacer, &out, &out_len, now_us()) == 1) send_packet(fd, dest, out, out_len);
+
+    usleep(500000);
+    bp->end = 1;
+    for (i = 0; i < 3; i++) sendto(fd, buf, sizeof(struct bench_packet), 0, (struct sockaddr *) dest, sizeof(*dest));
+
+    fprintf(stdout, "sender - pace %u%% - packet size %u - max burst: %u packets - IDR: %.1f ms, gap %.0f us\n",
+            pace, size, max_burst, (idrs > 0) ? idr_span / 1000.0 / idrs : 0.0,
+            (idr_packets > idrs) ? (double) idr_span / (idr_packets - idrs) : 0.0);
+    packet_pacer_stats(&pacer, "sender");
+    packet_pacer_free(&pacer);
+    close(fd);
+
+    return 0;
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s -R PORT [-g GROUP] [-I ADDR]\n", progname);
+    fprintf(stderr, "       %s -d ADDR:PORT [-I ADDR] [-n FRAMES] [-P PERCENT] [-M SIZE] [-i BYTES] [-p BYTES]\n\n", progname);
+    fprintf(stderr, "\t-R PORT\n");
+    fprintf(stderr, "\t\treceive on PORT\n");
+    fprintf(stderr, "\t-g GROUP\n");
+    fprintf(stderr, "\t\tjoin the multicast GROUP\n");
+    fprintf(stderr, "\t-I ADDR\n");
+    fprintf(stderr, "\t\tsend to or receive the multicast group on the interface with ADDR (default any)\n");
+    fprintf(stderr, "\t-d ADDR:PORT\n");
+    fprintf(stderr, "\t\tsend to ADDR:PORT\n");
+    fprintf(stderr, "\t-n FRAMES\n");
+    fprintf(stderr, "\t\tframes to send (default 400)\n");
+    fprintf(stderr, "\t-P PERCENT\n");
+    fprintf(stderr, "\t\tpace the frames over PERCENT of the frame interval, 0 no pacing (default 0)\n");
+    fprintf(stderr, "\t-M SIZE\n");
+    fprintf(stderr, "\t\tpacket size (default 1352)\n");
+    fprintf(stderr, "\t-i BYTES\n");
+    fprintf(stderr, "\t\tIDR size (default 100000)\n");
+    fprintf(stderr, "\t-p BYTES\n");
+    fprintf(stderr, "\t\tsize of the other frames (default 8000)\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in dest;
+    struct in_addr group, iface;
+    unsigned int frames = 400, pace = 0, size = 1352, idr_len = 100000, p_len = 8000;
+    int port = 0, have_dest = 0, have_group = 0, opt;
+    char *colon;
+
+    memset(&dest, 0, sizeof(dest));
+    iface.s_addr = htonl(INADDR_ANY);
+    while ((opt = getopt(argc, argv, "R:g:I:d:n:P:M:i:p:h")) != -1) {
+        switch (opt) {
+        case 'R':
+            port = atoi(optarg);
+            break;
+        case 'g':
+            if ((inet_pton(AF_INET, optarg, &group) != 1) || (!IN_MULTICAST(ntohl(group.s_addr)))) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            have_group = 1;
+            break;
+        case 'I':
+            if (inet_pton(AF_INET, optarg, &iface) != 1) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'd':
+            colon = strchr(optarg, ':');
+            if (colon == NULL) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            *colon = '\0';
+            dest.sin_family = AF_INET;
+            dest.sin_port = htons(atoi(colon + 1));
+            if (inet_pton(AF_INET, optarg, &dest.sin_addr) != 1) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            have_dest = 1;
+            break;
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'P':
+            pace = atoi(optarg);
+            break;
+        case 'M':
+            size = atoi(optarg);
+            break;
+        case 'i':
+            idr_len = atoi(optarg);
+            break;
+        case 'p':
+            p_len = atoi(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (port > 0) return receiver(port, have_group ? &group : NULL, &iface);
+    if ((!have_dest) || (frames == 0) || (frames > MAX_FRAMES) || (pace > 100) ||
+            (size < sizeof(struct bench_packet) + 12) || (size > PACER_SLOT_SIZE)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    return sender(&dest, &iface, frames, pace, size, idr_len, p_len);
+}
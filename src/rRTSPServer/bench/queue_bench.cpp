@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host microbenchmark: frame queue throughput and push to pop latency.
+ * Compare the old std::queue + pthread_mutex queue with the lock-free
+ * frame_queue, one producer and one consumer thread.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <queue>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+
+#include "FramePool.hh"
+#include "FrameQueue.hh"
+
+#define MODE_MUTEX_POLL 0                   // old code: mutex, consumer sleeps 1 ms when empty
+#define MODE_MUTEX_SPIN 1                   // mutex, consumer spins
+#define MODE_LOCKFREE_SPIN 2
+#define MODE_LOCKFREE_WAIT 3                // consumer sleeps on the futex
+
+const char *mode_names[] = { "mutex+usleep", "mutex+spin", "lockfree+spin", "lockfree+wait" };
+
+typedef struct
+{
+    std::queue<output_frame> frame_queue;
+    pthread_mutex_t mutex;
+} mutex_queue;
+
+int mode;
+unsigned int frames;
+unsigned int interval;
+unsigned int max_size;
+unsigned int frame_len;
+
+frame_pool pool;
+frame_queue lf_queue;
+mutex_queue mx_queue;
+volatile int producer_done;
+
+std::vector<long long> latencies;
+unsigned int consumed;
+
+long long time_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void *producer(void *ptr)
+{
+    output_frame of;
+    long long now, next;
+    unsigned int i;
+
+    next = time_ns();
+    for (i = 0; i < frames; i++) {
+        if (interval > 0) {
+            next += interval * 1000LL;
+            while ((now = time_ns()) < next) {
+                if (next - now > 100000) usleep((next - now) / 1000 - 50);
+            }
+        }
+
+        of.slab = frame_pool_get(&pool, frame_len);
+        now = time_ns();
+        memcpy(of.slab->data, &now, sizeof(now));
+        of.time = i;
+        of.counter = i;
+
+        if ((mode == MODE_LOCKFREE_SPIN) || (mode == MODE_LOCKFREE_WAIT)) {
+            frame_queue_push(&lf_queue, &of);
+        } else {
+            pthread_mutex_lock(&mx_queue.mutex);
+            mx_queue.frame_queue.push(of);
+            while (mx_queue.frame_queue.size() > max_size) {
+                frame_slab_unref(mx_queue.frame_queue.front().slab);
+                mx_queue.frame_queue.pop();
+            }
+            pthread_mutex_unlock(&mx_queue.mutex);
+        }
+    }
+    __atomic_store_n(&producer_done, 1, __ATOMIC_RELEASE);
+    if (mode == MODE_LOCKFREE_WAIT) {
+        // Wake up the consumer
+        of.slab = NULL;
+        frame_queue_push(&lf_queue, &of);
+    }
+
+    return NULL;
+}
+
+int consumer_pop(output_frame *of)
+{
+    int ret = 0;
+
+    if ((mode == MODE_LOCKFREE_SPIN) || (mode == MODE_LOCKFREE_WAIT)) {
+        return frame_queue_pop(&lf_queue, of);
+    }
+
+    pthread_mutex_lock(&mx_queue.mutex);
+    if (mx_queue.frame_queue.size() > 0) {
+        *of = mx_queue.frame_queue.front();
+        mx_queue.frame_queue.pop();
+        ret = 1;
+    }
+    pthread_mutex_unlock(&mx_queue.mutex);
+
+    return ret;
+}
+
+void *consumer(void *ptr)
+{
+    output_frame of;
+    long long t;
+
+    while (1) {
+        if (consumer_pop(&of) == 0) {
+            if (__atomic_load_n(&producer_done, __ATOMIC_ACQUIRE)) break;
+            if (mode == MODE_MUTEX_POLL) usleep(1000);
+            else if (mode == MODE_LOCKFREE_WAIT) frame_queue_wait(&lf_queue, 1, 100000);
+            continue;
+        }
+        if (of.slab == NULL) continue;
+        memcpy(&t, of.slab->data, sizeof(t));
+        latencies.push_back(time_ns() - t);
+        frame_slab_unref(of.slab);
+        consumed++;
+    }
+
+    return NULL;
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [-m MODE] [-n FRAMES] [-i INTERVAL] [-q SIZE] [-l LEN]\n\n", progname);
+    fprintf(stderr, "\t-m MODE\n");
+    fprintf(stderr, "\t\t0 mutex+usleep, 1 mutex+spin, 2 lockfree+spin, 3 lockfree+wait, -1 all (default)\n");
+    fprintf(stderr, "\t-n FRAMES\n");
+    fprintf(stderr, "\t\tframes to push (default 1000000)\n");
+    fprintf(stderr, "\t-i INTERVAL\n");
+    fprintf(stderr, "\t\tus between frames, 0 as fast as possible (default 0)\n");
+    fprintf(stderr, "\t-q SIZE\n");
+    fprintf(stderr, "\t\tqueue size, the oldest frames are dropped (default 20)\n");
+    fprintf(stderr, "\t-l LEN\n");
+    fprintf(stderr, "\t\tframe length (default 1024)\n");
+}
+
+int run(int m)
+{
+    pthread_t pth_producer, pth_consumer;
+    long long start, elapsed;
+    size_t n;
+
+    mode = m;
+    producer_done = 0;
+    consumed = 0;
+    latencies.clear();
+    latencies.reserve(frames);
+
+    if (frame_pool_init(&pool, 64 * (max_size + FRAME_POOL_SLABS_MARGIN) * frame_len, max_size + FRAME_POOL_SLABS_MARGIN) != 0) return -1;
+    if (frame_queue_init(&lf_queue, max_size) != 0) return -1;
+    pthread_mutex_init(&mx_queue.mutex, NULL);
+
+    start = time_ns();
+    pthread_create(&pth_consumer, NULL, consumer, NULL);
+    pthread_create(&pth_producer, NULL, producer, NULL);
+    pthread_join(pth_producer, NULL);
+    pthread_join(pth_consumer, NULL);
+    elapsed = time_ns() - start;
+
+    n = latencies.size();
+    std::sort(latencies.begin(), latencies.end());
+    fprintf(stdout, "%-14s pushed %u - consumed %u (%.1f%%) - %.0f frames/s - latency us p50 %.1f p99 %.1f p99.9 %.1f max %.1f - heap allocs %u\n",
+            mode_names[mode], frames, consumed, 100.0 * consumed / frames, frames * 1e9 / elapsed,
+            (n > 0) ? latencies[n / 2] / 1000.0 : 0,
+            (n > 0) ? latencies[n * 99 / 100] / 1000.0 : 0,
+            (n > 0) ? latencies[n * 999 / 1000] / 1000.0 : 0,
+            (n > 0) ? latencies[n - 1] / 1000.0 : 0,
+            pool.heap_allocs);
+
+    while (mx_queue.frame_queue.size() > 0) {
+        frame_slab_unref(mx_queue.frame_queue.front().slab);
+        mx_queue.frame_queue.pop();
+    }
+    pthread_mutex_destroy(&mx_queue.mutex);
+    frame_queue_free(&lf_queue);
+    frame_pool_free(&pool);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int c, m;
+
+    m = -1;
+    frames = 1000000;
+    interval = 0;
+    max_size = 20;
+    frame_len = 1024;
+
+    while ((c = getopt(argc, argv, "m:n:i:q:l:h")) != -1) {
+        switch (c) {
+        case 'm':
+            m = atoi(optarg);
+            break;
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'q':
+            max_size = atoi(optarg);
+            break;
+        case 'l':
+            frame_len = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if ((m > MODE_LOCKFREE_WAIT) || (max_size == 0) || (frame_len < sizeof(long long))) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    if (m >= 0) return run(m);
+    for (m = MODE_MUTEX_POLL; m <= MODE_LOCKFREE_WAIT; m++) {
+        if (run(m) != 0) return -1;
+    }
+
+    return 0;
+}
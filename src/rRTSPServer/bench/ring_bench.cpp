@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host microbenchmark: cost of each client of a stream in the event loop.
+ * Compare one queue drained by a single source whose frames are copied
+ * again for every replica (StreamReplicator) with the shared frame ring
+ * read by a cursor for each client.
+ * Both run in one thread, like the live555 event loop: push a frame, then
+ * give every client its frames. With the replicator every replica copies
+ * the frame into the input buffer of the fragmenter of its sink, which
+ * copies it again into the packets. With the ring the source of each
+ * client copies the packets straight from the slab (VideoFramedMemoryRTPSink).
+ * The cpu time is the thread cpu time of the best of a few runs.
+ * Optionally client 0 stalls for a while.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <getopt.h>
+
+#include "FramePool.hh"
+#include "FrameQueue.hh"
+#include "FrameRing.hh"
+
+#define MODE_REPLICATOR 0
+#define MODE_RING 1
+
+#define MAX_CLIENTS 16
+#define PACKET_SIZE 1400
+#define GOP 40
+#define IDR_LEN 60000
+#define P_LEN 8000
+
+const char *mode_names[] = { "replicator", "ring" };
+
+unsigned int frames;
+unsigned int runs;
+unsigned int max_size;
+unsigned int stall_start;
+unsigned int stall_len;
+
+unsigned char packet[PACKET_SIZE];
+unsigned char master_buf[IDR_LEN];
+unsigned char replica_buf[IDR_LEN];
+unsigned int delivered[MAX_CLIENTS];
+unsigned int delivered_during_stall[MAX_CLIENTS];
+
+long long cpu_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Copy the frame of a client into the packets of its sink
+void packetize(unsigned char *data, unsigned int len)
+{
+    unsigned int off, n;
+
+    for (off = 0; off < len; off += n) {
+        n = (len - off < PACKET_SIZE) ? len - off : PACKET_SIZE;
+        memcpy(packet, data + off, n);
+    }
+    __asm__ __volatile__("" : : "r" (packet) : "memory");
+}
+
+output_frame make_frame(frame_pool *pool, unsigned int i)
+{
+    output_frame of;
+    unsigned int len = (i % GOP == 0) ? IDR_LEN : P_LEN;
+
+    of.slab = frame_pool_get(pool, len);
+    memset(of.slab->data, i, len);
+    of.time = i * 50;
+    of.counter = i;
+    of.flags = (i % GOP == 0) ? FRAME_FLAG_KEY : 0;
+
+    return of;
+}
+
+int stalled(unsigned int client, unsigned int i)
+{
+    return ((client == 0) && (stall_len > 0) && (i >= stall_start) && (i < stall_start + stall_len));
+}
+
+long long run_replicator(unsigned int clients)
+{
+    frame_pool pool;
+    frame_queue queue;
+    output_frame of;
+    unsigned int i, c;
+    long long start;
+    int all_ready;
+
+    frame_pool_init(&pool, 4 * IDR_LEN * (max_size / GOP + 2), max_size + FRAME_POOL_SLABS_MARGIN + 4);
+    frame_queue_init(&queue, max_size);
+    frame_queue_set_limits(&queue, FRAME_QUEUE_POLICY_GOP, 0, 0);
+
+    start = cpu_ns();
+    for (i = 0; i < frames; i++) {
+        of = make_frame(&pool, i);
+        frame_queue_push(&queue, &of);
+
+        // The replicator reads the next frame only when every replica asked for it
+        all_ready = 1;
+        for (c = 0; c < clients; c++) {
+            if (stalled(c, i)) all_ready = 0;
+        }
+        if (!all_ready) continue;
+        while (frame_queue_pop(&queue, &of) == 1) {
+            // The source fills the buffer of the master replica, the
+            // others copy from it
+            memcpy(master_buf, of.slab->data, of.slab->len);
+            for (c = 0; c < clients; c++) {
+                if (c > 0) memcpy(replica_buf, master_buf, of.slab->len);
+                packetize((c > 0) ? replica_buf : master_buf, of.slab->len);
+                delivered[c]++;
+                if ((i >= stall_start) && (i < stall_start + stall_len)) delivered_during_stall[c]++;
+            }
+            frame_slab_unref(of.slab);
+        }
+    }
+    start = cpu_ns() - start;
+
+    frame_queue_free(&queue);
+    frame_pool_free(&pool);
+
+    return start;
+}
+
+long long run_ring(unsigned int clients)
+{
+    frame_pool pool;
+    frame_ring ring;
+    frame_cursor cursors[MAX_CLIENTS];
+    output_frame of;
+    unsigned int i, c;
+    long long start;
+
+    frame_pool_init(&pool, 4 * IDR_LEN * (max_size / GOP + 2), max_size + FRAME_POOL_SLABS_MARGIN + 4);
+    frame_ring_init(&ring, max_size);
+    frame_ring_set_limits(&ring, FRAME_RING_POLICY_GOP, 0, 0);
+    memset(cursors, 0, sizeof(cursors));
+    for (c = 0; c < clients; c++) {
+        frame_cursor_set_limits(&cursors[c], max_size, 0, 0);
+        frame_cursor_open(&ring, &cursors[c], 0);
+    }
+
+    start = cpu_ns();
+    for (i = 0; i < frames; i++) {
+        of = make_frame(&pool, i);
+        frame_ring_push(&ring, &of);
+
+        for (c = 0; c < clients; c++) {
+            if (stalled(c, i)) continue;
+            while (frame_cursor_pop(&cursors[c], &of) == 1) {
+                packetize(of.slab->data, of.slab->len);
+                frame_slab_unref(of.slab);
+                delivered[c]++;
+                if ((i >= stall_start) && (i < stall_start + stall_len)) delivered_during_stall[c]++;
+            }
+        }
+    }
+    start = cpu_ns() - start;
+
+    if (stall_len > 0) frame_ring_stats(&ring, "ring");
+    for (c = 0; c < clients; c++) frame_cursor_close(&cursors[c]);
+    frame_ring_free(&ring);
+    frame_pool_free(&pool);
+
+    return start;
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [-n FRAMES] [-r RUNS] [-q SIZE] [-s START] [-l LEN]\n\n", progname);
+    fprintf(stderr, "\t-n FRAMES\n");
+    fprintf(stderr, "\t\tframes to push (default 100000)\n");
+    fprintf(stderr, "\t-r RUNS\n");
+    fprintf(stderr, "\t\truns of each test, the fastest is reported (default 5)\n");
+    fprintf(stderr, "\t-q SIZE\n");
+    fprintf(stderr, "\t\tqueue size and lag limit of each client (default 20)\n");
+    fprintf(stderr, "\t-s START\n");
+    fprintf(stderr, "\t\tframe at which client 0 stalls (default 1000)\n");
+    fprintf(stderr, "\t-l LEN\n");
+    fprintf(stderr, "\t\tframes client 0 stalls for, 0 never (default 0)\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int clients_list[] = { 1, 4, 8 };
+    unsigned int m, k, c, r, clients;
+    long long ns = 0, t, base[2];
+    int opt;
+
+    frames = 100000;
+    runs = 5;
+    max_size = 20;
+    stall_start = 1000;
+    stall_len = 0;
+
+    while ((opt = getopt(argc, argv, "n:r:q:s:l:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'q':
+            max_size = atoi(optarg);
+            break;
+        case 's':
+            stall_start = atoi(optarg);
+            break;
+        case 'l':
+            stall_len = atoi(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if ((frames == 0) || (runs == 0) || (max_size == 0)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    for (m = MODE_REPLICATOR; m <= MODE_RING; m++) {
+        for (k = 0; k < sizeof(clients_list) / sizeof(clients_list[0]); k++) {
+            clients = clients_list[k];
+            for (r = 0; r < runs; r++) {
+                memset(delivered, 0, sizeof(delivered));
+                memset(delivered_during_stall, 0, sizeof(delivered_during_stall));
+                t = (m == MODE_RING) ? run_ring(clients) : run_replicator(clients);
+                if ((r == 0) || (t < ns)) ns = t;
+            }
+            if (k == 0) base[m] = ns;
+            fprintf(stdout, "%-10s clients %u - cpu %.0f ns/frame - per extra client %.0f ns/frame",
+                    mode_names[m], clients, (double) ns / frames,
+                    (clients > 1) ? (double) (ns - base[m]) / frames / (clients - 1) : 0.0);
+            if (stall_len > 0) {
+                fprintf(stdout, " - frames during the stall:");
+                for (c = 0; c < clients; c++) fprintf(stdout, " %u", delivered_during_stall[c]);
+            }
+            fprintf(stdout, " - delivered:");
+            for (c = 0; c < clients; c++) fprintf(stdout, " %u", delivered[c]);
+            fprintf(stdout, "\n");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host benchmark of the adaptive stream over a real TCP link.
+ * The sender produces a high and a low 20 fps stream, with an IDR every 40
+ * frames and the GOPs of the low stream half a GOP later. It sends one of
+ * them to the receiver like an RTP over TCP client, measures the send queue
+ * of the socket as the server does and switches at the IDRs. It prints the
+ * switches and the time spent on each stream.
+ * Limit the link with tc and change the rate during the run, for example a
+ * veth in a network namespace with
+ *   tc qdisc add dev veth0 root tbf rate 2mbit burst 16kb limit 64kb
+ *   tc qdisc change dev veth0 root tbf rate 500kbit burst 16kb limit 64kb
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include "StreamSwitch.hh"
+
+#define FRAME_US 50000
+#define GOP 40
+#define THIN_BYTES 65536                    // same thresholds as the server
+
+long long now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void sleep_until(long long t)
+{
+    long long d = t - now_us();
+    struct timespec ts;
+
+    if (d <= 0) return;
+    ts.tv_sec = d / 1000000;
+    ts.tv_nsec = (d % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+int receiver(int port)
+{
+    struct sockaddr_in addr;
+    unsigned char buf[65536];
+    unsigned long long bytes = 0;
+    long long start = 0;
+    int fd, client, on = 1;
+    ssize_t n;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if ((fd < 0) || (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) || (listen(fd, 1) != 0)) {
+        fprintf(stderr, "Error listening on port %d\n", port);
+        return -1;
+    }
+    client = accept(fd, NULL, NULL);
+    if (client < 0) return -1;
+
+    while ((n = recv(client, buf, sizeof(buf), 0)) > 0) {
+        if (start == 0) start = now_us();
+        bytes += n;
+    }
+    fprintf(stdout, "receiver - bytes: %llu - %.0f kbit/s\n", bytes,
+            (now_us() > start) ? bytes * 8000.0 / (now_us() - start) : 0.0);
+    close(client);
+    close(fd);
+
+    return 0;
+}
+
+// Congestion of the client as seen by the server, from the send queue
+int congestion(int fd)
+{
+    int queued;
+
+    if (ioctl(fd, SIOCOUTQ, &queued) != 0) return 0;
+    if (queued > 2 * THIN_BYTES) return 2;
+    if (queued > THIN_BYTES) return 1;
+
+    return 0;
+}
+
+int sender(struct sockaddr_in *dest, unsigned int frames, unsigned int idr_len, unsigned int p_len, unsigned int ratio)
+{
+    static unsigned char buf[1048576];
+    stream_switch sw;
+    unsigned int frame, len, sent[2], dropped = 0;
+    int fd, key[2], c, target;
+    long long start, t, ms;
+    ssize_t n;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((fd < 0) || (connect(fd, (struct sockaddr *) dest, sizeof(*dest)) != 0)) {
+        fprintf(stderr, "Error connecting\n");
+        return -1;
+    }
+    memset(buf, 0, sizeof(buf));
+    memset(sent, 0, sizeof(sent));
+
+    start = now_us();
+    stream_switch_init(&sw, 0);
+    for (frame = 0; frame < frames; frame++) {
+        t = start + (long long) frame * FRAME_US;
+        sleep_until(t);
+        ms = (t - start) / 1000;
+
+        key[SWITCH_HIGH] = (frame % GOP == 0);
+        key[SWITCH_LOW] = (frame % GOP == GOP / 2);
+        c = congestion(fd);
+        target = stream_switch_update(&sw, c, ms);
+        if ((target != sw.current) && (key[target])) {
+            fprintf(stdout, "%lld ms: switched %s -> %s after %lld ms - congestion %d\n",
+                    ms, stream_switch_name(sw.current), stream_switch_name(target), ms - sw.switched_at, c);
+            stream_switch_commit(&sw, ms);
+        }
+
+        len = key[sw.current] ? idr_len : p_len;
+        if (sw.current == SWITCH_LOW) len /= ratio;
+        if (len > sizeof(buf)) len = sizeof(buf);
+        // A full socket drops the frame, the server doesn't block either
+        n = send(fd, buf, len, MSG_DONTWAIT);
+        if ((n < 0) && (errno == EAGAIN)) {
+            dropped++;
+        } else {
+            sent[sw.current]++;
+        }
+    }
+    close(fd);
+
+    fprintf(stdout, "sender - frames: %u - high: %u - low: %u - dropped: %u\n",
+            frames, sent[SWITCH_HIGH], sent[SWITCH_LOW], dropped);
+    fflush(stdout);
+    stream_switch_stats(&sw, "sender", (long long) frames * FRAME_US / 1000);
+
+    return 0;
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s -R PORT\n", progname);
+    fprintf(stderr, "       %s -d ADDR:PORT [-n FRAMES] [-i BYTES] [-p BYTES] [-r RATIO]\n\n", progname);
+    fprintf(stderr, "\t-R PORT\n");
+    fprintf(stderr, "\t\treceive on PORT\n");
+    fprintf(stderr, "\t-d ADDR:PORT\n");
+    fprintf(stderr, "\t\tsend to ADDR:PORT\n");
+    fprintf(stderr, "\t-n FRAMES\n");
+    fprintf(stderr, "\t\tframes to send (default 1200)\n");
+    fprintf(stderr, "\t-i BYTES\n");
+    fprintf(stderr, "\t\thigh stream IDR size (default 60000)\n");
+    fprintf(stderr, "\t-p BYTES\n");
+    fprintf(stderr, "\t\tsize of the other high stream frames (default 6000)\n");
+    fprintf(stderr, "\t-r RATIO\n");
+    fprintf(stderr, "\t\tthe low stream frames are RATIO times smaller (default 4)\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in dest;
+    unsigned int frames = 1200, idr_len = 60000, p_len = 6000, ratio = 4;
+    int port = 0, have_dest = 0, opt;
+    char *colon;
+
+    memset(&dest, 0, sizeof(dest));
+    while ((opt = getopt(argc, argv, "R:d:n:i:p:r:h")) != -1) {
+        switch (opt) {
+        case 'R':
+            port = atoi(optarg);
+            break;
+        case 'd':
+            colon = strchr(optarg, ':');
+            if (colon == NULL) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            *colon = '\0';
+            dest.sin_family = AF_INET;
+            dest.sin_port = htons(atoi(colon + 1));
+            if (inet_pton(AF_INET, optarg, &dest.sin_addr) != 1) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            have_dest = 1;
+            break;
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'i':
+            idr_len = atoi(optarg);
+            break;
+        case 'p':
+            p_len = atoi(optarg);
+            break;
+        case 'r':
+            ratio = atoi(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (port > 0) return receiver(port);
+    if ((!have_dest) || (frames == 0) || (ratio == 0)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    return sender(&dest, frames, idr_len, p_len, ratio);
+}
@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host benchmark of a stalled TCP client next to healthy ones.
+ * A capture thread pushes a 20 fps stream, with an IDR every 40 frames and
+ * every other P frame not used as a reference, into the frame ring. An
+ * event loop thread reads a cursor for each client and sends the frames
+ * over loopback TCP like an RTP over TCP client: a non-blocking send and,
+ * when the socket takes only part of a frame, a blocking send of the rest
+ * with a 500 ms timeout that drops the client (RTPInterface). It thins the
+ * stream of a congested client from the send queue of its socket, like
+ * VideoFramedMemorySource.
+ * Each client is a thread that reads the frames and measures their latency
+ * from the push. Client 0 stops reading for a while, or reads slowly. The
+ * test runs without and with thinning and prints the latency of every
+ * client. The receive buffer of the clients stands for the link and the
+ * send buffer of the server for the memory of the camera.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include "FramePool.hh"
+#include "FrameRing.hh"
+
+#define MAX_CLIENTS 16
+#define FRAME_US 50000
+#define GOP 40
+#define IDR_LEN 60000
+#define P_LEN 6000
+#define HEADER_LEN 16                       // length, counter and push time in front of each frame
+#define RING_SIZE 40
+#define BLOCKING_WRITE_TIMEOUT_MS 500       // as RTPInterface
+#define THIN_STEP_MS 1000                   // same thresholds as the server
+#define THIN_RECOVER_MS 2000
+
+#define THIN_LEVEL_NONE   0
+#define THIN_LEVEL_NONREF 1
+#define THIN_LEVEL_GOP    2
+
+typedef struct
+{
+    int fd;                                 // server side
+    int peer;                               // client side
+    frame_cursor cursor;
+    int open;
+    long long congested_at;
+    long long thin_since;
+    unsigned int levels;                    // thin level changes
+    unsigned int send_drops;                // frames the full socket didn't take
+    unsigned int blocked_ms;                // event loop time in blocking sends
+    // Receiver
+    pthread_t thread;
+    unsigned int index;
+    unsigned int *latency;                  // ms of each frame received
+    unsigned int received;
+} client;
+
+unsigned int frames;
+unsigned int nclients;
+unsigned int stall_start;
+unsigned int stall_len;
+unsigned int slow_rate;
+unsigned int rcvbuf;
+unsigned int sndbuf;
+unsigned int thin_bytes;
+
+frame_pool pool;
+frame_ring ring;
+client clients[MAX_CLIENTS];
+int notify_pipe[2];
+int producer_done;
+int stop;
+long long start_us;
+
+long long now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void sleep_us(long long d)
+{
+    struct timespec ts;
+
+    if (d <= 0) return;
+    ts.tv_sec = d / 1000000;
+    ts.tv_nsec = (d % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+// Client 0 doesn't read during the stall
+int stalled(unsigned int index)
+{
+    long long t = now_us() - start_us;
+
+    return ((index == 0) && (stall_len > 0) && (t >= stall_start * 1000000LL) &&
+            (t < (stall_start + stall_len) * 1000000LL));
+}
+
+void *receiver(void *arg)
+{
+    client *c = (client *) arg;
+    unsigned char buf[IDR_LEN + HEADER_LEN];
+    unsigned int want, got = 0, len = 0, chunk;
+    long long pushed;
+    ssize_t n;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+        if (stalled(c->index)) {
+            sleep_us(10000);
+            continue;
+        }
+        want = (got < HEADER_LEN) ? HEADER_LEN - got : len - got;
+        chunk = ((c->index == 0) && (slow_rate > 0) && (want > 4096)) ? 4096 : want;
+        n = recv(c->peer, buf + got, chunk, 0);
+        if (n <= 0) break;
+        got += n;
+        if ((c->index == 0) && (slow_rate > 0)) sleep_us(n * 1000LL / slow_rate);
+        if (got == HEADER_LEN) {
+            memcpy(&len, buf, sizeof(len));
+            if (len < HEADER_LEN) break;
+        }
+        if ((got >= HEADER_LEN) && (got == len)) {
+            memcpy(&pushed, buf + 8, sizeof(pushed));
+            c->latency[c->received++] = (now_us() - pushed) / 1000;
+            got = 0;
+        }
+    }
+
+    return NULL;
+}
+
+// Wake up the event loop, as triggerEvent()
+void frame_ring_notify(void *data)
+{
+    char b = 0;
+    ssize_t n;
+
+    (void) data;
+    n = write(notify_pipe[1], &b, 1);
+    (void) n;
+}
+
+void *producer(void *arg)
+{
+    output_frame of;
+    unsigned int i, len;
+    long long t;
+    int counter;
+
+    (void) arg;
+    for (i = 0; i < frames; i++) {
+        sleep_us(start_us + (long long) i * FRAME_US - now_us());
+        len = (i % GOP == 0) ? IDR_LEN : P_LEN;
+        of.slab = frame_pool_get(&pool, len);
+        if (of.slab == NULL) continue;
+        memset(of.slab->data, i, len);
+        counter = i;
+        t = now_us();
+        memcpy(of.slab->data, &len, sizeof(len));
+        memcpy(of.slab->data + 4, &counter, sizeof(counter));
+        memcpy(of.slab->data + 8, &t, sizeof(t));
+        of.time = i * (FRAME_US / 1000);
+        of.counter = i;
+        of.flags = (i % GOP == 0) ? FRAME_FLAG_KEY : ((i % 2) ? FRAME_FLAG_NONREF : 0);
+        frame_ring_push(&ring, &of);
+    }
+    __atomic_store_n(&producer_done, 1, __ATOMIC_RELEASE);
+    frame_ring_notify(NULL);
+
+    return NULL;
+}
+
+int congestion(client *c)
+{
+    int queued;
+
+    if ((thin_bytes == 0) || (ioctl(c->fd, SIOCOUTQ, &queued) != 0)) return 0;
+    if ((unsigned int) queued > 2 * thin_bytes) return 2;
+    if ((unsigned int) queued > thin_bytes) return 1;
+
+    return 0;
+}
+
+// Same steps as VideoFramedMemorySource::thin()
+int thin(client *c, unsigned int flags)
+{
+    long long now = now_us() / 1000;
+    int cg = congestion(c);
+    int level = c->cursor.thin_level;
+
+    if (cg > 0) c->congested_at = now;
+    if (level == THIN_LEVEL_NONE) {
+        if (cg == 2) level = THIN_LEVEL_GOP;
+        else if (cg == 1) level = THIN_LEVEL_NONREF;
+    } else if (level == THIN_LEVEL_NONREF) {
+        if ((cg == 2) || ((cg == 1) && (now - c->thin_since >= THIN_STEP_MS))) level = THIN_LEVEL_GOP;
+        else if (now - c->congested_at >= THIN_RECOVER_MS) level = THIN_LEVEL_NONE;
+    } else if ((flags & FRAME_FLAG_KEY) && (now - c->congested_at >= THIN_RECOVER_MS)) {
+        level = THIN_LEVEL_NONREF;
+    }
+
+    if (level != c->cursor.thin_level) {
+        c->cursor.thin_level = level;
+        c->thin_since = now;
+        c->levels++;
+    }
+
+    if ((level == THIN_LEVEL_NONREF) && (flags & FRAME_FLAG_NONREF)) return 1;
+    if ((level == THIN_LEVEL_GOP) && !(flags & FRAME_FLAG_KEY)) return 1;
+
+    return 0;
+}
+
+void close_client(client *c)
+{
+    frame_cursor_close(&c->cursor);
+    shutdown(c->fd, SHUT_RDWR);
+    c->open = 0;
+}
+
+// Send a frame like RTPInterface: drop it if the socket is full, block
+// for the rest if it took a part, and drop the client if that times out
+void send_frame(client *c, unsigned char *data, unsigned int len)
+{
+    struct timeval tv;
+    long long t;
+    ssize_t n;
+
+    n = send(c->fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if ((n < 0) && (errno == EAGAIN)) {
+        c->send_drops++;
+        return;
+    }
+    if (n < 0) {
+        close_client(c);
+        return;
+    }
+    if ((unsigned int) n == len) return;
+
+    t = now_us();
+    tv.tv_sec = 0;
+    tv.tv_usec = BLOCKING_WRITE_TIMEOUT_MS * 1000;
+    setsockopt(c->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    while ((unsigned int) n < len) {
+        ssize_t m = send(c->fd, data + n, len - n, MSG_NOSIGNAL);
+        if (m <= 0) break;
+        n += m;
+    }
+    c->blocked_ms += (now_us() - t) / 1000;
+    if ((unsigned int) n < len) close_client(c);
+}
+
+void event_loop()
+{
+    struct pollfd pfd;
+    output_frame of;
+    unsigned int i;
+    char buf[64];
+    int busy;
+    ssize_t n;
+
+    pfd.fd = notify_pipe[0];
+    pfd.events = POLLIN;
+    for (;;) {
+        poll(&pfd, 1, 100);
+        do {
+            n = read(notify_pipe[0], buf, sizeof(buf));
+        } while (n == sizeof(buf));
+
+        busy = 0;
+        for (i = 0; i < nclients; i++) {
+            client *c = &clients[i];
+            while (c->open && (frame_cursor_pop(&c->cursor, &of) == 1)) {
+                if (thin(c, of.flags)) {
+                    c->cursor.thinned++;
+                } else {
+                    send_frame(c, of.slab->data, of.slab->len);
+                }
+                frame_slab_unref(of.slab);
+                busy = 1;
+            }
+        }
+        if (!busy && __atomic_load_n(&producer_done, __ATOMIC_ACQUIRE)) break;
+    }
+}
+
+int connect_client(int lfd, struct sockaddr_in *addr, client *c)
+{
+    int on = 1;
+
+    c->peer = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->peer < 0) return -1;
+    if (rcvbuf > 0) setsockopt(c->peer, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (connect(c->peer, (struct sockaddr *) addr, sizeof(*addr)) != 0) return -1;
+    c->fd = accept(lfd, NULL, NULL);
+    if (c->fd < 0) return -1;
+    if (sndbuf > 0) setsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    return 0;
+}
+
+int compare_uint(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+    return (x > y) - (x < y);
+}
+
+void print_client(client *c)
+{
+    unsigned int p50 = 0, p99 = 0, max = 0;
+
+    if (c->received > 0) {
+        qsort(c->latency, c->received, sizeof(unsigned int), compare_uint);
+        p50 = c->latency[c->received / 2];
+        p99 = c->latency[(c->received * 99) / 100];
+        max = c->latency[c->received - 1];
+    }
+    fprintf(stdout, "  client %u%s - received %u - latency p50 %u ms - p99 %u ms - max %u ms - thinned %u - dropped %u - send drops %u - thin changes %u - blocked %u ms%s\n",
+            c->index, (c->index == 0) ? " (stalled)" : "", c->received, p50, p99, max,
+            c->cursor.thinned, c->cursor.dropped, c->send_drops, c->levels, c->blocked_ms,
+            c->open ? "" : " - disconnected");
+}
+
+int run(unsigned int thin)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t producer_thread;
+    unsigned int i;
+    int lfd;
+
+    thin_bytes = thin;
+    memset(clients, 0, sizeof(clients));
+    producer_done = 0;
+    stop = 0;
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((lfd < 0) || (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) != 0) ||
+            (listen(lfd, MAX_CLIENTS) != 0) || (getsockname(lfd, (struct sockaddr *) &addr, &addr_len) != 0)) {
+        fprintf(stderr, "Error listening on loopback\n");
+        return -1;
+    }
+    if (pipe(notify_pipe) != 0) return -1;
+    fcntl(notify_pipe[0], F_SETFL, O_NONBLOCK);
+
+    frame_pool_init(&pool, 4 * IDR_LEN * (RING_SIZE / GOP + 2), RING_SIZE + FRAME_POOL_SLABS_MARGIN + 4);
+    frame_ring_init(&ring, RING_SIZE);
+    frame_ring_set_limits(&ring, FRAME_RING_POLICY_GOP, 0, 0);
+    frame_ring_set_notify(&ring, frame_ring_notify, NULL);
+
+    start_us = now_us();
+    for (i = 0; i < nclients; i++) {
+        client *c = &clients[i];
+        c->index = i;
+        c->latency = (unsigned int *) calloc(frames, sizeof(unsigned int));
+        if ((c->latency == NULL) || (connect_client(lfd, &addr, c) != 0)) {
+            fprintf(stderr, "Error connecting client %u\n", i);
+            return -1;
+        }
+        frame_cursor_set_limits(&c->cursor, RING_SIZE, 0, 0);
+        frame_cursor_open(&ring, &c->cursor, 0);
+        c->open = 1;
+        pthread_create(&c->thread, NULL, receiver, c);
+    }
+    pthread_create(&producer_thread, NULL, producer, NULL);
+
+    event_loop();
+
+    pthread_join(producer_thread, NULL);
+    // Let the healthy clients read the last frames
+    sleep_us(200000);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < nclients; i++) {
+        if (clients[i].open) shutdown(clients[i].fd, SHUT_RDWR);
+        shutdown(clients[i].peer, SHUT_RDWR);
+        pthread_join(clients[i].thread, NULL);
+    }
+
+    fprintf(stdout, "thin bytes %u - clients %u - frames %u\n", thin_bytes, nclients, frames);
+    for (i = 0; i < nclients; i++) {
+        print_client(&clients[i]);
+        if (clients[i].open) frame_cursor_close(&clients[i].cursor);
+        close(clients[i].fd);
+        close(clients[i].peer);
+        free(clients[i].latency);
+    }
+    fflush(stdout);
+
+    frame_ring_free(&ring);
+    frame_pool_free(&pool);
+    close(notify_pipe[0]);
+    close(notify_pipe[1]);
+    close(lfd);
+
+    return 0;
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [-n FRAMES] [-c CLIENTS] [-s START] [-l LEN] [-k RATE] [-b BYTES] [-w BYTES] [-t BYTES]\n\n", progname);
+    fprintf(stderr, "\t-n FRAMES\n");
+    fprintf(stderr, "\t\tframes to push, 20 per second (default 400)\n");
+    fprintf(stderr, "\t-c CLIENTS\n");
+    fprintf(stderr, "\t\tclients, client 0 stalls (default 4)\n");
+    fprintf(stderr, "\t-s START\n");
+    fprintf(stderr, "\t\tsecond at which client 0 stops reading (default 5)\n");
+    fprintf(stderr, "\t-l LEN\n");
+    fprintf(stderr, "\t\tseconds client 0 doesn't read for (default 5)\n");
+    fprintf(stderr, "\t-k RATE\n");
+    fprintf(stderr, "\t\tclient 0 reads RATE kB/s when it reads, 0 no limit (default 0)\n");
+    fprintf(stderr, "\t-b BYTES\n");
+    fprintf(stderr, "\t\treceive buffer of the clients (default 65536)\n");
+    fprintf(stderr, "\t-w BYTES\n");
+    fprintf(stderr, "\t\tsend buffer of the server, 0 system default (default 131072)\n");
+    fprintf(stderr, "\t-t BYTES\n");
+    fprintf(stderr, "\t\tsend queue that starts thinning in the second run (default 65536)\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int thin = 65536;
+    int opt;
+
+    frames = 400;
+    nclients = 4;
+    stall_start = 5;
+    stall_len = 5;
+    slow_rate = 0;
+    rcvbuf = 65536;
+    sndbuf = 131072;
+
+    while ((opt = getopt(argc, argv, "n:c:s:l:k:b:w:t:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'c':
+            nclients = atoi(optarg);
+            break;
+        case 's':
+            stall_start = atoi(optarg);
+            break;
+        case 'l':
+            stall_len = atoi(optarg);
+            break;
+        case 'k':
+            slow_rate = atoi(optarg);
+            break;
+        case 'b':
+            rcvbuf = atoi(optarg);
+            break;
+        case 'w':
+            sndbuf = atoi(optarg);
+            break;
+        case 't':
+            thin = atoi(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if ((frames == 0) || (nclients == 0) || (nclients > MAX_CLIENTS) || (thin == 0)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    if (run(0) != 0) return -1;
+
+    return run(thin);
+}
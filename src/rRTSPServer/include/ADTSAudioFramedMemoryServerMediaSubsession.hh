@@ -23,16 +23,15 @@
 #define _ADTS_AUDIO_FRAMED_MEMORY_SERVER_MEDIA_SUBSESSION_HH
 
 #include "OnDemandServerMediaSubsession.hh"
-#include "StreamReplicator.hh"
 
 #include "rRTSPServer.h"
 
 class ADTSAudioFramedMemoryServerMediaSubsession: public OnDemandServerMediaSubsession {
 public:
     static ADTSAudioFramedMemoryServerMediaSubsession*
-    createNew(UsageEnvironment& env, StreamReplicator *replicator,
+    createNew(UsageEnvironment& env, output_queue *qBuffer,
               Boolean reuseFirstSource, unsigned samplingFrequency,
-              unsigned char numChannels);
+              unsigned char numChannels, Boolean useTimeForPres);
 
     // Used to implement "getAuxSDPLine()":
     void checkForAuxSDPLine1();
@@ -40,10 +39,11 @@ public:
 
 protected:
     ADTSAudioFramedMemoryServerMediaSubsession(UsageEnvironment& env,
-                                               StreamReplicator *replicator,
+                                               output_queue *qBuffer,
                                                Boolean reuseFirstSource,
                                                unsigned samplingFrequency,
-                                               unsigned char numChannels);
+                                               unsigned char numChannels,
+                                               Boolean useTimeForPres);
         // called only by createNew();
     virtual ~ADTSAudioFramedMemoryServerMediaSubsession();
 
@@ -62,9 +62,10 @@ private:
     char* fAuxSDPLine;
     char fDoneFlag; // used when setting up "fAuxSDPLine"
     RTPSink* fDummyRTPSink; // ditto
-    StreamReplicator *fReplicator;
+    output_queue *fQBuffer;
     unsigned fSamplingFrequency;
     unsigned char fNumChannels;
+    Boolean fUseTimeForPres;
     char fConfigStr[5];
 };
 
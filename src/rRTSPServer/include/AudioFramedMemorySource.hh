@@ -57,8 +57,11 @@ private:
     virtual void doGetNextFrame();
     virtual void doStopGettingFrames();
 
+    void waitForFrames();
+
 private:
     output_queue *fQBuffer;
+    frame_cursor fCursor;                   // position of this client in the ring
     u_int64_t fCurIndex;
     int fProfile;
     unsigned fSamplingFrequency;
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Preallocated pool of refcounted frame buffers.
+ * Frames are copied out of the shm ring once, into a slab carved from a
+ * circular arena, and the slab is given back when the last reference is
+ * released.
+ * Only the capture thread gets slabs, any thread can release them.
+ */
+
+#ifndef _FRAME_POOL_H
+#define _FRAME_POOL_H
+
+#include <stdint.h>
+
+#define FRAME_POOL_SLABS_MARGIN 8          // slabs in use outside the queue
+
+typedef struct frame_slab
+{
+    unsigned char *data;
+    unsigned int len;
+    unsigned int off;                       // offset of data in the arena
+    int refcount;
+    int heap;                               // allocated outside the arena
+} frame_slab;
+
+#define FRAME_FLAG_KEY    1                 // parameter set or IDR
+#define FRAME_FLAG_NONREF 2                 // not used as a reference
+
+typedef struct
+{
+    frame_slab *slab;                       // refcounted, the reader releases it
+    uint32_t time;                          // ms
+    int counter;
+    unsigned int flags;
+} output_frame;
+
+typedef struct
+{
+    unsigned char *arena;
+    unsigned int size;
+    unsigned int head;                      // first free byte
+    unsigned int tail;                      // first byte in use
+    frame_slab *slabs;                      // descriptors, used in fifo order
+    unsigned int nslabs;
+    unsigned int slab_head;
+    unsigned int slab_tail;
+    unsigned int used;
+    // Statistics
+    unsigned int frames;
+    unsigned int heap_allocs;               // frames that didn't fit in the arena
+    unsigned int misses;                    // frames without memory, dropped
+    unsigned long long bytes_copied;
+} frame_pool;
+
+int frame_pool_init(frame_pool *pool, unsigned int size, unsigned int nslabs);
+void frame_pool_free(frame_pool *pool);
+frame_slab *frame_pool_get(frame_pool *pool, unsigned int len);
+void frame_pool_stats(frame_pool *pool, const char *name);
+
+void frame_slab_ref(frame_slab *slab);
+void frame_slab_unref(frame_slab *slab);
+
+#endif
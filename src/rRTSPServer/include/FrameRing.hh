@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shared frame ring with a read cursor for each client.
+ * One producer (the capture thread) pushes refcounted slabs, the ring
+ * keeps them within its limits (frames, bytes or ms) and every reader
+ * (a source in the live555 event loop) walks the ring with its own
+ * cursor, taking a reference to the slab instead of a copy.
+ * Each cursor has its own lag limits: when a reader falls behind, the
+ * producer moves its cursor forward. With FRAME_RING_POLICY_GOP the
+ * cursor jumps to the last GOP start in the ring, or skips the new frames
+ * until the next one, so the reader never gets a frame whose references
+ * have been removed. With FRAME_RING_POLICY_OLDEST the oldest frames are
+ * skipped.
+ * Popping is lock-free: the producer publishes the frames with the
+ * readable indexes and moves a late cursor by setting its jump index,
+ * which the reader applies at the next pop. All the cursors of a ring are
+ * read in one thread (the event loop), that marks the frame it takes a
+ * reference to so the producer doesn't release it meanwhile.
+ * The mutex serializes the push with opening and closing the cursors and
+ * with the statistics.
+ */
+
+#ifndef _FRAME_RING_H
+#define _FRAME_RING_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "FramePool.hh"
+
+#define FRAME_RING_POLICY_OLDEST 0          // audio, skip the oldest frames
+#define FRAME_RING_POLICY_GOP    1          // video, skip to a GOP start
+
+typedef struct
+{
+    output_frame of;
+    uint32_t pos;                           // bytes pushed before this frame
+} frame_ring_slot;
+
+typedef struct frame_cursor
+{
+    struct frame_ring *ring;
+    uint32_t tail;                          // next frame to read, set by the reader
+    uint32_t jump;                          // set by the producer, the reader moves its tail there
+    unsigned int max_size;                  // lag limits, 0 no limit
+    unsigned int max_bytes;
+    unsigned int max_ms;
+    int skipping;                           // waiting for the next GOP start, producer only
+    struct frame_cursor *next;
+    // Used only in the event loop
+    int waiting;                            // the reader wants a trigger at the next push
+    void (*reader_task)(void *);
+    void *reader;
+    int thin_level;                         // frames the reader skips, see VideoFramedMemorySource
+    // Statistics
+    unsigned int popped;
+    unsigned int dropped;                   // frames skipped by the producer
+    unsigned int catchups;
+    unsigned int thinned;                   // frames skipped by the reader
+} frame_cursor;
+
+typedef struct frame_ring
+{
+    frame_ring_slot *slots;
+    unsigned int capacity;                  // power of 2
+    unsigned int max_size;                  // frames kept, the largest lag of a cursor
+    unsigned int max_bytes;                 // 0 no limit
+    unsigned int max_ms;                    // 0 no limit
+    int policy;
+    uint32_t head;                          // producer only
+    uint32_t tail;                          // oldest frame kept, producer only
+    uint32_t first;                         // tail and head published to the readers
+    uint32_t last;
+    uint32_t reading;                       // frame the reader is taking
+    int reading_set;
+    uint32_t bytes;                         // total pushed, wraps
+    uint32_t gop_start;                     // last frame that starts a GOP
+    int gop_valid;                          // gop_start is still in the ring
+    unsigned int last_flags;
+    frame_cursor *cursors;
+    unsigned int ncursors;
+    pthread_mutex_t mutex;
+    void (*notify)(void *);                 // called by the producer after each push
+    void *notify_data;
+    // Statistics
+    unsigned int pushed;
+    unsigned int released;
+    unsigned int gops;
+} frame_ring;
+
+int frame_ring_init(frame_ring *r, unsigned int max_size);
+void frame_ring_set_limits(frame_ring *r, int policy, unsigned int max_bytes, unsigned int max_ms);
+void frame_ring_free(frame_ring *r);
+void frame_ring_set_notify(frame_ring *r, void (*notify)(void *), void *notify_data);
+
+/* Producer */
+void frame_ring_push(frame_ring *r, output_frame *of);
+
+/* Readers */
+void frame_cursor_set_limits(frame_cursor *c, unsigned int max_size, unsigned int max_bytes, unsigned int max_ms);
+unsigned int frame_cursor_open(frame_ring *r, frame_cursor *c, unsigned int backlog);
+void frame_cursor_close(frame_cursor *c);
+int frame_cursor_pop(frame_cursor *c, output_frame *of);
+unsigned int frame_cursor_size(frame_cursor *c);
+
+unsigned int frame_ring_size(frame_ring *r);
+
+void frame_ring_stats(frame_ring *r, const char *name);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cache of the last parameter sets and of the frames since the last IDR.
+ * A new reader starts from the cache instead of waiting for the next IDR.
+ * The cache holds references to the slabs of the ring pool.
+ */
+
+#ifndef _GOP_CACHE_H
+#define _GOP_CACHE_H
+
+#include <pthread.h>
+
+#include "FrameRing.hh"
+
+#define GOP_CACHE_PARAMS 4                  // VPS, SPS, PPS
+#define GOP_CACHE_FRAMES 100                // 5 s at 20 fps
+
+typedef struct
+{
+    output_frame params[GOP_CACHE_PARAMS];
+    unsigned int nparams;
+    unsigned int param_index;               // position in the group being received
+    unsigned int params_seq;                // incremented when the parameter sets change
+    output_frame frames[GOP_CACHE_FRAMES];
+    unsigned int nframes;
+    unsigned int bytes;
+    unsigned int max_bytes;
+    int valid;                              // frames start with an IDR
+    int last_type;
+    pthread_mutex_t mutex;
+    // Statistics
+    unsigned int gops;
+    unsigned int overflows;
+    unsigned int invalidations;             // frames of the GOP lost
+    unsigned int primes;
+    unsigned int frames_primed;
+} gop_cache;
+
+int gop_cache_init(gop_cache *c, unsigned int max_bytes);
+void gop_cache_free(gop_cache *c);
+
+/* Capture thread */
+void gop_cache_push(gop_cache *c, frame_ring *r, output_frame *of, int type);
+void gop_cache_invalidate(gop_cache *c);
+
+/* Reader */
+unsigned int gop_cache_prime(gop_cache *c, frame_ring *r, frame_cursor *cursor, output_frame **frames);
+
+unsigned int gop_cache_params(gop_cache *c, output_frame *params, unsigned int *seq);
+unsigned int gop_cache_params_seq(gop_cache *c);
+
+void gop_cache_stats(gop_cache *c, const char *name);
+
+#endif
@@ -26,27 +26,28 @@
 
 #include "rRTSPServer.h"
 
+class VideoFramedMemorySource;
+
 class H265VideoFramedMemoryServerMediaSubsession: public OnDemandServerMediaSubsession {
 public:
     static H265VideoFramedMemoryServerMediaSubsession*
         createNew(UsageEnvironment& env, output_queue *qBuffer, Boolean useTimeForPres,
-                                Boolean reuseFirstSource);
+                                Boolean reuseFirstSource, output_queue *qLow = NULL);
 
-    // Used to implement "getAuxSDPLine()":
-    void checkForAuxSDPLine1();
-    void afterPlayingDummy1();
+private:
+    Boolean auxSDPLineFromCache(RTPSink* rtpSink);
 
 protected:
     H265VideoFramedMemoryServerMediaSubsession(UsageEnvironment& env,
                                         output_queue *qBuffer,
                                         Boolean useTimeForPres,
-                                        Boolean reuseFirstSource);
+                                        Boolean reuseFirstSource,
+                                        output_queue *qLow);
       // called only by createNew();
       virtual ~H265VideoFramedMemoryServerMediaSubsession();
 
-      void setDoneFlag() { fDoneFlag = ~0; }
-
 protected: // redefined virtual functions
+    virtual char const* sdpLines(int addressFamily);
     virtual char const* getAuxSDPLine(RTPSink* rtpSink,
                                     FramedSource* inputSource);
     virtual FramedSource* createNewStreamSource(unsigned clientSessionId,
@@ -54,13 +55,29 @@ protected: // redefined virtual functions
     virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock,
                                     unsigned char rtpPayloadTypeIfDynamic,
                                     FramedSource* inputSource);
+    virtual void getStreamParameters(unsigned clientSessionId,
+                                    struct sockaddr_storage const& clientAddress,
+                                    Port const& clientRTPPort,
+                                    Port const& clientRTCPPort,
+                                    int tcpSocketNum,
+                                    unsigned char rtpChannelId,
+                                    unsigned char rtcpChannelId,
+                                    TLSState* tlsState,
+                                    struct sockaddr_storage& destinationAddress,
+                                    u_int8_t& destinationTTL,
+                                    Boolean& isMulticast,
+                                    Port& serverRTPPort,
+                                    Port& serverRTCPPort,
+                                    void*& streamToken);
+    virtual Groupsock* createGroupsock(struct sockaddr_storage const& addr, Port port);
 
 private:
     output_queue *fQBuffer;
+    output_queue *fQLow;                    // adaptive stream: switch to it under congestion
     Boolean fUseTimeForPres;
     char* fAuxSDPLine;
-    char fDoneFlag; // used when setting up "fAuxSDPLine"
-    RTPSink* fDummyRTPSink; // ditto
+    unsigned fAuxSDPLineSeq; // parameter sets used to build "fAuxSDPLine"
+    VideoFramedMemorySource* fNewSource; // created by the last createNewStreamSource()
 };
 
 #endif
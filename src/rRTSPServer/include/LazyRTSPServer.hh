@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTSP server that listens before all the streams are ready.
+ * A stream declared pending answers "503 Service Unavailable" instead of
+ * "404 Stream Not Found" until its ServerMediaSession is added.
+ */
+
+#ifndef _LAZY_RTSP_SERVER_HH
+#define _LAZY_RTSP_SERVER_HH
+
+#include "RTSPServer.hh"
+
+#define LAZY_RTSP_SERVER_MAX_PENDING 8
+
+class LazyRTSPServer: public RTSPServer {
+public:
+    static LazyRTSPServer* createNew(UsageEnvironment& env, Port ourPort = 554,
+                                    UserAuthenticationDatabase* authDatabase = NULL,
+                                    unsigned reclamationSeconds = 65);
+
+    void addPendingStream(char const* streamName);
+    // A stream that failed: "404 Stream Not Found" from now on
+    void removePendingStream(char const* streamName);
+    // Add the session and remove its stream from the pending ones
+    void addReadyServerMediaSession(ServerMediaSession* serverMediaSession);
+    Boolean isPendingStream(char const* streamName) const;
+
+protected:
+    LazyRTSPServer(UsageEnvironment& env, int ourSocketIPv4, int ourSocketIPv6, Port ourPort,
+                    UserAuthenticationDatabase* authDatabase, unsigned reclamationSeconds);
+        // called only by createNew();
+    virtual ~LazyRTSPServer();
+
+protected: // redefined virtual functions
+    virtual ClientConnection* createNewClientConnection(int clientSocket, struct sockaddr_storage const& clientAddr);
+
+public:
+    class LazyRTSPClientConnection: public RTSPClientConnection {
+    protected:
+        LazyRTSPClientConnection(LazyRTSPServer& ourServer, int clientSocket, struct sockaddr_storage const& clientAddr);
+        virtual ~LazyRTSPClientConnection();
+
+        friend class LazyRTSPServer;
+
+    protected: // redefined virtual functions
+        virtual void handleCmd_DESCRIBE(char const* urlPreSuffix, char const* urlSuffix, char const* fullRequestStr);
+
+    private:
+        LazyRTSPServer& fOurLazyRTSPServer;
+    };
+
+private:
+    char* fPending[LAZY_RTSP_SERVER_MAX_PENDING];
+};
+
+#endif
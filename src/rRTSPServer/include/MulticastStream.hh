@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTP multicast of a stream.
+ * A single source and sink send the stream to a group, whatever the number
+ * of viewers: the RTSP server only gives the group to the clients.
+ * The sink starts when the stream is created and never stops.
+ * A group in 232.0.0.0/8 is source specific (SSM), the others any source (ASM).
+ */
+
+#ifndef _MULTICAST_STREAM_HH
+#define _MULTICAST_STREAM_HH
+
+#include "Groupsock.hh"
+
+#include <rRTSPServer.h>
+
+class RTPSink;
+class RTCPInstance;
+class FramedSource;
+class ServerMediaSubsession;
+class StreamReplicator;
+
+#define MULTICAST_PAYLOAD_TYPE 96
+
+typedef struct
+{
+    struct sockaddr_storage addr;
+    u_int8_t ttl;
+    Boolean ssm;
+} multicast_group;
+
+typedef struct
+{
+    Groupsock *rtp_groupsock;
+    Groupsock *rtcp_groupsock;
+    FramedSource *source;
+    RTPSink *sink;
+    RTCPInstance *rtcp;
+} multicast_stream;
+
+/*
+ * Parse the group, NULL chooses a random SSM group.
+ * Return 0 or -1 if addr is not an IPv4 multicast address.
+ */
+int multicast_group_init(UsageEnvironment& env, multicast_group *g, char const *addr, int ttl);
+
+/*
+ * Start a stream on port of the group, RTCP on port + 1.
+ * Return 0 or -1 on error.
+ */
+int multicast_stream_video(UsageEnvironment& env, multicast_stream *ms, multicast_group *g, unsigned short port,
+        output_queue *q, int codec, Boolean useTimeForPres);
+int multicast_stream_aac(UsageEnvironment& env, multicast_stream *ms, multicast_group *g, unsigned short port,
+        output_queue *q, unsigned samplingFrequency, unsigned numChannels, Boolean useTimeForPres);
+int multicast_stream_pcm(UsageEnvironment& env, multicast_stream *ms, multicast_group *g, unsigned short port,
+        StreamReplicator *replicator, int convertTo);
+
+// A subsession for a session, every session needs its own
+ServerMediaSubsession* multicast_stream_subsession(multicast_stream *ms);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A Groupsock that paces the packets of large frames with scheduler timers
+ */
+
+#ifndef _PACED_GROUPSOCK_HH
+#define _PACED_GROUPSOCK_HH
+
+#include "Groupsock.hh"
+
+#include "PacketPacer.hh"
+
+class PacedGroupsock: public Groupsock {
+public:
+    PacedGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+                    Port port, u_int8_t ttl, unsigned const* windowUs, unsigned burst);
+    virtual ~PacedGroupsock();
+
+    virtual Boolean output(UsageEnvironment& env, unsigned char* buffer, unsigned bufferSize);
+
+private:
+    static void sendNextTask(void* clientData);
+    void sendNext();
+    void scheduleNext();
+    void flush();
+
+private:
+    packet_pacer fPacer;
+    unsigned const* fWindowUs;              // of the stream, follows its frame rate
+    TaskToken fTask;
+};
+
+#endif
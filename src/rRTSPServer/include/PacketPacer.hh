@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pacing of the RTP packets of a client.
+ * The RTP sink sends the packets of a frame back to back. The first burst
+ * packets of a frame are sent at once, the others are queued and spread
+ * over a window that starts with the first packet of the frame, so an IDR
+ * doesn't overflow the buffers of a Wi-Fi link. A frame that comes after
+ * the window starts a new one.
+ * No timers here: the caller asks when the next packet is due and sends it
+ * from its own scheduler. Times are in us.
+ */
+
+#ifndef _PACKET_PACER_H
+#define _PACKET_PACER_H
+
+#include <stdint.h>
+
+#define PACER_SLOTS 256                     // queued packets, more are sent at once
+#define PACER_SLOT_SIZE 1536
+#define PACER_COLLECT_US 1000               // wait for the rest of the frame before spreading it
+
+typedef struct
+{
+    unsigned char *data;                    // PACER_SLOTS slots of PACER_SLOT_SIZE bytes, allocated when needed
+    unsigned int lens[PACER_SLOTS];
+    uint32_t head;
+    uint32_t tail;
+    unsigned int window_us;                 // time to send a frame, 0 no pacing
+    unsigned int burst;                     // packets of a frame sent at once
+    long long window_end;
+    unsigned int window_packets;            // packets of the current frame
+    long long next_send;                    // when the first queued packet is due
+    long long gap;                          // between two queued packets of the window
+    // Statistics
+    unsigned int packets;
+    unsigned int paced;
+    unsigned int overflows;                 // packets sent at once with a full queue
+    unsigned int max_queue;
+} packet_pacer;
+
+int packet_pacer_init(packet_pacer *p, unsigned int window_us, unsigned int burst);
+void packet_pacer_free(packet_pacer *p);
+void packet_pacer_set_window(packet_pacer *p, unsigned int window_us);
+
+/*
+ * Add a packet sent at time now.
+ * Return 1 if it must be sent now, 0 if it has been queued, -1 if the
+ * queue is full: send the queued packets and then this one.
+ */
+int packet_pacer_push(packet_pacer *p, unsigned char *buf, unsigned int len, long long now);
+
+// Time of the next queued packet, -1 if the queue is empty
+long long packet_pacer_next(packet_pacer *p);
+
+/*
+ * Take the first queued packet, the buffer is valid until the next push.
+ * Return 1 or 0 if the queue is empty.
+ */
+int packet_pacer_pop(packet_pacer *p, unsigned char **buf, unsigned int *len, long long now);
+
+void packet_pacer_stats(packet_pacer *p, const char *name);
+
+#endif
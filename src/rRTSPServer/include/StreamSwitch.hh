@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Choice between the high and the low stream of an adaptive client.
+ * The client starts on the high stream and asks for the low one when it is
+ * heavily congested, or congested for a while. It asks for the high one
+ * again after a period without congestion, which doubles every time the
+ * high stream fails soon after a switch. The caller switches at the next
+ * key frame of the stream asked for and then commits.
+ * No clock here: times are in ms and given by the caller.
+ */
+
+#ifndef _STREAM_SWITCH_H
+#define _STREAM_SWITCH_H
+
+#define SWITCH_HIGH 0
+#define SWITCH_LOW  1
+
+#define SWITCH_DOWN_MS 1000                 // congestion that moves to the low stream
+#define SWITCH_UP_MS 10000                  // no congestion that moves back to the high stream
+#define SWITCH_UP_MAX_MS 120000
+#define SWITCH_PROBE_MS 10000               // a high stream congested sooner has failed
+
+typedef struct
+{
+    int current;                            // SWITCH_HIGH or SWITCH_LOW
+    int target;                             // the stream asked for
+    long long switched_at;
+    long long congested_since;              // start of the current congestion, 0 none
+    long long congested_at;                 // last congestion
+    long long up_ms;                        // no congestion that moves back up
+    // Statistics
+    unsigned int switches;
+    unsigned int failed_ups;
+    long long time_on[2];                   // ms on each stream, up to the last switch
+} stream_switch;
+
+void stream_switch_init(stream_switch *s, long long now);
+
+/*
+ * Give the congestion of the client (0 none, 1 congested, 2 heavily) at a
+ * frame. Return the stream asked for.
+ */
+int stream_switch_update(stream_switch *s, int congestion, long long now);
+
+// The stream asked for has reached a key frame and is now sent
+void stream_switch_commit(stream_switch *s, long long now);
+
+const char *stream_switch_name(int stream);
+void stream_switch_stats(stream_switch *s, const char *name, long long now);
+
+#endif
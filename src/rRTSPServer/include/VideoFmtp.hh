@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * fmtp line of the SDP of a H.264 or H.265 stream, built from the
+ * parameter sets cached by the capture thread.
+ */
+
+#ifndef _VIDEO_FMTP_H
+#define _VIDEO_FMTP_H
+
+#include "GopCache.hh"
+
+/*
+ * Build the "a=fmtp:" line of codec (CODEC_H264 or CODEC_H265), seq is set
+ * to the version of the parameter sets it comes from.
+ * Return the line, allocated with new[], or NULL if the cache doesn't have
+ * all the parameter sets yet.
+ */
+char *video_fmtp_from_cache(gop_cache *gop, int codec, unsigned char payload_type, unsigned int *seq);
+
+#endif
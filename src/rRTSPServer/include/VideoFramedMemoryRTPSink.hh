@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * H.264 and H.265 RTP sinks fed by a VideoFramedMemorySource without a
+ * framer and a fragmenter: the source copies every packet straight from
+ * the slab, the frame is not copied again for each client.
+ */
+
+#ifndef _VIDEO_FRAMED_MEMORY_RTP_SINK_HH
+#define _VIDEO_FRAMED_MEMORY_RTP_SINK_HH
+
+#include "H264VideoRTPSink.hh"
+#include "H265VideoRTPSink.hh"
+
+class H264VideoFramedMemoryRTPSink: public H264VideoRTPSink {
+public:
+    static H264VideoFramedMemoryRTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                                    u_int8_t const* sps = NULL, unsigned spsSize = 0,
+                                                    u_int8_t const* pps = NULL, unsigned ppsSize = 0);
+
+protected:
+    H264VideoFramedMemoryRTPSink(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                    u_int8_t const* sps, unsigned spsSize, u_int8_t const* pps, unsigned ppsSize);
+        // called only by createNew()
+
+private: // redefined virtual functions
+    virtual Boolean sourceIsCompatibleWithUs(MediaSource& source);
+    virtual Boolean continuePlaying();
+    virtual void doSpecialFrameHandling(unsigned fragmentationOffset, unsigned char* frameStart,
+                                        unsigned numBytesInFrame, struct timeval framePresentationTime,
+                                        unsigned numRemainingBytes);
+};
+
+class H265VideoFramedMemoryRTPSink: public H265VideoRTPSink {
+public:
+    static H265VideoFramedMemoryRTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                                    u_int8_t const* vps = NULL, unsigned vpsSize = 0,
+                                                    u_int8_t const* sps = NULL, unsigned spsSize = 0,
+                                                    u_int8_t const* pps = NULL, unsigned ppsSize = 0);
+
+protected:
+    H265VideoFramedMemoryRTPSink(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                    u_int8_t const* vps, unsigned vpsSize, u_int8_t const* sps, unsigned spsSize,
+                                    u_int8_t const* pps, unsigned ppsSize);
+        // called only by createNew()
+
+private: // redefined virtual functions
+    virtual Boolean sourceIsCompatibleWithUs(MediaSource& source);
+    virtual Boolean continuePlaying();
+    virtual void doSpecialFrameHandling(unsigned fragmentationOffset, unsigned char* frameStart,
+                                        unsigned numBytesInFrame, struct timeval framePresentationTime,
+                                        unsigned numRemainingBytes);
+};
+
+#endif
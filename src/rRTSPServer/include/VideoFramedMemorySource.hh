@@ -26,6 +26,13 @@
 #endif
 
 #include <rRTSPServer.h>
+#include "StreamSwitch.hh"
+
+#define THIN_LEVEL_NONE   0                 // send every frame
+#define THIN_LEVEL_NONREF 1                 // skip the frames not used as a reference
+#define THIN_LEVEL_GOP    2                 // skip everything up to the next key frame
+
+class RTPSink;
 
 class VideoFramedMemorySource: public FramedSource {
 public:
@@ -33,19 +40,30 @@ public:
                                                 int hNumber,
                                                 output_queue *qBuffer,
                                                 Boolean useTimeForPres,
-                                                unsigned playTimePerFrame = 0);
+                                                unsigned playTimePerFrame = 0,
+                                                output_queue *qLow = NULL);
 
     void seekToByteAbsolute(u_int64_t byteNumber, u_int64_t numBytesToStream = 0);
     void seekToByteRelative(int64_t offset, u_int64_t numBytesToStream = 0);
     static void doGetNextFrameTask(void *clientData);
     void doGetNextFrameEx();
 
+    // The client of this source, used to detect congestion
+    void setRTPSink(RTPSink* rtpSink) { fRTPSink = rtpSink; }
+    void setTCPSocket(int tcpSocketNum) { fTCPSocketNum = tcpSocketNum; }
+
+    // Without a framer: send the NAL units larger than a packet in
+    // fragments, straight from the slab, see VideoFramedMemoryRTPSink
+    void setMaxFragmentSize(unsigned maxFragmentSize) { fMaxFragmentSize = maxFragmentSize; }
+    Boolean pictureEndMarker() const { return fPictureEndMarker; }
+
 protected:
     VideoFramedMemorySource(UsageEnvironment& env,
                                 int hNumber,
                                 output_queue *qBuffer,
                                 Boolean useTimeForPres,
-                                unsigned playTimePerFrame);
+                                unsigned playTimePerFrame,
+                                output_queue *qLow);
         // called only by createNew()
 
     virtual ~VideoFramedMemorySource();
@@ -55,9 +73,24 @@ private:
     virtual void doGetNextFrame();
     virtual void doStopGettingFrames();
 
+    void waitForFrames();
+    void releasePrime();
+    void deliverFragment();
+    Boolean endsPicture(u_int8_t nal);
+    int congestion();
+    Boolean thin(unsigned int flags);
+    void adapt();
+    void switchStream(output_frame *keyFrame);
+
 private:
     int fHNumber;
-    output_queue *fQBuffer;
+    output_queue *fQBuffer;                 // the stream sent
+    frame_cursor *fCursor;                  // position of this client in its ring
+    output_queue *fQAlt;                    // adaptive client: the other stream
+    frame_cursor *fAltCursor;               // open while waiting for its key frame
+    frame_cursor fCursors[2];
+    stream_switch fSwitch;
+    uint32_t fLastTime;
     u_int64_t fCurIndex;
     Boolean fUseTimeForPres;
     unsigned fPlayTimePerFrame;
@@ -65,6 +98,19 @@ private:
     Boolean fLimitNumBytesToStream;
     u_int64_t fNumBytesToStream; // used iff "fLimitNumBytesToStream" is True
     Boolean fHaveStartedReading;
+    output_frame *fPrime;                   // frames from the gop cache, sent before the queue
+    unsigned fPrimeCount;
+    unsigned fPrimeIndex;
+    RTPSink* fRTPSink;
+    int fTCPSocketNum;                      // -1 for UDP
+    long long fThinSince;                   // last change of the thin level
+    long long fCongestedAt;                 // last time congestion was detected
+    int fCongestion;                        // at the last frame
+    unsigned fMaxFragmentSize;              // 0 whole frames, for a framer
+    output_frame fFrag;                     // frame being fragmented
+    unsigned fFragOffset;                   // next byte of its NAL unit
+    unsigned fFragDuration;
+    Boolean fPictureEndMarker;              // the last piece ends a picture
 };
 
 #endif
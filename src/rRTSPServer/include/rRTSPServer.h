@@ -25,122 +25,15 @@
 
 //#define _GNU_SOURCE
 
-#include <queue>
-#include <vector>
-
 #include <sys/types.h>
 
-#define BUFFER_FILE "/dev/shm/fshare_frame_buf"
-#define BUFFER_SHM "fshare_frame_buf"
-#define READ_LOCK_FILE "fshare_read_lock"
-#define WRITE_LOCK_FILE "fshare_write_lock"
+#include "fshare.h"
+#include "FramePool.hh"
+#include "FrameRing.hh"
+#include "GopCache.hh"
 
 #define MAX_QUEUE_SIZE 20
 
-#define Y20GA 0
-#define Y25GA 1
-#define Y30QA 2
-#define Y501GC 3
-#define Y21GA 4
-#define Y211GA 5
-#define Y211BA 6
-#define Y213GA 7
-#define Y291GA 8
-#define H30GA 9
-#define R30GB 10
-#define R35GB 11
-#define R37GB 12
-#define R40GA 13
-#define H51GA 14
-#define H52GA 15
-#define H60GA 16
-#define Y28GA 17
-#define Y29GA 18
-#define Y623 19
-#define Q321BR_LSX 20
-#define QG311R 21
-#define B091QP 22
-
-#define FRAME_OFFSET_AUTODETECT 0
-#define FRAME_OFFSET_TRY_1 300
-#define FRAME_OFFSET_TRY_2 368
-#define FRAME_HEADER_SIZE_AUTODETECT 0
-
-#define BUF_OFFSET_Y20GA 300
-#define FRAME_HEADER_SIZE_Y20GA 22
-
-#define BUF_OFFSET_Y25GA 300
-#define FRAME_HEADER_SIZE_Y25GA 22
-
-#define BUF_OFFSET_Y30QA 300
-#define FRAME_HEADER_SIZE_Y30QA 22
-
-#define BUF_OFFSET_Y501GC 368
-#define FRAME_HEADER_SIZE_Y501GC 24
-
-#define BUF_OFFSET_Y21GA 368
-#define FRAME_HEADER_SIZE_Y21GA 28
-
-#define BUF_OFFSET_Y211GA 368
-#define FRAME_HEADER_SIZE_Y211GA 28
-
-#define BUF_OFFSET_Y211BA 368
-#define FRAME_HEADER_SIZE_Y211BA 28
-
-#define BUF_OFFSET_Y213GA 368
-#define FRAME_HEADER_SIZE_Y213GA 28
-
-#define BUF_OFFSET_Y291GA 368
-#define FRAME_HEADER_SIZE_Y291GA 28
-
-#define BUF_OFFSET_H30GA 368
-#define FRAME_HEADER_SIZE_H30GA 28
-
-//#define BUF_OFFSET_R30GB 300
-#define BUF_OFFSET_R30GB 0
-//#define FRAME_HEADER_SIZE_R30GB 22
-#define FRAME_HEADER_SIZE_R30GB 0
-
-//#define BUF_OFFSET_R35GB 300
-#define BUF_OFFSET_R35GB 0
-//#define FRAME_HEADER_SIZE_R35GB 26
-#define FRAME_HEADER_SIZE_R35GB 0
-
-//#define BUF_OFFSET_R37GB 368
-#define BUF_OFFSET_R37GB 0
-//#define FRAME_HEADER_SIZE_R37GB 28
-#define FRAME_HEADER_SIZE_R37GB 0
-
-#define BUF_OFFSET_R40GA 300
-#define FRAME_HEADER_SIZE_R40GA 26
-
-#define BUF_OFFSET_H51GA 368
-#define FRAME_HEADER_SIZE_H51GA 28
-
-#define BUF_OFFSET_H52GA 368
-#define FRAME_HEADER_SIZE_H52GA 28
-
-#define BUF_OFFSET_H60GA 368
-#define FRAME_HEADER_SIZE_H60GA 28
-
-#define BUF_OFFSET_Y28GA 368
-#define FRAME_HEADER_SIZE_Y28GA 28
-
-#define BUF_OFFSET_Y29GA 368
-#define FRAME_HEADER_SIZE_Y29GA 28
-
-#define BUF_OFFSET_Y623 368
-#define FRAME_HEADER_SIZE_Y623 28
-
-#define BUF_OFFSET_Q321BR_LSX 300
-#define FRAME_HEADER_SIZE_Q321BR_LSX 26
-
-#define BUF_OFFSET_QG311R 300
-#define FRAME_HEADER_SIZE_QG311R 26
-
-#define BUF_OFFSET_B091QP 300
-#define FRAME_HEADER_SIZE_B091QP 26
-
 #define MILLIS_10 10000
 #define MILLIS_25 25000
 
@@ -161,93 +54,54 @@
 #define OUTPUT_BUFFER_SIZE_HIGH 524288
 #define OUTPUT_BUFFER_SIZE_AUDIO 32768
 
-#define CODEC_NONE 0
-#define CODEC_H264 264
-#define CODEC_H265 265
+class TaskScheduler;
 
-typedef struct
-{
-    unsigned char *buffer;                  // pointer to the base of the input buffer
-    char filename[256];                     // name of the buffer file
-    unsigned int size;                      // size of the buffer file
-    unsigned int offset;                    // offset where stream starts
-    unsigned char *read_index;              // read absolute index
-} cb_input_buffer;
+#define AUDIO_CURSOR_BACKLOG 5              // frames, a new audio reader starts with
 
-typedef struct
-{
-    std::vector<unsigned char> frame;
-    uint32_t time;
-    int counter;
-} output_frame;
+// Thinning of the video of a congested client
+#define THIN_BYTES_DEFAULT 65536            // TCP send queue that starts thinning
+#define THIN_LOSS 13                        // RTCP fraction lost (/256) that starts thinning, 5%
+#define THIN_LOSS_HEAVY 51                  // 20%
+#define THIN_RTT_MS 500                     // RTCP round trip that starts thinning
+#define THIN_RTT_HEAVY_MS 1500
+#define THIN_JITTER_MS 100                  // RTCP interarrival jitter that starts thinning
+#define THIN_RR_MAX_AGE_MS 10000            // ignore older receiver reports
+#define THIN_STEP_MS 1000                   // congestion that moves from non-ref frames to whole GOPs
+#define THIN_RECOVER_MS 2000                // no congestion that moves back
+
+#define VIDEO_FRAME_US 50000                // frame interval of the video sources, 20 fps
+#define PACE_PERCENT_DEFAULT 50             // part of the frame interval to send a large frame
+#define PACE_BURST 2                        // packets of a frame sent at once
+
+#ifndef RTP_PAYLOAD_MAX_SIZE
+#define RTP_PAYLOAD_MAX_SIZE 1456
+#endif
+#define RTP_PAYLOAD_MIN_SIZE 256
+#define RTP_PAYLOAD_LARGEST_SIZE 1456       // still fits a 1500 bytes MTU
+
+// Multicast streams: high on the first port, low on + 2, audio on + 4
+#define MULTICAST_PORT_DEFAULT 18888
+#define MULTICAST_TTL_DEFAULT 1             // don't leave the local network
 
 typedef struct
 {
-    std::queue<output_frame> frame_queue;
-    pthread_mutex_t mutex;
+    frame_ring ring;                        // shared by the readers, one cursor each
     unsigned int type;
+    frame_pool pool;
+    gop_cache gop;                          // video only
+    unsigned int max_size;                  // lag limits of each cursor
+    unsigned int max_bytes;
+    unsigned int max_ms;
+    unsigned int thin_bytes;                // TCP send queue of a client that starts thinning, 0 never
+    unsigned int pace_us;                   // window to send the packets of a frame, 0 no pacing
+    unsigned int payload_size;              // max size of the RTP packets
+    // Wake up the readers in the event loop when a frame is pushed
+    TaskScheduler *scheduler;
+    unsigned int trigger;
 } output_queue;
 
-struct __attribute__((__packed__)) frame_header {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-};
-
-struct __attribute__((__packed__)) frame_header_22 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint16_t u4;
-};
-
-struct __attribute__((__packed__)) frame_header_24 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint16_t u4;
-    uint16_t u5;
-};
-
-struct __attribute__((__packed__)) frame_header_26 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t u2;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint16_t u4;
-};
-
-struct __attribute__((__packed__)) frame_header_28 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t u2;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint32_t u4;
-};
-
-struct stream_type_s {
-    int codec_low;
-    int codec_high;
-    int sps_type_low;
-    int sps_type_high;
-    int vps_type_low;
-    int vps_type_high;
-};
-
 long long current_timestamp();
+void output_queue_notify(void *clientData);
+void output_queue_trigger(void *clientData);
 
 #endif
@@ -24,28 +24,29 @@
 #include "ADTSAudioFileSource.hh"
 #include "AudioFramedMemorySource.hh"
 #include "MPEG4GenericRTPSink.hh"
-#include "FramedFilter.hh"
 #include "rRTSPServer.h"
 
 extern int debug;
 
 ADTSAudioFramedMemoryServerMediaSubsession*
 ADTSAudioFramedMemoryServerMediaSubsession::createNew(UsageEnvironment& env,
-                                                StreamReplicator *replicator,
+                                                output_queue *qBuffer,
                                                 Boolean reuseFirstSource,
                                                 unsigned samplingFrequency,
-                                                unsigned char numChannels) {
-    return new ADTSAudioFramedMemoryServerMediaSubsession(env, replicator, reuseFirstSource, samplingFrequency, numChannels);
+                                                unsigned char numChannels,
+                                                Boolean useTimeForPres) {
+    return new ADTSAudioFramedMemoryServerMediaSubsession(env, qBuffer, reuseFirstSource, samplingFrequency, numChannels, useTimeForPres);
 }
 
 ADTSAudioFramedMemoryServerMediaSubsession::ADTSAudioFramedMemoryServerMediaSubsession(UsageEnvironment& env,
-                                                                        StreamReplicator *replicator,
+                                                                        output_queue *qBuffer,
                                                                         Boolean reuseFirstSource,
                                                                         unsigned samplingFrequency,
-                                                                        unsigned char numChannels)
+                                                                        unsigned char numChannels,
+                                                                        Boolean useTimeForPres)
     : OnDemandServerMediaSubsession(env, reuseFirstSource),
-      fAuxSDPLine(NULL), fDoneFlag(0), fDummyRTPSink(NULL), fReplicator(replicator),
-      fSamplingFrequency(samplingFrequency), fNumChannels(numChannels) {
+      fAuxSDPLine(NULL), fDoneFlag(0), fDummyRTPSink(NULL), fQBuffer(qBuffer),
+      fSamplingFrequency(samplingFrequency), fNumChannels(numChannels), fUseTimeForPres(useTimeForPres) {
 }
 
 ADTSAudioFramedMemoryServerMediaSubsession::~ADTSAudioFramedMemoryServerMediaSubsession() {
@@ -114,37 +115,17 @@ char const* ADTSAudioFramedMemoryServerMediaSubsession::getAuxSDPLine(RTPSink* r
 FramedSource* ADTSAudioFramedMemoryServerMediaSubsession::createNewStreamSource(unsigned /*clientSessionId*/, unsigned& estBitrate) {
     estBitrate = 32; // kbps, estimate
 
-    FramedSource* resultSource = NULL;
-    AudioFramedMemorySource* originalSource = NULL;
-    FramedFilter* previousSource = (FramedFilter*)fReplicator->inputSource();
-
-    // Iterate back into the filter chain until a source is found that.
-    // has a sample frequency and expected to be a AudioFramedMemorySource.
-    for (int x = 0; x < 10; x++) {
-        if ((((AudioFramedMemorySource*)(previousSource))->samplingFrequency() == fSamplingFrequency) &&
-               (((AudioFramedMemorySource*)(previousSource))->numChannels() == fNumChannels)) {
-
-            if (debug & 8) fprintf(stderr, "%lld: ADTSAudioFramedMemoryServerMediaSubsession - source found at x = %d\n", current_timestamp(), x);
-            originalSource = (AudioFramedMemorySource*)(previousSource);
-            break;
-        }
-        previousSource = (FramedFilter*)previousSource->inputSource();
-    }
-    if (debug & 8) fprintf(stderr, "%lld: ADTSAudioFramedMemoryServerMediaSubsession - fReplicator->inputSource() = %p\n", current_timestamp(), originalSource);
-    resultSource = fReplicator->createStreamReplica();
-    if (resultSource == NULL) {
-        fprintf(stderr, "%lld: ADTSAudioFramedMemoryServerMediaSubsession - Failed to create stream replica\n", current_timestamp());
-        Medium::close(resultSource);
+    // Each client reads the ring with its own source
+    AudioFramedMemorySource* memorySource = AudioFramedMemorySource::createNew(envir(), fQBuffer, fSamplingFrequency, fNumChannels, fUseTimeForPres);
+    if (memorySource == NULL) {
+        fprintf(stderr, "%lld: ADTSAudioFramedMemoryServerMediaSubsession - Failed to create source\n", current_timestamp());
         return NULL;
-    } else {
-        sprintf(fConfigStr, originalSource->configStr());
-        if (debug & 8) fprintf(stderr, "%lld: ADTSAudioFramedMemoryServerMediaSubsession - createStreamReplica completed successfully\n", current_timestamp());
-        if (debug & 8) fprintf(stderr, "%lld: ADTSAudioFramedMemoryServerMediaSubsession - Sampling frequency: %d, Num channels: %d, Config string: %s\n",
-            current_timestamp(), fSamplingFrequency, fNumChannels, fConfigStr);
-
-        //return ADTSAudioStreamDiscreteFramer::createNew(envir(), resultSource, fConfigStr);
-        return resultSource;
     }
+    sprintf(fConfigStr, "%s", memorySource->configStr());
+    if (debug & 8) fprintf(stderr, "%lld: ADTSAudioFramedMemoryServerMediaSubsession - Sampling frequency: %d, Num channels: %d, Config string: %s\n",
+        current_timestamp(), fSamplingFrequency, fNumChannels, fConfigStr);
+
+    return memorySource;
 }
 
 RTPSink* ADTSAudioFramedMemoryServerMediaSubsession
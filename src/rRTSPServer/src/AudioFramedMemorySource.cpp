@@ -63,6 +63,10 @@ AudioFramedMemorySource::AudioFramedMemorySource(UsageEnvironment& env,
     : FramedSource(env), fQBuffer(qBuffer), fProfile(1), fSamplingFrequency(samplingFrequency),
       fNumChannels(numChannels), fUseTimeForPres(useTimeForPres), fHaveStartedReading(False) {
 
+    memset(&fCursor, 0, sizeof(fCursor));
+    fCursor.reader_task = doGetNextFrameTask;
+    fCursor.reader = this;
+
     u_int8_t samplingFrequencyIndex;
     int i;
     for (i = 0; i < 16; i++) {
@@ -88,7 +92,14 @@ AudioFramedMemorySource::AudioFramedMemorySource(UsageEnvironment& env,
     if (debug & 8) fprintf(stderr, "%lld: AudioFramedMemorySource - fConfigStr %s\n", current_timestamp(), fConfigStr);
 }
 
-AudioFramedMemorySource::~AudioFramedMemorySource() {}
+AudioFramedMemorySource::~AudioFramedMemorySource() {
+    frame_cursor_close(&fCursor);
+}
+
+// Ask for a trigger, doGetNextFrame() is called again at the next push
+void AudioFramedMemorySource::waitForFrames() {
+    fCursor.waiting = 1;
+}
 
 int AudioFramedMemorySource::check_sync_word(unsigned char *str)
 {
@@ -103,6 +114,7 @@ int AudioFramedMemorySource::check_sync_word(unsigned char *str)
 
 void AudioFramedMemorySource::doStopGettingFrames() {
     fHaveStartedReading = False;
+    frame_cursor_close(&fCursor);
 }
 
 void AudioFramedMemorySource::doGetNextFrameTask(void* clientData) {
@@ -116,18 +128,16 @@ void AudioFramedMemorySource::doGetNextFrameEx() {
 
 void AudioFramedMemorySource::doGetNextFrame() {
     Boolean frameFound = false;
-    Boolean isFirstReading = !fHaveStartedReading;
+    output_frame of;
+
+    // Woken up by the event trigger but nobody asked for a frame
+    if (!isCurrentlyAwaitingData()) return;
+
     if (!fHaveStartedReading) {
         if (debug & 8) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() 1st start\n", current_timestamp());
-        pthread_mutex_lock(&(fQBuffer->mutex));
-        // Yes, I know that I should not block the event loop
-        while (fQBuffer->frame_queue.size() < 5) {
-            pthread_mutex_unlock(&(fQBuffer->mutex));
-            usleep(1000);
-            pthread_mutex_lock(&(fQBuffer->mutex));
-        }
-        while (fQBuffer->frame_queue.size() > 5) fQBuffer->frame_queue.pop();
-        pthread_mutex_unlock(&(fQBuffer->mutex));
+        // Start with the last frames in the ring
+        frame_cursor_set_limits(&fCursor, fQBuffer->max_size, fQBuffer->max_bytes, fQBuffer->max_ms);
+        frame_cursor_open(&(fQBuffer->ring), &fCursor, AUDIO_CURSOR_BACKLOG);
         fHaveStartedReading = True;
     }
 
@@ -136,31 +146,28 @@ void AudioFramedMemorySource::doGetNextFrame() {
     if (debug & 8) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() start - fMaxSize %d\n", current_timestamp(), fMaxSize);
 
     while (!frameFound) {
-        pthread_mutex_lock(&(fQBuffer->mutex));
-        if (fQBuffer->frame_queue.size() == 0) {
-            pthread_mutex_unlock(&(fQBuffer->mutex));
+        if (frame_cursor_pop(&fCursor, &of) == 0) {
             if (debug & 8) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() read_index = write_index\n", current_timestamp());
-        } else if (fQBuffer->frame_queue.front().frame.size() == 0) {
-            pthread_mutex_unlock(&(fQBuffer->mutex));
+            waitForFrames();
+            return;
+        } else if (of.slab->len == 0) {
+            frame_slab_unref(of.slab);
             fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() error - NULL ptr\n", current_timestamp());
-        } else if (check_sync_word(fQBuffer->frame_queue.front().frame.data()) != 1) {
-            if (fQBuffer->frame_queue.size() > 0) {
-                fQBuffer->frame_queue.pop();
-            }
-            pthread_mutex_unlock(&(fQBuffer->mutex));
+        } else if (check_sync_word(of.slab->data) != 1) {
+            frame_slab_unref(of.slab);
             fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() error - wrong frame header\n", current_timestamp());
         } else {
             frameFound = true;
         }
     }
 
-    if (debug & 8) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() size of queue is %d\n", current_timestamp(), fQBuffer->frame_queue.size());
+    if (debug & 8) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() size of queue is %d\n", current_timestamp(), frame_cursor_size(&fCursor));
 
     // Frame found, send it
     unsigned char *ptr;
-    int size = fQBuffer->frame_queue.front().frame.size();
-    uint32_t frame_time = fQBuffer->frame_queue.front().time;
-    ptr = fQBuffer->frame_queue.front().frame.data();
+    int size = of.slab->len;
+    uint32_t frame_time = of.time;
+    ptr = of.slab->data;
     ptr += HEADER_SIZE;
     size -= HEADER_SIZE;
 
@@ -168,17 +175,15 @@ void AudioFramedMemorySource::doGetNextFrame() {
         // The size of the frame is smaller than the available buffer
         fFrameSize = size;
         if (debug & 8) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() whole frame - fFrameSize %d - fMaxSize %d - counter %d - time %u\n",
-                current_timestamp(), fFrameSize, fMaxSize, fQBuffer->frame_queue.front().counter, frame_time);
+                current_timestamp(), fFrameSize, fMaxSize, of.counter, frame_time);
         std::memcpy(fTo, ptr, size);
-        fQBuffer->frame_queue.pop();
-        pthread_mutex_unlock(&(fQBuffer->mutex));
+        frame_slab_unref(of.slab);
         fNumTruncatedBytes = 0;
     } else {
         // The size of the frame is greater than the available buffer
         fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() error - the size of the frame is greater than the available buffer %d/%d\n", current_timestamp(), fFrameSize, fMaxSize);
         fFrameSize = 0;
-        fQBuffer->frame_queue.pop();
-        pthread_mutex_unlock(&(fQBuffer->mutex));
+        frame_slab_unref(of.slab);
         fNumTruncatedBytes = 0;
         fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() frame lost\n", current_timestamp());
     }
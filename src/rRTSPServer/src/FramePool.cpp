@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Preallocated pool of refcounted frame buffers.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "FramePool.hh"
+
+int frame_pool_init(frame_pool *pool, unsigned int size, unsigned int nslabs)
+{
+    memset(pool, 0, sizeof(frame_pool));
+
+    pool->arena = (unsigned char *) malloc(size);
+    pool->slabs = (frame_slab *) calloc(nslabs, sizeof(frame_slab));
+    if ((pool->arena == NULL) || (pool->slabs == NULL)) {
+        fprintf(stderr, "error - could not allocate frame pool\n");
+        frame_pool_free(pool);
+        return -1;
+    }
+    pool->size = size;
+    pool->nslabs = nslabs;
+
+    return 0;
+}
+
+void frame_pool_free(frame_pool *pool)
+{
+    if (pool->arena != NULL) free(pool->arena);
+    if (pool->slabs != NULL) free(pool->slabs);
+    pool->arena = NULL;
+    pool->slabs = NULL;
+    pool->size = 0;
+    pool->nslabs = 0;
+}
+
+// Give back the arena space of the oldest slabs that are no longer used
+static void frame_pool_reclaim(frame_pool *pool)
+{
+    while ((pool->used > 0) && (__atomic_load_n(&pool->slabs[pool->slab_tail].refcount, __ATOMIC_ACQUIRE) == 0)) {
+        pool->slab_tail = (pool->slab_tail + 1) % pool->nslabs;
+        pool->used--;
+        if (pool->used > 0) {
+            pool->tail = pool->slabs[pool->slab_tail].off;
+        } else {
+            pool->head = 0;
+            pool->tail = 0;
+        }
+    }
+}
+
+static frame_slab *frame_pool_get_heap(frame_pool *pool, unsigned int len)
+{
+    frame_slab *slab;
+
+    slab = (frame_slab *) malloc(sizeof(frame_slab) + len);
+    if (slab == NULL) {
+        fprintf(stderr, "error - could not allocate frame\n");
+        pool->misses++;
+        return NULL;
+    }
+    slab->data = (unsigned char *) (slab + 1);
+    slab->len = len;
+    slab->off = 0;
+    slab->refcount = 1;
+    slab->heap = 1;
+    pool->heap_allocs++;
+
+    return slab;
+}
+
+/*
+ * Get a slab of len bytes with a reference count of 1.
+ * If the arena is full fall back to the heap, the frame is never lost.
+ */
+frame_slab *frame_pool_get(frame_pool *pool, unsigned int len)
+{
+    frame_slab *slab;
+    unsigned int off;
+    int wrapped;
+
+    pool->frames++;
+    pool->bytes_copied += len;
+
+    frame_pool_reclaim(pool);
+    if (pool->used == pool->nslabs) return frame_pool_get_heap(pool, len);
+
+    // In use region is [tail, head) or, if wrapped, [tail, size) + [0, head)
+    wrapped = (pool->head < pool->tail) || ((pool->head == pool->tail) && (pool->used > 0));
+    if (!wrapped) {
+        if (len <= pool->size - pool->head) {
+            off = pool->head;
+        } else if (len < pool->tail) {
+            // Leave the end of the arena unused and restart from 0
+            off = 0;
+        } else if ((pool->used == 0) && (len <= pool->size)) {
+            off = 0;
+        } else {
+            return frame_pool_get_heap(pool, len);
+        }
+    } else {
+        if (len <= pool->tail - pool->head) {
+            off = pool->head;
+        } else {
+            return frame_pool_get_heap(pool, len);
+        }
+    }
+
+    slab = &pool->slabs[pool->slab_head];
+    slab->data = pool->arena + off;
+    slab->len = len;
+    slab->off = off;
+    slab->heap = 0;
+    __atomic_store_n(&slab->refcount, 1, __ATOMIC_RELAXED);
+
+    if (pool->used == 0) pool->tail = off;
+    pool->head = off + len;
+    pool->slab_head = (pool->slab_head + 1) % pool->nslabs;
+    pool->used++;
+
+    return slab;
+}
+
+void frame_pool_stats(frame_pool *pool, const char *name)
+{
+    fprintf(stderr, "%s: frame pool - frames: %u - heap allocations: %u - misses: %u - bytes copied per frame: %llu - slabs in use: %u/%u\n",
+            name, pool->frames, pool->heap_allocs, pool->misses,
+            (pool->frames > 0) ? pool->bytes_copied / pool->frames : 0, pool->used, pool->nslabs);
+    pool->frames = 0;
+    pool->heap_allocs = 0;
+    pool->misses = 0;
+    pool->bytes_copied = 0;
+}
+
+void frame_slab_ref(frame_slab *slab)
+{
+    __atomic_add_fetch(&slab->refcount, 1, __ATOMIC_RELAXED);
+}
+
+// Release a reference, arena slabs are reclaimed by the next frame_pool_get()
+void frame_slab_unref(frame_slab *slab)
+{
+    if (__atomic_sub_fetch(&slab->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (slab->heap) free(slab);
+    }
+}
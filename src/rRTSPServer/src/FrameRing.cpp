@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shared frame ring with a read cursor for each client.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sched.h>
+
+#include "FrameRing.hh"
+
+int frame_ring_init(frame_ring *r, unsigned int max_size)
+{
+    memset(r, 0, sizeof(frame_ring));
+
+    if (max_size == 0) return -1;
+    // One free slot for the new frame
+    r->capacity = 1;
+    while (r->capacity < max_size + 1) r->capacity <<= 1;
+    r->slots = (frame_ring_slot *) calloc(r->capacity, sizeof(frame_ring_slot));
+    if (r->slots == NULL) {
+        fprintf(stderr, "error - could not allocate frame ring\n");
+        return -1;
+    }
+    if (pthread_mutex_init(&(r->mutex), NULL) != 0) {
+        fprintf(stderr, "error - could not create frame ring mutex\n");
+        free(r->slots);
+        r->slots = NULL;
+        return -1;
+    }
+    r->max_size = max_size;
+
+    return 0;
+}
+
+/*
+ * Set the byte and time limits of the frames kept, 0 means no limit, and
+ * the policy of the cursors. Must be called before the first push.
+ */
+void frame_ring_set_limits(frame_ring *r, int policy, unsigned int max_bytes, unsigned int max_ms)
+{
+    r->policy = policy;
+    r->max_bytes = max_bytes;
+    r->max_ms = max_ms;
+}
+
+void frame_ring_free(frame_ring *r)
+{
+    if (r->slots == NULL) return;
+    while (r->tail != r->head) {
+        frame_slab_unref(r->slots[r->tail & (r->capacity - 1)].of.slab);
+        r->tail++;
+    }
+    free(r->slots);
+    r->slots = NULL;
+    pthread_mutex_destroy(&(r->mutex));
+}
+
+void frame_ring_set_notify(frame_ring *r, void (*notify)(void *), void *notify_data)
+{
+    r->notify_data = notify_data;
+    __atomic_store_n(&r->notify, notify, __ATOMIC_RELEASE);
+}
+
+static inline frame_ring_slot *frame_ring_slot_at(frame_ring *r, uint32_t index)
+{
+    return &r->slots[index & (r->capacity - 1)];
+}
+
+// Return 1 if the frames from index to head break the limits
+static int frame_ring_over(frame_ring *r, uint32_t index, unsigned int max_size, unsigned int max_bytes, unsigned int max_ms)
+{
+    unsigned int n = r->head - index;
+
+    if (n <= 1) return 0;
+    if ((max_size > 0) && (n > max_size)) return 1;
+    if ((max_bytes > 0) && (r->bytes - frame_ring_slot_at(r, index)->pos > max_bytes)) return 1;
+    if ((max_ms > 0) && ((int32_t) (frame_ring_slot_at(r, r->head - 1)->of.time - frame_ring_slot_at(r, index)->of.time) > (int32_t) max_ms)) return 1;
+
+    return 0;
+}
+
+// Move the tail past the oldest frames over the limits of the ring, the
+// caller releases them once the readers know
+static void frame_ring_release(frame_ring *r)
+{
+    while (frame_ring_over(r, r->tail, r->max_size, r->max_bytes, r->max_ms)) {
+        r->tail++;
+        r->released++;
+    }
+    if ((r->gop_valid) && ((int32_t) (r->gop_start - r->tail) < 0)) r->gop_valid = 0;
+}
+
+// Drop the reference of the ring to a frame no longer readable
+static void frame_ring_unref(frame_ring *r, uint32_t index)
+{
+    // The reader checked the frame before the tail moved and is taking a
+    // reference, a few instructions: wait for it
+    while ((__atomic_load_n(&r->reading_set, __ATOMIC_SEQ_CST)) &&
+            (__atomic_load_n(&r->reading, __ATOMIC_RELAXED) == index)) {
+        sched_yield();
+    }
+    frame_slab_unref(frame_ring_slot_at(r, index)->of.slab);
+}
+
+// Next frame of the cursor, the later of its tail and its jump
+static inline uint32_t frame_cursor_next(frame_cursor *c)
+{
+    uint32_t tail = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+    uint32_t jump = __atomic_load_n(&c->jump, __ATOMIC_ACQUIRE);
+
+    return ((int32_t) (jump - tail) > 0) ? jump : tail;
+}
+
+// The cursor is late, move it forward
+static void frame_cursor_catchup(frame_ring *r, frame_cursor *c, uint32_t tail)
+{
+    c->catchups++;
+    if ((int32_t) (tail - r->tail) < 0) {
+        c->dropped += r->tail - tail;
+        tail = r->tail;
+    }
+    if (r->policy == FRAME_RING_POLICY_GOP) {
+        if ((r->gop_valid) && ((int32_t) (r->gop_start - tail) >= 0)) {
+            // Restart from the last GOP, the reader gets a clean cut
+            c->dropped += r->gop_start - tail;
+            tail = r->gop_start;
+            if (!frame_ring_over(r, tail, c->max_size, c->max_bytes, c->max_ms)) {
+                __atomic_store_n(&c->jump, tail, __ATOMIC_RELEASE);
+                return;
+            }
+        }
+        // A single GOP, skip the new frames until the next one starts
+        c->dropped += r->head - tail;
+        tail = r->head;
+        c->skipping = 1;
+    } else {
+        while (frame_ring_over(r, tail, c->max_size, c->max_bytes, c->max_ms)) {
+            tail++;
+            c->dropped++;
+        }
+    }
+    __atomic_store_n(&c->jump, tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Add a frame, the ring takes the reference of the caller.
+ * Release the frames over the limits of the ring and move forward the
+ * cursors over their own limits.
+ * The jumps of the cursors are set before the new indexes are published:
+ * a reader that sees the new frame also sees where its cursor must go.
+ */
+void frame_ring_push(frame_ring *r, output_frame *of)
+{
+    frame_ring_slot *slot;
+    frame_cursor *c;
+    void (*notify)(void *);
+    uint32_t index, tail;
+    int start;
+
+    pthread_mutex_lock(&(r->mutex));
+    index = r->head;
+    slot = frame_ring_slot_at(r, index);
+    slot->of = *of;
+    slot->pos = r->bytes;
+    r->bytes += (of->slab != NULL) ? of->slab->len : 0;
+    r->head = index + 1;
+    r->pushed++;
+
+    // A key frame after a frame that is not starts a GOP
+    start = ((of->flags & FRAME_FLAG_KEY) && !(r->last_flags & FRAME_FLAG_KEY));
+    r->last_flags = of->flags;
+    if ((r->policy == FRAME_RING_POLICY_GOP) && (start)) {
+        r->gop_start = index;
+        r->gop_valid = 1;
+        r->gops++;
+    }
+    index = r->tail;
+    frame_ring_release(r);
+
+    for (c = r->cursors; c != NULL; c = c->next) {
+        if (c->skipping) {
+            // The jump is at the new frame
+            if (start) {
+                c->skipping = 0;
+            } else {
+                __atomic_store_n(&c->jump, r->head, __ATOMIC_RELEASE);
+                c->dropped++;
+            }
+            continue;
+        }
+        tail = frame_cursor_next(c);
+        if (((int32_t) (tail - r->tail) < 0) ||
+                (frame_ring_over(r, tail, c->max_size, c->max_bytes, c->max_ms))) {
+            frame_cursor_catchup(r, c, tail);
+        }
+    }
+
+    // Sequentially consistent, against the reading mark of the reader
+    __atomic_store_n(&r->first, r->tail, __ATOMIC_SEQ_CST);
+    for (; index != r->tail; index++) frame_ring_unref(r, index);
+    __atomic_store_n(&r->last, r->head, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&(r->mutex));
+
+    notify = __atomic_load_n(&r->notify, __ATOMIC_ACQUIRE);
+    if (notify != NULL) notify(r->notify_data);
+}
+
+// Set the lag limits of the cursor, 0 means no limit, before opening it
+void frame_cursor_set_limits(frame_cursor *c, unsigned int max_size, unsigned int max_bytes, unsigned int max_ms)
+{
+    c->max_size = max_size;
+    c->max_bytes = max_bytes;
+    c->max_ms = max_ms;
+}
+
+/*
+ * Attach the cursor to the ring, starting with the last backlog frames.
+ * With the gop policy the cursor starts at the first GOP start among them
+ * or, if there is none, at the next one.
+ * Return the number of frames available.
+ */
+unsigned int frame_cursor_open(frame_ring *r, frame_cursor *c, unsigned int backlog)
+{
+    uint32_t index;
+    unsigned int n;
+
+    pthread_mutex_lock(&(r->mutex));
+    c->ring = r;
+    c->skipping = 0;
+    c->waiting = 0;
+    c->popped = 0;
+    c->dropped = 0;
+    c->catchups = 0;
+    c->thin_level = 0;
+    c->thinned = 0;
+
+    n = r->head - r->tail;
+    if (backlog < n) n = backlog;
+    c->tail = r->head - n;
+    if ((r->policy == FRAME_RING_POLICY_GOP) && (backlog > 0)) {
+        // The frame at the ring tail could have lost its parameter sets
+        index = c->tail;
+        if ((index == r->tail) && (index != r->head)) index++;
+        while ((index != r->head) && !((frame_ring_slot_at(r, index)->of.flags & FRAME_FLAG_KEY) &&
+                !(frame_ring_slot_at(r, index - 1)->of.flags & FRAME_FLAG_KEY))) {
+            index++;
+        }
+        c->tail = index;
+        if (index == r->head) c->skipping = 1;
+    }
+    c->jump = c->tail;
+    n = r->head - c->tail;
+
+    c->next = r->cursors;
+    r->cursors = c;
+    r->ncursors++;
+    pthread_mutex_unlock(&(r->mutex));
+
+    return n;
+}
+
+void frame_cursor_close(frame_cursor *c)
+{
+    frame_ring *r = c->ring;
+    frame_cursor **p;
+
+    if (r == NULL) return;
+    pthread_mutex_lock(&(r->mutex));
+    for (p = &(r->cursors); *p != NULL; p = &((*p)->next)) {
+        if (*p == c) {
+            *p = c->next;
+            r->ncursors--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&(r->mutex));
+    c->ring = NULL;
+    c->next = NULL;
+    c->waiting = 0;
+}
+
+/*
+ * Take the next frame of the cursor, without locking the ring.
+ * Return 1 and a reference to the slab, 0 if there are no new frames.
+ */
+int frame_cursor_pop(frame_cursor *c, output_frame *of)
+{
+    frame_ring *r = c->ring;
+    uint32_t head, tail;
+
+    if (r == NULL) return 0;
+    for (;;) {
+        head = __atomic_load_n(&r->last, __ATOMIC_ACQUIRE);
+        tail = frame_cursor_next(c);
+        if ((int32_t) (head - tail) <= 0) return 0;
+
+        // Mark the frame, then check that the producer has not released it
+        __atomic_store_n(&r->reading, tail, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->reading_set, 1, __ATOMIC_SEQ_CST);
+        if ((int32_t) (tail - __atomic_load_n(&r->first, __ATOMIC_SEQ_CST)) >= 0) break;
+        // Released by a push in progress, its jump is set: read it again
+        __atomic_store_n(&r->reading_set, 0, __ATOMIC_RELEASE);
+    }
+    *of = frame_ring_slot_at(r, tail)->of;
+    frame_slab_ref(of->slab);
+    __atomic_store_n(&r->reading_set, 0, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&c->tail, tail + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&c->popped, 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+unsigned int frame_cursor_size(frame_cursor *c)
+{
+    frame_ring *r = c->ring;
+    int32_t n;
+
+    if (r == NULL) return 0;
+    n = __atomic_load_n(&r->last, __ATOMIC_ACQUIRE) - frame_cursor_next(c);
+
+    return (n > 0) ? n : 0;
+}
+
+unsigned int frame_ring_size(frame_ring *r)
+{
+    uint32_t head = __atomic_load_n(&r->last, __ATOMIC_ACQUIRE);
+
+    return head - __atomic_load_n(&r->first, __ATOMIC_ACQUIRE);
+}
+
+void frame_ring_stats(frame_ring *r, const char *name)
+{
+    frame_cursor *c;
+    unsigned int i = 0;
+
+    pthread_mutex_lock(&(r->mutex));
+    fprintf(stderr, "%s: frame ring - pushed: %u - released: %u - gops: %u - size: %u/%u - cursors: %u\n",
+            name, r->pushed, r->released, r->gops, r->head - r->tail, r->max_size, r->ncursors);
+    r->pushed = 0;
+    r->released = 0;
+    r->gops = 0;
+    for (c = r->cursors; c != NULL; c = c->next) {
+        // popped and thinned are counted by the reader
+        fprintf(stderr, "%s: cursor %u - popped: %u - dropped: %u - catch-ups: %u - thinned: %u - thin level: %d - lag: %u%s\n",
+                name, i++, __atomic_exchange_n(&c->popped, 0, __ATOMIC_RELAXED), c->dropped, c->catchups,
+                __atomic_exchange_n(&c->thinned, 0, __ATOMIC_RELAXED), c->thin_level, r->head - frame_cursor_next(c),
+                (c->skipping) ? " - skipping" : "");
+        c->dropped = 0;
+        c->catchups = 0;
+    }
+    pthread_mutex_unlock(&(r->mutex));
+}
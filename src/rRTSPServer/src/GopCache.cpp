@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cache of the last parameter sets and of the frames since the last IDR.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "fshare.h"
+#include "GopCache.hh"
+
+int gop_cache_init(gop_cache *c, unsigned int max_bytes)
+{
+    memset(c, 0, sizeof(gop_cache));
+    c->max_bytes = max_bytes;
+    if (pthread_mutex_init(&(c->mutex), NULL) != 0) {
+        fprintf(stderr, "error - could not create gop cache mutex\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void gop_cache_clear_frames(gop_cache *c)
+{
+    unsigned int i;
+
+    for (i = 0; i < c->nframes; i++) frame_slab_unref(c->frames[i].slab);
+    c->nframes = 0;
+    c->bytes = 0;
+    c->valid = 0;
+}
+
+static void gop_cache_clear_params(gop_cache *c)
+{
+    unsigned int i;
+
+    for (i = 0; i < c->nparams; i++) frame_slab_unref(c->params[i].slab);
+    c->nparams = 0;
+}
+
+void gop_cache_free(gop_cache *c)
+{
+    gop_cache_clear_frames(c);
+    gop_cache_clear_params(c);
+    pthread_mutex_destroy(&(c->mutex));
+}
+
+// Replace the parameter set at index k, return 1 if it's different
+static int gop_cache_set_param(gop_cache *c, unsigned int k, output_frame *of)
+{
+    int changed = 1;
+
+    frame_slab_ref(of->slab);
+    if (k < c->nparams) {
+        if ((c->params[k].slab->len == of->slab->len) &&
+                (memcmp(c->params[k].slab->data, of->slab->data, of->slab->len) == 0)) {
+            changed = 0;
+        }
+        // Always keep the new slab, an old one would hold the pool
+        frame_slab_unref(c->params[k].slab);
+    } else {
+        c->nparams = k + 1;
+    }
+    c->params[k] = *of;
+
+    return changed;
+}
+
+static void gop_cache_add(gop_cache *c, output_frame *of, int type)
+{
+    unsigned int i;
+
+    if (type & (FSHARE_TYPE_VPS | FSHARE_TYPE_SPS | FSHARE_TYPE_PPS)) {
+        // A new group of parameter sets replaces the previous one
+        if (!(c->last_type & (FSHARE_TYPE_VPS | FSHARE_TYPE_SPS | FSHARE_TYPE_PPS))) c->param_index = 0;
+        if (c->param_index < GOP_CACHE_PARAMS) {
+            if (gop_cache_set_param(c, c->param_index, of)) c->params_seq++;
+            c->param_index++;
+        }
+    } else {
+        if ((c->last_type & (FSHARE_TYPE_VPS | FSHARE_TYPE_SPS | FSHARE_TYPE_PPS)) && (c->param_index < c->nparams)) {
+            // The new group is shorter than the previous one
+            for (i = c->param_index; i < c->nparams; i++) frame_slab_unref(c->params[i].slab);
+            c->nparams = c->param_index;
+            c->params_seq++;
+        }
+        if ((type & FSHARE_TYPE_IDR) && !(c->last_type & FSHARE_TYPE_IDR)) {
+            // A new GOP
+            gop_cache_clear_frames(c);
+            c->valid = 1;
+            c->gops++;
+        }
+        if (c->valid) {
+            if ((c->nframes == GOP_CACHE_FRAMES) || (c->bytes + of->slab->len > c->max_bytes)) {
+                // Too long, release it and wait for the next IDR
+                gop_cache_clear_frames(c);
+                c->overflows++;
+            } else {
+                frame_slab_ref(of->slab);
+                c->frames[c->nframes++] = *of;
+                c->bytes += of->slab->len;
+            }
+        }
+    }
+    c->last_type = type;
+}
+
+/*
+ * Add a frame to the cache and push it to the ring.
+ * Both are done with the mutex held, so a reader priming from the cache
+ * never finds the same frame in the ring.
+ */
+void gop_cache_push(gop_cache *c, frame_ring *r, output_frame *of, int type)
+{
+    pthread_mutex_lock(&(c->mutex));
+    gop_cache_add(c, of, type);
+    frame_ring_push(r, of);
+    pthread_mutex_unlock(&(c->mutex));
+}
+
+// A frame of the current GOP was lost: don't prime from it until the next IDR
+void gop_cache_invalidate(gop_cache *c)
+{
+    pthread_mutex_lock(&(c->mutex));
+    if (c->valid) c->invalidations++;
+    gop_cache_clear_frames(c);
+    pthread_mutex_unlock(&(c->mutex));
+}
+
+/*
+ * Open the cursor and return a copy of the cache: parameter sets first,
+ * then the frames since the last IDR. The cursor starts after them.
+ * If the cache is not usable the cursor starts at a GOP start in the ring.
+ * The caller owns a reference to each slab and must free() the array.
+ * Return the number of frames, 0 if the cache is not usable.
+ */
+unsigned int gop_cache_prime(gop_cache *c, frame_ring *r, frame_cursor *cursor, output_frame **frames)
+{
+    unsigned int i, n = 0;
+
+    *frames = NULL;
+    pthread_mutex_lock(&(c->mutex));
+    if ((c->valid) && (c->nparams > 0) && (c->nframes > 0)) {
+        *frames = (output_frame *) malloc((c->nparams + c->nframes) * sizeof(output_frame));
+    }
+    if (*frames == NULL) {
+        frame_cursor_open(r, cursor, r->max_size);
+    } else {
+        frame_cursor_open(r, cursor, 0);
+        for (i = 0; i < c->nparams; i++) {
+            frame_slab_ref(c->params[i].slab);
+            (*frames)[n++] = c->params[i];
+        }
+        for (i = 0; i < c->nframes; i++) {
+            frame_slab_ref(c->frames[i].slab);
+            (*frames)[n++] = c->frames[i];
+        }
+        c->primes++;
+        c->frames_primed += n;
+    }
+    pthread_mutex_unlock(&(c->mutex));
+
+    return n;
+}
+
+/*
+ * Return the last parameter sets and their sequence number.
+ * The caller owns a reference to each slab.
+ */
+unsigned int gop_cache_params(gop_cache *c, output_frame *params, unsigned int *seq)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&(c->mutex));
+    for (i = 0; i < c->nparams; i++) {
+        frame_slab_ref(c->params[i].slab);
+        params[i] = c->params[i];
+    }
+    *seq = c->params_seq;
+    pthread_mutex_unlock(&(c->mutex));
+
+    return i;
+}
+
+unsigned int gop_cache_params_seq(gop_cache *c)
+{
+    unsigned int seq;
+
+    pthread_mutex_lock(&(c->mutex));
+    seq = c->params_seq;
+    pthread_mutex_unlock(&(c->mutex));
+
+    return seq;
+}
+
+void gop_cache_stats(gop_cache *c, const char *name)
+{
+    pthread_mutex_lock(&(c->mutex));
+    fprintf(stderr, "%s: gop cache - frames: %u - bytes: %u/%u - gops: %u - overflows: %u - invalidations: %u - primes: %u - frames primed: %u\n",
+            name, c->nframes, c->bytes, c->max_bytes, c->gops, c->overflows, c->invalidations, c->primes, c->frames_primed);
+    c->gops = 0;
+    c->overflows = 0;
+    c->invalidations = 0;
+    c->primes = 0;
+    c->frames_primed = 0;
+    pthread_mutex_unlock(&(c->mutex));
+}
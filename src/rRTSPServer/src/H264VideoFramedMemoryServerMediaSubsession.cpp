@@ -20,85 +20,63 @@
  */
 
 #include "H264VideoFramedMemoryServerMediaSubsession.hh"
-#include "H264VideoRTPSink.hh"
+#include "VideoFramedMemoryRTPSink.hh"
 #include "VideoFramedMemorySource.hh"
-#include "H264VideoStreamDiscreteFramer.hh"
+#include "VideoFmtp.hh"
+#include "PacedGroupsock.hh"
 
 H264VideoFramedMemoryServerMediaSubsession*
 H264VideoFramedMemoryServerMediaSubsession::createNew(UsageEnvironment& env,
                                                 output_queue *qBuffer,
                                                 Boolean useTimeForPres,
-                                                Boolean reuseFirstSource) {
-    return new H264VideoFramedMemoryServerMediaSubsession(env, qBuffer, useTimeForPres, reuseFirstSource);
+                                                Boolean reuseFirstSource,
+                                                output_queue *qLow) {
+    return new H264VideoFramedMemoryServerMediaSubsession(env, qBuffer, useTimeForPres, reuseFirstSource, qLow);
 }
 
 H264VideoFramedMemoryServerMediaSubsession::H264VideoFramedMemoryServerMediaSubsession(UsageEnvironment& env,
                                                                         output_queue *qBuffer,
                                                                         Boolean useTimeForPres,
-                                                                        Boolean reuseFirstSource)
+                                                                        Boolean reuseFirstSource,
+                                                                        output_queue *qLow)
     : OnDemandServerMediaSubsession(env, reuseFirstSource),
-      fQBuffer(qBuffer), fUseTimeForPres(useTimeForPres), fAuxSDPLine(NULL), fDoneFlag(0), fDummyRTPSink(NULL) {
+      fQBuffer(qBuffer), fQLow(qLow), fUseTimeForPres(useTimeForPres), fAuxSDPLine(NULL), fAuxSDPLineSeq(0), fNewSource(NULL) {
 }
 
 H264VideoFramedMemoryServerMediaSubsession::~H264VideoFramedMemoryServerMediaSubsession() {
     delete[] fAuxSDPLine;
 }
 
-static void afterPlayingDummy(void* clientData) {
-    H264VideoFramedMemoryServerMediaSubsession* subsess = (H264VideoFramedMemoryServerMediaSubsession*)clientData;
-    subsess->afterPlayingDummy1();
-}
-
-void H264VideoFramedMemoryServerMediaSubsession::afterPlayingDummy1() {
-    // Unschedule any pending 'checking' task:
-    envir().taskScheduler().unscheduleDelayedTask(nextTask());
-    // Signal the event loop that we're done:
-    setDoneFlag();
-}
-
-static void checkForAuxSDPLine(void* clientData) {
-    H264VideoFramedMemoryServerMediaSubsession* subsess = (H264VideoFramedMemoryServerMediaSubsession*)clientData;
-    subsess->checkForAuxSDPLine1();
-}
-
-void H264VideoFramedMemoryServerMediaSubsession::checkForAuxSDPLine1() {
-    nextTask() = NULL;
-
-    char const* dasl;
-    if (fAuxSDPLine != NULL) {
-        // Signal the event loop that we're done:
-        setDoneFlag();
-    } else if (fDummyRTPSink != NULL && (dasl = fDummyRTPSink->auxSDPLine()) != NULL) {
-        fAuxSDPLine = strDup(dasl);
-        fDummyRTPSink = NULL;
-
-        // Signal the event loop that we're done:
-        setDoneFlag();
-    } else if (!fDoneFlag) {
-        // try again after a brief delay:
-        int uSecsToDelay = 100000; // 100 ms
-        nextTask() = envir().taskScheduler().scheduleDelayedTask(uSecsToDelay,
-                                (TaskFunc*)checkForAuxSDPLine, this);
+char const* H264VideoFramedMemoryServerMediaSubsession::sdpLines(int addressFamily) {
+    // Build the SDP again if it has no parameter sets yet or they have changed
+    if ((fSDPLines != NULL) && ((fAuxSDPLine == NULL) || (fAuxSDPLineSeq != gop_cache_params_seq(&(fQBuffer->gop))))) {
+        delete[] fSDPLines;
+        fSDPLines = NULL;
     }
+
+    return OnDemandServerMediaSubsession::sdpLines(addressFamily);
 }
 
-char const* H264VideoFramedMemoryServerMediaSubsession::getAuxSDPLine(RTPSink* rtpSink, FramedSource* inputSource) {
-    if (fAuxSDPLine != NULL) return fAuxSDPLine; // it's already been set up (for a previous client)
+// Build the fmtp line from the parameter sets cached by the capture thread
+Boolean H264VideoFramedMemoryServerMediaSubsession::auxSDPLineFromCache(RTPSink* rtpSink) {
+    unsigned seq;
+    char* fmtp;
 
-    if (fDummyRTPSink == NULL) { // we're not already setting it up for another, concurrent stream
-        // Note: For H264 video files, the 'config' information ("profile-level-id" and "sprop-parameter-sets") isn't known
-        // until we start reading the file.  This means that "rtpSink"s "auxSDPLine()" will be NULL initially,
-        // and we need to start reading data from our file until this changes.
-        fDummyRTPSink = rtpSink;
+    if ((fAuxSDPLine != NULL) && (fAuxSDPLineSeq == gop_cache_params_seq(&(fQBuffer->gop)))) return True;
 
-        // Start reading the source:
-        fDummyRTPSink->startPlaying(*inputSource, afterPlayingDummy, this);
+    fmtp = video_fmtp_from_cache(&(fQBuffer->gop), CODEC_H264, rtpSink->rtpPayloadType(), &seq);
+    if (fmtp == NULL) return False;
+    delete[] fAuxSDPLine;
+    fAuxSDPLine = fmtp;
+    fAuxSDPLineSeq = seq;
 
-        // Check whether the sink's 'auxSDPLine()' is ready:
-        checkForAuxSDPLine(this);
-    }
+    return True;
+}
 
-    envir().taskScheduler().doEventLoop(&fDoneFlag);
+char const* H264VideoFramedMemoryServerMediaSubsession::getAuxSDPLine(RTPSink* rtpSink, FramedSource* /*inputSource*/) {
+    // The sink has no framer to take the parameter sets from: use the ones
+    // cached by the capture thread, or none until it has them
+    auxSDPLineFromCache(rtpSink);
 
     return fAuxSDPLine;
 }
@@ -112,16 +90,59 @@ FramedSource* H264VideoFramedMemoryServerMediaSubsession::createNewStreamSource(
         estBitrate = 500; // kbps, estimate
 
     // Create the video source:
-    VideoFramedMemorySource* memorySource = VideoFramedMemorySource::createNew(envir(), 264, fQBuffer, fUseTimeForPres, 50000);
+    VideoFramedMemorySource* memorySource = VideoFramedMemorySource::createNew(envir(), 264, fQBuffer, fUseTimeForPres, VIDEO_FRAME_US, fQLow);
     if (memorySource == NULL) return NULL;
+    fNewSource = memorySource;
 
-    // Create a framer for the Video Elementary Stream:
-    return H264VideoStreamDiscreteFramer::createNew(envir(), memorySource, false, false);
+    // No framer: the sink packetizes the NAL units straight from the slabs
+    return memorySource;
 }
 
 RTPSink* H264VideoFramedMemoryServerMediaSubsession
 ::createNewRTPSink(Groupsock* rtpGroupsock,
                     unsigned char rtpPayloadTypeIfDynamic,
                     FramedSource* /*inputSource*/) {
-    return H264VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
+    unsigned preferredSize;
+    H264VideoFramedMemoryRTPSink* rtpSink = H264VideoFramedMemoryRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
+
+    // Packets of small frames are joined up to the preferred size, as live555 does
+    preferredSize = (fQBuffer->payload_size < 1000) ? fQBuffer->payload_size : 1000;
+    rtpSink->setPacketSizes(preferredSize, fQBuffer->payload_size);
+
+    // The sink of the source just created, for its receiver reports
+    if (fNewSource != NULL) fNewSource->setRTPSink(rtpSink);
+    return rtpSink;
+}
+
+void H264VideoFramedMemoryServerMediaSubsession
+::getStreamParameters(unsigned clientSessionId,
+                    struct sockaddr_storage const& clientAddress,
+                    Port const& clientRTPPort,
+                    Port const& clientRTCPPort,
+                    int tcpSocketNum,
+                    unsigned char rtpChannelId,
+                    unsigned char rtcpChannelId,
+                    TLSState* tlsState,
+                    struct sockaddr_storage& destinationAddress,
+                    u_int8_t& destinationTTL,
+                    Boolean& isMulticast,
+                    Port& serverRTPPort,
+                    Port& serverRTCPPort,
+                    void*& streamToken) {
+    fNewSource = NULL;
+    OnDemandServerMediaSubsession::getStreamParameters(clientSessionId, clientAddress, clientRTPPort, clientRTCPPort,
+            tcpSocketNum, rtpChannelId, rtcpChannelId, tlsState, destinationAddress, destinationTTL, isMulticast,
+            serverRTPPort, serverRTCPPort, streamToken);
+
+    // Every client has its own source, tell it the socket of an RTP over TCP client
+    if (fNewSource != NULL) fNewSource->setTCPSocket(tcpSocketNum);
+    fNewSource = NULL;
+}
+
+Groupsock* H264VideoFramedMemoryServerMediaSubsession::createGroupsock(struct sockaddr_storage const& addr, Port port) {
+    // Only RTP is paced, RTCP has the odd port
+    if ((fQBuffer->pace_us == 0) || (ntohs(port.num()) & 1)) return OnDemandServerMediaSubsession::createGroupsock(addr, port);
+
+    // Spread the packets of large frames, IDRs mostly
+    return new PacedGroupsock(envir(), addr, port, 255, &(fQBuffer->pace_us), PACE_BURST);
 }
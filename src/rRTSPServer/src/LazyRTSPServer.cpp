@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTSP server that listens before all the streams are ready.
+ */
+
+#include "LazyRTSPServer.hh"
+
+#include <cstring>
+
+LazyRTSPServer* LazyRTSPServer::createNew(UsageEnvironment& env, Port ourPort,
+                                        UserAuthenticationDatabase* authDatabase,
+                                        unsigned reclamationSeconds) {
+    int ourSocketIPv4 = setUpOurSocket(env, ourPort, AF_INET);
+    int ourSocketIPv6 = setUpOurSocket(env, ourPort, AF_INET6);
+    if ((ourSocketIPv4 < 0) && (ourSocketIPv6 < 0)) return NULL;
+
+    return new LazyRTSPServer(env, ourSocketIPv4, ourSocketIPv6, ourPort, authDatabase, reclamationSeconds);
+}
+
+LazyRTSPServer::LazyRTSPServer(UsageEnvironment& env, int ourSocketIPv4, int ourSocketIPv6, Port ourPort,
+                                UserAuthenticationDatabase* authDatabase, unsigned reclamationSeconds)
+    : RTSPServer(env, ourSocketIPv4, ourSocketIPv6, ourPort, authDatabase, reclamationSeconds) {
+    memset(fPending, 0, sizeof(fPending));
+}
+
+LazyRTSPServer::~LazyRTSPServer() {
+    for (int i = 0; i < LAZY_RTSP_SERVER_MAX_PENDING; i++) delete[] fPending[i];
+}
+
+void LazyRTSPServer::addPendingStream(char const* streamName) {
+    for (int i = 0; i < LAZY_RTSP_SERVER_MAX_PENDING; i++) {
+        if (fPending[i] == NULL) {
+            fPending[i] = strDup(streamName);
+            return;
+        }
+    }
+}
+
+void LazyRTSPServer::removePendingStream(char const* streamName) {
+    for (int i = 0; i < LAZY_RTSP_SERVER_MAX_PENDING; i++) {
+        if ((fPending[i] != NULL) && (strcmp(fPending[i], streamName) == 0)) {
+            delete[] fPending[i];
+            fPending[i] = NULL;
+        }
+    }
+}
+
+void LazyRTSPServer::addReadyServerMediaSession(ServerMediaSession* serverMediaSession) {
+    removePendingStream(serverMediaSession->streamName());
+    addServerMediaSession(serverMediaSession);
+}
+
+Boolean LazyRTSPServer::isPendingStream(char const* streamName) const {
+    for (int i = 0; i < LAZY_RTSP_SERVER_MAX_PENDING; i++) {
+        if ((fPending[i] != NULL) && (strcmp(fPending[i], streamName) == 0)) return True;
+    }
+
+    return False;
+}
+
+GenericMediaServer::ClientConnection*
+LazyRTSPServer::createNewClientConnection(int clientSocket, struct sockaddr_storage const& clientAddr) {
+    return new LazyRTSPClientConnection(*this, clientSocket, clientAddr);
+}
+
+LazyRTSPServer::LazyRTSPClientConnection
+::LazyRTSPClientConnection(LazyRTSPServer& ourServer, int clientSocket, struct sockaddr_storage const& clientAddr)
+    : RTSPClientConnection(ourServer, clientSocket, clientAddr),
+      fOurLazyRTSPServer(ourServer) {
+}
+
+LazyRTSPServer::LazyRTSPClientConnection::~LazyRTSPClientConnection() {
+}
+
+void LazyRTSPServer::LazyRTSPClientConnection
+::handleCmd_DESCRIBE(char const* urlPreSuffix, char const* urlSuffix, char const* fullRequestStr) {
+    char urlTotalSuffix[2 * RTSP_PARAM_STRING_MAX];
+
+    // Build the stream name as RTSPServer does
+    urlTotalSuffix[0] = '\0';
+    if ((urlPreSuffix[0] != '\0') && (strlen(urlPreSuffix) + strlen(urlSuffix) + 2 <= sizeof(urlTotalSuffix))) {
+        strcat(urlTotalSuffix, urlPreSuffix);
+        strcat(urlTotalSuffix, "/");
+    }
+    strncat(urlTotalSuffix, urlSuffix, sizeof(urlTotalSuffix) - strlen(urlTotalSuffix) - 1);
+
+    if (fOurLazyRTSPServer.isPendingStream(urlTotalSuffix)) {
+        // Don't tell an unauthenticated client that the stream exists
+        if (!authenticationOK("DESCRIBE", urlTotalSuffix, fullRequestStr)) return;
+
+        setRTSPResponse("503 Service Unavailable");
+        return;
+    }
+
+    RTSPClientConnection::handleCmd_DESCRIBE(urlPreSuffix, urlSuffix, fullRequestStr);
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTP multicast of a stream
+ */
+
+#include "MulticastStream.hh"
+#include "GroupsockHelper.hh"
+#include "RTCP.hh"
+#include "PassiveServerMediaSubsession.hh"
+#include "H264VideoRTPSink.hh"
+#include "H265VideoRTPSink.hh"
+#include "H264VideoStreamDiscreteFramer.hh"
+#include "H265VideoStreamDiscreteFramer.hh"
+#include "MPEG4GenericRTPSink.hh"
+#include "SimpleRTPSink.hh"
+#include "StreamReplicator.hh"
+#include "VideoFramedMemorySource.hh"
+#include "AudioFramedMemorySource.hh"
+#include "PacedGroupsock.hh"
+#include "VideoFmtp.hh"
+#include "WAVAudioFifoSource.hh"
+
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+static unsigned char cname[101];
+
+int multicast_group_init(UsageEnvironment& env, multicast_group *g, char const *addr, int ttl)
+{
+    struct sockaddr_in *sin = (struct sockaddr_in *) &(g->addr);
+
+    memset(g, 0, sizeof(multicast_group));
+    sin->sin_family = AF_INET;
+    if (addr == NULL) {
+        sin->sin_addr.s_addr = chooseRandomIPv4SSMAddress(env);
+    } else if ((inet_pton(AF_INET, addr, &(sin->sin_addr)) != 1) || (!IN_MULTICAST(ntohl(sin->sin_addr.s_addr)))) {
+        fprintf(stderr, "error - %s is not an IPv4 multicast address\n", addr);
+        return -1;
+    }
+    g->ttl = ttl;
+    g->ssm = ((ntohl(sin->sin_addr.s_addr) >> 24) == 232);
+
+    // The CNAME of the RTCP instances
+    if (cname[0] == '\0') {
+        gethostname((char *) cname, sizeof(cname) - 1);
+    }
+
+    return 0;
+}
+
+static void multicast_stream_open(UsageEnvironment& env, multicast_stream *ms, multicast_group *g, unsigned short port,
+        unsigned int *pace_us)
+{
+    memset(ms, 0, sizeof(multicast_stream));
+
+    // The packets of a large frame reach every viewer at once, pace them too
+    if ((pace_us != NULL) && (*pace_us > 0)) {
+        ms->rtp_groupsock = new PacedGroupsock(env, g->addr, Port(port), g->ttl, pace_us, PACE_BURST);
+    } else {
+        ms->rtp_groupsock = new Groupsock(env, g->addr, Port(port), g->ttl);
+    }
+    ms->rtcp_groupsock = new Groupsock(env, g->addr, Port(port + 1), g->ttl);
+    if (g->ssm) {
+        ms->rtp_groupsock->multicastSendOnly();
+        ms->rtcp_groupsock->multicastSendOnly();
+    }
+}
+
+static int multicast_stream_start(UsageEnvironment& env, multicast_stream *ms, multicast_group *g, unsigned int bitrate)
+{
+    if ((ms->source == NULL) || (ms->sink == NULL)) {
+        fprintf(stderr, "%lld: multicast stream - failed to create the source or the sink\n", current_timestamp());
+        Medium::close(ms->sink);
+        Medium::close(ms->source);
+        delete ms->rtp_groupsock;
+        delete ms->rtcp_groupsock;
+        memset(ms, 0, sizeof(multicast_stream));
+        return -1;
+    }
+
+    ms->rtcp = RTCPInstance::createNew(env, ms->rtcp_groupsock, bitrate, cname, ms->sink, NULL, g->ssm);
+    ms->sink->startPlaying(*(ms->source), NULL, NULL);
+
+    return 0;
+}
+
+// Sinks that give the SDP the fmtp line built from the parameter sets
+// already cached, the SDP of a passive subsession is built once
+class MulticastH264VideoRTPSink: public H264VideoRTPSink {
+public:
+    static MulticastH264VideoRTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs, char* fmtp) {
+        return new MulticastH264VideoRTPSink(env, RTPgs, fmtp);
+    }
+
+protected:
+    MulticastH264VideoRTPSink(UsageEnvironment& env, Groupsock* RTPgs, char* fmtp)
+        : H264VideoRTPSink(env, RTPgs, MULTICAST_PAYLOAD_TYPE), fFmtp(fmtp) {
+    }
+    virtual ~MulticastH264VideoRTPSink() {
+        delete[] fFmtp;
+    }
+
+private: // redefined virtual functions
+    virtual char const* auxSDPLine() { return fFmtp; }
+
+private:
+    char* fFmtp;
+};
+
+class MulticastH265VideoRTPSink: public H265VideoRTPSink {
+public:
+    static MulticastH265VideoRTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs, char* fmtp) {
+        return new MulticastH265VideoRTPSink(env, RTPgs, fmtp);
+    }
+
+protected:
+    MulticastH265VideoRTPSink(UsageEnvironment& env, Groupsock* RTPgs, char* fmtp)
+        : H265VideoRTPSink(env, RTPgs, MULTICAST_PAYLOAD_TYPE), fFmtp(fmtp) {
+    }
+    virtual ~MulticastH265VideoRTPSink() {
+        delete[] fFmtp;
+    }
+
+private: // redefined virtual functions
+    virtual char const* auxSDPLine() { return fFmtp; }
+
+private:
+    char* fFmtp;
+};
+
+static RTPSink* multicast_video_sink(UsageEnvironment& env, Groupsock *gs, output_queue *q, int codec)
+{
+    MultiFramedRTPSink* sink;
+    unsigned int seq, preferredSize;
+    char *fmtp;
+
+    // Otherwise the sink takes the parameter sets from the framer
+    fmtp = video_fmtp_from_cache(&(q->gop), codec, MULTICAST_PAYLOAD_TYPE, &seq);
+    if (codec == CODEC_H265) {
+        if (fmtp != NULL) sink = MulticastH265VideoRTPSink::createNew(env, gs, fmtp);
+        else sink = H265VideoRTPSink::createNew(env, gs, MULTICAST_PAYLOAD_TYPE);
+    } else {
+        if (fmtp != NULL) sink = MulticastH264VideoRTPSink::createNew(env, gs, fmtp);
+        else sink = H264VideoRTPSink::createNew(env, gs, MULTICAST_PAYLOAD_TYPE);
+    }
+
+    preferredSize = (q->payload_size < 1000) ? q->payload_size : 1000;
+    if (sink != NULL) sink->setPacketSizes(preferredSize, q->payload_size);
+
+    return sink;
+}
+
+int multicast_stream_video(UsageEnvironment& env, multicast_stream *ms, multicast_group *g, unsigned short port,
+        output_queue *q, int codec, Boolean useTimeForPres)
+{
+    VideoFramedMemorySource* memorySource;
+    unsigned int bitrate;
+
+    multicast_stream_open(env, ms, g, port, &(q->pace_us));
+
+    // No RTP sink and no TCP socket: the stream is never thinned, a single
+    // congested receiver would degrade it for everybody
+    memorySource = VideoFramedMemorySource::createNew(env, (codec == CODEC_H265) ? 265 : 264, q, useTimeForPres, VIDEO_FRAME_US);
+    if (memorySource != NULL) {
+        if (codec == CODEC_H265) {
+            ms->source = H265VideoStreamDiscreteFramer::createNew(env, memorySource, false, false);
+        } else {
+            ms->source = H264VideoStreamDiscreteFramer::createNew(env, memorySource, false, false);
+        }
+    }
+    ms->sink = multicast_video_sink(env, ms->rtp_groupsock, q, codec);
+
+    if (q->type == TYPE_LOW)
+        bitrate = 200; // kbps, estimate
+    else if (q->type == TYPE_HIGH)
+        bitrate = 700; // kbps, estimate
+    else
+        bitrate = 500; // kbps, estimate
+
+    return multicast_stream_start(env, ms, g, bitrate);
+}
+
+int multicast_stream_aac(UsageEnvironment& env, multicast_stream *ms, multicast_group *g, unsigned short port,
+        output_queue *q, unsigned samplingFrequency, unsigned numChannels, Boolean useTimeForPres)
+{
+    AudioFramedMemorySource* memorySource;
+
+    multicast_stream_open(env, ms, g, port, NULL);
+
+    memorySource = AudioFramedMemorySource::createNew(env, q, samplingFrequency, numChannels, useTimeForPres);
+    ms->source = memorySource;
+    if (memorySource != NULL) {
+        ms->sink = MPEG4GenericRTPSink::createNew(env, ms->rtp_groupsock, MULTICAST_PAYLOAD_TYPE,
+                                                samplingFrequency, "audio", "AAC-hbr",
+                                                memorySource->configStr(), numChannels);
+    }
+
+    return multicast_stream_start(env, ms, g, 32);
+}
+
+int multicast_stream_pcm(UsageEnvironment& env, multicast_stream *ms, multicast_group *g, unsigned short port,
+        StreamReplicator *replicator, int convertTo)
+{
+    char const* mimeType;
+    unsigned char payloadFormatCode;
+    unsigned int bitrate;
+
+    multicast_stream_open(env, ms, g, port, NULL);
+
+    // The replicator already converts the samples
+    if (convertTo == WA_PCMA) {
+        mimeType = "PCMA";
+        payloadFormatCode = 8; // a static RTP payload type
+        bitrate = 64;
+    } else if (convertTo == WA_PCMU) {
+        mimeType = "PCMU";
+        payloadFormatCode = 0; // a static RTP payload type
+        bitrate = 64;
+    } else {
+        mimeType = "L16";
+        payloadFormatCode = MULTICAST_PAYLOAD_TYPE;
+        bitrate = 128;
+    }
+    ms->source = replicator->createStreamReplica();
+    if (ms->source != NULL) {
+        ms->sink = SimpleRTPSink::createNew(env, ms->rtp_groupsock, payloadFormatCode, 8000, "audio", mimeType, 1);
+    }
+
+    return multicast_stream_start(env, ms, g, bitrate);
+}
+
+ServerMediaSubsession* multicast_stream_subsession(multicast_stream *ms)
+{
+    if (ms->sink == NULL) return NULL;
+
+    return PassiveServerMediaSubsession::createNew(*(ms->sink), ms->rtcp);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A Groupsock that paces the packets of large frames with scheduler timers
+ */
+
+#include "PacedGroupsock.hh"
+
+#include <sys/time.h>
+
+extern int debug;
+
+static long long current_timestamp_us() {
+    struct timeval te;
+
+    gettimeofday(&te, NULL);
+    return te.tv_sec * 1000000LL + te.tv_usec;
+}
+
+PacedGroupsock::PacedGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+                                Port port, u_int8_t ttl, unsigned const* windowUs, unsigned burst)
+    : Groupsock(env, groupAddr, port, ttl), fWindowUs(windowUs), fTask(NULL) {
+    packet_pacer_init(&fPacer, *windowUs, burst);
+}
+
+PacedGroupsock::~PacedGroupsock() {
+    env().taskScheduler().unscheduleDelayedTask(fTask);
+    if ((debug & 4) && (fPacer.packets > 0)) packet_pacer_stats(&fPacer, "PacedGroupsock");
+    packet_pacer_free(&fPacer);
+}
+
+Boolean PacedGroupsock::output(UsageEnvironment& env, unsigned char* buffer, unsigned bufferSize) {
+    unsigned windowUs;
+    int ret;
+
+    // Set by the capture thread when the measured frame rate changes
+    windowUs = __atomic_load_n(fWindowUs, __ATOMIC_RELAXED);
+    if (windowUs != fPacer.window_us) packet_pacer_set_window(&fPacer, windowUs);
+
+    ret = packet_pacer_push(&fPacer, buffer, bufferSize, current_timestamp_us());
+    if (ret == 0) {
+        scheduleNext();
+        return True;
+    }
+    // Keep the order of the packets
+    if (ret < 0) flush();
+
+    return Groupsock::output(env, buffer, bufferSize);
+}
+
+void PacedGroupsock::sendNextTask(void* clientData) {
+    PacedGroupsock* gs = (PacedGroupsock*) clientData;
+    gs->sendNext();
+}
+
+void PacedGroupsock::sendNext() {
+    unsigned char* buf;
+    unsigned int len;
+    long long now = current_timestamp_us();
+    long long next;
+
+    fTask = NULL;
+    // Also the packets that are late
+    while (((next = packet_pacer_next(&fPacer)) >= 0) && (next <= now)) {
+        packet_pacer_pop(&fPacer, &buf, &len, now);
+        Groupsock::output(env(), buf, len);
+    }
+    scheduleNext();
+}
+
+void PacedGroupsock::scheduleNext() {
+    long long delay;
+
+    if (fTask != NULL) return;
+    delay = packet_pacer_next(&fPacer);
+    if (delay < 0) return;
+    delay -= current_timestamp_us();
+    if (delay < 0) delay = 0;
+    fTask = env().taskScheduler().scheduleDelayedTask(delay, (TaskFunc*) sendNextTask, this);
+}
+
+void PacedGroupsock::flush() {
+    unsigned char* buf;
+    unsigned int len;
+    long long now = current_timestamp_us();
+
+    env().taskScheduler().unscheduleDelayedTask(fTask);
+    while (packet_pacer_pop(&fPacer, &buf, &len, now) == 1) Groupsock::output(env(), buf, len);
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pacing of the RTP packets of a client.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "PacketPacer.hh"
+
+int packet_pacer_init(packet_pacer *p, unsigned int window_us, unsigned int burst)
+{
+    memset(p, 0, sizeof(packet_pacer));
+
+    // The slots are allocated with the first packet to queue: the RTP over
+    // TCP clients and the frames within the burst never need them
+    p->window_us = window_us;
+    p->burst = burst;
+
+    return 0;
+}
+
+void packet_pacer_free(packet_pacer *p)
+{
+    free(p->data);
+    p->data = NULL;
+    p->head = p->tail = 0;
+}
+
+// A new frame interval, used from the next frame
+void packet_pacer_set_window(packet_pacer *p, unsigned int window_us)
+{
+    if ((p->window_us == 0) || (window_us == 0)) return;
+    p->window_us = window_us;
+}
+
+int packet_pacer_push(packet_pacer *p, unsigned char *buf, unsigned int len, long long now)
+{
+    unsigned int queued = p->head - p->tail;
+
+    p->packets++;
+    if ((p->window_us == 0) || (len > PACER_SLOT_SIZE)) return 1;
+
+    // The first packet after the window starts a frame
+    if (now >= p->window_end) {
+        p->window_end = now + p->window_us;
+        p->window_packets = 0;
+        p->gap = p->window_us;
+    }
+    p->window_packets++;
+    if ((queued == 0) && (p->window_packets <= p->burst)) return 1;
+    if (queued == PACER_SLOTS) {
+        p->overflows++;
+        return -1;
+    }
+    if (p->data == NULL) {
+        p->data = (unsigned char *) malloc(PACER_SLOTS * PACER_SLOT_SIZE);
+        if (p->data == NULL) {
+            // Without memory the packets are sent at once
+            fprintf(stderr, "error - could not allocate packet pacer\n");
+            p->window_us = 0;
+            return 1;
+        }
+    }
+
+    memcpy(p->data + (p->head & (PACER_SLOTS - 1)) * PACER_SLOT_SIZE, buf, len);
+    p->lens[p->head & (PACER_SLOTS - 1)] = len;
+    p->head++;
+    p->paced++;
+    if (queued + 1 > p->max_queue) p->max_queue = queued + 1;
+
+    // The sink is still sending the frame, spread it when it's all here
+    if (queued == 0) {
+        p->next_send = now + PACER_COLLECT_US;
+        if (p->next_send > p->window_end) p->next_send = p->window_end;
+    }
+
+    return 0;
+}
+
+long long packet_pacer_next(packet_pacer *p)
+{
+    if (p->head == p->tail) return -1;
+
+    return p->next_send;
+}
+
+int packet_pacer_pop(packet_pacer *p, unsigned char **buf, unsigned int *len, long long now)
+{
+    unsigned int queued;
+    long long remaining;
+
+    if (p->head == p->tail) return 0;
+    *buf = p->data + (p->tail & (PACER_SLOTS - 1)) * PACER_SLOT_SIZE;
+    *len = p->lens[p->tail & (PACER_SLOTS - 1)];
+    p->tail++;
+
+    // Spread the rest over what is left of the window. The gap only
+    // shrinks, the last packets of a frame are not delayed to the end
+    // of the window and a late frame keeps the pace
+    queued = p->head - p->tail;
+    if (queued > 0) {
+        remaining = p->window_end - now;
+        if ((remaining > 0) && (remaining / queued < p->gap)) p->gap = remaining / queued;
+        p->next_send = now + p->gap;
+    }
+
+    return 1;
+}
+
+void packet_pacer_stats(packet_pacer *p, const char *name)
+{
+    fprintf(stderr, "%s: packet pacer - packets: %u - paced: %u - overflows: %u - max queue: %u - window: %u us\n",
+            name, p->packets, p->paced, p->overflows, p->max_queue, p->window_us);
+}
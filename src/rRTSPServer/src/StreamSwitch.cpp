@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Choice between the high and the low stream of an adaptive client
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "StreamSwitch.hh"
+
+void stream_switch_init(stream_switch *s, long long now)
+{
+    memset(s, 0, sizeof(stream_switch));
+    s->current = SWITCH_HIGH;
+    s->target = SWITCH_HIGH;
+    s->switched_at = now;
+    s->up_ms = SWITCH_UP_MS;
+}
+
+int stream_switch_update(stream_switch *s, int congestion, long long now)
+{
+    if (congestion > 0) {
+        if (s->congested_since == 0) s->congested_since = now;
+        s->congested_at = now;
+    } else {
+        s->congested_since = 0;
+    }
+
+    if (s->current == SWITCH_HIGH) {
+        if ((congestion == 2) || ((congestion == 1) && (now - s->congested_since >= SWITCH_DOWN_MS))) {
+            s->target = SWITCH_LOW;
+        } else if (congestion == 0) {
+            // Not switched yet, and the congestion is over
+            s->target = SWITCH_HIGH;
+        }
+    } else {
+        if ((congestion == 0) && (now - s->congested_at >= s->up_ms) && (now - s->switched_at >= s->up_ms)) {
+            s->target = SWITCH_HIGH;
+        } else if (congestion > 0) {
+            s->target = SWITCH_LOW;
+        }
+    }
+
+    return s->target;
+}
+
+void stream_switch_commit(stream_switch *s, long long now)
+{
+    if (s->target == s->current) return;
+
+    if (s->target == SWITCH_LOW) {
+        // The high stream didn't last: wait longer before the next try
+        if ((s->switches > 0) && (now - s->switched_at < SWITCH_PROBE_MS)) {
+            s->failed_ups++;
+            s->up_ms *= 2;
+            if (s->up_ms > SWITCH_UP_MAX_MS) s->up_ms = SWITCH_UP_MAX_MS;
+        } else {
+            s->up_ms = SWITCH_UP_MS;
+        }
+    }
+    s->time_on[s->current] += now - s->switched_at;
+    s->current = s->target;
+    s->switched_at = now;
+    s->congested_since = 0;
+    s->switches++;
+}
+
+const char *stream_switch_name(int stream)
+{
+    return (stream == SWITCH_LOW) ? "low" : "high";
+}
+
+void stream_switch_stats(stream_switch *s, const char *name, long long now)
+{
+    long long time_on[2];
+
+    time_on[SWITCH_HIGH] = s->time_on[SWITCH_HIGH];
+    time_on[SWITCH_LOW] = s->time_on[SWITCH_LOW];
+    time_on[s->current] += now - s->switched_at;
+    fprintf(stderr, "%s: stream switch - switches: %u - failed ups: %u - high: %lld.%03lld s - low: %lld.%03lld s - on %s\n",
+            name, s->switches, s->failed_ups, time_on[SWITCH_HIGH] / 1000, time_on[SWITCH_HIGH] % 1000,
+            time_on[SWITCH_LOW] / 1000, time_on[SWITCH_LOW] % 1000, stream_switch_name(s->current));
+}
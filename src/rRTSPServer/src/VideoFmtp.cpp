@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * fmtp line of the SDP of a H.264 or H.265 stream.
+ */
+
+#include "VideoFmtp.hh"
+#include "rRTSPServer.h"
+#include "H264or5VideoStreamFramer.hh"
+#include "Base64.hh"
+
+#include <cstdio>
+#include <cstring>
+
+static char *video_fmtp_h264(unsigned char payload_type, u_int8_t *sps, unsigned spsSize, u_int8_t *pps, unsigned ppsSize)
+{
+    char *fmtp = NULL;
+    u_int8_t *spsWEB = new u_int8_t[spsSize]; // "WEB" means "Without Emulation Bytes"
+    unsigned spsWEBSize = removeH264or5EmulationBytes(spsWEB, spsSize, sps, spsSize);
+
+    if (spsWEBSize >= 4) {
+        u_int32_t profileLevelId = (spsWEB[1]<<16) | (spsWEB[2]<<8) | spsWEB[3];
+        char *sps_base64 = base64Encode((char *) sps, spsSize);
+        char *pps_base64 = base64Encode((char *) pps, ppsSize);
+
+        char const *fmtpFmt =
+            "a=fmtp:%d packetization-mode=1"
+            ";profile-level-id=%06X"
+            ";sprop-parameter-sets=%s,%s\r\n";
+        unsigned fmtpFmtSize = strlen(fmtpFmt)
+            + 3 /* max char len */
+            + 6 /* 3 bytes in hex */
+            + strlen(sps_base64) + strlen(pps_base64);
+        fmtp = new char[fmtpFmtSize];
+        sprintf(fmtp, fmtpFmt, payload_type, profileLevelId, sps_base64, pps_base64);
+
+        delete[] sps_base64;
+        delete[] pps_base64;
+    }
+    delete[] spsWEB;
+
+    return fmtp;
+}
+
+static char *video_fmtp_h265(unsigned char payload_type, u_int8_t *vps, unsigned vpsSize, u_int8_t *sps, unsigned spsSize,
+        u_int8_t *pps, unsigned ppsSize)
+{
+    char *fmtp = NULL;
+    u_int8_t *vpsWEB = new u_int8_t[vpsSize]; // "WEB" means "Without Emulation Bytes"
+    unsigned vpsWEBSize = removeH264or5EmulationBytes(vpsWEB, vpsSize, vps, vpsSize);
+
+    if (vpsWEBSize >= 6/*'profile_tier_level' offset*/ + 12/*num 'profile_tier_level' bytes*/) {
+        u_int8_t const *profileTierLevelHeaderBytes = &vpsWEB[6];
+        unsigned profileSpace  = profileTierLevelHeaderBytes[0]>>6; // top 2 bits
+        unsigned profileId = profileTierLevelHeaderBytes[0]&0x1F; // low 5 bits
+        unsigned tierFlag = (profileTierLevelHeaderBytes[0]>>5)&0x1; // one bit
+        unsigned levelId = profileTierLevelHeaderBytes[11]; // one byte
+        u_int8_t const *interop_constraints = &profileTierLevelHeaderBytes[5];
+        char interopConstraintsStr[100];
+        sprintf(interopConstraintsStr, "%02X%02X%02X%02X%02X%02X",
+                interop_constraints[0], interop_constraints[1], interop_constraints[2],
+                interop_constraints[3], interop_constraints[4], interop_constraints[5]);
+
+        char *sprop_vps = base64Encode((char *) vps, vpsSize);
+        char *sprop_sps = base64Encode((char *) sps, spsSize);
+        char *sprop_pps = base64Encode((char *) pps, ppsSize);
+
+        char const *fmtpFmt =
+            "a=fmtp:%d profile-space=%u"
+            ";profile-id=%u"
+            ";tier-flag=%u"
+            ";level-id=%u"
+            ";interop-constraints=%s"
+            ";sprop-vps=%s"
+            ";sprop-sps=%s"
+            ";sprop-pps=%s\r\n";
+        unsigned fmtpFmtSize = strlen(fmtpFmt)
+            + 3 /* max num chars: rtpPayloadType */ + 20 /* max num chars: profile_space */
+            + 20 /* max num chars: profile_id */
+            + 20 /* max num chars: tier_flag */
+            + 20 /* max num chars: level_id */
+            + strlen(interopConstraintsStr)
+            + strlen(sprop_vps)
+            + strlen(sprop_sps)
+            + strlen(sprop_pps);
+        fmtp = new char[fmtpFmtSize];
+        sprintf(fmtp, fmtpFmt,
+                payload_type, profileSpace,
+                profileId,
+                tierFlag,
+                levelId,
+                interopConstraintsStr,
+                sprop_vps,
+                sprop_sps,
+                sprop_pps);
+
+        delete[] sprop_vps;
+        delete[] sprop_sps;
+        delete[] sprop_pps;
+    }
+    delete[] vpsWEB;
+
+    return fmtp;
+}
+
+char *video_fmtp_from_cache(gop_cache *gop, int codec, unsigned char payload_type, unsigned int *seq)
+{
+    output_frame params[GOP_CACHE_PARAMS];
+    unsigned int n, i;
+    u_int8_t nal_unit_type;
+    u_int8_t *vps = NULL;
+    u_int8_t *sps = NULL;
+    u_int8_t *pps = NULL;
+    unsigned vpsSize = 0, spsSize = 0, ppsSize = 0;
+    char *fmtp = NULL;
+
+    // The slabs start with the 4 bytes of the NALU header
+    n = gop_cache_params(gop, params, seq);
+    for (i = 0; i < n; i++) {
+        if (params[i].slab->len <= 4) continue;
+        if (codec == CODEC_H264) {
+            // H.264: SPS (7) and PPS (8)
+            nal_unit_type = params[i].slab->data[4] & 0x1F;
+            if (nal_unit_type == 7) {
+                sps = params[i].slab->data + 4;
+                spsSize = params[i].slab->len - 4;
+            } else if (nal_unit_type == 8) {
+                pps = params[i].slab->data + 4;
+                ppsSize = params[i].slab->len - 4;
+            }
+        } else {
+            // H.265: VPS (32), SPS (33) and PPS (34)
+            nal_unit_type = (params[i].slab->data[4] & 0x7E) >> 1;
+            if (nal_unit_type == 32) {
+                vps = params[i].slab->data + 4;
+                vpsSize = params[i].slab->len - 4;
+            } else if (nal_unit_type == 33) {
+                sps = params[i].slab->data + 4;
+                spsSize = params[i].slab->len - 4;
+            } else if (nal_unit_type == 34) {
+                pps = params[i].slab->data + 4;
+                ppsSize = params[i].slab->len - 4;
+            }
+        }
+    }
+
+    if ((codec == CODEC_H264) && (sps != NULL) && (pps != NULL)) {
+        fmtp = video_fmtp_h264(payload_type, sps, spsSize, pps, ppsSize);
+    } else if ((codec == CODEC_H265) && (vps != NULL) && (sps != NULL) && (pps != NULL)) {
+        fmtp = video_fmtp_h265(payload_type, vps, vpsSize, sps, spsSize, pps, ppsSize);
+    }
+
+    for (i = 0; i < n; i++) frame_slab_unref(params[i].slab);
+
+    return fmtp;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2025 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * H.264 and H.265 RTP sinks fed by a VideoFramedMemorySource without a
+ * framer and a fragmenter.
+ */
+
+#include "VideoFramedMemoryRTPSink.hh"
+#include "VideoFramedMemorySource.hh"
+
+// Payload without the RTP header, as H264or5VideoRTPSink gives its fragmenter
+#define RTP_HEADER_SIZE 12
+
+////////// H264VideoFramedMemoryRTPSink //////////
+
+H264VideoFramedMemoryRTPSink*
+H264VideoFramedMemoryRTPSink::createNew(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                        u_int8_t const* sps, unsigned spsSize, u_int8_t const* pps, unsigned ppsSize) {
+    return new H264VideoFramedMemoryRTPSink(env, RTPgs, rtpPayloadFormat, sps, spsSize, pps, ppsSize);
+}
+
+H264VideoFramedMemoryRTPSink::H264VideoFramedMemoryRTPSink(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                        u_int8_t const* sps, unsigned spsSize, u_int8_t const* pps, unsigned ppsSize)
+    : H264VideoRTPSink(env, RTPgs, rtpPayloadFormat, sps, spsSize, pps, ppsSize) {
+}
+
+Boolean H264VideoFramedMemoryRTPSink::sourceIsCompatibleWithUs(MediaSource& source) {
+    // The subsessions give it only a VideoFramedMemorySource
+    return source.isFramedSource();
+}
+
+Boolean H264VideoFramedMemoryRTPSink::continuePlaying() {
+    // No fragmenter, the source fragments the NAL units
+    ((VideoFramedMemorySource*) fSource)->setMaxFragmentSize(ourMaxPacketSize() - RTP_HEADER_SIZE);
+
+    return MultiFramedRTPSink::continuePlaying();
+}
+
+void H264VideoFramedMemoryRTPSink::doSpecialFrameHandling(unsigned /*fragmentationOffset*/, unsigned char* /*frameStart*/,
+                                                        unsigned /*numBytesInFrame*/, struct timeval framePresentationTime,
+                                                        unsigned /*numRemainingBytes*/) {
+    if (((VideoFramedMemorySource*) fSource)->pictureEndMarker()) setMarkerBit();
+    setTimestamp(framePresentationTime);
+}
+
+////////// H265VideoFramedMemoryRTPSink //////////
+
+H265VideoFramedMemoryRTPSink*
+H265VideoFramedMemoryRTPSink::createNew(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                        u_int8_t const* vps, unsigned vpsSize, u_int8_t const* sps, unsigned spsSize,
+                                        u_int8_t const* pps, unsigned ppsSize) {
+    return new H265VideoFramedMemoryRTPSink(env, RTPgs, rtpPayloadFormat, vps, vpsSize, sps, spsSize, pps, ppsSize);
+}
+
+H265VideoFramedMemoryRTPSink::H265VideoFramedMemoryRTPSink(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                        u_int8_t const* vps, unsigned vpsSize, u_int8_t const* sps, unsigned spsSize,
+                                        u_int8_t const* pps, unsigned ppsSize)
+    : H265VideoRTPSink(env, RTPgs, rtpPayloadFormat, vps, vpsSize, sps, spsSize, pps, ppsSize) {
+}
+
+Boolean H265VideoFramedMemoryRTPSink::sourceIsCompatibleWithUs(MediaSource& source) {
+    // The subsessions give it only a VideoFramedMemorySource
+    return source.isFramedSource();
+}
+
+Boolean H265VideoFramedMemoryRTPSink::continuePlaying() {
+    // No fragmenter, the source fragments the NAL units
+    ((VideoFramedMemorySource*) fSource)->setMaxFragmentSize(ourMaxPacketSize() - RTP_HEADER_SIZE);
+
+    return MultiFramedRTPSink::continuePlaying();
+}
+
+void H265VideoFramedMemoryRTPSink::doSpecialFrameHandling(unsigned /*fragmentationOffset*/, unsigned char* /*frameStart*/,
+                                                        unsigned /*numBytesInFrame*/, struct timeval framePresentationTime,
+                                                        unsigned /*numRemainingBytes*/) {
+    if (((VideoFramedMemorySource*) fSource)->pictureEndMarker()) setMarkerBit();
+    setTimestamp(framePresentationTime);
+}
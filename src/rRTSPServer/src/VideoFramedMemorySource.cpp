@@ -20,13 +20,15 @@
 
 #include "VideoFramedMemorySource.hh"
 #include "GroupsockHelper.hh"
+#include "RTPSink.hh"
 #include "rRTSPServer.h"
 
 #include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 
+#include <cstdlib>
 #include <cstring>
-#include <queue>
-#include <vector>
 
 unsigned char NALU_HEADER[] = { 0x00, 0x00, 0x00, 0x01 };
 
@@ -39,25 +41,245 @@ VideoFramedMemorySource::createNew(UsageEnvironment& env,
                                         int hNumber,
                                         output_queue *qBuffer,
                                         Boolean useTimeForPres,
-                                        unsigned playTimePerFrame) {
+                                        unsigned playTimePerFrame,
+                                        output_queue *qLow) {
     if (qBuffer == NULL) return NULL;
 
-    return new VideoFramedMemorySource(env, hNumber, qBuffer, useTimeForPres, playTimePerFrame);
+    return new VideoFramedMemorySource(env, hNumber, qBuffer, useTimeForPres, playTimePerFrame, qLow);
 }
 
 VideoFramedMemorySource::VideoFramedMemorySource(UsageEnvironment& env,
                                                         int hNumber,
                                                         output_queue *qBuffer,
                                                         Boolean useTimeForPres,
-                                                        unsigned playTimePerFrame)
-    : FramedSource(env), fHNumber(hNumber), fQBuffer(qBuffer),
+                                                        unsigned playTimePerFrame,
+                                                        output_queue *qLow)
+    : FramedSource(env), fHNumber(hNumber), fQBuffer(qBuffer), fCursor(&fCursors[0]),
+      fQAlt(qLow), fAltCursor(&fCursors[1]), fLastTime(0),
       fCurIndex(0), fUseTimeForPres(useTimeForPres), fPlayTimePerFrame(playTimePerFrame), fLastPlayTime(0),
-      fLimitNumBytesToStream(False), fNumBytesToStream(0), fHaveStartedReading(False) {
+      fLimitNumBytesToStream(False), fNumBytesToStream(0), fHaveStartedReading(False),
+      fPrime(NULL), fPrimeCount(0), fPrimeIndex(0),
+      fRTPSink(NULL), fTCPSocketNum(-1), fThinSince(0), fCongestedAt(0), fCongestion(0),
+      fMaxFragmentSize(0), fFragOffset(0), fFragDuration(0), fPictureEndMarker(False) {
+
+    memset(fCursors, 0, sizeof(fCursors));
+    memset(&fFrag, 0, sizeof(fFrag));
+    fCursors[0].reader_task = fCursors[1].reader_task = doGetNextFrameTask;
+    fCursors[0].reader = fCursors[1].reader = this;
+    stream_switch_init(&fSwitch, current_timestamp());
 
     if (debug & 4) fprintf(stderr, "%lld: VideoFramedMemorySource - fPlayTimePerFrame %u\n", current_timestamp(), fPlayTimePerFrame);
 }
 
-VideoFramedMemorySource::~VideoFramedMemorySource() {}
+VideoFramedMemorySource::~VideoFramedMemorySource() {
+    frame_cursor_close(fCursor);
+    frame_cursor_close(fAltCursor);
+    releasePrime();
+    if (fFrag.slab != NULL) frame_slab_unref(fFrag.slab);
+    if (fQAlt != NULL) stream_switch_stats(&fSwitch, "VideoFramedMemorySource", current_timestamp());
+}
+
+void VideoFramedMemorySource::releasePrime() {
+    while (fPrimeIndex < fPrimeCount) frame_slab_unref(fPrime[fPrimeIndex++].slab);
+    free(fPrime);
+    fPrime = NULL;
+    fPrimeCount = 0;
+    fPrimeIndex = 0;
+}
+
+// A VCL NAL unit, the last of a picture as H264or5VideoStreamDiscreteFramer guesses
+Boolean VideoFramedMemorySource::endsPicture(u_int8_t nal) {
+    if (fHNumber == 264) return (((nal & 0x1F) >= 1) && ((nal & 0x1F) <= 5));
+
+    return (((nal & 0x7E) >> 1) <= 31);
+}
+
+/*
+ * Copy the next fragment of fFrag into the packet, as H264or5Fragmenter
+ * does: FU-A for H.264, FU for H.265. The NAL header goes into the FU
+ * headers, the first fragment has the S bit and the last one the E bit.
+ */
+void VideoFramedMemorySource::deliverFragment() {
+    unsigned char *nal = fFrag.slab->data + sizeof(NALU_HEADER);
+    unsigned len = fFrag.slab->len - sizeof(NALU_HEADER);
+    unsigned maxSize = (fMaxSize < fMaxFragmentSize) ? fMaxSize : fMaxFragmentSize;
+    unsigned headerSize, nalHeaderSize, n;
+
+    if (fHNumber == 264) {
+        headerSize = 2;
+        nalHeaderSize = 1;
+        fTo[0] = (nal[0] & 0xE0) | 28;          // FU indicator
+        fTo[1] = nal[0] & 0x1F;                 // FU header
+    } else {
+        headerSize = 3;
+        nalHeaderSize = 2;
+        fTo[0] = (nal[0] & 0x81) | (49 << 1);   // payload header
+        fTo[1] = nal[1];
+        fTo[2] = (nal[0] & 0x7E) >> 1;          // FU header
+    }
+    if (fFragOffset == 0) {
+        fTo[headerSize - 1] |= 0x80;
+        fFragOffset = nalHeaderSize;
+    }
+    n = len - fFragOffset;
+    if (headerSize + n > maxSize) {
+        n = maxSize - headerSize;
+    } else {
+        fTo[headerSize - 1] |= 0x40;
+    }
+    memcpy(fTo + headerSize, nal + fFragOffset, n);
+    fFragOffset += n;
+    fFrameSize = headerSize + n;
+    fNumTruncatedBytes = 0;
+
+    fPictureEndMarker = False;
+    if (fFragOffset == len) {
+        fPictureEndMarker = endsPicture(nal[0]);
+        frame_slab_unref(fFrag.slab);
+        fFrag.slab = NULL;
+    }
+}
+
+// Ask for a trigger, doGetNextFrame() is called again at the next push
+void VideoFramedMemorySource::waitForFrames() {
+    fCursor->waiting = 1;
+}
+
+// Return 2 if the client is heavily congested, 1 if it is congested, 0 if not
+int VideoFramedMemorySource::congestion() {
+    RTPTransmissionStats* stats;
+    struct timeval now;
+    long long age;
+    unsigned int rtt, jitter;
+    int queued;
+    int level = 0;
+
+    // Bytes not yet acknowledged by a TCP client
+    if ((fTCPSocketNum >= 0) && (fQBuffer->thin_bytes > 0) && (ioctl(fTCPSocketNum, SIOCOUTQ, &queued) == 0)) {
+        if ((unsigned int) queued > 2 * fQBuffer->thin_bytes) return 2;
+        if ((unsigned int) queued > fQBuffer->thin_bytes) level = 1;
+    }
+
+    // Loss and round trip of the last receiver reports
+    if (fRTPSink != NULL) {
+        gettimeofday(&now, NULL);
+        RTPTransmissionStatsDB::Iterator iter(fRTPSink->transmissionStatsDB());
+        while ((stats = iter.next()) != NULL) {
+            age = (now.tv_sec - stats->lastTimeReceived().tv_sec) * 1000LL + (now.tv_usec - stats->lastTimeReceived().tv_usec) / 1000;
+            if (age > THIN_RR_MAX_AGE_MS) continue;
+            // roundTripDelay() is in 1/65536 s
+            rtt = ((unsigned long long) stats->roundTripDelay() * 1000) >> 16;
+            // jitter() is in RTP timestamp units
+            jitter = (unsigned long long) stats->jitter() * 1000 / fRTPSink->rtpTimestampFrequency();
+            if ((stats->packetLossRatio() >= THIN_LOSS_HEAVY) || (rtt >= THIN_RTT_HEAVY_MS)) return 2;
+            if ((stats->packetLossRatio() >= THIN_LOSS) || (rtt >= THIN_RTT_MS) || (jitter >= THIN_JITTER_MS)) level = 1;
+        }
+    }
+
+    return level;
+}
+
+/*
+ * Move the thin level of the client with its congestion and return True
+ * if the frame must be skipped.
+ * Congestion skips the non-reference frames first, then everything up to
+ * the next key frame if it lasts or gets heavy. The client goes back to
+ * the full stream one step at a time, from a key frame, when there has
+ * been no congestion for a while.
+ */
+Boolean VideoFramedMemorySource::thin(unsigned int flags) {
+    long long now = current_timestamp();
+    int c = congestion();
+    int level = fCursor->thin_level;
+
+    fCongestion = c;
+    if (c > 0) fCongestedAt = now;
+    if (level == THIN_LEVEL_NONE) {
+        if (c == 2) level = THIN_LEVEL_GOP;
+        else if (c == 1) level = THIN_LEVEL_NONREF;
+    } else if (level == THIN_LEVEL_NONREF) {
+        if ((c == 2) || ((c == 1) && (now - fThinSince >= THIN_STEP_MS))) level = THIN_LEVEL_GOP;
+        else if (now - fCongestedAt >= THIN_RECOVER_MS) level = THIN_LEVEL_NONE;
+    } else if ((flags & FRAME_FLAG_KEY) && (now - fCongestedAt >= THIN_RECOVER_MS)) {
+        level = THIN_LEVEL_NONREF;
+    }
+
+    if (level != fCursor->thin_level) {
+        fprintf(stderr, "%lld: VideoFramedMemorySource - %s client - thin level %d -> %d\n",
+                current_timestamp(), (fTCPSocketNum >= 0) ? "tcp" : "udp", fCursor->thin_level, level);
+        fCursor->thin_level = level;
+        fThinSince = now;
+    }
+
+    if ((level == THIN_LEVEL_NONREF) && (flags & FRAME_FLAG_NONREF)) return True;
+    if ((level == THIN_LEVEL_GOP) && !(flags & FRAME_FLAG_KEY)) return True;
+
+    return False;
+}
+
+/*
+ * Adaptive client: ask for the low or the high stream with the congestion
+ * of the last frame. The other stream is read from now on and its frames
+ * are skipped up to the first key frame, where the client switches.
+ */
+void VideoFramedMemorySource::adapt() {
+    long long now = current_timestamp();
+    int current = fSwitch.current;
+    int target;
+    output_frame of;
+
+    target = stream_switch_update(&fSwitch, fCongestion, now);
+    if ((target != current) && (fAltCursor->ring == NULL)) {
+        fprintf(stderr, "%lld: VideoFramedMemorySource - %s client - switch %s -> %s - congestion %d\n",
+                now, (fTCPSocketNum >= 0) ? "tcp" : "udp", stream_switch_name(current), stream_switch_name(target), fCongestion);
+        frame_cursor_set_limits(fAltCursor, fQAlt->max_size, fQAlt->max_bytes, fQAlt->max_ms);
+        frame_cursor_open(&(fQAlt->ring), fAltCursor, 0);
+    } else if ((target == current) && (fAltCursor->ring != NULL)) {
+        fprintf(stderr, "%lld: VideoFramedMemorySource - %s client - switch to %s cancelled\n",
+                now, (fTCPSocketNum >= 0) ? "tcp" : "udp", stream_switch_name(1 - current));
+        frame_cursor_close(fAltCursor);
+    }
+
+    while ((fAltCursor->ring != NULL) && (frame_cursor_pop(fAltCursor, &of) == 1)) {
+        if (of.flags & FRAME_FLAG_KEY) {
+            switchStream(&of);
+        } else {
+            frame_slab_unref(of.slab);
+        }
+    }
+}
+
+// Send the other stream from its key frame, after its parameter sets
+void VideoFramedMemorySource::switchStream(output_frame *keyFrame) {
+    long long now = current_timestamp();
+    output_queue *q;
+    frame_cursor *c;
+    unsigned seq;
+
+    fprintf(stderr, "%lld: VideoFramedMemorySource - %s client - switched %s -> %s after %lld ms\n",
+            now, (fTCPSocketNum >= 0) ? "tcp" : "udp", stream_switch_name(fSwitch.current),
+            stream_switch_name(fSwitch.target), now - fSwitch.switched_at);
+    stream_switch_commit(&fSwitch, now);
+
+    frame_cursor_close(fCursor);
+    q = fQBuffer;
+    fQBuffer = fQAlt;
+    fQAlt = q;
+    c = fCursor;
+    fCursor = fAltCursor;
+    fAltCursor = c;
+
+    // The decoder reinitializes with the new parameter sets in band
+    releasePrime();
+    fPrime = (output_frame *) malloc((GOP_CACHE_PARAMS + 1) * sizeof(output_frame));
+    if (fPrime == NULL) {
+        frame_slab_unref(keyFrame->slab);
+        return;
+    }
+    fPrimeCount = gop_cache_params(&(fQBuffer->gop), fPrime, &seq);
+    fPrime[fPrimeCount++] = *keyFrame;
+    fPrimeIndex = 0;
+}
 
 void VideoFramedMemorySource::seekToByteAbsolute(u_int64_t byteNumber, u_int64_t numBytesToStream) {
 }
@@ -67,6 +289,11 @@ void VideoFramedMemorySource::seekToByteRelative(int64_t offset, u_int64_t numBy
 
 void VideoFramedMemorySource::doStopGettingFrames() {
     fHaveStartedReading = False;
+    frame_cursor_close(fCursor);
+    frame_cursor_close(fAltCursor);
+    releasePrime();
+    if (fFrag.slab != NULL) frame_slab_unref(fFrag.slab);
+    fFrag.slab = NULL;
 }
 
 void VideoFramedMemorySource::doGetNextFrameTask(void* clientData) {
@@ -80,18 +307,30 @@ void VideoFramedMemorySource::doGetNextFrameEx() {
 
 void VideoFramedMemorySource::doGetNextFrame() {
     Boolean frameFound = false;
+    Boolean primed = false;
+    output_frame of;
+
+    // Woken up by the event trigger but nobody asked for a frame
+    if (!isCurrentlyAwaitingData()) return;
+
+    if (fFrag.slab != NULL) {
+        // The rest of a NAL unit larger than a packet
+        deliverFragment();
+        fDurationInMicroseconds = fFragDuration;
+        FramedSource::afterGetting(this);
+        return;
+    }
 
     if (!fHaveStartedReading) {
         if (debug & 4) fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() 1st start\n", current_timestamp());
-        pthread_mutex_lock(&(fQBuffer->mutex));
-        // Yes, I know that I should not block the event loop
-        while (fQBuffer->frame_queue.size() < 5) {
-            pthread_mutex_unlock(&(fQBuffer->mutex));
-            usleep(1000);
-            pthread_mutex_lock(&(fQBuffer->mutex));
+        // Start from the last IDR if the gop cache has it, otherwise
+        // from a GOP start in the ring
+        frame_cursor_set_limits(fCursor, fQBuffer->max_size, fQBuffer->max_bytes, fQBuffer->max_ms);
+        fPrimeCount = gop_cache_prime(&(fQBuffer->gop), &(fQBuffer->ring), fCursor, &fPrime);
+        fPrimeIndex = 0;
+        if ((fPrimeCount > 0) && (debug & 4)) {
+            fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() primed with %u frames from gop cache\n", current_timestamp(), fPrimeCount);
         }
-        while (fQBuffer->frame_queue.size() > 5) fQBuffer->frame_queue.pop();
-        pthread_mutex_unlock(&(fQBuffer->mutex));
         fHaveStartedReading = True;
     }
 
@@ -109,59 +348,79 @@ void VideoFramedMemorySource::doGetNextFrame() {
     if (debug & 4) fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() start - fMaxSize %d - fLimitNumBytesToStream %d\n", current_timestamp(), fMaxSize, fLimitNumBytesToStream);
 
     while (!frameFound) {
-        pthread_mutex_lock(&(fQBuffer->mutex));
-        if (fQBuffer->frame_queue.size() == 0) {
-            pthread_mutex_unlock(&(fQBuffer->mutex));
+        if ((fQAlt != NULL) && (fPrimeIndex == fPrimeCount)) adapt();
+        if (fPrimeIndex < fPrimeCount) {
+            // Cached frames: compress their timestamps 1 ms apart, up to the last one,
+            // and send them without waiting so the client catches up with live
+            of = fPrime[fPrimeIndex];
+            of.time = fPrime[fPrimeCount - 1].time - (fPrimeCount - 1 - fPrimeIndex);
+            fPrimeIndex++;
+            if (fPrimeIndex == fPrimeCount) releasePrime();
+            primed = true;
+            frameFound = true;
+        } else if (frame_cursor_pop(fCursor, &of) == 0) {
             if (debug & 4) fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() queue is empty\n", current_timestamp());
-            usleep(1000);
-        } else if (fQBuffer->frame_queue.front().frame.size() == 0) {
-            pthread_mutex_unlock(&(fQBuffer->mutex));
+            waitForFrames();
+            return;
+        } else if (of.slab->len == 0) {
+            frame_slab_unref(of.slab);
             fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() error - NULL ptr\n", current_timestamp());
-            usleep(1000);
-        } else if (memcmp(NALU_HEADER, fQBuffer->frame_queue.front().frame.data(), sizeof(NALU_HEADER)) != 0) {
-            // Maybe the buffer is too small, align read index with write index
-            if (fQBuffer->frame_queue.size() > 0) {
-                fQBuffer->frame_queue.pop();
-            }
-            pthread_mutex_unlock(&(fQBuffer->mutex));
+        } else if (memcmp(NALU_HEADER, of.slab->data, sizeof(NALU_HEADER)) != 0) {
+            // Maybe the buffer is too small, skip the frame
+            frame_slab_unref(of.slab);
             fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() error - wrong frame header\n", current_timestamp());
+        } else if (thin(of.flags)) {
+            // The client is congested
+            frame_slab_unref(of.slab);
+            __atomic_add_fetch(&fCursor->thinned, 1, __ATOMIC_RELAXED);
         } else {
             frameFound = true;
         }
     }
 
-    if (debug & 4) fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() size of queue is %d\n", current_timestamp(), fQBuffer->frame_queue.size());
+    if (debug & 4) fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() size of queue is %d\n", current_timestamp(), frame_cursor_size(fCursor));
 
     // Frame found, send it
     unsigned char *ptr;
     unsigned char nal;
-    int size = fQBuffer->frame_queue.front().frame.size();
-    uint32_t frame_time = fQBuffer->frame_queue.front().time;
-    ptr = fQBuffer->frame_queue.front().frame.data();
+    int size = of.slab->len;
+    uint32_t frame_time = of.time;
+    ptr = of.slab->data;
     // Remove nalu header before sending the frame to FramedSource
     ptr += 4 * sizeof(unsigned char);
     size -= 4 * sizeof(unsigned char);
     nal = ptr[0];
 
-    if ((unsigned) size <= fFrameSize) {
+    if ((fMaxFragmentSize > 0) && ((unsigned) size > fMaxFragmentSize)) {
+        // The sink has no fragmenter: the packets are copied from the slab,
+        // which is kept until the last fragment
+        if (debug & 4) fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() fragmented frame - size %d - fMaxFragmentSize %u - counter %d - time %u\n",
+                current_timestamp(), size, fMaxFragmentSize, of.counter, frame_time);
+        fFrag = of;
+        fFragOffset = 0;
+        deliverFragment();
+    } else if ((unsigned) size <= fFrameSize) {
         // The size of the frame is smaller than the available buffer
         fFrameSize = size;
+        fPictureEndMarker = endsPicture(nal);
         if (debug & 4) fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() whole frame - fFrameSize %d - fMaxSize %d - counter %d - time %u\n",
-                current_timestamp(), fFrameSize, fMaxSize, fQBuffer->frame_queue.front().counter, frame_time);
+                current_timestamp(), fFrameSize, fMaxSize, of.counter, frame_time);
         std::memcpy(fTo, ptr, size);
-        fQBuffer->frame_queue.pop();
-        pthread_mutex_unlock(&(fQBuffer->mutex));
+        frame_slab_unref(of.slab);
         fNumTruncatedBytes = 0;
     } else {
         // The size of the frame is greater than the available buffer
         fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() error - the size of the frame is greater than the available buffer %d/%d\n", current_timestamp(), fFrameSize, fMaxSize);
         fFrameSize = 0;
-        fQBuffer->frame_queue.pop();
-        pthread_mutex_unlock(&(fQBuffer->mutex));
+        frame_slab_unref(of.slab);
         fNumTruncatedBytes = 0;
         fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() frame lost\n", current_timestamp());
     }
 
+    // The streams share the clock, but a switch must not go back in time
+    if ((fQAlt != NULL) && (fLastTime != 0) && ((int32_t) (frame_time - fLastTime) < 0)) frame_time = fLastTime;
+    fLastTime = frame_time;
+
     if (!fUseTimeForPres) {
         fPresentationTime.tv_usec = (frame_time % 1000) * 1000;
         fPresentationTime.tv_sec = frame_time / 1000;
@@ -171,6 +430,7 @@ void VideoFramedMemorySource::doGetNextFrame() {
         gettimeofday(&fPresentationTime, NULL);
     }
     fDurationInMicroseconds = fPlayTimePerFrame;
+    if (primed) fDurationInMicroseconds = 0;
 
     // If it's a VPS/SPS/PPS set duration = 0
     u_int8_t nal_unit_type;
@@ -182,6 +442,8 @@ void VideoFramedMemorySource::doGetNextFrame() {
         if ((nal_unit_type == 32) || (nal_unit_type == 33) || (nal_unit_type == 34)) fDurationInMicroseconds = 0;
     }
 
+    fFragDuration = fDurationInMicroseconds;
+
     // Inform the reader that he has data:
     FramedSource::afterGetting(this);
 }
@@ -29,8 +29,9 @@
 #include "ADTSAudioFileServerMediaSubsession_BC.hh"
 #include "PCMAudioFileServerMediaSubsession_BC.hh"
 #include "WAVAudioFifoServerMediaSubsession.hh"
+#include "LazyRTSPServer.hh"
+#include "MulticastStream.hh"
 #include "WAVAudioFifoSource.hh"
-#include "AudioFramedMemorySource.hh"
 #include "StreamReplicator.hh"
 #include "aLawAudioFilter.hh"
 #include "PCMFileSink.hh"
@@ -43,191 +44,70 @@
 #include <vector>
 
 #include <getopt.h>
+#include <arpa/inet.h>
 #include <pthread.h>
 #include <errno.h>
 #include <limits.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <sys/resource.h>
 
 #include "rRTSPServer.h"
 
-//#define USE_SEMAPHORE 1
-#ifdef USE_SEMAPHORE
-#include <semaphore.h>
-#endif
-
-int buf_offset;
-int buf_size;
-int frame_header_size;
+unsigned int buf_offset;
+unsigned int frame_header_size;
 struct stream_type_s stream_type;
-
-unsigned char IDR4[]                = {0x65, 0xB8};
-unsigned char NALx_START[]          = {0x00, 0x00, 0x00, 0x01};
-unsigned char IDR4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x65, 0x88};
-unsigned char IDR5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x26};
-unsigned char PFR4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x41};
-unsigned char PFR5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x02};
-unsigned char SPS4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x67};
-unsigned char SPS5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x42};
-unsigned char PPS4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x68};
-unsigned char PPS5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x44};
-unsigned char VPS5_START[]          = {0x00, 0x00, 0x00, 0x01, 0x40};
-
-unsigned char PPS4_HEADER[]         = {0x08, 0x00, 0x00, 0x00};
-
-unsigned char SPS4_640X360[]        = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x14,
-                                       0x96, 0x54, 0x05, 0x01, 0x7B, 0xCB, 0x37, 0x01,
-                                       0x01, 0x01, 0x02};
-unsigned char SPS4_640X360_TI[]     = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x14,
-                                       0x96, 0x54, 0x05, 0x01, 0x7B, 0xCB, 0x37, 0x01,
-                                       0x01, 0x01, 0x40, 0x00, 0x00, 0x7D, 0x00, 0x00,
-                                       0x13, 0x88, 0x21};
-unsigned char SPS4_1920X1080[]      = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
-                                       0x96, 0x54, 0x03, 0xC0, 0x11, 0x2F, 0x2C, 0xDC,
-                                       0x04, 0x04, 0x04, 0x08};
-unsigned char SPS4_1920X1080_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
-                                       0x96, 0x54, 0x03, 0xC0, 0x11, 0x2F, 0x2C, 0xDC,
-                                       0x04, 0x04, 0x05, 0x00, 0x00, 0x03, 0x01, 0xF4,
-                                       0x00, 0x00, 0x4E, 0x20, 0x84};
-unsigned char SPS4_2304X1296[]      = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
-                                       0x96, 0x54, 0x01, 0x20, 0x05, 0x19, 0x37, 0x01,
-                                       0x01, 0x01, 0x02};
-unsigned char SPS4_2304X1296_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x67, 0x4D, 0x00, 0x20,
-                                       0x96, 0x54, 0x01, 0x20, 0x05, 0x19, 0x37, 0x01,
-                                       0x00, 0x00, 0x40, 0x00, 0x00, 0x7D, 0x00, 0x00,
-                                       0x13, 0x88, 0x21};
-unsigned char SPS4_2_640X360[]      = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x14,
-                                       0xAC, 0x2C, 0xA8, 0x0A, 0x02, 0xF7, 0x96, 0x6E,
-                                       0x02, 0x02, 0x02, 0x04};
-unsigned char SPS4_2_640X360_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x14,
-                                       0xAC, 0x2C, 0xA8, 0x0A, 0x02, 0xF7, 0x96, 0x6E,
-                                       0x02, 0x02, 0x02, 0x80, 0x00, 0x00, 0xFA, 0x00,
-                                       0x00, 0x27, 0x10, 0x42};
-unsigned char SPS4_2_1920X1080[]    = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x07, 0x80, 0x22, 0x5E, 0x59,
-                                       0xB8, 0x08, 0x08, 0x08, 0x10};
-unsigned char SPS4_2_1920X1080_TI[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x07, 0x80, 0x22, 0x5E, 0x59,
-                                       0xB8, 0x08, 0x08, 0x0A, 0x00, 0x00, 0x03, 0x03,
-                                       0xE8, 0x00, 0x00, 0x9C, 0x41, 0x08};
-unsigned char SPS4_2_2304X1296[]    = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x02, 0x40, 0x0A, 0x32, 0x6E,
-                                       0x02, 0x02, 0x02, 0x04};
-unsigned char SPS4_2_2304X1296_TI[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x02, 0x40, 0x0A, 0x32, 0x6E,
-                                       0x02, 0x02, 0x02, 0x80, 0x00, 0x00, 0xFA, 0x00,
-                                       0x00, 0x27, 0x10, 0x42};
-unsigned char SPS4_3_640X360[]      = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x14,
-                                       0xAC, 0x2C, 0xA8, 0x0A, 0x02, 0xF7, 0x96, 0x6A,
-                                       0x02, 0x02, 0x02, 0x04};
-unsigned char SPS4_3_640X360_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x14,
-                                       0xAC, 0x2C, 0xA8, 0x0A, 0x02, 0xF7, 0x96, 0x6A,
-                                       0x02, 0x02, 0x02, 0x80, 0x00, 0x00, 0xFA, 0x00,
-                                       0x00, 0x27, 0x10, 0x42};
-unsigned char SPS4_3_1920X1080[]    = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x07, 0x80, 0x22, 0x5E, 0x59,
-                                       0xA8, 0x08, 0x08, 0x08, 0x10};
-unsigned char SPS4_3_1920X1080_TI[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x07, 0x80, 0x22, 0x5E, 0x59,
-                                       0xA8, 0x08, 0x08, 0x0A, 0x00, 0x00, 0x03, 0x03,
-                                       0xE8, 0x00, 0x00, 0x9C, 0x41, 0x08};
-unsigned char SPS4_3_2304X1296[]    = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x02, 0x40, 0x0A, 0x32, 0x6A,
-                                       0x02, 0x02, 0x02, 0x04};
-unsigned char SPS4_3_2304X1296_TI[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x20,
-                                       0xAC, 0x2C, 0xA8, 0x02, 0x40, 0x0A, 0x32, 0x6A,
-                                       0x02, 0x02, 0x02, 0x80, 0x00, 0x00, 0xFA, 0x00,
-                                       0x00, 0x27, 0x10, 0x42};
-unsigned char SPS5_1920X1080[]      = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x7B, 0xA0,
-                                       0x03, 0xC0, 0x80, 0x10, 0xE7, 0xF9, 0x6B, 0xB9,
-                                       0x12, 0x20, 0xB2, 0xFC, 0xF3, 0xCF, 0x3C, 0xF3,
-                                       0xCF, 0x3C, 0xF3, 0xCF, 0x3C, 0xF3, 0xCF, 0x3C,
-                                       0xF3, 0xCB, 0x73, 0x70, 0x10, 0x10, 0x10, 0x08};
-//unsigned char SPS5_1920X1080_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-//                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-//                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x7B, 0xA0,
-//                                       0x03, 0xC0, 0x80, 0x10, 0xE7, 0xF9, 0x6B, 0xB9,
-//                                       0x12, 0x20, 0xB2, 0xFC, 0xF3, 0xCF, 0x3C, 0xF3,
-//                                       0xCF, 0x3C, 0xF3, 0xCF, 0x3C, 0xF3, 0xCF, 0x3C,
-//                                       0xF3, 0xCB, 0x73, 0x70, 0x10, 0x10, 0x10, 0x40,
-//                                       0x00, 0x00, 0x7D, 0x00, 0x00, 0x13, 0x88, 0x02};
-unsigned char SPS5_2_1920X1080[]    = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xBA, 0xA0,
-                                       0x03, 0xC0, 0x80, 0x10, 0xE7, 0xF9, 0x6B, 0xB9,
-                                       0x12, 0x20, 0xB2, 0xFC, 0xF3, 0xCF, 0x3C, 0xF3,
-                                       0xCF, 0x3C, 0xF3, 0xCF, 0x3C, 0xF3, 0xCF, 0x3C,
-                                       0xF3, 0xCB, 0x73, 0x70, 0x10, 0x10, 0x10, 0x08};
-//unsigned char SPS5_2_1920X1080_TI[] = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-//                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-//                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xBA, 0xA0,
-//                                       0x03, 0xC0, 0x80, 0x10, 0xE7, 0xF9, 0x6B, 0xB9,
-//                                       0x12, 0x20, 0xB2, 0xFC, 0xF3, 0xCF, 0x3C, 0xF3,
-//                                       0xCF, 0x3C, 0xF3, 0xCF, 0x3C, 0xF3, 0xCF, 0x3C,
-//                                       0xF3, 0xCB, 0x73, 0x70, 0x10, 0x10, 0x10, 0x40,
-//                                       0x00, 0x00, 0x7D, 0x00, 0x00, 0x13, 0x88, 0x02};
-unsigned char SPS5_3_2304X1296[]    = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xBA, 0xA0,
-                                       0x01, 0x20, 0x20, 0x05, 0x11, 0xFE, 0x5A, 0xEE,
-                                       0x44, 0x88, 0x8B, 0xF2, 0xDC, 0xD4, 0x04, 0x04,
-                                       0x04, 0x02};
-//unsigned char SPS5_3_2304X1296_TI[] = {0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
-//                                       0x60, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
-//                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xBA, 0xA0,
-//                                       0x01, 0x20, 0x20, 0x05, 0x11, 0xFE, 0x5A, 0xEE,
-//                                       0x44, 0x88, 0x8B, 0xF2, 0xDC, 0xD4, 0x04, 0x04,
-//                                       0x04, 0x10, 0x00, 0x00, 0x1F, 0x40, 0x00, 0x04,
-//                                       0xE2, 0x00, 0x80};
-unsigned char VPS5_1920X1080[]      = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0x7B, 0xAC, 0x09};
-unsigned char VPS5_1920X1080_TI[]   = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0x7B, 0xAC, 0x0C, 0x00, 0x00, 0x07, 0xD0,
-                                       0x00, 0x01, 0x38, 0x81, 0x40};
-unsigned char VPS5_2_1920X1080[]    = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0xBA, 0xAC, 0x09};
-unsigned char VPS5_2_1920X1080_TI[] = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0xBA, 0xAC, 0x0C, 0x00, 0x00, 0x07, 0xD0,
-                                       0x00, 0x01, 0x38, 0x81, 0x40};
-unsigned char VPS5_3_2304X1296[]    = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0xBA, 0xAC, 0x09};
-unsigned char VPS5_3_2304X1296_TI[] = {0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01,
-                                       0xFF, 0xFF, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
-                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
-                                       0x00, 0xBA, 0xAC, 0x0C, 0x00, 0x00, 0x07, 0xD0,
-                                       0x00, 0x01, 0x38, 0x81, 0x40};
+fshare_timing timing_low;
+fshare_timing timing_high;
 
 int debug;                                  /* Set to 1 to debug this .c */
-int model;
 int resolution;
 int audio;
 int port;
 int sps_timing_info;
-
-#ifdef USE_SEMAPHORE
-sem_t *sem_fshare_read_lock = SEM_FAILED;
-sem_t *sem_fshare_write_lock = SEM_FAILED;
-#endif
-
-cb_input_buffer input_buffer;
+int queue_size;
+int queue_bytes;
+int queue_ms;
+int thin_bytes;
+int pace;
+int payload_size;
+int multicast;
+int multicast_port;
+int multicast_ttl;
+int adaptive;
+
+fshare_ring input_ring;
 output_queue output_queue_high;
 output_queue output_queue_low;
 output_queue output_queue_audio;
 output_queue *p_output_queue;
+int wakeup_pipe[2];
+long long start_time;
+
+// Everything needed to add a video stream when its codec is detected
+typedef struct
+{
+    LazyRTSPServer *server;
+    StreamReplicator *replicator;
+    char const *description;
+    Boolean useTimeForPres;
+    int convertTo;
+    int back_channel;
+    Boolean enable_speaker;
+    char const *outputAudioFileName;
+    int high_ready;
+    int low_ready;
+    int adaptive_ready;
+    EventTriggerId trigger;
+} stream_setup;
+stream_setup setup;
+
+multicast_group mcast_group;
+multicast_stream mcast_high;
+multicast_stream mcast_low;
+multicast_stream mcast_audio;
 
 UsageEnvironment* env;
 
@@ -244,492 +124,412 @@ long long current_timestamp() {
     return milliseconds;
 }
 
-/* Locate a string in the circular buffer */
-unsigned char *cb_memmem(unsigned char *src, int src_len, unsigned char *what, int what_len)
+// Called by the capture thread after each push
+void output_queue_notify(void *clientData)
 {
-    unsigned char *p;
+    output_queue *q = (output_queue *) clientData;
 
-    if (src_len >= 0) {
-        p = (unsigned char*) std::search(src, src+src_len, what, what+what_len);
-    } else {
-        // From src to the end of the buffer
-        p = (unsigned char*) std::search(src, input_buffer.buffer + input_buffer.size, what, what + what_len);
-        if (p == NULL) {
-            // And from the start of the buffer size src_len
-            p = (unsigned char*) std::search(input_buffer.buffer + input_buffer.offset, src + src_len, what, what + what_len);
-        }
-    }
-    return p;
+    q->scheduler->triggerEvent(q->trigger, q);
+    // Wake up select(), otherwise the trigger waits for the scheduler tick
+    if (write(wakeup_pipe[1], "", 1) < 0) {}
 }
 
-unsigned char *cb_move(unsigned char *buf, int offset)
+/*
+ * Pace the packets of a frame over a part of the frame interval measured
+ * on the stream. The paced groupsocks read it before each packet, a new
+ * window starts with the next frame.
+ */
+static void output_queue_pace(output_queue *q, fshare_timing *t, const char *name)
 {
-    buf += offset;
-    if ((offset > 0) && (buf > input_buffer.buffer + input_buffer.size))
-        buf -= (input_buffer.size - input_buffer.offset);
-    if ((offset < 0) && (buf < input_buffer.buffer + input_buffer.offset))
-        buf += (input_buffer.size - input_buffer.offset);
+    unsigned int pace_us;
 
-    return buf;
+    if ((pace == 0) || (t->fps == 0)) return;
+    pace_us = 1000000 / t->fps * pace / 100;
+    if (pace_us == q->pace_us) return;
+    if (debug & 1) fprintf(stderr, "%lld: h26x in - %s res - %u fps - pace window %u us\n", current_timestamp(), name, t->fps, pace_us);
+    __atomic_store_n(&q->pace_us, pace_us, __ATOMIC_RELAXED);
 }
 
-// The second argument is the circular buffer
-int cb_memcmp(unsigned char *str1, unsigned char *str2, size_t n)
+// Empty the wakeup pipe, the triggers are handled in the same loop step
+void wakeup_pipe_handler(void *clientData, int mask)
 {
-    int ret;
+    char buf[64];
 
-    if (str2 + n > input_buffer.buffer + input_buffer.size) {
-        ret = std::memcmp(str1, str2, input_buffer.buffer + input_buffer.size - str2);
-        if (ret != 0) return ret;
-        ret = std::memcmp(str1 + (input_buffer.buffer + input_buffer.size - str2), input_buffer.buffer + input_buffer.offset, n - (input_buffer.buffer + input_buffer.size - str2));
-    } else {
-        ret = std::memcmp(str1, str2, n);
-    }
+    while (read(wakeup_pipe[0], buf, sizeof(buf)) > 0);
+}
 
-    return ret;
+// Event trigger handler, resume the readers waiting for a frame
+void output_queue_trigger(void *clientData)
+{
+    output_queue *q = (output_queue *) clientData;
+    frame_cursor *c;
+
+    // The cursors are added and removed only in the event loop, but a
+    // reader could close another one: restart from the first each time
+    do {
+        for (c = q->ring.cursors; c != NULL; c = c->next) {
+            if ((c->waiting) && (frame_cursor_size(c) > 0)) break;
+        }
+        if (c != NULL) {
+            c->waiting = 0;
+            c->reader_task(c->reader);
+        }
+    } while (c != NULL);
 }
 
-// The second argument is the circular buffer
-void cb2s_memcpy(unsigned char *dest, unsigned char *src, size_t n)
+// Flags used by the queue drop policy
+static unsigned int frame_flags(output_frame *of, int type, int codec)
 {
-    if (src + n > input_buffer.buffer + input_buffer.size) {
-        std::memcpy(dest, src, input_buffer.buffer + input_buffer.size - src);
-        std::memcpy(dest + (input_buffer.buffer + input_buffer.size - src), input_buffer.buffer + input_buffer.offset, n - (input_buffer.buffer + input_buffer.size - src));
+    unsigned char *nal;
+    unsigned int nal_type;
+
+    if (type & (FSHARE_TYPE_VPS | FSHARE_TYPE_SPS | FSHARE_TYPE_PPS | FSHARE_TYPE_IDR)) return FRAME_FLAG_KEY;
+    if ((type & FSHARE_TYPE_AAC) || (of->slab->len < 5)) return 0;
+
+    // Skip the start code
+    nal = of->slab->data;
+    if ((nal[0] == 0) && (nal[1] == 0) && (nal[2] == 0) && (nal[3] == 1)) {
+        nal += 4;
+    } else if ((nal[0] == 0) && (nal[1] == 0) && (nal[2] == 1)) {
+        nal += 3;
     } else {
-        std::memcpy(dest, src, n);
+        return 0;
+    }
+    if (codec == CODEC_H264) {
+        // Non-IDR slice with nal_ref_idc == 0
+        if (((nal[0] & 0x1f) == 1) && ((nal[0] & 0x60) == 0)) return FRAME_FLAG_NONREF;
+    } else if (codec == CODEC_H265) {
+        // Sub-layer non-reference pictures: TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N
+        nal_type = (nal[0] >> 1) & 0x3f;
+        if ((nal_type <= 9) && ((nal_type & 1) == 0)) return FRAME_FLAG_NONREF;
     }
+
+    return 0;
 }
 
-// The second argument is the circular buffer
-void cb2s_headercpy(unsigned char *dest, unsigned char *src, size_t n)
-{
-    struct frame_header *fh = (struct frame_header *) dest;
-    struct frame_header_22 fh22;
-    struct frame_header_24 fh24;
-    struct frame_header_26 fh26;
-    struct frame_header_28 fh28;
-    unsigned char *fp = NULL;
-
-    if (n == sizeof(fh22)) {
-        fp = (unsigned char *) &fh22;
-    } else if (n == sizeof(fh24)) {
-        fp = (unsigned char *) &fh24;
-    } else if (n == sizeof(fh26)) {
-        fp = (unsigned char *) &fh26;
-    } else if (n == sizeof(fh28)) {
-        fp = (unsigned char *) &fh28;
-    }
-    if (fp == NULL) return;
+static void announceStream(RTSPServer* rtspServer, ServerMediaSession* sms, char const* streamName, int audio);
 
-    if (src + n > input_buffer.buffer + input_buffer.size) {
-        std::memcpy(fp, src, input_buffer.buffer + input_buffer.size - src);
-        std::memcpy(fp + (input_buffer.buffer + input_buffer.size - src), input_buffer.buffer + input_buffer.offset, n - (input_buffer.buffer + input_buffer.size - src));
-    } else {
-        std::memcpy(fp, src, n);
-    }
-    if (n == sizeof(fh22)) {
-        fh->len = fh22.len;
-        fh->counter = fh22.counter;
-        fh->time = fh22.time;
-        fh->type = fh22.type;
-        fh->stream_counter = fh22.stream_counter;
-    } else if (n == sizeof(fh24)) {
-        fh->len = fh24.len;
-        fh->counter = fh24.counter;
-        fh->time = fh24.time;
-        fh->type = fh24.type;
-        fh->stream_counter = fh24.stream_counter;
-    } else if (n == sizeof(fh26)) {
-        fh->len = fh26.len;
-        fh->counter = fh26.counter;
-        fh->time = fh26.time;
-        fh->type = fh26.type;
-        fh->stream_counter = fh26.stream_counter;
-    } else if (n == sizeof(fh28)) {
-        fh->len = fh28.len;
-        fh->counter = fh28.counter;
-        fh->time = fh28.time;
-        fh->type = fh28.type;
-        fh->stream_counter = fh28.stream_counter;
+static void addBackChannel(ServerMediaSession* sms)
+{
+    if (setup.back_channel == 1) {
+        sms->addSubsession(PCMAudioFileServerMediaSubsession_BC
+                ::createNew(*env, setup.outputAudioFileName, reuseFirstSource, 16000, 1, ALAW, setup.enable_speaker));
+    } else if (setup.back_channel == 2) {
+        sms->addSubsession(PCMAudioFileServerMediaSubsession_BC
+                ::createNew(*env, setup.outputAudioFileName, reuseFirstSource, 16000, 1, ULAW, setup.enable_speaker));
+    } else if (setup.back_channel == 4) {
+        sms->addSubsession(ADTSAudioFileServerMediaSubsession_BC
+                ::createNew(*env, setup.outputAudioFileName, reuseFirstSource, 16000, 1, setup.enable_speaker));
     }
 }
 
-#ifdef USE_SEMAPHORE
-int sem_fshare_open()
+// A H.264/5 video elementary stream, with audio and back channel.
+// With qLow the stream switches from q to qLow when a client is congested
+static void addVideoStream(char const* streamName, output_queue *q, int codec, Boolean backChannel,
+        output_queue *qLow)
 {
-    sem_fshare_read_lock = sem_open(READ_LOCK_FILE, O_RDWR);
-    if (sem_fshare_read_lock == SEM_FAILED) {
-        fprintf(stderr, "error opening %s\n", READ_LOCK_FILE);
-        return -1;
+    ServerMediaSession* sms
+        = ServerMediaSession::createNew(*env, streamName, streamName,
+                                          setup.description);
+    // Every client reads the ring with its own source and cursor
+    if (codec == CODEC_H264) {
+        sms->addSubsession(H264VideoFramedMemoryServerMediaSubsession
+                               ::createNew(*env, q, setup.useTimeForPres, False, qLow));
+    } else if (codec == CODEC_H265) {
+        sms->addSubsession(H265VideoFramedMemoryServerMediaSubsession
+                               ::createNew(*env, q, setup.useTimeForPres, False, qLow));
     }
-    sem_fshare_write_lock = sem_open(WRITE_LOCK_FILE, O_RDWR);
-    if (sem_fshare_write_lock == SEM_FAILED) {
-        fprintf(stderr, "error opening %s\n", WRITE_LOCK_FILE);
-        return -2;
+    if (audio == 1) {
+        sms->addSubsession(WAVAudioFifoServerMediaSubsession
+                                   ::createNew(*env, setup.replicator, reuseFirstSource, 8000, 1, 16, setup.convertTo));
+    } else if (audio == 2) {
+        sms->addSubsession(ADTSAudioFramedMemoryServerMediaSubsession
+                                   ::createNew(*env, &output_queue_audio, False, 16000, 1, setup.useTimeForPres));
     }
-    return 0;
-}
+    if (backChannel) addBackChannel(sms);
+    setup.server->addReadyServerMediaSession(sms);
 
-void sem_fshare_close()
+    announceStream(setup.server, sms, streamName, audio);
+    fprintf(stderr, "%lld: \"%s\" stream ready, %lld ms after start\n",
+            current_timestamp(), streamName, current_timestamp() - start_time);
+}
 
+// The same video stream sent once to a multicast group, for any number of clients
+static void addMulticastStream(char const* streamName, output_queue *q, int codec, multicast_stream *ms, int port)
 {
-    if (sem_fshare_write_lock != SEM_FAILED) {
-        sem_close(sem_fshare_write_lock);
-        sem_fshare_write_lock = SEM_FAILED;
+    if (multicast_stream_video(*env, ms, &mcast_group, port, q, codec, setup.useTimeForPres) != 0) {
+        fprintf(stderr, "Failed to create multicast stream \"%s\"\n", streamName);
+        setup.server->removePendingStream(streamName);
+        return;
     }
-    if (sem_fshare_read_lock != SEM_FAILED) {
-        sem_close(sem_fshare_read_lock);
-        sem_fshare_read_lock = SEM_FAILED;
+
+    ServerMediaSession* sms
+        = ServerMediaSession::createNew(*env, streamName, streamName,
+                                          setup.description, mcast_group.ssm);
+    sms->addSubsession(multicast_stream_subsession(ms));
+    if (mcast_audio.sink != NULL) {
+        sms->addSubsession(multicast_stream_subsession(&mcast_audio));
     }
-    return;
+    setup.server->addReadyServerMediaSession(sms);
+
+    announceStream(setup.server, sms, streamName, (mcast_audio.sink != NULL) ? audio : 0);
+    fprintf(stderr, "%lld: \"%s\" multicast stream ready on port %d, %lld ms after start\n",
+            current_timestamp(), streamName, port, current_timestamp() - start_time);
 }
 
-void sem_write_lock()
+// Event trigger handler, add the video streams whose codec has been detected
+static void stream_ready_trigger(void *clientData)
 {
-    int wl, ret = 0;
-    int *fshare_frame_buf_start = (int *) input_buffer.buffer;
-
-    while (ret == 0) {
-        sem_wait(sem_fshare_read_lock);
-        wl = *fshare_frame_buf_start;
-        if (wl == 0) {
-            ret = 1;
+    if (setup.server == NULL) return;
+
+    if ((!setup.high_ready) && ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH)) &&
+            (stream_type.codec_high != CODEC_NONE)) {
+        addVideoStream("ch0_0.h264", &output_queue_high, stream_type.codec_high, True, NULL);
+        if ((multicast == RESOLUTION_HIGH) || (multicast == RESOLUTION_BOTH)) {
+            addMulticastStream("ch0_0m.h264", &output_queue_high, stream_type.codec_high, &mcast_high, multicast_port);
+        }
+        setup.high_ready = 1;
+    }
+    if ((!setup.low_ready) && ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH)) &&
+            (stream_type.codec_low != CODEC_NONE)) {
+        addVideoStream("ch0_1.h264", &output_queue_low, stream_type.codec_low, (resolution == RESOLUTION_LOW), NULL);
+        if ((multicast == RESOLUTION_LOW) || (multicast == RESOLUTION_BOTH)) {
+            addMulticastStream("ch0_1m.h264", &output_queue_low, stream_type.codec_low, &mcast_low, multicast_port + 2);
+        }
+        setup.low_ready = 1;
+    }
+    if ((!setup.adaptive_ready) && (adaptive) && (setup.high_ready) && (setup.low_ready)) {
+        // A single session, the decoder can't change codec
+        if (stream_type.codec_high == stream_type.codec_low) {
+            addVideoStream("ch0_3.h264", &output_queue_high, stream_type.codec_high, False, &output_queue_low);
         } else {
-            sem_post(sem_fshare_read_lock);
-            usleep(1000);
+            fprintf(stderr, "The high and low streams use different codecs, adaptive stream disabled\n");
         }
+        setup.adaptive_ready = 1;
     }
-    return;
 }
 
-void sem_write_unlock()
+// Called by the capture thread when a codec is detected
+static void stream_ready_notify()
 {
-    sem_post(sem_fshare_read_lock);
-    return;
+    env->taskScheduler().triggerEvent(setup.trigger, NULL);
+    if (write(wakeup_pipe[1], "", 1) < 0) {}
 }
-#endif
 
 void *capture(void *ptr)
 {
-    unsigned char *buf_idx, *buf_idx_cur, *buf_idx_end, *buf_idx_end_prev;
-    unsigned char *buf_idx_start = NULL;
-    unsigned char *header_a1, *header_a2;
-    int fshm;
+    unsigned char *buf_idx_start, *buf_idx_end, *buf_idx_end_prev;
+    unsigned char *sps;
+    unsigned int sps_len;
 
     int frame_type = TYPE_NONE;
     int frame_len = 0;
     int frame_counter = -1;
     uint32_t frame_time;
-    int frame_counter_last_valid_low = -1;
-    int frame_counter_last_valid_high = -1;
-    int frame_counter_last_valid_audio = -1;
 
-    int i, n;
+    int i, n, ret;
     int write_enable = 0;
-    int frame_sync = 0;
 
-    struct frame_header fhs[10];
-    unsigned char* fhs_addr[10];
+    fshare_scan scan;
+    fshare_resync resync_low, resync_high, resync_audio;
+    fshare_wait wait;
+    fshare_frame *fhs;
+    fshare_span span;
     uint32_t last_counter;
+    struct stream_type_s detected;
 
 #ifdef USE_SEMAPHORE
-    if (sem_fshare_open() != 0) {
+    if (fshare_sem_open() != 0) {
         fprintf(stderr, "error - could not open semaphores\n") ;
         exit(EXIT_FAILURE);
     }
-#endif
-
-    // Opening an existing file
-    fshm = shm_open(input_buffer.filename, O_RDWR, 0);
-    if (fshm == -1) {
-        fprintf(stderr, "error - could not open file %s\n", input_buffer.filename) ;
-        exit(EXIT_FAILURE);
-    }
-
-    // Map file to memory
-    input_buffer.buffer = (unsigned char*) mmap(NULL, input_buffer.size, PROT_READ | PROT_WRITE, MAP_SHARED, fshm, 0);
-    if (input_buffer.buffer == MAP_FAILED) {
-        fprintf(stderr, "%lld: capture - error - mapping file %s\n", current_timestamp(), input_buffer.filename);
-        close(fshm);
-        exit(EXIT_FAILURE);
-    }
-    if (debug & 3) fprintf(stderr, "%lld: capture - mapping file %s, size %d, to %08x\n", current_timestamp(), input_buffer.filename, input_buffer.size, (unsigned int) input_buffer.buffer);
 
-    // Closing the file
-    if (debug & 3) fprintf(stderr, "%lld: capture - closing the file %s\n", current_timestamp(), input_buffer.filename);
-    close(fshm) ;
-
-#ifdef USE_SEMAPHORE
-    sem_write_lock();
+    fshare_sem_write_lock(&input_ring);
 #endif
 
     // Autodetect offset if not defined
-    if (input_buffer.offset == FRAME_OFFSET_AUTODETECT) {
-        std::memcpy(&i, input_buffer.buffer + FRAME_OFFSET_TRY_1, sizeof(i));
-        if (i != 0)
-            input_buffer.offset = FRAME_OFFSET_TRY_1;
-        else
-            input_buffer.offset = FRAME_OFFSET_TRY_2;
-    }
+    fshare_detect_offset(&input_ring);
 
-    std::memcpy(&i, input_buffer.buffer + 16, sizeof(i));
-    buf_idx = input_buffer.buffer + input_buffer.offset + i;
-    buf_idx_cur = buf_idx;
-    std::memcpy(&i, input_buffer.buffer + 4, sizeof(i));
-    buf_idx_end = buf_idx + i;
-    if (buf_idx_end >= input_buffer.buffer + input_buffer.size) buf_idx_end -= (input_buffer.size - input_buffer.offset);
+    while (fshare_read_index(&input_ring, NULL, &buf_idx_end) != 0) {
+        usleep(1000);
+    }
     buf_idx_end_prev = buf_idx_end;
 #ifdef USE_SEMAPHORE
-    sem_write_unlock();
+    fshare_sem_write_unlock();
 #endif
     last_counter = 0;
 
     // Autodetect header size if not defined
-    if ((frame_header_size == FRAME_HEADER_SIZE_AUTODETECT) && (debug & 3)) fprintf(stderr, "%lld: capture - detecting frame header size\n", current_timestamp());
-    while (frame_header_size == FRAME_HEADER_SIZE_AUTODETECT) {
-        header_a2 = (unsigned char *) std::search(input_buffer.buffer + input_buffer.offset, input_buffer.buffer + input_buffer.size, PPS4_START, PPS4_START + sizeof(PPS4_START));
-        if ((header_a2 != NULL) && (header_a2 - 40 > input_buffer.buffer + input_buffer.offset)) {
-            header_a1 = cb_move(header_a2, -40);
-            header_a1 = (unsigned char *) std::search(header_a1, header_a1 + 40, PPS4_HEADER, PPS4_HEADER + sizeof(PPS4_HEADER));
-            if (header_a1 != NULL) {
-                frame_header_size = header_a2 - header_a1;
-                if (frame_header_size < 0)
-                        frame_header_size += (input_buffer.size - input_buffer.offset);
-                if ((frame_header_size < 0) && (frame_header_size > 40))
-                    frame_header_size = FRAME_HEADER_SIZE_AUTODETECT;
-            }
-        }
+    if ((input_ring.header_size == FRAME_HEADER_SIZE_AUTODETECT) && (debug & 3)) fprintf(stderr, "%lld: capture - detecting frame header size\n", current_timestamp());
+    while (fshare_detect_header_size(&input_ring) == FRAME_HEADER_SIZE_AUTODETECT) {
         usleep(1000);
     }
-    if (debug & 3) fprintf(stderr, "%lld: capture - frame offset = %d\n", current_timestamp(), input_buffer.offset);
-    if (debug & 3) fprintf(stderr, "%lld: capture - frame header size = %d\n", current_timestamp(), frame_header_size);
+    if (debug & 3) fprintf(stderr, "%lld: capture - frame offset = %d\n", current_timestamp(), input_ring.offset);
+    if (debug & 3) fprintf(stderr, "%lld: capture - frame header size = %d\n", current_timestamp(), input_ring.header_size);
+    fshare_layout_save(&input_ring, NULL);
+    detected.codec_low = CODEC_NONE;
+    detected.codec_high = CODEC_NONE;
 
     if (debug & 3) fprintf(stderr, "%lld: capture - starting capture main loop\n", current_timestamp());
 
+    fshare_resync_init(&resync_low, 1);
+    fshare_resync_init(&resync_high, 1);
+    fshare_resync_init(&resync_audio, 0);
+    if (fshare_scan_init(&scan, &input_ring) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Wait for new frames predicting their arrival
+    fshare_wait_init(&wait, &input_ring);
+
     // Infinite loop
     while (1) {
 #ifdef USE_SEMAPHORE
-        sem_write_lock();
+        fshare_sem_write_lock(&input_ring);
+#endif
+        if (fshare_read_index(&input_ring, &buf_idx_start, &buf_idx_end) != 0) {
+#ifdef USE_SEMAPHORE
+            fshare_sem_write_unlock();
 #endif
-        std::memcpy(&i, input_buffer.buffer + 16, sizeof(i));
-        buf_idx = input_buffer.buffer + input_buffer.offset + i;
-        std::memcpy(&i, input_buffer.buffer + 4, sizeof(i));
-        buf_idx_end = buf_idx + i;
-        if (buf_idx_end >= input_buffer.buffer + input_buffer.size) buf_idx_end -= (input_buffer.size - input_buffer.offset);
-        // Check if the header is ok
-        std::memcpy(&i, input_buffer.buffer + 12, sizeof(i));
-        if (buf_idx_end != input_buffer.buffer + input_buffer.offset + i) {
-            if (debug & 3) fprintf(stderr, "%lld: capture - buf_idx_end != input_buffer.buffer + input_buffer.offset + i\n", current_timestamp());
+            if (debug & 3) fprintf(stderr, "%lld: capture - index end check failed\n", current_timestamp());
             usleep(1000);
             continue;
         }
 
         if (buf_idx_end == buf_idx_end_prev) {
 #ifdef USE_SEMAPHORE
-            sem_write_unlock();
+            fshare_sem_write_unlock();
 #endif
             if (debug & 3) fprintf(stderr, "%lld: capture - buf_idx_end == buf_idx_end_prev\n", current_timestamp());
-            usleep(10000);
+            fshare_wait_next(&wait, 0);
             continue;
         }
 
-        buf_idx_cur = buf_idx_end_prev;
-        frame_sync = 1;
-        i = 0;
-
-        while (buf_idx_cur != buf_idx_end) {
-            cb2s_headercpy((unsigned char *) &fhs[i], buf_idx_cur, frame_header_size);
-            // Check the len
-            if (fhs[i].len > input_buffer.size - input_buffer.offset - frame_header_size) {
-                frame_sync = 0;
-                if (debug & 3) fprintf(stderr, "%lld: capture - fhs[i].len > input_buffer.size - input_buffer.offset\n", current_timestamp());
-                break;
-            }
-            fhs_addr[i] = buf_idx_cur;
-            buf_idx_cur = cb_move(buf_idx_cur, fhs[i].len + frame_header_size);
-            i++;
-            // Check if the sync is lost
-            if (i == 10) {
-                frame_sync = 0;
-                if (debug & 3) fprintf(stderr, "%lld: capture - i=10\n", current_timestamp());
-                break;
-            }
-        }
+        // All the frames written since the last time, however many
+        n = fshare_scan_frames(&scan, buf_idx_end_prev, buf_idx_start, buf_idx_end);
+        buf_idx_end_prev = scan.next;
 
 #ifdef USE_SEMAPHORE
-        sem_write_unlock();
+        fshare_sem_write_unlock();
 #endif
 
-        if (frame_sync == 0) {
-            buf_idx_end_prev = buf_idx_end;
-            if (debug & 3) fprintf(stderr, "%lld: capture - frame_sync == 0\n", current_timestamp());
-            usleep(10000);
+        if (n < 0) {
+            fprintf(stderr, "%lld: capture - warning - sync lost\n", current_timestamp());
+            fshare_resync_lost(&resync_low);
+            fshare_resync_lost(&resync_high);
+            fshare_resync_lost(&resync_audio);
+            fshare_wait_next(&wait, 0);
             continue;
         }
-
-        n = i;
-        // Ignore last frame, it could be corrupted
-        if (n > 1) {
-            buf_idx_end_prev = fhs_addr[n - 1];
-            n--;
-        } else {
-            if (debug & 3) fprintf(stderr, "%lld: capture - ! n > 1\n", current_timestamp());
-            usleep(10000);
+        if (n == 0) {
+            if (debug & 3) fprintf(stderr, "%lld: capture - last frame incomplete\n", current_timestamp());
+            fshare_wait_next(&wait, 0);
             continue;
         }
+        fhs = scan.frames;
 
-        if (n > 0) {
-            if (fhs[0].counter != last_counter + 1) {
-                fprintf(stderr, "%lld: capture - warning - %d frame(s) lost\n",
-                            current_timestamp(), fhs[0].counter - (last_counter + 1));
-            }
-            last_counter = fhs[n - 1].counter;
+        if (fhs[0].counter != last_counter + 1) {
+            fprintf(stderr, "%lld: capture - warning - %d frame(s) lost\n",
+                        current_timestamp(), fhs[0].counter - (last_counter + 1));
         }
+        last_counter = fhs[n - 1].counter;
 
         for (i = 0; i < n; i++) {
-            buf_idx_cur = fhs_addr[i];
-            frame_len = fhs[i].len;
-            // If SPS
-            if (fhs[i].type & 0x0002) {
-                buf_idx_cur = cb_move(buf_idx_cur, frame_header_size + 6);
-                frame_len -= 6;
+            // If SPS skip the FPS, width and height prefix
+            if (fhs[i].type & FSHARE_TYPE_SPS) {
+                fshare_frame_span(&input_ring, &fhs[i], FSHARE_SPS_PREFIX_SIZE, &span);
 
                 // Autodetect stream type (only the 1st time)
-                if ((stream_type.codec_low  == CODEC_NONE) && (fhs[i].type & 0x0800)) {
-                    if (cb_memcmp(SPS4_640X360, buf_idx_cur, sizeof(SPS4_640X360)) == 0) {
-                        stream_type.codec_low = CODEC_H264;
-                        stream_type.sps_type_low = 0x0101;
-                    } else if (cb_memcmp(SPS4_2_640X360, buf_idx_cur, sizeof(SPS4_2_640X360)) == 0) {
-                        stream_type.codec_low = CODEC_H264;
-                        stream_type.sps_type_low = 0x0201;
-                    } else if (cb_memcmp(SPS4_3_640X360, buf_idx_cur, sizeof(SPS4_3_640X360)) == 0) {
-                        stream_type.codec_low = CODEC_H264;
-                        stream_type.sps_type_low = 0x0401;
-                    } else if (cb_memcmp(SPS4_START, buf_idx_cur, sizeof(SPS4_START)) == 0) {
-                        stream_type.codec_low = CODEC_H264;
-                        stream_type.sps_type_low = 0x0000;
-                    } else if (cb_memcmp(SPS5_START, buf_idx_cur, sizeof(SPS5_START)) == 0) {
-                        stream_type.codec_low = CODEC_H265;
-                        stream_type.sps_type_low = 0x0000;
+                ret = fshare_stream_detect(&input_ring, &fhs[i], &detected);
+                if ((debug & 1) && (ret == FSHARE_TYPE_LOW)) fprintf(stderr, "%lld: h264 in - low - codec type is %d\n",
+                        current_timestamp(), detected.codec_low);
+                if ((debug & 1) && (ret == FSHARE_TYPE_HIGH)) fprintf(stderr, "%lld: h264 in - high - codec type is %d\n",
+                        current_timestamp(), detected.codec_high);
+                if (ret != 0) {
+                    // The codecs could come from the layout file, the sessions are already set up
+                    if (((stream_type.codec_low != CODEC_NONE) && (detected.codec_low != CODEC_NONE) && (stream_type.codec_low != detected.codec_low)) ||
+                            ((stream_type.codec_high != CODEC_NONE) && (detected.codec_high != CODEC_NONE) && (stream_type.codec_high != detected.codec_high))) {
+                        fprintf(stderr, "%lld: capture - codec changed, removing %s and exiting\n", current_timestamp(), FSHARE_LAYOUT_FILE);
+                        fshare_layout_remove();
+                        exit(EXIT_FAILURE);
                     }
-                    if ((debug & 1) && (stream_type.codec_low != CODEC_NONE)) fprintf(stderr, "%lld: h264 in - low - codec type is %d - sps type is %d\n",
-                            current_timestamp(), stream_type.codec_low, stream_type.sps_type_low);
-                } else if ((stream_type.codec_high  == CODEC_NONE) && (fhs[i].type & 0x0400)) {
-                    if (cb_memcmp(SPS4_1920X1080, buf_idx_cur, sizeof(SPS4_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0102;
-                    } else if (cb_memcmp(SPS4_2304X1296, buf_idx_cur, sizeof(SPS4_2304X1296)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0103;
-                    } else if (cb_memcmp(SPS4_2_1920X1080, buf_idx_cur, sizeof(SPS4_2_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0202;
-                    } else if (cb_memcmp(SPS4_2_2304X1296, buf_idx_cur, sizeof(SPS4_2_2304X1296)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0203;
-                    } else if (cb_memcmp(SPS4_3_1920X1080, buf_idx_cur, sizeof(SPS4_3_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0402;
-                    } else if (cb_memcmp(SPS4_3_2304X1296, buf_idx_cur, sizeof(SPS4_3_2304X1296)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0403;
-                    } else if (cb_memcmp(SPS5_1920X1080, buf_idx_cur, sizeof(SPS5_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H265;
-                        stream_type.sps_type_high = 0x0802;
-                    } else if (cb_memcmp(SPS5_2_1920X1080, buf_idx_cur, sizeof(SPS5_2_1920X1080)) == 0) {
-                        stream_type.codec_high = CODEC_H265;
-                        stream_type.sps_type_high = 0x1002;
-                    } else if (cb_memcmp(SPS5_3_2304X1296, buf_idx_cur, sizeof(SPS5_3_2304X1296)) == 0) {
-                        stream_type.codec_high = CODEC_H265;
-                        stream_type.sps_type_high = 0x2003;
-                    } else if (cb_memcmp(SPS4_START, buf_idx_cur, sizeof(SPS4_START)) == 0) {
-                        stream_type.codec_high = CODEC_H264;
-                        stream_type.sps_type_high = 0x0000;
-                    } else if (cb_memcmp(SPS5_START, buf_idx_cur, sizeof(SPS5_START)) == 0) {
-                        stream_type.codec_high = CODEC_H265;
-                        stream_type.sps_type_high = 0x0000;
-                    }
-                    if ((debug & 1) && (stream_type.codec_high != CODEC_NONE)) fprintf(stderr, "%lld: h264 in - high - codec type is %d - sps type is %d\n",
-                            current_timestamp(), stream_type.codec_high, stream_type.sps_type_high);
+                    if (detected.codec_low != CODEC_NONE) stream_type.codec_low = detected.codec_low;
+                    if (detected.codec_high != CODEC_NONE) stream_type.codec_high = detected.codec_high;
+                    fshare_layout_save(&input_ring, &stream_type);
+                    stream_ready_notify();
                 }
             } else {
-                buf_idx_cur = cb_move(buf_idx_cur, frame_header_size);
+                fshare_frame_span(&input_ring, &fhs[i], 0, &span);
             }
+            frame_len = span.len[0] + span.len[1];
 
             write_enable = 1;
             frame_counter = fhs[i].stream_counter;
             frame_time = fhs[i].time;
 
-            // (fhs[i].type & 0x0002) -> SPS
-            // (fhs[i].type & 0x0008) -> VPS
-            // (fhs[i].type & 0x0800) -> low res frame
-            // (fhs[i].type & 0x0400) -> high res frame
-            // (fhs[i].type & 0x0100) -> aac frame
-            if (fhs[i].type & 0x0800) {
+            if (fhs[i].type & FSHARE_TYPE_LOW) {
                 frame_type = TYPE_LOW;
-            } else if (fhs[i].type & 0x0400) {
+            } else if (fhs[i].type & FSHARE_TYPE_HIGH) {
                 frame_type = TYPE_HIGH;
-            } else if (fhs[i].type & 0x0100) {
+            } else if (fhs[i].type & FSHARE_TYPE_AAC) {
                 frame_type = TYPE_AAC;
             } else {
                 frame_type = TYPE_NONE;
             }
+            // Measure the frame rate of the video streams, for the SPS and the pacing
+            if ((sps_timing_info) || (pace > 0)) {
+                if (frame_type == TYPE_LOW) {
+                    fshare_timing_update(&timing_low, &fhs[i]);
+                    output_queue_pace(&output_queue_low, &timing_low, "low");
+                } else if (frame_type == TYPE_HIGH) {
+                    fshare_timing_update(&timing_high, &fhs[i]);
+                    output_queue_pace(&output_queue_high, &timing_high, "high");
+                }
+            }
             if ((frame_type == TYPE_LOW) && ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH))) {
-                if ((65536 + frame_counter - frame_counter_last_valid_low) % 65536 > 1) {
-
-                    if (debug & 1) fprintf(stderr, "%lld: h26x in - warning - %d low res frame(s) lost - frame_counter: %d - frame_counter_last_valid: %d\n",
-                                current_timestamp(), (65536 + frame_counter - frame_counter_last_valid_low - 1) % 65536, frame_counter, frame_counter_last_valid_low);
-                    frame_counter_last_valid_low = frame_counter;
-                } else {
-                    if (debug & 1) {
-                        if (fhs[i].type & 0x0002) {
-                            fprintf(stderr, "%lld: h26x in - SPS detected - frame_len: %d - frame_counter: %d - frame_counter_last_valid: %d - resolution: %d\n",
-                                    current_timestamp(), frame_len, frame_counter,
-                                    frame_counter_last_valid_low, frame_type);
-                        } else {
-                            fprintf(stderr, "%lld: h26x in - frame detected - frame_len: %d - frame_counter: %d - frame_counter_last_valid: %d - resolution: %d\n",
-                                    current_timestamp(), frame_len, frame_counter,
-                                    frame_counter_last_valid_low, frame_type);
-                        }
+                write_enable = fshare_resync_check(&resync_low, &fhs[i]);
+                if ((debug & 1) && (resync_low.gap > 0)) {
+                    fprintf(stderr, "%lld: h26x in - warning - %d low res frame(s) lost - frame_counter: %d\n",
+                            current_timestamp(), resync_low.gap, frame_counter);
+                }
+                if (!write_enable) {
+                    if (debug & 1) fprintf(stderr, "%lld: h26x in - low res frame dropped, waiting for IDR - frame_len: %d - frame_counter: %d\n",
+                            current_timestamp(), frame_len, frame_counter);
+                } else if (debug & 1) {
+                    if (fhs[i].type & FSHARE_TYPE_SPS) {
+                        fprintf(stderr, "%lld: h26x in - SPS detected - frame_len: %d - frame_counter: %d - resolution: %d\n",
+                                current_timestamp(), frame_len, frame_counter, frame_type);
+                    } else {
+                        fprintf(stderr, "%lld: h26x in - frame detected - frame_len: %d - frame_counter: %d - resolution: %d\n",
+                                current_timestamp(), frame_len, frame_counter, frame_type);
                     }
-                    frame_counter_last_valid_low = frame_counter;
                 }
-
-                buf_idx_start = buf_idx_cur;
             } else if ((frame_type == TYPE_HIGH) && ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH))) {
-                if ((65536 + frame_counter - frame_counter_last_valid_high) % 65536 > 1) {
-
-                    if (debug & 1) fprintf(stderr, "%lld: h26x in - warning - %d high res frame(s) lost - frame_counter: %d - frame_counter_last_valid: %d\n",
-                                current_timestamp(), (65536 + frame_counter - frame_counter_last_valid_high - 1) % 65536, frame_counter, frame_counter_last_valid_high);
-                    frame_counter_last_valid_high = frame_counter;
-                } else {
-                    if (debug & 1) {
-                        if (fhs[i].type & 0x0002) {
-                            fprintf(stderr, "%lld: h26x in - SPS detected - frame_len: %d - frame_counter: %d - frame_counter_last_valid: %d - resolution: %d\n",
-                                    current_timestamp(), frame_len, frame_counter,
-                                    frame_counter_last_valid_high, frame_type);
-                        } else {
-                            fprintf(stderr, "%lld: h26x in - frame detected - frame_len: %d - frame_counter: %d - frame_counter_last_valid: %d - resolution: %d\n",
-                                    current_timestamp(), frame_len, frame_counter,
-                                    frame_counter_last_valid_high, frame_type);
-                        }
+                write_enable = fshare_resync_check(&resync_high, &fhs[i]);
+                if ((debug & 1) && (resync_high.gap > 0)) {
+                    fprintf(stderr, "%lld: h26x in - warning - %d high res frame(s) lost - frame_counter: %d\n",
+                            current_timestamp(), resync_high.gap, frame_counter);
+                }
+                if (!write_enable) {
+                    if (debug & 1) fprintf(stderr, "%lld: h26x in - high res frame dropped, waiting for IDR - frame_len: %d - frame_counter: %d\n",
+                            current_timestamp(), frame_len, frame_counter);
+                } else if (debug & 1) {
+                    if (fhs[i].type & FSHARE_TYPE_SPS) {
+                        fprintf(stderr, "%lld: h26x in - SPS detected - frame_len: %d - frame_counter: %d - resolution: %d\n",
+                                current_timestamp(), frame_len, frame_counter, frame_type);
+                    } else {
+                        fprintf(stderr, "%lld: h26x in - frame detected - frame_len: %d - frame_counter: %d - resolution: %d\n",
+                                current_timestamp(), frame_len, frame_counter, frame_type);
                     }
-                    frame_counter_last_valid_high = frame_counter;
                 }
-
-                buf_idx_start = buf_idx_cur;
             } else if ((frame_type == TYPE_AAC) && (audio == 2)) {
-                if ((65536 + frame_counter - frame_counter_last_valid_audio) % 65536 > 1) {
-                    if (debug & 2) fprintf(stderr, "%lld: aac in - warning - %d AAC frame(s) lost - frame_counter: %d - frame_counter_last_valid: %d\n",
-                                current_timestamp(), (65536 + frame_counter - frame_counter_last_valid_audio - 1) % 65536, frame_counter, frame_counter_last_valid_audio);
-                    frame_counter_last_valid_audio = frame_counter;
-                } else {
-                    if (debug & 2) fprintf(stderr, "%lld: aac in - frame detected - frame_len: %d - frame_counter: %d - audio AAC\n",
-                                current_timestamp(), frame_len, fhs[i].stream_counter);
-
-                    frame_counter_last_valid_audio = frame_counter;
+                write_enable = fshare_resync_check(&resync_audio, &fhs[i]);
+                if ((debug & 2) && (resync_audio.gap > 0)) {
+                    fprintf(stderr, "%lld: aac in - warning - %d AAC frame(s) lost - frame_counter: %d\n",
+                            current_timestamp(), resync_audio.gap, frame_counter);
                 }
-                buf_idx_start = buf_idx_cur;
+                if (debug & 2) fprintf(stderr, "%lld: aac in - frame detected - frame_len: %d - frame_counter: %d - audio AAC\n",
+                            current_timestamp(), frame_len, frame_counter);
             } else {
                 write_enable = 0;
             }
@@ -747,148 +547,94 @@ void *capture(void *ptr)
                 }
 
                 if (p_output_queue != NULL) {
-                    if (debug & 3) fprintf(stderr, "%lld: h264/aac in - frame_len: %d - cb_current->size: %d\n", current_timestamp(), frame_len, p_output_queue->frame_queue.size());
-                    pthread_mutex_lock(&(p_output_queue->mutex));
-                    input_buffer.read_index = buf_idx_start;
-                    unsigned char *tmp_out;
-
-                    if (sps_timing_info) {
-                        // Overwrite SPS or VPS with one that contains timing info at 20 fps
-                        if (fhs[i].type & 0x0002) {
-                            if (frame_type == TYPE_LOW) {
-                                if (stream_type.sps_type_low & 0x0101) {
-                                    frame_len = sizeof(SPS4_640X360_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS4_640X360_TI, frame_len);
-                                } else if (stream_type.sps_type_low & 0x0201) {
-                                    frame_len = sizeof(SPS4_2_640X360_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS4_2_640X360_TI, frame_len);
-                                } else if (stream_type.sps_type_low & 0x0401) {
-                                    frame_len = sizeof(SPS4_3_640X360_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS4_3_640X360_TI, frame_len);
-                                } else {
-                                    // don't change frame_len
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, input_buffer.read_index, frame_len);
-                                }
-                            } else if (frame_type == TYPE_HIGH) {
-                                if (stream_type.sps_type_high == 0x0102) {
-                                    frame_len = sizeof(SPS4_1920X1080_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS4_1920X1080_TI, frame_len);
-                                } else if (stream_type.sps_type_high == 0x0202) {
-                                    frame_len = sizeof(SPS4_2_1920X1080_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS4_2_1920X1080_TI, frame_len);
-                                } else if (stream_type.sps_type_high == 0x0402) {
-                                    frame_len = sizeof(SPS4_3_1920X1080_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS4_3_1920X1080_TI, frame_len);
-                                } else if (stream_type.sps_type_high == 0x0103) {
-                                    frame_len = sizeof(SPS4_2304X1296_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS4_2304X1296_TI, frame_len);
-                                } else if (stream_type.sps_type_high == 0x0203) {
-                                    frame_len = sizeof(SPS4_2_2304X1296_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS4_2_2304X1296_TI, frame_len);
-                                } else if (stream_type.sps_type_high == 0x0403) {
-                                    frame_len = sizeof(SPS4_3_2304X1296_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS4_3_2304X1296_TI, frame_len);
-/*                                } else if (stream_type.sps_type_high & 0x0802) {
-                                    frame_len = sizeof(SPS5_1920X1080_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS5_1920X1080_TI, frame_len);
-                                } else if (stream_type.sps_type_high & 0x1002) {
-                                    frame_len = sizeof(SPS5_2_1920X1080_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS5_2_1920X1080_TI, frame_len);
-                                } else if (stream_type.sps_type_high & 0x2002) {
-                                    frame_len = sizeof(SPS5_3_2304X1296_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, SPS5_3_2304X1296_TI, frame_len); */
-                                } else {
-                                    // don't change frame_len
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, input_buffer.read_index, frame_len);
-                                }
-                            } else {
-                                // don't change frame_len
-                                tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                cb2s_memcpy(tmp_out, input_buffer.read_index, frame_len);
-                            }
-                        } else if (fhs[i].type & 0x0008) {
-                            if (frame_type == TYPE_LOW) {
-                                // don't change frame_len
-                                tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                cb2s_memcpy(tmp_out, input_buffer.read_index, frame_len);
-                            } else if (frame_type == TYPE_HIGH) {
-/*                                if (stream_type.sps_type_high == 0x0802) {
-                                    frame_len = sizeof(VPS5_1920X1080_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, VPS5_1920X1080_TI, frame_len);
-                                } else if (stream_type.sps_type_high == 0x1002) {
-                                    frame_len = sizeof(VPS5_2_1920X1080_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, VPS5_2_1920_1080_TI, frame_len);
-                                } else if (stream_type.sps_type_high == 0x2002) {
-                                    frame_len = sizeof(VPS5_3_2304X1296_TI);
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, VPS5_3_2304X1296_TI, frame_len);
-                                } else { */
-                                    // don't change frame_len
-                                    tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                    cb2s_memcpy(tmp_out, input_buffer.read_index, frame_len);
-/*                                } */
-                            } else {
-                                // don't change frame_len
-                                tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                                cb2s_memcpy(tmp_out, input_buffer.read_index, frame_len);
-                            }
+                    if (debug & 3) fprintf(stderr, "%lld: h264/aac in - frame_len: %d - cb_current->size: %d\n", current_timestamp(), frame_len, frame_ring_size(&(p_output_queue->ring)));
+                    output_frame of;
+
+                    // Overwrite SPS/VPS with one that contains the timing info of the measured frame rate
+                    sps = NULL;
+                    if ((sps_timing_info) && (p_output_queue == &output_queue_low)) {
+                        sps = fshare_timing_nal(&timing_low, stream_type.codec_low, &fhs[i], &span, &sps_len);
+                    } else if ((sps_timing_info) && (p_output_queue == &output_queue_high)) {
+                        sps = fshare_timing_nal(&timing_high, stream_type.codec_high, &fhs[i], &span, &sps_len);
+                    }
+                    if (sps != NULL) frame_len = sps_len;
+
+                    // Copy the frame once, into a slab of the queue pool
+                    of.slab = frame_pool_get(&(p_output_queue->pool), frame_len);
+                    if (of.slab == NULL) {
+                        // The frames that follow could reference this one: wait for the next IDR
+                        fprintf(stderr, "%lld: capture - warning - no memory for a frame of %d bytes, dropped - frame_counter: %d\n",
+                                current_timestamp(), frame_len, frame_counter);
+                        if (p_output_queue == &output_queue_low) {
+                            fshare_resync_lost(&resync_low);
+                            gop_cache_invalidate(&(output_queue_low.gop));
+                        } else if (p_output_queue == &output_queue_high) {
+                            fshare_resync_lost(&resync_high);
+                            gop_cache_invalidate(&(output_queue_high.gop));
                         } else {
-                            // don't change frame_len
-                            tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                            cb2s_memcpy(tmp_out, input_buffer.read_index, frame_len);
+                            fshare_resync_lost(&resync_audio);
                         }
-
+                        continue;
+                    }
+                    if (sps != NULL) {
+                        memcpy(of.slab->data, sps, sps_len);
                     } else {
-                        tmp_out = (unsigned char *) malloc(frame_len * sizeof(unsigned char));
-                        cb2s_memcpy(tmp_out, input_buffer.read_index, frame_len);
+                        // Straight from the ring, in two chunks if it wraps
+                        fshare_span_copy(of.slab->data, &span);
                     }
-
-                    output_frame of;
-                    of.frame = {tmp_out, tmp_out + frame_len};
                     of.counter = frame_counter;
                     of.time = frame_time;
-                    p_output_queue->frame_queue.push(of);
-                    free(tmp_out);
-                    while (p_output_queue->frame_queue.size() > MAX_QUEUE_SIZE) p_output_queue->frame_queue.pop();
+                    of.flags = frame_flags(&of, fhs[i].type,
+                            (p_output_queue == &output_queue_low) ? stream_type.codec_low : stream_type.codec_high);
+
+                    if (p_output_queue == &output_queue_audio) {
+                        frame_ring_push(&(p_output_queue->ring), &of);
+                    } else {
+                        gop_cache_push(&(p_output_queue->gop), &(p_output_queue->ring), &of, fhs[i].type);
+                    }
 
                     if (debug & 3) {
                         fprintf(stderr, "%lld: h264/aac in - frame_len: %d - frame_counter: %d - resolution: %d\n", current_timestamp(), frame_len, frame_counter, frame_type);
                     }
-                    pthread_mutex_unlock(&(p_output_queue->mutex));
                 }
             }
         }
 
-        usleep(25000);
+        if (debug & 3) {
+            if (fshare_wait_stats(&wait, "capture", 0)) {
+                fshare_scan_stats(&scan, "capture", 1);
+                if (resolution != RESOLUTION_HIGH) {
+                    fshare_resync_stats(&resync_low, "capture low");
+                    frame_pool_stats(&(output_queue_low.pool), "capture low");
+                    frame_ring_stats(&(output_queue_low.ring), "capture low");
+                    gop_cache_stats(&(output_queue_low.gop), "capture low");
+                }
+                if (resolution != RESOLUTION_LOW) {
+                    fshare_resync_stats(&resync_high, "capture high");
+                    frame_pool_stats(&(output_queue_high.pool), "capture high");
+                    frame_ring_stats(&(output_queue_high.ring), "capture high");
+                    gop_cache_stats(&(output_queue_high.gop), "capture high");
+                }
+                if (audio != 0) {
+                    fshare_resync_stats(&resync_audio, "capture audio");
+                    frame_pool_stats(&(output_queue_audio.pool), "capture audio");
+                    frame_ring_stats(&(output_queue_audio.ring), "capture audio");
+                }
+            }
+        }
+        fshare_wait_next(&wait, 0);
     }
 
     // Unreacheable path
+    fshare_wait_close(&wait);
+    fshare_scan_free(&scan);
 
     // Unmap file from memory
-    if (munmap(input_buffer.buffer, input_buffer.size) == -1) {
-        fprintf(stderr, "%lld: capture - error - unmapping file\n", current_timestamp());
-    } else {
-        if (debug & 3) fprintf(stderr, "%lld: capture - unmapping file %s, size %d, from %08x\n", current_timestamp(), input_buffer.filename, input_buffer.size, (unsigned int) input_buffer.buffer);
-    }
+    if (debug & 3) fprintf(stderr, "%lld: capture - unmapping file %s, size %d, from %08x\n", current_timestamp(), BUFFER_FILE, input_ring.size, (unsigned int) input_ring.addr);
+    fshare_close(&input_ring);
 
 #ifdef USE_SEMAPHORE
-    sem_fshare_close();
+    fshare_sem_close();
 #endif
 
     return NULL;
@@ -923,22 +669,6 @@ StreamReplicator* startReplicatorStream(const char* inputAudioFileName, unsigned
     return replicator;
 }
 
-StreamReplicator* startReplicatorStream(output_queue *qBuffer, unsigned samplingFrequency, unsigned char numChannels, Boolean useTimeForPres) {
-    // Create a single ADTSFromWAVAudioFifo source that will be replicated for mutliple streams
-    AudioFramedMemorySource* adtsSource = AudioFramedMemorySource::createNew(*env, qBuffer, samplingFrequency, numChannels, useTimeForPres);
-    if (adtsSource == NULL) {
-        fprintf(stderr, "Failed to create Fifo Source \n");
-    }
-
-    // Create and start the replicator that will be given to each subsession
-    StreamReplicator* replicator = StreamReplicator::createNew(*env, adtsSource);
-
-    // Begin by creating an input stream from our replicator:
-    replicator->createStreamReplica();
-
-    return replicator;
-}
-
 static void announceStream(RTSPServer* rtspServer, ServerMediaSession* sms, char const* streamName, int audio)
 {
     char* url = rtspServer->rtspURL(sms);
@@ -967,6 +697,30 @@ void print_usage(char *progname)
     fprintf(stderr, "\t\tset TCP port (default 554)\n");
     fprintf(stderr, "\t-s,       --sti\n");
     fprintf(stderr, "\t\tdon't overwrite SPS timing info (default overwrite)\n");
+    fprintf(stderr, "\t-q SIZE,  --queue SIZE\n");
+    fprintf(stderr, "\t\tset the max number of frames in each queue (default %d)\n", MAX_QUEUE_SIZE);
+    fprintf(stderr, "\t-Q BYTES, --queue_bytes BYTES\n");
+    fprintf(stderr, "\t\tset the max number of bytes in each queue, 0 no limit (default 0)\n");
+    fprintf(stderr, "\t-t MS,    --queue_ms MS\n");
+    fprintf(stderr, "\t\tset the max duration in ms of each queue, 0 no limit (default 0)\n");
+    fprintf(stderr, "\t\tabove the limits video queues drop whole GOP segments, audio queues the oldest frames\n");
+    fprintf(stderr, "\t-T BYTES, --thin_bytes BYTES\n");
+    fprintf(stderr, "\t\tset the TCP send queue of a client that starts dropping its video frames, 0 never (default %d)\n", THIN_BYTES_DEFAULT);
+    fprintf(stderr, "\t\tcongested clients drop non-reference frames first, then everything up to the next IDR\n");
+    fprintf(stderr, "\t-P PERCENT, --pace PERCENT\n");
+    fprintf(stderr, "\t\tspread the RTP packets of a large video frame over PERCENT of the frame interval, 0 disables (default %d)\n", PACE_PERCENT_DEFAULT);
+    fprintf(stderr, "\t-M BYTES, --payload_size BYTES\n");
+    fprintf(stderr, "\t\tset the max size of the video RTP packets, %d - %d (default %d)\n", RTP_PAYLOAD_MIN_SIZE, RTP_PAYLOAD_LARGEST_SIZE, RTP_PAYLOAD_MAX_SIZE);
+    fprintf(stderr, "\t-A,       --adaptive\n");
+    fprintf(stderr, "\t\tadd the ch0_3 stream: high resolution, low for a congested client (needs resolution both)\n");
+    fprintf(stderr, "\t-c RES,   --multicast RES\n");
+    fprintf(stderr, "\t\talso send these streams to a multicast group, one copy for all the clients: low, high, both or none (default none)\n");
+    fprintf(stderr, "\t-g ADDR,  --multicast_group ADDR\n");
+    fprintf(stderr, "\t\tset the multicast group, 232.x.x.x is source specific (default random 232.x.x.x)\n");
+    fprintf(stderr, "\t-o PORT,  --multicast_port PORT\n");
+    fprintf(stderr, "\t\tset the first UDP port of the multicast streams, high +0, low +2, audio +4 (default %d)\n", MULTICAST_PORT_DEFAULT);
+    fprintf(stderr, "\t-l TTL,   --multicast_ttl TTL\n");
+    fprintf(stderr, "\t\tset the TTL of the multicast packets (default %d)\n", MULTICAST_TTL_DEFAULT);
     fprintf(stderr, "\t-u USER,  --user USER\n");
     fprintf(stderr, "\t\tset username\n");
     fprintf(stderr, "\t-w PASSWORD,  --password PASSWORD\n");
@@ -984,6 +738,7 @@ int main(int argc, char** argv)
     int back_channel;
     char user[65];
     char pwd[65];
+    char multicast_addr[INET_ADDRSTRLEN];
     int pth_ret;
     int c;
     char *endptr;
@@ -995,16 +750,28 @@ int main(int argc, char** argv)
     char const* inputAudioFileName = "/tmp/audio_fifo";
     char const* outputAudioFileName = "/tmp/audio_in_fifo";
     struct stat stat_buffer;
-    FILE *fFS;
     Boolean useTimeForPres;
 
+    start_time = current_timestamp();
+
     // Setting default
-    model = Y20GA;
+    buf_offset = BUF_OFFSET_Y20GA;
+    frame_header_size = FRAME_HEADER_SIZE_Y20GA;
     resolution = RESOLUTION_HIGH;
     audio = 1;
     back_channel = 0;
     port = 554;
     sps_timing_info = 1;
+    queue_size = MAX_QUEUE_SIZE;
+    queue_bytes = 0;
+    queue_ms = 0;
+    thin_bytes = THIN_BYTES_DEFAULT;
+    pace = PACE_PERCENT_DEFAULT;
+    payload_size = RTP_PAYLOAD_MAX_SIZE;
+    multicast = RESOLUTION_NONE;
+    multicast_port = MULTICAST_PORT_DEFAULT;
+    multicast_ttl = MULTICAST_TTL_DEFAULT;
+    adaptive = 0;
     debug = 0;
     v = 2;
     enable_speaker = False;
@@ -1012,13 +779,12 @@ int main(int argc, char** argv)
     // Autodetect sps/vps type
     stream_type.codec_low = CODEC_NONE;
     stream_type.codec_high = CODEC_NONE;
-    stream_type.sps_type_low = 0;
-    stream_type.sps_type_high = 0;
-    stream_type.vps_type_low = 0;
-    stream_type.vps_type_high = 0;
+    fshare_timing_init(&timing_low);
+    fshare_timing_init(&timing_high);
 
     memset(user, 0, sizeof(user));
     memset(pwd, 0, sizeof(pwd));
+    memset(multicast_addr, 0, sizeof(multicast_addr));
 
     while (1) {
         static struct option long_options[] =
@@ -1029,6 +795,17 @@ int main(int argc, char** argv)
             {"audio_back_channel", required_argument, 0, 'b'},
             {"port",  required_argument, 0, 'p'},
             {"sti",  no_argument, 0, 's'},
+            {"queue",  required_argument, 0, 'q'},
+            {"queue_bytes",  required_argument, 0, 'Q'},
+            {"queue_ms",  required_argument, 0, 't'},
+            {"thin_bytes",  required_argument, 0, 'T'},
+            {"pace",  required_argument, 0, 'P'},
+            {"payload_size",  required_argument, 0, 'M'},
+            {"adaptive",  no_argument, 0, 'A'},
+            {"multicast",  required_argument, 0, 'c'},
+            {"multicast_group",  required_argument, 0, 'g'},
+            {"multicast_port",  required_argument, 0, 'o'},
+            {"multicast_ttl",  required_argument, 0, 'l'},
             {"user",  required_argument, 0, 'u'},
             {"password",  required_argument, 0, 'w'},
             {"debug",  required_argument, 0, 'd'},
@@ -1038,7 +815,7 @@ int main(int argc, char** argv)
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "m:r:a:b:p:su:w:d:h",
+        c = getopt_long (argc, argv, "m:r:a:b:p:sq:Q:t:T:P:M:Ac:g:o:l:u:w:d:h",
                          long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -1047,75 +824,9 @@ int main(int argc, char** argv)
 
         switch (c) {
         case 'm':
-            if (strcasecmp("y20ga", optarg) == 0) {
-                model = Y20GA;
-                v = 1;
-            } else if (strcasecmp("y25ga", optarg) == 0) {
-                model = Y25GA;
-                v = 1;
-            } else if (strcasecmp("y30qa", optarg) == 0) {
-                model = Y30QA;
-                v = 1;
-            } else if (strcasecmp("y501gc", optarg) == 0) {
-                model = Y501GC;
-                v = 1;
-            } else if (strcasecmp("y21ga", optarg) == 0) {
-                model = Y21GA;
-                v = 2;
-            } else if (strcasecmp("y211ga", optarg) == 0) {
-                model = Y211GA;
-                v = 2;
-            } else if (strcasecmp("y211ba", optarg) == 0) {
-                model = Y211BA;
-                v = 2;
-            } else if (strcasecmp("y213ga", optarg) == 0) {
-                model = Y213GA;
-                v = 2;
-            } else if (strcasecmp("y291ga", optarg) == 0) {
-                model = Y291GA;
-                v = 2;
-            } else if (strcasecmp("h30ga", optarg) == 0) {
-                model = H30GA;
-                v = 2;
-            } else if (strcasecmp("r30gb", optarg) == 0) {
-                model = R30GB;
-                v = 2;
-            } else if (strcasecmp("r35gb", optarg) == 0) {
-                model = R35GB;
-                v = 2;
-            } else if (strcasecmp("r37gb", optarg) == 0) {
-                model = R37GB;
-                v = 2;
-            } else if (strcasecmp("r40ga", optarg) == 0) {
-                model = R40GA;
-                v = 2;
-            } else if (strcasecmp("h51ga", optarg) == 0) {
-                model = H51GA;
-                v = 2;
-            } else if (strcasecmp("h52ga", optarg) == 0) {
-                model = H52GA;
-                v = 2;
-            } else if (strcasecmp("h60ga", optarg) == 0) {
-                model = H60GA;
-                v = 2;
-            } else if (strcasecmp("y28ga", optarg) == 0) {
-                model = Y28GA;
-                v = 2;
-            } else if (strcasecmp("y29ga", optarg) == 0) {
-                model = Y29GA;
-                v = 2;
-            } else if (strcasecmp("y623", optarg) == 0) {
-                model = Y623;
-                v = 2;
-            } else if (strcasecmp("q321br_lsx", optarg) == 0) {
-                model = Q321BR_LSX;
-                v = 2;
-            } else if (strcasecmp("qg311r", optarg) == 0) {
-                model = QG311R;
-                v = 2;
-            } else if (strcasecmp("b091qp", optarg) == 0) {
-                model = B091QP;
-                v = 2;
+            // An unknown model keeps the previous layout
+            if (fshare_model_layout(optarg, &buf_offset, &frame_header_size) == 0) {
+                v = fshare_model_version(optarg);
             }
             break;
 
@@ -1182,6 +893,180 @@ int main(int argc, char** argv)
             sps_timing_info = 0;
             break;
 
+        case 'q':
+            errno = 0;    /* To distinguish success/failure after call */
+            queue_size = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno == ERANGE && (queue_size == LONG_MAX || queue_size == LONG_MIN)) || (errno != 0 && queue_size == 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (endptr == optarg) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if ((queue_size < 1) || (queue_size > 256)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'Q':
+            errno = 0;    /* To distinguish success/failure after call */
+            queue_bytes = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno == ERANGE && (queue_bytes == LONG_MAX || queue_bytes == LONG_MIN)) || (errno != 0 && queue_bytes == 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (endptr == optarg) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (queue_bytes < 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 't':
+            errno = 0;    /* To distinguish success/failure after call */
+            queue_ms = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno == ERANGE && (queue_ms == LONG_MAX || queue_ms == LONG_MIN)) || (errno != 0 && queue_ms == 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (endptr == optarg) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (queue_ms < 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'T':
+            errno = 0;    /* To distinguish success/failure after call */
+            thin_bytes = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno == ERANGE && (thin_bytes == LONG_MAX || thin_bytes == LONG_MIN)) || (errno != 0 && thin_bytes == 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (endptr == optarg) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (thin_bytes < 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'P':
+            errno = 0;    /* To distinguish success/failure after call */
+            pace = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno == ERANGE && (pace == LONG_MAX || pace == LONG_MIN)) || (errno != 0 && pace == 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (endptr == optarg) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if ((pace < 0) || (pace > 100)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'M':
+            errno = 0;    /* To distinguish success/failure after call */
+            payload_size = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno == ERANGE && (payload_size == LONG_MAX || payload_size == LONG_MIN)) || (errno != 0 && payload_size == 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (endptr == optarg) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if ((payload_size < RTP_PAYLOAD_MIN_SIZE) || (payload_size > RTP_PAYLOAD_LARGEST_SIZE)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'A':
+            adaptive = 1;
+            break;
+
+        case 'c':
+            if (strcasecmp("low", optarg) == 0) {
+                multicast = RESOLUTION_LOW;
+            } else if (strcasecmp("high", optarg) == 0) {
+                multicast = RESOLUTION_HIGH;
+            } else if (strcasecmp("both", optarg) == 0) {
+                multicast = RESOLUTION_BOTH;
+            } else if (strcasecmp("none", optarg) == 0) {
+                multicast = RESOLUTION_NONE;
+            }
+            break;
+
+        case 'g':
+            if (strlen(optarg) < sizeof(multicast_addr)) {
+                strcpy(multicast_addr, optarg);
+            }
+            break;
+
+        case 'o':
+            errno = 0;    /* To distinguish success/failure after call */
+            multicast_port = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno == ERANGE && (multicast_port == LONG_MAX || multicast_port == LONG_MIN)) || (errno != 0 && multicast_port == 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (endptr == optarg) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if ((multicast_port < 1) || (multicast_port > 65530)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'l':
+            errno = 0;    /* To distinguish success/failure after call */
+            multicast_ttl = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno == ERANGE && (multicast_ttl == LONG_MAX || multicast_ttl == LONG_MIN)) || (errno != 0 && multicast_ttl == 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (endptr == optarg) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if ((multicast_ttl < 1) || (multicast_ttl > 255)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
         case 'u':
             if (strlen(optarg) < sizeof(user)) {
                 strcpy(user, optarg);
@@ -1231,75 +1116,9 @@ int main(int argc, char** argv)
     // Get parameters from environment
     str = getenv("RRTSP_MODEL");
     if (str != NULL) {
-        if (strcasecmp("y20ga", str) == 0) {
-            model = Y20GA;
-            v = 1;
-        } else if (strcasecmp("y25ga", str) == 0) {
-            model = Y25GA;
-            v = 1;
-        } else if (strcasecmp("y30qa", str) == 0) {
-            model = Y30QA;
-            v = 1;
-        } else if (strcasecmp("y501gc", str) == 0) {
-            model = Y501GC;
-            v = 1;
-        } else if (strcasecmp("y21ga", str) == 0) {
-            model = Y21GA;
-            v = 2;
-        } else if (strcasecmp("y211ga", str) == 0) {
-            model = Y211GA;
-            v = 2;
-        } else if (strcasecmp("y211ba", str) == 0) {
-            model = Y211BA;
-            v = 2;
-        } else if (strcasecmp("y213ga", str) == 0) {
-            model = Y213GA;
-            v = 2;
-        } else if (strcasecmp("y291ga", str) == 0) {
-            model = Y291GA;
-            v = 2;
-        } else if (strcasecmp("h30ga", str) == 0) {
-            model = H30GA;
-            v = 2;
-        } else if (strcasecmp("r30gb", str) == 0) {
-            model = R30GB;
-            v = 2;
-        } else if (strcasecmp("r35gb", str) == 0) {
-            model = R35GB;
-            v = 2;
-        } else if (strcasecmp("r37gb", str) == 0) {
-            model = R37GB;
-            v = 2;
-        } else if (strcasecmp("r40ga", str) == 0) {
-            model = R40GA;
-            v = 2;
-        } else if (strcasecmp("h51ga", str) == 0) {
-            model = H51GA;
-            v = 2;
-        } else if (strcasecmp("h52ga", str) == 0) {
-            model = H52GA;
-            v = 2;
-        } else if (strcasecmp("h60ga", str) == 0) {
-            model = H60GA;
-            v = 2;
-        } else if (strcasecmp("y28ga", str) == 0) {
-            model = Y28GA;
-            v = 2;
-        } else if (strcasecmp("y29ga", str) == 0) {
-            model = Y29GA;
-            v = 2;
-        } else if (strcasecmp("y623", str) == 0) {
-            model = Y623;
-            v = 2;
-        } else if (strcasecmp("q321br_lsx", str) == 0) {
-            model = Q321BR_LSX;
-            v = 2;
-        } else if (strcasecmp("qg311r", str) == 0) {
-            model = QG311R;
-            v = 2;
-        } else if (strcasecmp("b091qp", str) == 0) {
-            model = B091QP;
-            v = 2;
+        // An unknown model keeps the previous layout
+        if (fshare_model_layout(str, &buf_offset, &frame_header_size) == 0) {
+            v = fshare_model_version(str);
         }
     }
 
@@ -1360,6 +1179,69 @@ int main(int argc, char** argv)
         sps_timing_info = nm;
     }
 
+    str = getenv("RRTSP_QUEUE");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 1) && (nm <= 256)) {
+        queue_size = nm;
+    }
+
+    str = getenv("RRTSP_QUEUE_BYTES");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0)) {
+        queue_bytes = nm;
+    }
+
+    str = getenv("RRTSP_QUEUE_MS");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0)) {
+        queue_ms = nm;
+    }
+
+    str = getenv("RRTSP_THIN_BYTES");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0)) {
+        thin_bytes = nm;
+    }
+
+    str = getenv("RRTSP_PACE");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0) && (nm <= 100)) {
+        pace = nm;
+    }
+
+    str = getenv("RRTSP_PAYLOAD_SIZE");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= RTP_PAYLOAD_MIN_SIZE) && (nm <= RTP_PAYLOAD_LARGEST_SIZE)) {
+        payload_size = nm;
+    }
+
+    str = getenv("RRTSP_ADAPTIVE");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0) && (nm <= 1)) {
+        adaptive = nm;
+    }
+
+    str = getenv("RRTSP_MULTICAST");
+    if (str != NULL) {
+        if (strcasecmp("low", str) == 0) {
+            multicast = RESOLUTION_LOW;
+        } else if (strcasecmp("high", str) == 0) {
+            multicast = RESOLUTION_HIGH;
+        } else if (strcasecmp("both", str) == 0) {
+            multicast = RESOLUTION_BOTH;
+        } else if (strcasecmp("none", str) == 0) {
+            multicast = RESOLUTION_NONE;
+        }
+    }
+
+    str = getenv("RRTSP_MULTICAST_GROUP");
+    if ((str != NULL) && (strlen(str) < sizeof(multicast_addr))) {
+        strcpy(multicast_addr, str);
+    }
+
+    str = getenv("RRTSP_MULTICAST_PORT");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 1) && (nm <= 65530)) {
+        multicast_port = nm;
+    }
+
+    str = getenv("RRTSP_MULTICAST_TTL");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 1) && (nm <= 255)) {
+        multicast_ttl = nm;
+    }
+
     str = getenv("RRTSP_DEBUG");
     if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0)) {
         debug = nm;
@@ -1375,92 +1257,10 @@ int main(int argc, char** argv)
         strcpy(pwd, str);
     }
 
-    fFS = fopen(BUFFER_FILE, "r");
-    if ( fFS == NULL ) {
-        fprintf(stderr, "could not get size of %s\n", BUFFER_FILE);
-        exit(EXIT_FAILURE);
-    }
-    fseek(fFS, 0, SEEK_END);
-    buf_size = ftell(fFS);
-    fclose(fFS);
-    if (debug) fprintf(stderr, "%lld: the size of the buffer is %d\n",
-            current_timestamp(), buf_size);
-
     if  (v == 2) {
         enable_speaker = True;
     }
 
-    if (model == Y20GA) {
-        buf_offset = BUF_OFFSET_Y20GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y20GA;
-    } else if (model == Y25GA) {
-        buf_offset = BUF_OFFSET_Y25GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y25GA;
-    } else if (model == Y30QA) {
-        buf_offset = BUF_OFFSET_Y30QA;
-        frame_header_size = FRAME_HEADER_SIZE_Y30QA;
-    } else if (model == Y501GC) {
-        buf_offset = BUF_OFFSET_Y501GC;
-        frame_header_size = FRAME_HEADER_SIZE_Y501GC;
-    } else if (model == Y21GA) {
-        buf_offset = BUF_OFFSET_Y21GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y21GA;
-    } else if (model == Y211GA) {
-        buf_offset = BUF_OFFSET_Y211GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y211GA;
-    } else if (model == Y211BA) {
-        buf_offset = BUF_OFFSET_Y211BA;
-        frame_header_size = FRAME_HEADER_SIZE_Y211BA;
-    } else if (model == Y213GA) {
-        buf_offset = BUF_OFFSET_Y213GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y213GA;
-    } else if (model == Y291GA) {
-        buf_offset = BUF_OFFSET_Y291GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y291GA;
-    } else if (model == H30GA) {
-        buf_offset = BUF_OFFSET_H30GA;
-        frame_header_size = FRAME_HEADER_SIZE_H30GA;
-    } else if (model == R30GB) {
-        buf_offset = BUF_OFFSET_R30GB;
-        frame_header_size = FRAME_HEADER_SIZE_R30GB;
-    } else if (model == R35GB) {
-        buf_offset = BUF_OFFSET_R35GB;
-        frame_header_size = FRAME_HEADER_SIZE_R35GB;
-    } else if (model == R37GB) {
-        buf_offset = BUF_OFFSET_R37GB;
-        frame_header_size = FRAME_HEADER_SIZE_R37GB;
-    } else if (model == R40GA) {
-        buf_offset = BUF_OFFSET_R40GA;
-        frame_header_size = FRAME_HEADER_SIZE_R40GA;
-    } else if (model == H51GA) {
-        buf_offset = BUF_OFFSET_H51GA;
-        frame_header_size = FRAME_HEADER_SIZE_H51GA;
-    } else if (model == H52GA) {
-        buf_offset = BUF_OFFSET_H52GA;
-        frame_header_size = FRAME_HEADER_SIZE_H52GA;
-    } else if (model == H60GA) {
-        buf_offset = BUF_OFFSET_H60GA;
-        frame_header_size = FRAME_HEADER_SIZE_H60GA;
-    } else if (model == Y28GA) {
-        buf_offset = BUF_OFFSET_Y28GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y28GA;
-    } else if (model == Y29GA) {
-        buf_offset = BUF_OFFSET_Y29GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y29GA;
-    } else if (model == Y623) {
-        buf_offset = BUF_OFFSET_Y623;
-        frame_header_size = FRAME_HEADER_SIZE_Y623;
-    } else if (model == Q321BR_LSX) {
-        buf_offset = BUF_OFFSET_Q321BR_LSX;
-        frame_header_size = FRAME_HEADER_SIZE_Q321BR_LSX;
-    } else if (model == QG311R) {
-        buf_offset = BUF_OFFSET_QG311R;
-        frame_header_size = FRAME_HEADER_SIZE_QG311R;
-    } else if (model == B091QP) {
-        buf_offset = BUF_OFFSET_B091QP;
-        frame_header_size = FRAME_HEADER_SIZE_B091QP;
-    }
-
     // If fifo doesn't exist, disable audio
     if ((audio == 1) && (stat (inputAudioFileName, &stat_buffer) != 0)) {
         fprintf(stderr, "unable to find %s, audio disabled\n", inputAudioFileName);
@@ -1469,10 +1269,19 @@ int main(int argc, char** argv)
 
     setpriority(PRIO_PROCESS, 0, -10);
 
-    // Fill input and output buffer struct
-    strcpy(input_buffer.filename, BUFFER_SHM);
-    input_buffer.size = buf_size;
-    input_buffer.offset = buf_offset;
+    // Map the input buffer, its size is read from the shm object
+    if (fshare_open(&input_ring, buf_offset, frame_header_size) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (debug) fprintf(stderr, "%lld: the size of the buffer is %d\n",
+            current_timestamp(), input_ring.size);
+
+    // Use the layout and the codecs detected by a previous process if they match the ring
+    if ((fshare_layout_load(&input_ring, &stream_type) == 0) && (debug)) {
+        fprintf(stderr, "%lld: layout loaded from %s - offset: %d - header size: %d - codec low: %d - codec high: %d\n",
+                current_timestamp(), FSHARE_LAYOUT_FILE, input_ring.offset, input_ring.header_size,
+                stream_type.codec_low, stream_type.codec_high);
+    }
 
     // Low res
     if ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH)) {
@@ -1503,17 +1312,55 @@ int main(int argc, char** argv)
     TaskScheduler* scheduler = BasicTaskScheduler::createNew();
     env = BasicUsageEnvironment::createNew(*scheduler);
 
-    // Init mutexes
-    if (pthread_mutex_init(&(output_queue_low.mutex), NULL) != 0) {
-        fprintf(stderr, "Failed to create mutex\n");
+    // Init rings, they keep the largest lag allowed to a reader
+    if ((frame_ring_init(&(output_queue_low.ring), queue_size) != 0) ||
+            (frame_ring_init(&(output_queue_high.ring), queue_size) != 0) ||
+            (frame_ring_init(&(output_queue_audio.ring), queue_size) != 0)) {
+        fprintf(stderr, "Failed to create rings\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_init(&(output_queue_high.mutex), NULL) != 0) {
-        fprintf(stderr, "Failed to create mutex\n");
+    frame_ring_set_limits(&(output_queue_low.ring), FRAME_RING_POLICY_GOP, queue_bytes, queue_ms);
+    frame_ring_set_limits(&(output_queue_high.ring), FRAME_RING_POLICY_GOP, queue_bytes, queue_ms);
+    frame_ring_set_limits(&(output_queue_audio.ring), FRAME_RING_POLICY_OLDEST, queue_bytes, queue_ms);
+    output_queue_low.max_size = output_queue_high.max_size = output_queue_audio.max_size = queue_size;
+    output_queue_low.max_bytes = output_queue_high.max_bytes = output_queue_audio.max_bytes = queue_bytes;
+    output_queue_low.max_ms = output_queue_high.max_ms = output_queue_audio.max_ms = queue_ms;
+    output_queue_low.thin_bytes = output_queue_high.thin_bytes = thin_bytes;
+    // Until the frame rate is measured
+    output_queue_low.pace_us = output_queue_high.pace_us = VIDEO_FRAME_US * pace / 100;
+    output_queue_low.payload_size = output_queue_high.payload_size = payload_size;
+
+    // Init event triggers
+    if (pipe2(wakeup_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        fprintf(stderr, "Failed to create pipe\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_init(&(output_queue_audio.mutex), NULL) != 0) {
-        fprintf(stderr, "Failed to create mutex\n");
+    scheduler->turnOnBackgroundReadHandling(wakeup_pipe[0], wakeup_pipe_handler, NULL);
+    output_queue_low.scheduler = scheduler;
+    output_queue_low.trigger = scheduler->createEventTrigger(output_queue_trigger);
+    frame_ring_set_notify(&(output_queue_low.ring), output_queue_notify, &output_queue_low);
+    output_queue_high.scheduler = scheduler;
+    output_queue_high.trigger = scheduler->createEventTrigger(output_queue_trigger);
+    frame_ring_set_notify(&(output_queue_high.ring), output_queue_notify, &output_queue_high);
+    output_queue_audio.scheduler = scheduler;
+    output_queue_audio.trigger = scheduler->createEventTrigger(output_queue_trigger);
+    frame_ring_set_notify(&(output_queue_audio.ring), output_queue_notify, &output_queue_audio);
+    memset(&setup, 0, sizeof(setup));
+    setup.trigger = scheduler->createEventTrigger(stream_ready_trigger);
+
+    // Init frame pools, twice the size of the output buffer for each ring
+    // plus the gop cache for video
+    if ((frame_pool_init(&(output_queue_low.pool), 3 * OUTPUT_BUFFER_SIZE_LOW,
+                queue_size + FRAME_POOL_SLABS_MARGIN + GOP_CACHE_PARAMS + GOP_CACHE_FRAMES) != 0) ||
+            (frame_pool_init(&(output_queue_high.pool), 3 * OUTPUT_BUFFER_SIZE_HIGH,
+                queue_size + FRAME_POOL_SLABS_MARGIN + GOP_CACHE_PARAMS + GOP_CACHE_FRAMES) != 0) ||
+            (frame_pool_init(&(output_queue_audio.pool), 2 * OUTPUT_BUFFER_SIZE_AUDIO, queue_size + FRAME_POOL_SLABS_MARGIN) != 0)) {
+        fprintf(stderr, "Failed to create frame pools\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((gop_cache_init(&(output_queue_low.gop), OUTPUT_BUFFER_SIZE_LOW) != 0) ||
+            (gop_cache_init(&(output_queue_high.gop), OUTPUT_BUFFER_SIZE_HIGH) != 0)) {
+        fprintf(stderr, "Failed to create gop caches\n");
         exit(EXIT_FAILURE);
     }
 
@@ -1525,23 +1372,6 @@ int main(int argc, char** argv)
     }
     pthread_detach(capture_thread);
 
-    sleep(2);
-
-    // Wait for stream type autodetect
-    while (1) {
-        if ((stream_type.codec_low != CODEC_NONE) && (stream_type.codec_high != CODEC_NONE)) {
-            usleep(10000);
-            break;
-        }
-        usleep(10000);
-    }
-
-    if (debug) {
-        fprintf(stderr, "Stream detected: high res is %s, low res is %s\n",
-                (stream_type.codec_high==CODEC_H264)?"h264":"h265",
-                (stream_type.codec_low==CODEC_H264)?"h264":"h265");
-    }
-
     UserAuthenticationDatabase* authDB = NULL;
 
     if ((user[0] != '\0') && (pwd[0] != '\0')) {
@@ -1552,22 +1382,21 @@ int main(int argc, char** argv)
         // access to the server.
     }
 
-    // Create the RTSP server:
-    RTSPServer* rtspServer = RTSPServer::createNew(*env, port, authDB);
+    // Create the RTSP server at once, the video streams are added when
+    // their codec is detected and answer 503 until then
+    LazyRTSPServer* rtspServer = LazyRTSPServer::createNew(*env, port, authDB);
     if (rtspServer == NULL) {
         fprintf(stderr, "Failed to create RTSP server: %s\n", env->getResultMsg());
         exit(1);
     }
+    fprintf(stderr, "%lld: RTSP server listening on port %d, %lld ms after start\n",
+            current_timestamp(), port, current_timestamp() - start_time);
 
     StreamReplicator* replicator = NULL;
     if (audio == 1) {
         if (debug) fprintf(stderr, "Starting pcm replicator\n");
         // Create and start the replicator that will be given to each subsession
         replicator = startReplicatorStream(inputAudioFileName, 8000, 1, 16, convertTo);
-    } else if (audio == 2) {
-        if (debug) fprintf(stderr, "Starting aac replicator\n");
-        // Create and start the replicator that will be given to each subsession
-        replicator = startReplicatorStream(&output_queue_audio, 16000, 1, useTimeForPres);
     }
 
     char const* descriptionString = "Session streamed by \"rRTSPServer\"";
@@ -1579,88 +1408,59 @@ int main(int argc, char** argv)
     // RTSP server.  Each such stream is implemented using a
     // "ServerMediaSession" object, plus one or more
     // "ServerMediaSubsession" objects for each audio/video substream.
+    setup.server = rtspServer;
+    setup.replicator = replicator;
+    setup.description = descriptionString;
+    setup.useTimeForPres = useTimeForPres;
+    setup.convertTo = convertTo;
+    setup.back_channel = back_channel;
+    setup.enable_speaker = enable_speaker;
+    setup.outputAudioFileName = outputAudioFileName;
+
+    // Only the streams that are served can be multicast
+    if ((resolution != RESOLUTION_BOTH) && (multicast != resolution)) {
+        if (multicast == RESOLUTION_BOTH) multicast = resolution;
+        else multicast = RESOLUTION_NONE;
+    }
+    if (multicast != RESOLUTION_NONE) {
+        char groupStr[INET_ADDRSTRLEN];
 
-    // A H.264/5 video elementary stream:
-    if ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH))
-    {
-        char const* streamName = "ch0_0.h264";
-
-        ServerMediaSession* sms_high
-            = ServerMediaSession::createNew(*env, streamName, streamName,
-                                              descriptionString);
-        if (stream_type.codec_high == CODEC_H264) {
-            sms_high->addSubsession(H264VideoFramedMemoryServerMediaSubsession
-                                   ::createNew(*env, &output_queue_high, useTimeForPres, reuseFirstSource));
-        } else if (stream_type.codec_high == CODEC_H265) {
-            sms_high->addSubsession(H265VideoFramedMemoryServerMediaSubsession
-                                   ::createNew(*env, &output_queue_high, useTimeForPres, reuseFirstSource));
-        }
-        if (audio == 1) {
-            sms_high->addSubsession(WAVAudioFifoServerMediaSubsession
-                                       ::createNew(*env, replicator, reuseFirstSource, 8000, 1, 16, convertTo));
-        } else if (audio == 2) {
-            sms_high->addSubsession(ADTSAudioFramedMemoryServerMediaSubsession
-                                       ::createNew(*env, replicator, reuseFirstSource, 16000, 1));
+        if (multicast_group_init(*env, &mcast_group, (multicast_addr[0] != '\0') ? multicast_addr : NULL, multicast_ttl) != 0) {
+            exit(EXIT_FAILURE);
         }
-        if (back_channel == 1) {
-            PCMAudioFileServerMediaSubsession_BC* smss_bc = PCMAudioFileServerMediaSubsession_BC
-                    ::createNew(*env, outputAudioFileName, reuseFirstSource, 16000, 1, ALAW, enable_speaker);
-            sms_high->addSubsession(smss_bc);
-        } else if (back_channel == 2) {
-            PCMAudioFileServerMediaSubsession_BC* smss_bc = PCMAudioFileServerMediaSubsession_BC
-                    ::createNew(*env, outputAudioFileName, reuseFirstSource, 16000, 1, ULAW, enable_speaker);
-            sms_high->addSubsession(smss_bc);
-        } else if (back_channel == 4) {
-            ADTSAudioFileServerMediaSubsession_BC* smss_bc = ADTSAudioFileServerMediaSubsession_BC
-                    ::createNew(*env, outputAudioFileName, reuseFirstSource, 16000, 1, enable_speaker);
-            sms_high->addSubsession(smss_bc);
+        inet_ntop(AF_INET, &(((struct sockaddr_in *) &(mcast_group.addr))->sin_addr), groupStr, sizeof(groupStr));
+        fprintf(stderr, "Multicast group %s (%s), TTL %d\n", groupStr, mcast_group.ssm ? "SSM" : "ASM", multicast_ttl);
+
+        // One audio stream for the multicast sessions
+        if ((audio == 1) && (multicast_stream_pcm(*env, &mcast_audio, &mcast_group, multicast_port + 4, replicator, convertTo) != 0)) {
+            fprintf(stderr, "Failed to create multicast audio stream\n");
+        } else if ((audio == 2) && (multicast_stream_aac(*env, &mcast_audio, &mcast_group, multicast_port + 4,
+                    &output_queue_audio, 16000, 1, useTimeForPres) != 0)) {
+            fprintf(stderr, "Failed to create multicast audio stream\n");
         }
-        rtspServer->addServerMediaSession(sms_high);
-
-        announceStream(rtspServer, sms_high, streamName, audio);
     }
 
-    // A H.264 video elementary stream:
-    if ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH))
-    {
-        char const* streamName = "ch0_1.h264";
-
-        ServerMediaSession* sms_low
-            = ServerMediaSession::createNew(*env, streamName, streamName,
-                                              descriptionString);
-        if (stream_type.codec_low == CODEC_H264) {
-            sms_low->addSubsession(H264VideoFramedMemoryServerMediaSubsession
-                                       ::createNew(*env, &output_queue_low, useTimeForPres, reuseFirstSource));
-        } else if (stream_type.codec_low == CODEC_H265) {
-            sms_low->addSubsession(H265VideoFramedMemoryServerMediaSubsession
-                                       ::createNew(*env, &output_queue_low, useTimeForPres, reuseFirstSource));
-        }
-        if (audio == 1) {
-            sms_low->addSubsession(WAVAudioFifoServerMediaSubsession
-                                       ::createNew(*env, replicator, reuseFirstSource, 8000, 1, 16, convertTo));
-        } else if (audio == 2) {
-            sms_low->addSubsession(ADTSAudioFramedMemoryServerMediaSubsession
-                                       ::createNew(*env, replicator, reuseFirstSource, 16000, 1));
+    if ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH)) {
+        rtspServer->addPendingStream("ch0_0.h264");
+        if ((multicast == RESOLUTION_HIGH) || (multicast == RESOLUTION_BOTH)) {
+            rtspServer->addPendingStream("ch0_0m.h264");
         }
-        if (resolution == RESOLUTION_LOW) {
-            if (back_channel == 1) {
-                PCMAudioFileServerMediaSubsession_BC* smss_bc = PCMAudioFileServerMediaSubsession_BC
-                        ::createNew(*env, outputAudioFileName, reuseFirstSource, 16000, 1, ALAW, enable_speaker);
-                sms_low->addSubsession(smss_bc);
-            } else if (back_channel == 2) {
-                PCMAudioFileServerMediaSubsession_BC* smss_bc = PCMAudioFileServerMediaSubsession_BC
-                        ::createNew(*env, outputAudioFileName, reuseFirstSource, 16000, 1, ULAW, enable_speaker);
-                sms_low->addSubsession(smss_bc);
-            } else if (back_channel == 4) {
-                ADTSAudioFileServerMediaSubsession_BC* smss_bc = ADTSAudioFileServerMediaSubsession_BC
-                        ::createNew(*env, outputAudioFileName, reuseFirstSource, 16000, 1, enable_speaker);
-                sms_low->addSubsession(smss_bc);
-            }
+    }
+    if ((resolution == RESOLUTION_LOW) || (resolution == RESOLUTION_BOTH)) {
+        rtspServer->addPendingStream("ch0_1.h264");
+        if ((multicast == RESOLUTION_LOW) || (multicast == RESOLUTION_BOTH)) {
+            rtspServer->addPendingStream("ch0_1m.h264");
         }
-        rtspServer->addServerMediaSession(sms_low);
-
-        announceStream(rtspServer, sms_low, streamName, audio);
     }
+    if ((adaptive) && (resolution != RESOLUTION_BOTH)) {
+        fprintf(stderr, "The adaptive stream needs both resolutions, disabled\n");
+        adaptive = 0;
+    }
+    if (adaptive) {
+        rtspServer->addPendingStream("ch0_3.h264");
+    }
+    // The codecs could be known already
+    stream_ready_trigger(NULL);
 
     // A PCM audio elementary stream:
     if (audio != 0)
@@ -1675,33 +1475,38 @@ int main(int argc, char** argv)
                                        ::createNew(*env, replicator, reuseFirstSource, 8000, 1, 16, convertTo));
         } else if (audio == 2) {
             sms_audio->addSubsession(ADTSAudioFramedMemoryServerMediaSubsession
-                                       ::createNew(*env, replicator, reuseFirstSource, 16000, 1));
+                                       ::createNew(*env, &output_queue_audio, False, 16000, 1, useTimeForPres));
         }
         if (resolution == RESOLUTION_NONE) {
-            if (back_channel == 1) {
-                PCMAudioFileServerMediaSubsession_BC* smss_bc = PCMAudioFileServerMediaSubsession_BC
-                        ::createNew(*env, outputAudioFileName, reuseFirstSource, 16000, 1, ALAW, enable_speaker);
-                sms_audio->addSubsession(smss_bc);
-            } else if (back_channel == 2) {
-                PCMAudioFileServerMediaSubsession_BC* smss_bc = PCMAudioFileServerMediaSubsession_BC
-                        ::createNew(*env, outputAudioFileName, reuseFirstSource, 16000, 1, ULAW, enable_speaker);
-                sms_audio->addSubsession(smss_bc);
-            } else if (back_channel == 4) {
-                ADTSAudioFileServerMediaSubsession_BC* smss_bc = ADTSAudioFileServerMediaSubsession_BC
-                        ::createNew(*env, outputAudioFileName, reuseFirstSource, 16000, 1, enable_speaker);
-                sms_audio->addSubsession(smss_bc);
-            }
+            addBackChannel(sms_audio);
         }
         rtspServer->addServerMediaSession(sms_audio);
 
         announceStream(rtspServer, sms_audio, streamName, audio);
+
+        if (mcast_audio.sink != NULL) {
+            streamName = "ch0_2m.h264";
+            ServerMediaSession* sms_audio_mcast
+                = ServerMediaSession::createNew(*env, streamName, streamName,
+                                                  descriptionString, mcast_group.ssm);
+            sms_audio_mcast->addSubsession(multicast_stream_subsession(&mcast_audio));
+            rtspServer->addServerMediaSession(sms_audio_mcast);
+
+            announceStream(rtspServer, sms_audio_mcast, streamName, audio);
+        }
     }
 
     env->taskScheduler().doEventLoop(); // does not return
 
-    pthread_mutex_destroy(&(output_queue_low.mutex));
-    pthread_mutex_destroy(&(output_queue_high.mutex));
-    pthread_mutex_destroy(&(output_queue_audio.mutex));
+    gop_cache_free(&(output_queue_low.gop));
+    gop_cache_free(&(output_queue_high.gop));
+    frame_ring_free(&(output_queue_low.ring));
+    frame_ring_free(&(output_queue_high.ring));
+    frame_ring_free(&(output_queue_audio.ring));
+
+    frame_pool_free(&(output_queue_low.pool));
+    frame_pool_free(&(output_queue_high.pool));
+    frame_pool_free(&(output_queue_audio.pool));
 
     return 0; // only to prevent compiler warning
 }
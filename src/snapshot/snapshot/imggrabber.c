@@ -39,95 +39,8 @@
 #include "convert2jpg.h"
 #include "add_water.h"
 
-//#define USE_SEMAPHORE 1
-#ifdef USE_SEMAPHORE
-#include <semaphore.h>
-#endif
-
-#define FRAME_OFFSET_AUTODETECT 0
-#define FRAME_OFFSET_TRY_1 300
-#define FRAME_OFFSET_TRY_2 368
-#define FRAME_HEADER_SIZE_AUTODETECT 0
-
-#define BUF_OFFSET_Y20GA 300
-#define FRAME_HEADER_SIZE_Y20GA 22
-
-#define BUF_OFFSET_Y25GA 300
-#define FRAME_HEADER_SIZE_Y25GA 22
-
-#define BUF_OFFSET_Y30QA 300
-#define FRAME_HEADER_SIZE_Y30QA 22
-
-#define BUF_OFFSET_Y501GC 368
-#define FRAME_HEADER_SIZE_Y501GC 24
-
-#define BUF_OFFSET_Y21GA 368
-#define FRAME_HEADER_SIZE_Y21GA 28
-
-#define BUF_OFFSET_Y211GA 368
-#define FRAME_HEADER_SIZE_Y211GA 28
-
-#define BUF_OFFSET_Y211BA 368
-#define FRAME_HEADER_SIZE_Y211BA 28
-
-#define BUF_OFFSET_Y213GA 368
-#define FRAME_HEADER_SIZE_Y213GA 28
-
-#define BUF_OFFSET_Y291GA 368
-#define FRAME_HEADER_SIZE_Y291GA 28
-
-#define BUF_OFFSET_H30GA 368
-#define FRAME_HEADER_SIZE_H30GA 28
-
-//#define BUF_OFFSET_R30GB 300
-#define BUF_OFFSET_R30GB 0
-//#define FRAME_HEADER_SIZE_R30GB 22
-#define FRAME_HEADER_SIZE_R30GB 0
-
-//#define BUF_OFFSET_R35GB 300
-#define BUF_OFFSET_R35GB 0
-//#define FRAME_HEADER_SIZE_R35GB 26
-#define FRAME_HEADER_SIZE_R35GB 0
-
-//#define BUF_OFFSET_R37GB 368
-#define BUF_OFFSET_R37GB 0
-//#define FRAME_HEADER_SIZE_R37GB 28
-#define FRAME_HEADER_SIZE_R37GB 0
-
-#define BUF_OFFSET_R40GA 300
-#define FRAME_HEADER_SIZE_R40GA 26
-
-#define BUF_OFFSET_H51GA 368
-#define FRAME_HEADER_SIZE_H51GA 28
-
-#define BUF_OFFSET_H52GA 368
-#define FRAME_HEADER_SIZE_H52GA 28
-
-#define BUF_OFFSET_H60GA 368
-#define FRAME_HEADER_SIZE_H60GA 28
-
-#define BUF_OFFSET_Y28GA 368
-#define FRAME_HEADER_SIZE_Y28GA 28
-
-#define BUF_OFFSET_Y29GA 368
-#define FRAME_HEADER_SIZE_Y29GA 28
-
-#define BUF_OFFSET_Y623 368
-#define FRAME_HEADER_SIZE_Y623 28
-
-#define BUF_OFFSET_Q321BR_LSX 300
-#define FRAME_HEADER_SIZE_Q321BR_LSX 26
-
-#define BUF_OFFSET_QG311R 300
-#define FRAME_HEADER_SIZE_QG311R 26
+#include "fshare.h"
 
-#define BUF_OFFSET_B091QP 300
-#define FRAME_HEADER_SIZE_B091QP 26
-
-#define BUFFER_FILE "/dev/shm/fshare_frame_buf"
-#define BUFFER_SHM "fshare_frame_buf"
-#define READ_LOCK_FILE "fshare_read_lock"
-#define WRITE_LOCK_FILE "fshare_write_lock"
 #define FF_INPUT_BUFFER_PADDING_SIZE 32
 
 #define RESOLUTION_LOW  360
@@ -146,9 +59,6 @@
 #define W_3M 2304
 #define H_3M 1296
 
-unsigned char PPS4_START[]          = {0x00, 0x00, 0x00, 0x01, 0x68};
-unsigned char PPS4_HEADER[]         = {0x08, 0x00, 0x00, 0x00};
-
 typedef struct {
     int sps_addr;
     int sps_len;
@@ -160,204 +70,11 @@ typedef struct {
     int idr_len;
 } frame;
 
-struct __attribute__((__packed__)) frame_header {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-};
-
-struct __attribute__((__packed__)) frame_header_22 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint16_t u4;
-};
-
-struct __attribute__((__packed__)) frame_header_24 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint16_t u4;
-    uint16_t u5;
-};
-
-struct __attribute__((__packed__)) frame_header_26 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t u2;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint16_t u4;
-};
-
-struct __attribute__((__packed__)) frame_header_28 {
-    uint32_t len;
-    uint32_t counter;
-    uint32_t u1;
-    uint32_t u2;
-    uint32_t time;
-    uint16_t type;
-    uint16_t stream_counter;
-    uint32_t u4;
-};
-
-int buf_offset;
-int buf_size;
-int frame_header_size;
+fshare_ring ring;
+
 int res;
 int debug;
 
-unsigned char *addr;
-
-#ifdef USE_SEMAPHORE
-sem_t *sem_fshare_read_lock = SEM_FAILED;
-sem_t *sem_fshare_write_lock = SEM_FAILED;
-#endif
-
-unsigned char *cb_move(unsigned char *buf, int offset)
-{
-    buf += offset;
-    if ((offset > 0) && (buf > addr + buf_size))
-        buf -= (buf_size - buf_offset);
-    if ((offset < 0) && (buf < addr + buf_offset))
-        buf += (buf_size - buf_offset);
-
-    return buf;
-}
-
-void *cb_memcpy(void * dest, const void * src, size_t n)
-{
-    unsigned char *uc_src = (unsigned char *) src;
-    unsigned char *uc_dest = (unsigned char *) dest;
-
-    if (uc_src + n > addr + buf_size) {
-        memcpy(uc_dest, uc_src, addr + buf_size - uc_src);
-        memcpy(uc_dest + (addr + buf_size - uc_src), addr + buf_offset, n - (addr + buf_size - uc_src));
-    } else {
-        memcpy(uc_dest, src, n);
-    }
-    return dest;
-}
-
-// The second argument is the circular buffer
-void cb2s_headercpy(unsigned char *dest, unsigned char *src, size_t n)
-{
-    struct frame_header *fh = (struct frame_header *) dest;
-    struct frame_header_22 fh22;
-    struct frame_header_24 fh24;
-    struct frame_header_26 fh26;
-    struct frame_header_28 fh28;
-    unsigned char *fp = NULL;
-
-    if (n == sizeof(fh22)) {
-        fp = (unsigned char *) &fh22;
-    } else if (n == sizeof(fh24)) {
-        fp = (unsigned char *) &fh24;
-    } else if (n == sizeof(fh26)) {
-        fp = (unsigned char *) &fh26;
-    } else if (n == sizeof(fh28)) {
-        fp = (unsigned char *) &fh28;
-    }
-    if (fp == NULL) return;
-
-    if (src + n > addr + buf_size) {
-        memcpy(fp, src, addr + buf_size - src);
-        memcpy(fp + (addr + buf_size - src), addr + buf_offset, n - (addr + buf_size - src));
-    } else {
-        memcpy(fp, src, n);
-    }
-    if (n == sizeof(fh22)) {
-        fh->len = fh22.len;
-        fh->counter = fh22.counter;
-        fh->time = fh22.time;
-        fh->type = fh22.type;
-        fh->stream_counter = fh22.stream_counter;
-    } else if (n == sizeof(fh24)) {
-        fh->len = fh24.len;
-        fh->counter = fh24.counter;
-        fh->time = fh24.time;
-        fh->type = fh24.type;
-        fh->stream_counter = fh24.stream_counter;
-    } else if (n == sizeof(fh26)) {
-        fh->len = fh26.len;
-        fh->counter = fh26.counter;
-        fh->time = fh26.time;
-        fh->type = fh26.type;
-        fh->stream_counter = fh26.stream_counter;
-    } else if (n == sizeof(fh28)) {
-        fh->len = fh28.len;
-        fh->counter = fh28.counter;
-        fh->time = fh28.time;
-        fh->type = fh28.type;
-        fh->stream_counter = fh28.stream_counter;
-    }
-}
-
-#ifdef USE_SEMAPHORE
-int sem_fshare_open()
-{
-    sem_fshare_read_lock = sem_open(READ_LOCK_FILE, O_RDWR);
-    if (sem_fshare_read_lock == SEM_FAILED) {
-        fprintf(stderr, "error opening %s\n", READ_LOCK_FILE);
-        return -1;
-    }
-    sem_fshare_write_lock = sem_open(WRITE_LOCK_FILE, O_RDWR);
-    if (sem_fshare_write_lock == SEM_FAILED) {
-        fprintf(stderr, "error opening %s\n", WRITE_LOCK_FILE);
-        return -2;
-    }
-    return 0;
-}
-
-void sem_fshare_close()
-
-{
-    if (sem_fshare_write_lock != SEM_FAILED) {
-        sem_close(sem_fshare_write_lock);
-        sem_fshare_write_lock = SEM_FAILED;
-    }
-    if (sem_fshare_read_lock != SEM_FAILED) {
-        sem_close(sem_fshare_read_lock);
-        sem_fshare_read_lock = SEM_FAILED;
-    }
-    return;
-}
-
-void sem_write_lock()
-{
-    int wl, ret = 0;
-    int *fshare_frame_buf_start = (int *) addr;
-
-    while (ret == 0) {
-        sem_wait(sem_fshare_read_lock);
-        wl = *fshare_frame_buf_start;
-        if (wl == 0) {
-            ret = 1;
-        } else {
-            sem_post(sem_fshare_read_lock);
-            usleep(1000);
-        }
-    }
-    return;
-}
-
-void sem_write_unlock()
-{
-    sem_post(sem_fshare_read_lock);
-    return;
-}
-#endif
-
 int frame_decode(unsigned char *outbuffer, unsigned char *p, int length, int h26x)
 {
     AVCodec *codec;
@@ -543,12 +260,10 @@ void usage(char *prog_name)
 
 int main(int argc, char **argv)
 {
-    FILE *fFS, *fHF;
-    int fshm;
-    uint32_t offset, length;
+    FILE *fHF;
+    unsigned int buf_offset, frame_header_size;
 
-    unsigned char *buf_idx, *buf_idx_cur, *buf_idx_end;
-    unsigned char *header_a1, *header_a2;
+    unsigned char *buf_idx, *buf_idx_end;
     unsigned char *bufferh26x, *bufferyuv;
     char file[256];
     int watermark = 0;
@@ -559,8 +274,11 @@ int main(int argc, char **argv)
 
     int c;
 
-    struct frame_header fh, fhs, fhp, fhv, fhi;
+    struct frame_header fhs, fhp, fhv, fhi;
     unsigned char *fhs_addr, *fhp_addr, *fhv_addr, *fhi_addr;
+    fshare_iter it;
+    fshare_wait wait;
+    fshare_frame fr;
 
     int sps_start_found = -1, sps_end_found = -1;
     int pps_start_found = -1, pps_end_found = -1;
@@ -782,41 +500,18 @@ int main(int argc, char **argv)
 
     if (file[0] == '\0') {
         // Read frames from frame buffer
-        fFS = fopen(BUFFER_FILE, "r");
-        if ( fFS == NULL ) {
-            fprintf(stderr, "Could not get size of %s\n", BUFFER_FILE);
-            exit(-2);
-        }
-        fseek(fFS, 0, SEEK_END);
-        buf_size = ftell(fFS);
-        fclose(fFS);
-        if (debug) fprintf(stderr, "The size of the buffer is %d\n", buf_size);
-
 #ifdef USE_SEMAPHORE
-        if (sem_fshare_open() != 0) {
+        if (fshare_sem_open() != 0) {
             fprintf(stderr, "Could not open semaphores\n") ;
             exit(-3);
         }
 #endif
 
-        // Opening an existing file
-        fshm = shm_open(BUFFER_SHM, O_RDWR, 0);
-        if (fshm == -1) {
-            fprintf(stderr, "Could not open file %s\n", BUFFER_FILE) ;
-            exit(-4);
-        }
-
-        // Map file to memory
-        addr = (unsigned char*) mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_SHARED, fshm, 0);
-        if (addr == MAP_FAILED) {
-            fprintf(stderr, "Error mapping file %s\n", BUFFER_FILE);
-            close(fshm);
+        // Map the buffer, its size is read from the shm object
+        if (fshare_open(&ring, buf_offset, frame_header_size) != 0) {
             exit(-5);
         }
-        if (debug) fprintf(stderr, "Mapping file %s, size %d, to %08x\n", BUFFER_FILE, buf_size, addr);
-
-        // Closing the file
-        close(fshm);
+        if (debug) fprintf(stderr, "Mapping file %s, size %d, to %08x\n", BUFFER_FILE, ring.size, ring.addr);
 
         fhs.len = 0;
         fhp.len = 0;
@@ -827,90 +522,64 @@ int main(int argc, char **argv)
         fhv_addr = NULL;
         fhi_addr = NULL;
 
+        // Use the layout detected by a previous process if it matches the ring
+        if ((fshare_layout_load(&ring, NULL) == 0) && (debug)) fprintf(stderr, "Layout loaded from %s\n", FSHARE_LAYOUT_FILE);
+
         // Autodetect offset if not defined
-        if (buf_offset == FRAME_OFFSET_AUTODETECT) {
-            memcpy(&i, addr + FRAME_OFFSET_TRY_1, sizeof(i));
-            if (i != 0)
-                buf_offset = FRAME_OFFSET_TRY_1;
-            else
-                buf_offset = FRAME_OFFSET_TRY_2;
-        }
+        fshare_detect_offset(&ring);
 
         // Autodetect header size if not defined
-        if ((frame_header_size == FRAME_HEADER_SIZE_AUTODETECT) && (debug)) fprintf(stderr, "Detecting frame header size\n");
-        while (frame_header_size == FRAME_HEADER_SIZE_AUTODETECT) {
-            header_a2 = (unsigned char *) memmem(addr + buf_offset, buf_size - buf_offset, PPS4_START, sizeof(PPS4_START));
-            if ((header_a2 != NULL) && (header_a2 - 40 > addr + buf_offset)) {
-                header_a1 = cb_move(header_a2, -40);
-                header_a1 = (unsigned char *) memmem(header_a1, 40, PPS4_HEADER, sizeof(PPS4_HEADER));
-                if (header_a1 != NULL) {
-                    frame_header_size = header_a2 - header_a1;
-                    if (frame_header_size < 0)
-                            frame_header_size += (buf_size - buf_offset);
-                    if ((frame_header_size < 0) && (frame_header_size > 40))
-                        frame_header_size = FRAME_HEADER_SIZE_AUTODETECT;
-                }
-            }
+        if ((ring.header_size == FRAME_HEADER_SIZE_AUTODETECT) && (debug)) fprintf(stderr, "Detecting frame header size\n");
+        while (fshare_detect_header_size(&ring) == FRAME_HEADER_SIZE_AUTODETECT) {
             usleep(1000);
         }
-        if (debug) fprintf(stderr, "Frame header size = %d\n", frame_header_size);
+        if (debug) fprintf(stderr, "Frame header size = %d\n", ring.header_size);
+        fshare_layout_save(&ring, NULL);
 
+        fshare_wait_init(&wait, &ring);
         while (1) {
 #ifdef USE_SEMAPHORE
-            sem_write_lock();
+            fshare_sem_write_lock(&ring);
 #endif
-            memcpy(&i, addr + 16, sizeof(i));
-            buf_idx = addr + buf_offset + i;
-            memcpy(&i, addr + 4, sizeof(i));
-            buf_idx_end = buf_idx + i;
-            if (buf_idx_end >= addr + buf_size) buf_idx_end -= (buf_size - buf_offset);
-            // Check if the header is ok
-            memcpy(&i, addr + 12, sizeof(i));
-            if (buf_idx_end != addr + buf_offset + i) {
+            if (fshare_read_index(&ring, &buf_idx, &buf_idx_end) != 0) {
                 usleep(1000);
                 continue;
             }
 
-            buf_idx_cur = buf_idx;
-
-            while (buf_idx_cur != buf_idx_end) {
-                cb2s_headercpy((unsigned char *) &fh, buf_idx_cur, frame_header_size);
-                // Check the len
-                if (fh.len > buf_size - buf_offset - frame_header_size) {
-                    fhs_addr = NULL;
-                    break;
-                }
-                if (((res == RESOLUTION_LOW) && (fh.type & 0x0800)) || ((res == RESOLUTION_HIGH) && (fh.type & 0x0400))) {
-                    if (fh.type & 0x0002) {
-                        memcpy((unsigned char *) &fhs, (unsigned char *) &fh, sizeof(struct frame_header));
-                        fhs_addr = buf_idx_cur;
-                    } else if (fh.type & 0x0004) {
-                        memcpy((unsigned char *) &fhp, (unsigned char *) &fh, sizeof(struct frame_header));
-                        fhp_addr = buf_idx_cur;
-                    } else if (fh.type & 0x0008) {
-                        memcpy((unsigned char *) &fhv, (unsigned char *) &fh, sizeof(struct frame_header));
-                        fhv_addr = buf_idx_cur;
-                    } else if (fh.type & 0x0001) {
-                        memcpy((unsigned char *) &fhi, (unsigned char *) &fh, sizeof(struct frame_header));
-                        fhi_addr = buf_idx_cur;
+            // Keep the last SPS, PPS, VPS and IDR of the selected resolution
+            fshare_iter_init(&it, &ring, buf_idx, buf_idx_end);
+            while ((iret = fshare_iter_next(&it, &fr)) == 1) {
+                if (((res == RESOLUTION_LOW) && (fr.type & FSHARE_TYPE_LOW)) || ((res == RESOLUTION_HIGH) && (fr.type & FSHARE_TYPE_HIGH))) {
+                    if (fr.type & FSHARE_TYPE_SPS) {
+                        fhs.len = fr.len;
+                        fhs_addr = fshare_frame_data(&ring, &fr);
+                    } else if (fr.type & FSHARE_TYPE_PPS) {
+                        fhp.len = fr.len;
+                        fhp_addr = fshare_frame_data(&ring, &fr);
+                    } else if (fr.type & FSHARE_TYPE_VPS) {
+                        fhv.len = fr.len;
+                        fhv_addr = fshare_frame_data(&ring, &fr);
+                    } else if (fr.type & FSHARE_TYPE_IDR) {
+                        fhi.len = fr.len;
+                        fhi_addr = fshare_frame_data(&ring, &fr);
                     }
                 }
-                buf_idx_cur = cb_move(buf_idx_cur, fh.len + frame_header_size);
             }
+            // Sync lost
+            if (iret < 0) fhs_addr = NULL;
 
 #ifdef USE_SEMAPHORE
-            sem_write_unlock();
+            fshare_sem_write_unlock();
 #endif
             if (fhs_addr != NULL) break;
-            usleep(10000);
+            // Wait for the next frame
+            fshare_wait_next(&wait, 0);
         }
+        fshare_wait_close(&wait);
 
-        // Remove headers
-        if (fhv_addr != NULL) fhv_addr = cb_move(fhv_addr, frame_header_size);
-        fhs_addr = cb_move(fhs_addr, frame_header_size + 6);
-        fhs.len -= 6;
-        fhp_addr = cb_move(fhp_addr, frame_header_size);
-        fhi_addr = cb_move(fhi_addr, frame_header_size);
+        // Remove FPS, width and height prefix
+        fhs_addr = fshare_move(&ring, fhs_addr, FSHARE_SPS_PREFIX_SIZE);
+        fhs.len -= FSHARE_SPS_PREFIX_SIZE;
 
     } else {
         // Read frames from h26x file
@@ -1022,14 +691,11 @@ int main(int argc, char **argv)
         if (h26x_file_buffer != NULL) free(h26x_file_buffer);
         if (file[0] == '\0') {
             // Unmap file from memory
-            if (munmap(addr, buf_size) == -1) {
-                fprintf(stderr, "Error munmapping file\n");
-            } else {
-                if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, buf_size, addr);
-            }
+            if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, ring.size, ring.addr);
+            fshare_close(&ring);
 
 #ifdef USE_SEMAPHORE
-            sem_fshare_close();
+            fshare_sem_close();
 #endif
         }
         exit(-9);
@@ -1042,14 +708,11 @@ int main(int argc, char **argv)
         if (bufferh26x != NULL) free(bufferh26x);
         if (file[0] == '\0') {
             // Unmap file from memory
-            if (munmap(addr, buf_size) == -1) {
-                fprintf(stderr, "Error munmapping file\n");
-            } else {
-                if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, buf_size, addr);
-            }
+            if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, ring.size, ring.addr);
+            fshare_close(&ring);
 
 #ifdef USE_SEMAPHORE
-            sem_fshare_close();
+            fshare_sem_close();
 #endif
         }
         exit(-10);
@@ -1057,11 +720,11 @@ int main(int argc, char **argv)
 
     if (file[0] == '\0') {
         if (fhv_addr != NULL) {
-            cb_memcpy(bufferh26x, fhv_addr, fhv.len);
+            fshare_memcpy(&ring, bufferh26x, fhv_addr, fhv.len);
         }
-        cb_memcpy(bufferh26x + fhv.len, fhs_addr, fhs.len);
-        cb_memcpy(bufferh26x + fhv.len + fhs.len, fhp_addr, fhp.len);
-        cb_memcpy(bufferh26x + fhv.len + fhs.len + fhp.len, fhi_addr, fhi.len);
+        fshare_memcpy(&ring, bufferh26x + fhv.len, fhs_addr, fhs.len);
+        fshare_memcpy(&ring, bufferh26x + fhv.len + fhs.len, fhp_addr, fhp.len);
+        fshare_memcpy(&ring, bufferh26x + fhv.len + fhs.len + fhp.len, fhi_addr, fhi.len);
     } else {
         if (fhv_addr != NULL) {
             memcpy(bufferh26x, fhv_addr, fhv.len);
@@ -1081,14 +744,11 @@ int main(int argc, char **argv)
             if (bufferyuv != NULL) free(bufferyuv);
             if (file[0] == '\0') {
                 // Unmap file from memory
-                if (munmap(addr, buf_size) == -1) {
-                    fprintf(stderr, "Error munmapping file\n");
-                } else {
-                    if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, buf_size, addr);
-                }
+                if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, ring.size, ring.addr);
+                fshare_close(&ring);
 
 #ifdef USE_SEMAPHORE
-                sem_fshare_close();
+                fshare_sem_close();
 #endif
             }
             exit(-11);
@@ -1101,14 +761,11 @@ int main(int argc, char **argv)
             if (bufferyuv != NULL) free(bufferyuv);
             if (file[0] == '\0') {
                 // Unmap file from memory
-                if (munmap(addr, buf_size) == -1) {
-                    fprintf(stderr, "Error munmapping file\n");
-                } else {
-                    if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, buf_size, addr);
-                }
+                if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, ring.size, ring.addr);
+                fshare_close(&ring);
 
 #ifdef USE_SEMAPHORE
-                sem_fshare_close();
+                fshare_sem_close();
 #endif
             }
             exit(-11);
@@ -1129,14 +786,11 @@ int main(int argc, char **argv)
             if (bufferyuv != NULL) free(bufferyuv);
             if (file[0] == '\0') {
                 // Unmap file from memory
-                if (munmap(addr, buf_size) == -1) {
-                    fprintf(stderr, "Error munmapping file\n");
-                } else {
-                    if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, buf_size, addr);
-                }
+                if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, ring.size, ring.addr);
+                fshare_close(&ring);
 
 #ifdef USE_SEMAPHORE
-                sem_fshare_close();
+                fshare_sem_close();
 #endif
             }
             exit(-12);
@@ -1149,14 +803,11 @@ int main(int argc, char **argv)
         if (bufferyuv != NULL) free(bufferyuv);
         if (file[0] == '\0') {
             // Unmap file from memory
-            if (munmap(addr, buf_size) == -1) {
-                fprintf(stderr, "Error munmapping file\n");
-            } else {
-                if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, buf_size, addr);
-            }
+            if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, ring.size, ring.addr);
+            fshare_close(&ring);
 
 #ifdef USE_SEMAPHORE
-            sem_fshare_close();
+            fshare_sem_close();
 #endif
         }
         exit(-13);
@@ -1166,14 +817,11 @@ int main(int argc, char **argv)
 
     if (file[0] == '\0') {
         // Unmap file from memory
-        if (munmap(addr, buf_size) == -1) {
-            fprintf(stderr, "Error munmapping file\n");
-        } else {
-            if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, buf_size, addr);
-        }
+        if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, ring.size, ring.addr);
+        fshare_close(&ring);
 
 #ifdef USE_SEMAPHORE
-        sem_fshare_close();
+        fshare_sem_close();
 #endif
     }
 